@@ -0,0 +1,230 @@
+#include "buffer_pool.h"
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "PROVIDORE_BUFFER_POOL";
+
+// Segments are kept on a free list once released, up to
+// CONFIG_PROVIDORE_BUFFER_POOL_SEGMENTS, so back to back requests don't go back
+// to the heap. Segments come from PSRAM when it is enabled, falling back to
+// internal RAM, which is capped at CONFIG_PROVIDORE_BUFFER_INTERNAL_LIMIT KB.
+static buffer_segment_t *free_segments;
+static size_t free_count;
+static buffer_pool_usage_t usage;
+static portMUX_TYPE pool_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static buffer_segment_t *buffer_pool_alloc()
+{
+  buffer_segment_t *segment = NULL;
+
+  portENTER_CRITICAL(&pool_lock);
+  if (free_segments != NULL)
+  {
+    segment = free_segments;
+    free_segments = segment->next;
+    free_count--;
+    usage.reuses++;
+  }
+  portEXIT_CRITICAL(&pool_lock);
+
+  if (segment == NULL)
+  {
+    bool psram = false;
+#ifdef CONFIG_PROVIDORE_BUFFER_PSRAM
+    segment = (buffer_segment_t *)heap_caps_malloc(sizeof(buffer_segment_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    psram = segment != NULL;
+#endif
+    if (segment == NULL)
+    {
+      // Reserved before allocating, so requests running at once can't all pass
+      // the limit check and take it over the limit between them
+      bool reserved = true;
+      portENTER_CRITICAL(&pool_lock);
+#if CONFIG_PROVIDORE_BUFFER_INTERNAL_LIMIT > 0
+      reserved = usage.internal_bytes + sizeof(buffer_segment_t) <= CONFIG_PROVIDORE_BUFFER_INTERNAL_LIMIT * 1024;
+#endif
+      if (reserved)
+      {
+        usage.internal_bytes += sizeof(buffer_segment_t);
+      }
+      portEXIT_CRITICAL(&pool_lock);
+
+      if (!reserved)
+      {
+        ESP_LOGW(TAG, "Internal RAM limit of %iKB reached", CONFIG_PROVIDORE_BUFFER_INTERNAL_LIMIT);
+      }
+      else
+      {
+        segment = (buffer_segment_t *)heap_caps_malloc(sizeof(buffer_segment_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (segment == NULL)
+        {
+          portENTER_CRITICAL(&pool_lock);
+          usage.internal_bytes -= sizeof(buffer_segment_t);
+          portEXIT_CRITICAL(&pool_lock);
+        }
+      }
+    }
+
+    portENTER_CRITICAL(&pool_lock);
+    if (segment == NULL)
+    {
+      usage.failures++;
+    }
+    else if (psram)
+    {
+      usage.allocations++;
+      usage.psram_bytes += sizeof(buffer_segment_t);
+      usage.psram_peak = usage.psram_bytes > usage.psram_peak ? usage.psram_bytes : usage.psram_peak;
+    }
+    else
+    {
+      usage.allocations++;
+      usage.internal_peak = usage.internal_bytes > usage.internal_peak ? usage.internal_bytes : usage.internal_peak;
+    }
+    portEXIT_CRITICAL(&pool_lock);
+
+    if (segment == NULL)
+    {
+      return NULL;
+    }
+    segment->psram = psram;
+  }
+
+  segment->next = NULL;
+  segment->len = 0;
+  return segment;
+}
+
+static void buffer_pool_release(buffer_segment_t *segment)
+{
+  portENTER_CRITICAL(&pool_lock);
+  if (free_count < CONFIG_PROVIDORE_BUFFER_POOL_SEGMENTS)
+  {
+    segment->next = free_segments;
+    free_segments = segment;
+    free_count++;
+    segment = NULL;
+  }
+  else if (segment->psram)
+  {
+    usage.psram_bytes -= sizeof(buffer_segment_t);
+  }
+  else
+  {
+    usage.internal_bytes -= sizeof(buffer_segment_t);
+  }
+  portEXIT_CRITICAL(&pool_lock);
+
+  if (segment != NULL)
+  {
+    heap_caps_free(segment);
+  }
+}
+
+void providore_buffer_init(providore_buffer_t *buffer)
+{
+  bzero(buffer, sizeof(providore_buffer_t));
+}
+
+esp_err_t providore_buffer_append(providore_buffer_t *buffer, const void *data, size_t data_len)
+{
+  const uint8_t *data_ptr = (const uint8_t *)data;
+
+  while (data_len > 0)
+  {
+    if (buffer->tail == NULL || buffer->tail->len == BUFFER_SEGMENT_LEN)
+    {
+      buffer_segment_t *segment = buffer_pool_alloc();
+      if (segment == NULL)
+      {
+        return ESP_ERR_NO_MEM;
+      }
+      if (buffer->tail == NULL)
+      {
+        buffer->head = segment;
+      }
+      else
+      {
+        buffer->tail->next = segment;
+      }
+      buffer->tail = segment;
+    }
+
+    buffer_segment_t *segment = buffer->tail;
+    size_t len = BUFFER_SEGMENT_LEN - segment->len < data_len ? BUFFER_SEGMENT_LEN - segment->len : data_len;
+    memcpy(segment->data + segment->len, data_ptr, len);
+    segment->len += len;
+    buffer->len += len;
+    data_ptr += len;
+    data_len -= len;
+  }
+  return ESP_OK;
+}
+
+size_t providore_buffer_read(const providore_buffer_t *buffer, size_t offset, void *output, size_t output_len)
+{
+  uint8_t *output_ptr = (uint8_t *)output;
+  size_t copied = 0;
+
+  for (buffer_segment_t *segment = buffer->head; segment != NULL && copied < output_len; segment = segment->next)
+  {
+    if (offset >= segment->len)
+    {
+      offset -= segment->len;
+      continue;
+    }
+
+    size_t len = segment->len - offset < output_len - copied ? segment->len - offset : output_len - copied;
+    memcpy(output_ptr + copied, segment->data + offset, len);
+    copied += len;
+    offset = 0;
+  }
+  return copied;
+}
+
+void providore_buffer_free(providore_buffer_t *buffer)
+{
+  buffer_segment_t *segment = buffer->head;
+  while (segment != NULL)
+  {
+    buffer_segment_t *next = segment->next;
+    buffer_pool_release(segment);
+    segment = next;
+  }
+  providore_buffer_init(buffer);
+}
+
+void buffer_pool_usage(buffer_pool_usage_t *output)
+{
+  portENTER_CRITICAL(&pool_lock);
+  memcpy(output, &usage, sizeof(buffer_pool_usage_t));
+  portEXIT_CRITICAL(&pool_lock);
+}
+
+void buffer_pool_trim()
+{
+  portENTER_CRITICAL(&pool_lock);
+  buffer_segment_t *segment = free_segments;
+  free_segments = NULL;
+  free_count = 0;
+  portEXIT_CRITICAL(&pool_lock);
+
+  while (segment != NULL)
+  {
+    buffer_segment_t *next = segment->next;
+    portENTER_CRITICAL(&pool_lock);
+    if (segment->psram)
+    {
+      usage.psram_bytes -= sizeof(buffer_segment_t);
+    }
+    else
+    {
+      usage.internal_bytes -= sizeof(buffer_segment_t);
+    }
+    portEXIT_CRITICAL(&pool_lock);
+    heap_caps_free(segment);
+    segment = next;
+  }
+}
@@ -0,0 +1,87 @@
+#include "config_cache.h"
+#include <string.h>
+#include "nvs_flash.h"
+#include "esp_log.h"
+
+static const char *TAG = "PROVIDORE_CONFIG_CACHE";
+
+esp_err_t config_cache_load(config_cache_t *cache)
+{
+  bzero(cache, sizeof(config_cache_t));
+
+  nvs_handle_t handle;
+  esp_err_t result = nvs_open("providore", NVS_READONLY, &handle);
+  if (result != ESP_OK)
+  {
+    return result;
+  }
+
+  size_t length = sizeof(config_cache_t);
+  result = nvs_get_blob(handle, "config_headers", cache, &length);
+  nvs_close(handle);
+
+  if (result != ESP_OK || length != sizeof(config_cache_t))
+  {
+    bzero(cache, sizeof(config_cache_t));
+    return result == ESP_OK ? ESP_ERR_INVALID_SIZE : result;
+  }
+  return ESP_OK;
+}
+
+esp_err_t config_cache_load_body(void *output, size_t *length)
+{
+  nvs_handle_t handle;
+  esp_err_t result = nvs_open("providore", NVS_READONLY, &handle);
+  if (result != ESP_OK)
+  {
+    return result;
+  }
+
+  result = nvs_get_blob(handle, "config_body", output, length);
+  nvs_close(handle);
+  return result;
+}
+
+esp_err_t config_cache_save(const config_cache_t *cache, const void *body, size_t body_len)
+{
+  nvs_handle_t handle;
+  esp_err_t result = nvs_open("providore", NVS_READWRITE, &handle);
+  if (result != ESP_OK)
+  {
+    ESP_LOGW(TAG, "Unable to cache config: %s", esp_err_to_name(result));
+    return result;
+  }
+
+  result = nvs_set_blob(handle, "config_body", body, body_len);
+  if (result == ESP_OK)
+  {
+    result = nvs_set_blob(handle, "config_headers", cache, sizeof(config_cache_t));
+  }
+  if (result == ESP_OK)
+  {
+    result = nvs_commit(handle);
+  }
+  nvs_close(handle);
+
+  if (result != ESP_OK)
+  {
+    ESP_LOGW(TAG, "Unable to cache config: %s", esp_err_to_name(result));
+  }
+  return result;
+}
+
+esp_err_t config_cache_clear()
+{
+  nvs_handle_t handle;
+  esp_err_t result = nvs_open("providore", NVS_READWRITE, &handle);
+  if (result != ESP_OK)
+  {
+    return result;
+  }
+
+  nvs_erase_key(handle, "config_headers");
+  nvs_erase_key(handle, "config_body");
+  result = nvs_commit(handle);
+  nvs_close(handle);
+  return result;
+}
@@ -0,0 +1,465 @@
+#include "config_parser.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+
+static const char *TAG = "PROVIDORE_CONFIG_PARSER";
+
+static bool config_parser_whitespace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int config_parser_hex(char c)
+{
+  if (c >= '0' && c <= '9')
+  {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f')
+  {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F')
+  {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// Buffers always keep a byte spare for the terminator
+static esp_err_t config_parser_append(char *buffer, size_t *len, size_t max_len, const char *data, size_t data_len)
+{
+  if (*len + data_len >= max_len)
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  memcpy(buffer + *len, data, data_len);
+  *len += data_len;
+  return ESP_OK;
+}
+
+static esp_err_t config_parser_utf8(char *buffer, size_t *len, size_t max_len, uint32_t codepoint)
+{
+  char bytes[4];
+  size_t bytes_len;
+  if (codepoint < 0x80)
+  {
+    bytes[0] = (char)codepoint;
+    bytes_len = 1;
+  }
+  else if (codepoint < 0x800)
+  {
+    bytes[0] = (char)(0xc0 | codepoint >> 6);
+    bytes[1] = (char)(0x80 | (codepoint & 0x3f));
+    bytes_len = 2;
+  }
+  else if (codepoint < 0x10000)
+  {
+    bytes[0] = (char)(0xe0 | codepoint >> 12);
+    bytes[1] = (char)(0x80 | (codepoint >> 6 & 0x3f));
+    bytes[2] = (char)(0x80 | (codepoint & 0x3f));
+    bytes_len = 3;
+  }
+  else
+  {
+    bytes[0] = (char)(0xf0 | codepoint >> 18);
+    bytes[1] = (char)(0x80 | (codepoint >> 12 & 0x3f));
+    bytes[2] = (char)(0x80 | (codepoint >> 6 & 0x3f));
+    bytes[3] = (char)(0x80 | (codepoint & 0x3f));
+    bytes_len = 4;
+  }
+  return config_parser_append(buffer, len, max_len, bytes, bytes_len);
+}
+
+// Handles one character of a key or string value, setting done at the closing quote
+static esp_err_t config_parser_string(config_parser_t *parser, char c, char *buffer, size_t *len, size_t max_len, bool *done)
+{
+  *done = false;
+
+  // \uXXXX - escape counts the hex digits read so far, offset by 2
+  if (parser->escape >= 2)
+  {
+    int digit = config_parser_hex(c);
+    if (digit < 0)
+    {
+      return ESP_ERR_INVALID_RESPONSE;
+    }
+    parser->codepoint = parser->codepoint << 4 | (uint32_t)digit;
+    if (++parser->escape < 6)
+    {
+      return ESP_OK;
+    }
+    parser->escape = 0;
+
+    uint32_t codepoint = parser->codepoint;
+    if (codepoint >= 0xd800 && codepoint < 0xdc00)
+    {
+      parser->high_surrogate = codepoint;
+      return ESP_OK;
+    }
+    if (codepoint >= 0xdc00 && codepoint < 0xe000)
+    {
+      if (parser->high_surrogate == 0)
+      {
+        return ESP_ERR_INVALID_RESPONSE;
+      }
+      codepoint = 0x10000 + ((parser->high_surrogate - 0xd800) << 10) + (codepoint - 0xdc00);
+    }
+    parser->high_surrogate = 0;
+    return config_parser_utf8(buffer, len, max_len, codepoint);
+  }
+
+  if (parser->escape == 1)
+  {
+    parser->escape = 0;
+    switch (c)
+    {
+    case '"':
+    case '\\':
+    case '/':
+      break;
+    case 'b':
+      c = '\b';
+      break;
+    case 'f':
+      c = '\f';
+      break;
+    case 'n':
+      c = '\n';
+      break;
+    case 'r':
+      c = '\r';
+      break;
+    case 't':
+      c = '\t';
+      break;
+    case 'u':
+      parser->escape = 2;
+      parser->codepoint = 0;
+      return ESP_OK;
+    default:
+      return ESP_ERR_INVALID_RESPONSE;
+    }
+    return config_parser_append(buffer, len, max_len, &c, 1);
+  }
+
+  if (c == '\\')
+  {
+    parser->escape = 1;
+    return ESP_OK;
+  }
+  if (c == '"')
+  {
+    *done = true;
+    return ESP_OK;
+  }
+  if ((uint8_t)c < 0x20)
+  {
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  return config_parser_append(buffer, len, max_len, &c, 1);
+}
+
+static void config_parser_value_done(config_parser_t *parser)
+{
+  parser->state = parser->depth == 0 ? CONFIG_PARSER_DONE : CONFIG_PARSER_NEXT;
+}
+
+static esp_err_t config_parser_push(config_parser_t *parser, bool array)
+{
+  if (parser->depth == CONFIG_PARSER_DEPTH)
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  config_parser_frame_t *frame = &parser->stack[parser->depth++];
+  frame->array = array;
+  frame->key_len = parser->key_len;
+  frame->index = 0;
+  parser->state = array ? CONFIG_PARSER_ARRAY_START : CONFIG_PARSER_OBJECT_START;
+  return ESP_OK;
+}
+
+static void config_parser_pop(config_parser_t *parser)
+{
+  parser->depth--;
+  parser->key_len = parser->stack[parser->depth].key_len;
+  config_parser_value_done(parser);
+}
+
+// Object keys are appended to the path of the object they are in
+static esp_err_t config_parser_key(config_parser_t *parser)
+{
+  parser->key_len = parser->stack[parser->depth - 1].key_len;
+  if (parser->key_len > 0)
+  {
+    esp_err_t result = config_parser_append(parser->key, &parser->key_len, CONFIG_PARSER_KEY_LEN, ".", 1);
+    if (result != ESP_OK)
+    {
+      return result;
+    }
+  }
+  parser->state = CONFIG_PARSER_KEY_STRING;
+  return ESP_OK;
+}
+
+static esp_err_t config_parser_element(config_parser_t *parser)
+{
+  config_parser_frame_t *frame = &parser->stack[parser->depth - 1];
+  char index[16];
+  int index_len = snprintf(index, sizeof(index), "[%u]", frame->index);
+
+  parser->key_len = frame->key_len;
+  parser->state = CONFIG_PARSER_VALUE;
+  return config_parser_append(parser->key, &parser->key_len, CONFIG_PARSER_KEY_LEN, index, index_len);
+}
+
+static esp_err_t config_parser_scalar(config_parser_t *parser)
+{
+  config_value_t value;
+  bzero(&value, sizeof(value));
+  parser->value[parser->value_len] = '\0';
+
+  if (parser->state == CONFIG_PARSER_STRING)
+  {
+    value.type = CONFIG_VALUE_STRING;
+    value.string = parser->value;
+    value.string_len = parser->value_len;
+  }
+  else if (parser->state == CONFIG_PARSER_NUMBER)
+  {
+    char *end = NULL;
+    errno = 0;
+    if (strpbrk(parser->value, ".eE") == NULL)
+    {
+      value.type = CONFIG_VALUE_INTEGER;
+      value.integer = strtoll(parser->value, &end, 10);
+      value.number = (double)value.integer;
+    }
+    // Too big for an integer, or not one in the first place
+    if (strpbrk(parser->value, ".eE") != NULL || errno == ERANGE)
+    {
+      value.type = CONFIG_VALUE_NUMBER;
+      value.number = strtod(parser->value, &end);
+    }
+    if (end != parser->value + parser->value_len)
+    {
+      return ESP_ERR_INVALID_RESPONSE;
+    }
+  }
+  else if (strcmp(parser->value, "true") == 0 || strcmp(parser->value, "false") == 0)
+  {
+    value.type = CONFIG_VALUE_BOOL;
+    value.boolean = parser->value[0] == 't';
+  }
+  else if (strcmp(parser->value, "null") == 0)
+  {
+    value.type = CONFIG_VALUE_NULL;
+  }
+  else
+  {
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+
+  parser->key[parser->key_len] = '\0';
+  parser->callback(parser->key, &value, parser->user_data);
+  config_parser_value_done(parser);
+  return ESP_OK;
+}
+
+static esp_err_t config_parser_char(config_parser_t *parser, char c)
+{
+  esp_err_t result;
+  bool done;
+
+  switch (parser->state)
+  {
+  case CONFIG_PARSER_VALUE:
+    if (config_parser_whitespace(c))
+    {
+      return ESP_OK;
+    }
+    parser->value_len = 0;
+    if (c == '{' || c == '[')
+    {
+      return config_parser_push(parser, c == '[');
+    }
+    if (c == '"')
+    {
+      parser->state = CONFIG_PARSER_STRING;
+      return ESP_OK;
+    }
+    if (c == '-' || (c >= '0' && c <= '9'))
+    {
+      parser->state = CONFIG_PARSER_NUMBER;
+      return config_parser_append(parser->value, &parser->value_len, CONFIG_PARSER_VALUE_LEN, &c, 1);
+    }
+    if (c == 't' || c == 'f' || c == 'n')
+    {
+      parser->state = CONFIG_PARSER_LITERAL;
+      return config_parser_append(parser->value, &parser->value_len, CONFIG_PARSER_VALUE_LEN, &c, 1);
+    }
+    return ESP_ERR_INVALID_RESPONSE;
+
+  case CONFIG_PARSER_OBJECT_START:
+  case CONFIG_PARSER_KEY:
+    if (config_parser_whitespace(c))
+    {
+      return ESP_OK;
+    }
+    if (c == '}' && parser->state == CONFIG_PARSER_OBJECT_START)
+    {
+      config_parser_pop(parser);
+      return ESP_OK;
+    }
+    if (c == '"')
+    {
+      return config_parser_key(parser);
+    }
+    return ESP_ERR_INVALID_RESPONSE;
+
+  case CONFIG_PARSER_KEY_STRING:
+    result = config_parser_string(parser, c, parser->key, &parser->key_len, CONFIG_PARSER_KEY_LEN, &done);
+    if (result == ESP_OK && done)
+    {
+      parser->state = CONFIG_PARSER_COLON;
+    }
+    return result;
+
+  case CONFIG_PARSER_COLON:
+    if (config_parser_whitespace(c))
+    {
+      return ESP_OK;
+    }
+    if (c == ':')
+    {
+      parser->state = CONFIG_PARSER_VALUE;
+      return ESP_OK;
+    }
+    return ESP_ERR_INVALID_RESPONSE;
+
+  case CONFIG_PARSER_ARRAY_START:
+    if (config_parser_whitespace(c))
+    {
+      return ESP_OK;
+    }
+    if (c == ']')
+    {
+      config_parser_pop(parser);
+      return ESP_OK;
+    }
+    result = config_parser_element(parser);
+    return result == ESP_OK ? config_parser_char(parser, c) : result;
+
+  case CONFIG_PARSER_STRING:
+    result = config_parser_string(parser, c, parser->value, &parser->value_len, CONFIG_PARSER_VALUE_LEN, &done);
+    if (result == ESP_OK && done)
+    {
+      result = config_parser_scalar(parser);
+    }
+    return result;
+
+  case CONFIG_PARSER_NUMBER:
+  case CONFIG_PARSER_LITERAL:
+    if ((parser->state == CONFIG_PARSER_NUMBER && ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E')) ||
+        (parser->state == CONFIG_PARSER_LITERAL && c >= 'a' && c <= 'z'))
+    {
+      return config_parser_append(parser->value, &parser->value_len, CONFIG_PARSER_VALUE_LEN, &c, 1);
+    }
+    // Numbers and literals only end at the next character, which still needs handling
+    result = config_parser_scalar(parser);
+    return result == ESP_OK ? config_parser_char(parser, c) : result;
+
+  case CONFIG_PARSER_NEXT:
+  {
+    if (config_parser_whitespace(c))
+    {
+      return ESP_OK;
+    }
+    config_parser_frame_t *frame = &parser->stack[parser->depth - 1];
+    if (c == ',')
+    {
+      if (frame->array)
+      {
+        frame->index++;
+        return config_parser_element(parser);
+      }
+      parser->state = CONFIG_PARSER_KEY;
+      return ESP_OK;
+    }
+    if ((c == ']' && frame->array) || (c == '}' && !frame->array))
+    {
+      config_parser_pop(parser);
+      return ESP_OK;
+    }
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+
+  case CONFIG_PARSER_DONE:
+    return config_parser_whitespace(c) ? ESP_OK : ESP_ERR_INVALID_RESPONSE;
+
+  default:
+    return ESP_ERR_INVALID_STATE;
+  }
+}
+
+void config_parser_begin(config_parser_t *parser, config_parser_cb callback, void *user_data)
+{
+  bzero(parser, sizeof(config_parser_t));
+  parser->callback = callback;
+  parser->user_data = user_data;
+  parser->state = CONFIG_PARSER_VALUE;
+}
+
+esp_err_t config_parser_write(config_parser_t *parser, const void *data, size_t data_len)
+{
+  const char *data_ptr = (const char *)data;
+  if (parser->state == CONFIG_PARSER_ERROR)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  for (size_t i = 0; i < data_len; i++)
+  {
+    esp_err_t result = config_parser_char(parser, data_ptr[i]);
+    if (result != ESP_OK)
+    {
+      switch (result)
+      {
+      case ESP_ERR_INVALID_SIZE:
+        ESP_LOGE(TAG, "Config key, value or nesting too large at byte %i", parser->position);
+        break;
+      default:
+        ESP_LOGE(TAG, "Invalid config at byte %i", parser->position);
+        break;
+      }
+      parser->state = CONFIG_PARSER_ERROR;
+      return result;
+    }
+    parser->position++;
+  }
+  return ESP_OK;
+}
+
+esp_err_t config_parser_finish(config_parser_t *parser)
+{
+  // A number or literal at the very end has nothing after it to end it
+  if (parser->state == CONFIG_PARSER_NUMBER || parser->state == CONFIG_PARSER_LITERAL)
+  {
+    esp_err_t result = config_parser_write(parser, " ", 1);
+    if (result != ESP_OK)
+    {
+      return result;
+    }
+  }
+
+  if (parser->state != CONFIG_PARSER_DONE)
+  {
+    ESP_LOGE(TAG, "Config ended early");
+    return ESP_ERR_INVALID_SIZE;
+  }
+  return ESP_OK;
+}
@@ -2,7 +2,7 @@
 #include "nvs_flash.h"
 #include "esp_log.h"
 
-const char *TAG = "configuration";
+static const char *TAG = "PROVIDORE_CONFIGURATION";
 
 esp_err_t get_device_id(char *out_value, size_t *length)
 {
@@ -12,7 +12,9 @@ esp_err_t get_device_id(char *out_value, size_t *length)
   {
     return result;
   }
-  return nvs_get_str(handle, "device_id", out_value, length);
+  result = nvs_get_str(handle, "device_id", out_value, length);
+  nvs_close(handle);
+  return result;
 }
 
 esp_err_t get_psk(char *out_value, size_t *length)
@@ -29,7 +31,9 @@ esp_err_t get_psk(char *out_value, size_t *length)
   {
     return result;
   }
-  return nvs_get_str(handle, "psk", out_value, length);
+  result = nvs_get_str(handle, "psk", out_value, length);
+  nvs_close(handle);
+  return result;
 #endif
 }
 
@@ -0,0 +1,177 @@
+#include "delta.h"
+#include <string.h>
+#include "esp_log.h"
+
+static const char *TAG = "PROVIDORE_DELTA";
+
+static uint32_t delta_read_u32(const uint8_t *data)
+{
+  return (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+static esp_err_t delta_patch_output(delta_patch_t *patch, const void *data, size_t data_len)
+{
+  if (patch->written + data_len > patch->image_size)
+  {
+    ESP_LOGE(TAG, "Patch writes past the end of the image");
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  esp_err_t result = patch->write(patch->user_data, data, data_len);
+  if (result == ESP_OK)
+  {
+    patch->written += data_len;
+  }
+  return result;
+}
+
+static esp_err_t delta_patch_copy(delta_patch_t *patch)
+{
+  while (patch->remaining > 0)
+  {
+    size_t len = patch->remaining < DELTA_BUFFER_LEN ? patch->remaining : DELTA_BUFFER_LEN;
+    esp_err_t result = esp_partition_read(patch->source, patch->offset, patch->buffer, len);
+    if (result != ESP_OK)
+    {
+      return result;
+    }
+    result = delta_patch_output(patch, patch->buffer, len);
+    if (result != ESP_OK)
+    {
+      return result;
+    }
+    patch->offset += len;
+    patch->remaining -= len;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t delta_patch_command(delta_patch_t *patch)
+{
+  delta_opcode_t opcode = (delta_opcode_t)patch->fields[0];
+  patch->offset = delta_read_u32(patch->fields + 1);
+  patch->remaining = delta_read_u32(patch->fields + 5);
+  patch->fields_len = 0;
+
+  if (opcode != DELTA_END && opcode != DELTA_INSERT && (patch->offset > patch->source->size || patch->remaining > patch->source->size - patch->offset))
+  {
+    ESP_LOGE(TAG, "Patch reads past the end of the running image");
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  switch (opcode)
+  {
+  case DELTA_END:
+    patch->state = DELTA_DONE;
+    return ESP_OK;
+  case DELTA_COPY:
+    return delta_patch_copy(patch);
+  case DELTA_INSERT:
+    patch->state = patch->remaining > 0 ? DELTA_INSERTING : DELTA_READING_COMMAND;
+    return ESP_OK;
+  case DELTA_ADD:
+    patch->state = patch->remaining > 0 ? DELTA_ADDING : DELTA_READING_COMMAND;
+    return ESP_OK;
+  default:
+    ESP_LOGE(TAG, "Unknown patch command %i", opcode);
+    return ESP_ERR_INVALID_ARG;
+  }
+}
+
+void delta_patch_begin(delta_patch_t *patch, const esp_partition_t *source, delta_write_cb write, void *user_data)
+{
+  bzero(patch, sizeof(delta_patch_t));
+  patch->source = source;
+  patch->write = write;
+  patch->user_data = user_data;
+  patch->state = DELTA_READING_HEADER;
+}
+
+esp_err_t delta_patch_write(delta_patch_t *patch, const void *data, size_t data_len)
+{
+  const uint8_t *data_ptr = (const uint8_t *)data;
+  esp_err_t result = ESP_OK;
+
+  while (data_len > 0 && result == ESP_OK)
+  {
+    size_t len = 0;
+    switch (patch->state)
+    {
+    case DELTA_READING_HEADER:
+    case DELTA_READING_COMMAND:
+    {
+      // Headers and commands can be split across chunks, so gather them first
+      size_t needed = (patch->state == DELTA_READING_HEADER ? DELTA_HEADER_LEN : DELTA_COMMAND_LEN) - patch->fields_len;
+      len = data_len < needed ? data_len : needed;
+      memcpy(patch->fields + patch->fields_len, data_ptr, len);
+      patch->fields_len += len;
+      if (len < needed)
+      {
+        break;
+      }
+
+      if (patch->state == DELTA_READING_COMMAND)
+      {
+        result = delta_patch_command(patch);
+        break;
+      }
+
+      if (memcmp(patch->fields, DELTA_MAGIC, 4) != 0)
+      {
+        ESP_LOGE(TAG, "Not a delta patch");
+        result = ESP_ERR_INVALID_ARG;
+        break;
+      }
+      patch->image_size = delta_read_u32(patch->fields + 4);
+      patch->fields_len = 0;
+      patch->state = DELTA_READING_COMMAND;
+    }
+    break;
+    case DELTA_INSERTING:
+      len = data_len < patch->remaining ? data_len : patch->remaining;
+      result = delta_patch_output(patch, data_ptr, len);
+      patch->remaining -= len;
+      break;
+    case DELTA_ADDING:
+    {
+      len = data_len < patch->remaining ? data_len : patch->remaining;
+      len = len < DELTA_BUFFER_LEN ? len : DELTA_BUFFER_LEN;
+      result = esp_partition_read(patch->source, patch->offset, patch->buffer, len);
+      if (result != ESP_OK)
+      {
+        break;
+      }
+      for (size_t i = 0; i < len; i++)
+      {
+        patch->buffer[i] += data_ptr[i];
+      }
+      result = delta_patch_output(patch, patch->buffer, len);
+      patch->offset += len;
+      patch->remaining -= len;
+    }
+    break;
+    case DELTA_DONE:
+      ESP_LOGE(TAG, "Unexpected data after the end of the patch");
+      return ESP_ERR_INVALID_SIZE;
+    }
+
+    if ((patch->state == DELTA_INSERTING || patch->state == DELTA_ADDING) && patch->remaining == 0)
+    {
+      patch->state = DELTA_READING_COMMAND;
+    }
+    data_ptr += len;
+    data_len -= len;
+  }
+
+  return result;
+}
+
+esp_err_t delta_patch_finish(delta_patch_t *patch)
+{
+  if (patch->state != DELTA_DONE || patch->written != patch->image_size)
+  {
+    ESP_LOGE(TAG, "Patch ended early: %i of %i bytes rebuilt", patch->written, patch->image_size);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  return ESP_OK;
+}
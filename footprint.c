@@ -0,0 +1,54 @@
+#include "footprint.h"
+#include "sdkconfig.h"
+#include "buffer_pool.h"
+#include "metrics.h"
+#include "push.h"
+#include "scheduler.h"
+#include "session.h"
+#include "types.h"
+
+#define FOOTPRINT_STATIC (2 * sizeof(providore_session_t) + sizeof(providore_signer_t) + sizeof(ota_request_context_t) + sizeof(providore_stats_t) + sizeof(providore_scheduler_config_t))
+
+#ifdef CONFIG_PROVIDORE_PEER
+#define FOOTPRINT_PEER_STACK CONFIG_PROVIDORE_PEER_STACK_SIZE
+#else
+#define FOOTPRINT_PEER_STACK 0
+#endif
+
+#define FOOTPRINT_STACKS (CONFIG_PROVIDORE_TASK_STACK_SIZE + CONFIG_PROVIDORE_OTA_PIPELINE_STACK_SIZE + CONFIG_PROVIDORE_SCHEDULER_STACK_SIZE + PUSH_STACK_SIZE + FOOTPRINT_PEER_STACK)
+
+#ifdef CONFIG_PROVIDORE_OTA_DELTA
+#define FOOTPRINT_DELTA sizeof(delta_patch_t)
+#else
+#define FOOTPRINT_DELTA 0
+#endif
+
+#ifdef CONFIG_PROVIDORE_OTA_COMPRESSION
+#define FOOTPRINT_INFLATE sizeof(inflate_stream_t)
+#else
+#define FOOTPRINT_INFLATE 0
+#endif
+
+// Without an internal RAM limit a response buffer can grow as far as the
+// response does, so only the segments kept for reuse are counted
+#if CONFIG_PROVIDORE_BUFFER_INTERNAL_LIMIT > 0
+#define FOOTPRINT_BUFFERS (CONFIG_PROVIDORE_BUFFER_INTERNAL_LIMIT * 1024)
+#else
+#define FOOTPRINT_BUFFERS (CONFIG_PROVIDORE_BUFFER_POOL_SEGMENTS * sizeof(buffer_segment_t))
+#endif
+
+#define FOOTPRINT_HEAP (sizeof(ota_pipeline_t) + FOOTPRINT_DELTA + FOOTPRINT_INFLATE + FOOTPRINT_BUFFERS)
+
+#define FOOTPRINT_TOTAL (FOOTPRINT_STATIC + FOOTPRINT_STACKS + FOOTPRINT_HEAP)
+
+#if CONFIG_PROVIDORE_MEMORY_BUDGET > 0
+_Static_assert(FOOTPRINT_TOTAL <= CONFIG_PROVIDORE_MEMORY_BUDGET * 1024, "Providore can use more RAM than CONFIG_PROVIDORE_MEMORY_BUDGET, shrink its buffers or stacks");
+#endif
+
+void providore_get_footprint(providore_footprint_t *footprint)
+{
+  footprint->static_ram = FOOTPRINT_STATIC;
+  footprint->stacks = FOOTPRINT_STACKS;
+  footprint->heap = FOOTPRINT_HEAP;
+  footprint->total = FOOTPRINT_TOTAL;
+}
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "providore.h"
+#include "test.h"
+#include "test_support.h"
+
+// Every public request API against the host stand-ins: requests/s, bytes/s
+// off the wire, heap allocations a request and the most stack one took.
+// The stand-in server answers at once and there is no TLS, so these compare
+// the component's own costs between changes rather than predict a device.
+
+#define RUNNING_LEN (128 * 1024)
+#define IMAGE_LEN (320 * 1024)
+#define REQUESTS 500
+#define UPGRADES 20
+#define CONFIG "{\"interval\": 60, \"wifi\": {\"ssid\": \"home\", \"channel\": 6}}"
+
+typedef struct
+{
+  test_server_t *server;
+  const uint8_t *running;
+  providore_err_t result;
+} bench_t;
+
+static void bench_get_config(void *arguments)
+{
+  bench_t *bench = (bench_t *)arguments;
+  char config[128] = {0};
+  size_t config_len = 0;
+  bench->result = providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len);
+}
+
+static void ignore_field(const char *key, const config_value_t *value, void *user_data)
+{
+}
+
+static void bench_get_config_parsed(void *arguments)
+{
+  bench_t *bench = (bench_t *)arguments;
+  bench->result = providore_get_config_parsed(TEST_DEVICE_ID, TEST_PSK, ignore_field, NULL);
+}
+
+static void bench_get_config_buffer(void *arguments)
+{
+  bench_t *bench = (bench_t *)arguments;
+  providore_buffer_t buffer;
+  bench->result = providore_get_config_buffer(TEST_DEVICE_ID, TEST_PSK, &buffer);
+  providore_buffer_free(&buffer);
+}
+
+static void bench_sync(void *arguments)
+{
+  bench_t *bench = (bench_t *)arguments;
+  config_parser_t parser;
+  config_parser_begin(&parser, ignore_field, NULL);
+  providore_buffer_t certificates;
+  providore_buffer_init(&certificates);
+  sync_handler_t handlers[] = {{"config", sync_parser_part, &parser}, {"certificates", sync_buffer_part, &certificates}};
+  bench->result = providore_sync(TEST_DEVICE_ID, TEST_PSK, handlers, 2);
+  providore_buffer_free(&certificates);
+}
+
+static void bench_firmware_manifest(void *arguments)
+{
+  bench_t *bench = (bench_t *)arguments;
+  firmware_manifest_t manifest;
+  bench->result = providore_firmware_manifest(TEST_DEVICE_ID, TEST_PSK, &manifest);
+}
+
+static void bench_firmware_upgrade(void *arguments)
+{
+  bench_t *bench = (bench_t *)arguments;
+  bench->result = providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK);
+}
+
+// Back to a device still running the old image, so each upgrade downloads it again
+static void fresh_device(bench_t *bench)
+{
+  providore_close_session();
+  host_reset();
+  test_running_image(bench->running, RUNNING_LEN);
+  test_server_start(bench->server);
+  test_identity();
+}
+
+static void bench(const char *name, void (*request)(void *), bench_t *run, int requests, void (*prepare)(bench_t *))
+{
+  providore_stats_t before;
+  providore_stats_t after;
+  // The first request opens the connection
+  request(run);
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, run->result);
+
+  int64_t elapsed_us = 0;
+  uint64_t allocations = 0;
+  providore_reset_stats();
+  providore_get_stats(&before);
+  for (int i = 0; i < requests; i++)
+  {
+    if (prepare != NULL)
+    {
+      prepare(run);
+    }
+    uint64_t allocated = test_allocations();
+    int64_t started = test_now_us();
+    request(run);
+    elapsed_us += test_now_us() - started;
+    allocations += test_allocations() - allocated;
+    TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, run->result);
+  }
+  providore_get_stats(&after);
+  uint64_t received = after.bytes_received - before.bytes_received;
+
+  if (prepare != NULL)
+  {
+    prepare(run);
+  }
+  size_t stack = test_stack_peak(request, run);
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, run->result);
+  // Firmware downloads run on tasks of their own, which record their peak as they finish
+  providore_get_stats(&after);
+  uint32_t task_stack = 0;
+  for (int i = 0; i < PROVIDORE_TASK_MAX; i++)
+  {
+    task_stack = after.stacks[i].peak > task_stack ? after.stacks[i].peak : task_stack;
+  }
+
+  double seconds = (elapsed_us > 0 ? elapsed_us : 1) / 1e6;
+  printf("BENCH %s: %.0f requests/s, %.1f MB/s, %.1f allocations a request, %zu bytes host stack, %u on its own tasks\n", name, requests / seconds,
+         received / seconds / 1e6, allocations / (double)requests, stack, task_stack);
+}
+
+static void test_bench_config()
+{
+  test_server_t server = {.config = CONFIG, .chunk_len = 1436};
+  test_server_start(&server);
+  test_identity();
+  bench_t run = {.server = &server};
+
+  bench("get_config", bench_get_config, &run, REQUESTS, NULL);
+  bench("get_config_parsed", bench_get_config_parsed, &run, REQUESTS, NULL);
+  bench("get_config_buffer", bench_get_config_buffer, &run, REQUESTS, NULL);
+  TEST_ASSERT_EQUAL_INT(0, server.unsigned_requests);
+}
+
+static void test_bench_sync()
+{
+  static const char *names[] = {"config", "certificates"};
+  static const char *bodies[] = {CONFIG, "-----BEGIN CERTIFICATE-----"};
+  uint8_t *body;
+  size_t body_len = test_sync_body(names, bodies, 2, &body);
+  test_server_t server = {.sync = body, .sync_len = body_len, .chunk_len = 1436};
+  test_server_start(&server);
+  test_identity();
+  bench_t run = {.server = &server};
+
+  bench("sync", bench_sync, &run, REQUESTS, NULL);
+  free(body);
+}
+
+static void test_bench_firmware()
+{
+  uint8_t *running = test_image(RUNNING_LEN, 1);
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  test_server_t server = {.manifest = true, .image = image, .image_len = IMAGE_LEN, .chunk_len = 1436};
+  bench_t run = {.server = &server, .running = running};
+  fresh_device(&run);
+
+  // The stand-in hashes the image for every manifest it serves, so keep that out of the figure
+  server.image_len = 4096;
+  bench("firmware_manifest", bench_firmware_manifest, &run, REQUESTS, NULL);
+  server.image_len = IMAGE_LEN;
+  fresh_device(&run);
+  bench("firmware_upgrade", bench_firmware_upgrade, &run, UPGRADES, fresh_device);
+  free(image);
+  free(running);
+}
+
+int main()
+{
+  RUN_TEST(test_bench_config);
+  RUN_TEST(test_bench_sync);
+  RUN_TEST(test_bench_firmware);
+  return test_end();
+}
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "esp_ota_ops.h"
+#include "providore.h"
+#include "test.h"
+#include "test_support.h"
+
+// A fleet of devices against tools/providore_server.py at once, each a process
+// of its own as the component keeps one session a process. Reports p50/p99
+// config latency, OTA throughput and the server's CPU time, on a clean network
+// and on one with slow links, resets and bodies cut off halfway. The figures
+// depend on the host; the test only fails when a device gives up, or ends up
+// with a config or image other than the one served.
+
+#define CLIENTS 200
+#define FETCHES 5
+#define UPGRADES 10
+#define ATTEMPTS 50
+#define RUNNING_LEN (128 * 1024)
+#define IMAGE_LEN (256 * 1024)
+#define CONFIG "{\"interval\": 60, \"wifi\": {\"ssid\": \"home\", \"channel\": 6}}"
+
+typedef struct
+{
+  // Until each config arrived, retries included
+  int64_t latency_us[FETCHES];
+  int64_t elapsed_us;
+  uint32_t requests;
+  uint32_t failures;
+  bool done;
+} load_result_t;
+
+static uint8_t *running;
+static uint8_t *image;
+
+static bool boot_partition_holds(const uint8_t *expected, size_t len)
+{
+  const esp_partition_t *boot = esp_ota_get_boot_partition();
+  if (boot == NULL || boot->address != host_flash_partition(1)->address)
+  {
+    return false;
+  }
+  uint8_t *flash = malloc(len);
+  host_flash_read(boot, 0, flash, len);
+  bool matches = memcmp(flash, expected, len) == 0;
+  free(flash);
+  return matches;
+}
+
+static void load_config(load_result_t *result)
+{
+  result->done = true;
+  for (int i = 0; i < FETCHES; i++)
+  {
+    char config[128] = {0};
+    size_t config_len = 0;
+    providore_err_t err = PROVIDORE_CONNECTION_FAIL;
+    int64_t started = test_now_us();
+    for (int attempt = 0; attempt < ATTEMPTS && err != PROVIDORE_OK; attempt++)
+    {
+      err = providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len);
+      result->requests++;
+      result->failures += err != PROVIDORE_OK;
+    }
+    result->latency_us[i] = test_now_us() - started;
+    result->done = result->done && err == PROVIDORE_OK && strcmp(config, CONFIG) == 0;
+  }
+}
+
+static void load_firmware(load_result_t *result)
+{
+  test_running_image(running, RUNNING_LEN);
+  providore_err_t err = PROVIDORE_CONNECTION_FAIL;
+  int64_t started = test_now_us();
+  for (int attempt = 0; attempt < ATTEMPTS && err != PROVIDORE_OK; attempt++)
+  {
+    err = providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK);
+    result->requests++;
+    result->failures += err != PROVIDORE_OK;
+  }
+  result->elapsed_us = test_now_us() - started;
+  result->done = err == PROVIDORE_OK && boot_partition_holds(image, IMAGE_LEN);
+}
+
+// Forks a device for each client, all at once, and collects what each saw.
+// Results are small enough for each write to the pipe to be atomic.
+static bool load_run(int clients, void (*client)(load_result_t *), load_result_t *results, int64_t *elapsed_us)
+{
+  int channel[2];
+  if (pipe(channel) != 0)
+  {
+    return false;
+  }
+  fflush(stdout);
+  fflush(stderr);
+  pid_t *pids = calloc(clients, sizeof(pid_t));
+  int64_t started = test_now_us();
+  for (int i = 0; i < clients; i++)
+  {
+    pids[i] = fork();
+    if (pids[i] == 0)
+    {
+      close(channel[0]);
+      load_result_t result = {0};
+      client(&result);
+      _exit(write(channel[1], &result, sizeof(result)) == sizeof(result) ? 0 : 1);
+    }
+  }
+  close(channel[1]);
+
+  size_t expected = clients * sizeof(load_result_t);
+  size_t received = 0;
+  while (received < expected)
+  {
+    ssize_t len = read(channel[0], (uint8_t *)results + received, expected - received);
+    if (len <= 0)
+    {
+      break;
+    }
+    received += len;
+  }
+  close(channel[0]);
+  bool exited = true;
+  for (int i = 0; i < clients; i++)
+  {
+    int status = 0;
+    exited = pids[i] > 0 && waitpid(pids[i], &status, 0) == pids[i] && WIFEXITED(status) && WEXITSTATUS(status) == 0 && exited;
+  }
+  *elapsed_us = test_now_us() - started;
+  free(pids);
+  return exited && received == expected;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+  int64_t difference = *(const int64_t *)a - *(const int64_t *)b;
+  return difference < 0 ? -1 : difference > 0;
+}
+
+static int load_done(const load_result_t *results, int clients, uint32_t *requests, uint32_t *failures)
+{
+  int done = 0;
+  *requests = 0;
+  *failures = 0;
+  for (int i = 0; i < clients; i++)
+  {
+    done += results[i].done;
+    *requests += results[i].requests;
+    *failures += results[i].failures;
+  }
+  return done;
+}
+
+static void load_config_test(const char *name, const char *const *args, bool faults)
+{
+  test_script_server_t server;
+  load_result_t *results = calloc(CLIENTS, sizeof(load_result_t));
+  TEST_ASSERT(test_script_server_start(&server, CONFIG, image, IMAGE_LEN, args));
+  test_script_server_route(&server);
+  test_identity();
+  int64_t elapsed_us = 0;
+  bool collected = load_run(CLIENTS, load_config, results, &elapsed_us);
+  int64_t server_us = test_script_server_stop(&server);
+
+  int64_t *latencies = malloc(CLIENTS * FETCHES * sizeof(int64_t));
+  for (int i = 0; i < CLIENTS; i++)
+  {
+    memcpy(latencies + i * FETCHES, results[i].latency_us, sizeof(results[i].latency_us));
+  }
+  qsort(latencies, CLIENTS * FETCHES, sizeof(int64_t), compare_latency);
+  uint32_t requests;
+  uint32_t failures;
+  int done = load_done(results, CLIENTS, &requests, &failures);
+  printf("LOAD %s: %d devices, %u requests, %u failed, p50 %.1f ms, p99 %.1f ms, %.0f requests/s, server %.2f ms CPU a request\n", name, CLIENTS,
+         requests, failures, latencies[CLIENTS * FETCHES / 2] / 1e3, latencies[CLIENTS * FETCHES * 99 / 100] / 1e3,
+         requests / (elapsed_us / 1e6), server_us / 1e3 / (requests > 0 ? requests : 1));
+  free(latencies);
+  free(results);
+
+  TEST_ASSERT(collected);
+  TEST_ASSERT_EQUAL_INT(CLIENTS, done);
+  TEST_ASSERT(faults ? failures > 0 : failures == 0);
+}
+
+static void load_firmware_test(const char *name, const char *const *args, bool faults)
+{
+  test_script_server_t server;
+  load_result_t results[UPGRADES] = {0};
+  TEST_ASSERT(test_script_server_start(&server, CONFIG, image, IMAGE_LEN, args));
+  test_script_server_route(&server);
+  test_identity();
+  int64_t elapsed_us = 0;
+  bool collected = load_run(UPGRADES, load_firmware, results, &elapsed_us);
+  int64_t server_us = test_script_server_stop(&server);
+
+  int64_t slowest_us = 0;
+  for (int i = 0; i < UPGRADES; i++)
+  {
+    slowest_us = results[i].elapsed_us > slowest_us ? results[i].elapsed_us : slowest_us;
+  }
+  uint32_t requests;
+  uint32_t failures;
+  int done = load_done(results, UPGRADES, &requests, &failures);
+  printf("LOAD %s: %d devices, %u upgrades, %u failed, %.1f MB/s in all, slowest %.2f s, server %.1f ms CPU an upgrade\n", name, UPGRADES, requests,
+         failures, (double)UPGRADES * IMAGE_LEN / (elapsed_us / 1e6) / 1e6, slowest_us / 1e6, server_us / 1e3 / UPGRADES);
+
+  TEST_ASSERT(collected);
+  TEST_ASSERT_EQUAL_INT(UPGRADES, done);
+  TEST_ASSERT(faults ? failures > 0 : failures == 0);
+}
+
+static void test_load_config()
+{
+  load_config_test("config", NULL, false);
+}
+
+static void test_load_config_faults()
+{
+  static const char *const args[] = {"--slow-link", "65536", "--reset-rate", "0.1", "--truncate-rate", "0.1", "--seed", "1", NULL};
+  load_config_test("config, slow link, resets and truncation", args, true);
+}
+
+static void test_load_firmware()
+{
+  load_firmware_test("firmware", NULL, false);
+}
+
+static void test_load_firmware_faults()
+{
+  static const char *const args[] = {"--slow-link", "1048576", "--reset-rate", "0.1", "--truncate-rate", "0.1", "--seed", "1", NULL};
+  load_firmware_test("firmware, slow link, resets and truncation", args, true);
+}
+
+int main()
+{
+  running = test_image(RUNNING_LEN, 1);
+  image = test_image(IMAGE_LEN, 2);
+  RUN_TEST(test_load_config);
+  RUN_TEST(test_load_config_faults);
+  RUN_TEST(test_load_firmware);
+  RUN_TEST(test_load_firmware_faults);
+  free(image);
+  free(running);
+  return test_end();
+}
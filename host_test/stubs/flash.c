@@ -0,0 +1,654 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "host_internal.h"
+#include "host_stubs.h"
+#include "mbedtls/sha256.h"
+
+// ota_0 and ota_1 where a typical two OTA partition table puts them
+#define HOST_FLASH_PARTITIONS 2
+#define HOST_FLASH_FIRST_ADDRESS 0x10000
+#define HOST_FLASH_SIZE (HOST_FLASH_FIRST_ADDRESS + HOST_FLASH_PARTITIONS * HOST_FLASH_PARTITION_SIZE)
+#define HOST_OTA_HANDLES 4
+
+typedef struct _host_ota
+{
+  esp_ota_handle_t handle;
+  int partition;
+  size_t wrote_size;
+  size_t erased_to;
+  bool sequential_erase;
+} host_ota_t;
+
+struct esp_partition_iterator_opaque_
+{
+  int index;
+  esp_partition_type_t type;
+  esp_partition_subtype_t subtype;
+  const char *label;
+};
+
+static const esp_partition_t partitions[HOST_FLASH_PARTITIONS] = {
+    {.type = ESP_PARTITION_TYPE_APP, .subtype = ESP_PARTITION_SUBTYPE_APP_OTA_0, .address = HOST_FLASH_FIRST_ADDRESS, .size = HOST_FLASH_PARTITION_SIZE, .label = "ota_0"},
+    {.type = ESP_PARTITION_TYPE_APP, .subtype = ESP_PARTITION_SUBTYPE_APP_OTA_1, .address = HOST_FLASH_FIRST_ADDRESS + HOST_FLASH_PARTITION_SIZE, .size = HOST_FLASH_PARTITION_SIZE, .label = "ota_1"},
+};
+
+static pthread_mutex_t flash_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *flash_file;
+// A forked process gets a flash of its own rather than sharing the file
+static pid_t flash_owner;
+static host_flash_stats_t stats;
+static uint32_t writes_in_progress;
+static uint32_t write_latency_us;
+static uint32_t erase_latency_us;
+static uint32_t fail_after;
+static esp_err_t fail_error;
+static host_ota_t otas[HOST_OTA_HANDLES];
+static esp_ota_handle_t next_handle = 1;
+static int running = 0;
+static int boot = 0;
+static esp_ota_img_states_t states[HOST_FLASH_PARTITIONS] = {ESP_OTA_IMG_VALID, ESP_OTA_IMG_UNDEFINED};
+static bool rolled_back;
+
+static int host_partition_index(const esp_partition_t *partition)
+{
+  for (int i = 0; i < HOST_FLASH_PARTITIONS; i++)
+  {
+    if (partition == &partitions[i] || (partition != NULL && partition->address == partitions[i].address))
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Called with flash_lock held
+static FILE *host_flash_file()
+{
+  if (flash_file == NULL || flash_owner != getpid())
+  {
+    if (flash_file != NULL)
+    {
+      fclose(flash_file);
+    }
+    flash_owner = getpid();
+    flash_file = tmpfile();
+    if (flash_file == NULL)
+    {
+      perror("Unable to create the flash file");
+      abort();
+    }
+    uint8_t erased[SPI_FLASH_SEC_SIZE];
+    memset(erased, 0xff, sizeof(erased));
+    for (size_t offset = 0; offset < HOST_FLASH_SIZE; offset += sizeof(erased))
+    {
+      fwrite(erased, 1, sizeof(erased), flash_file);
+    }
+  }
+  return flash_file;
+}
+
+static void host_flash_io(uint32_t address, void *data, size_t len, bool write)
+{
+  FILE *file = host_flash_file();
+  size_t done = write ? pwrite(fileno(file), data, len, address) : pread(fileno(file), data, len, address);
+  if (done != len)
+  {
+    perror("Flash file I/O failed");
+    abort();
+  }
+}
+
+static void host_flash_erase(uint32_t address, size_t len)
+{
+  uint8_t erased[SPI_FLASH_SEC_SIZE];
+  memset(erased, 0xff, sizeof(erased));
+  for (size_t offset = 0; offset < len; offset += SPI_FLASH_SEC_SIZE)
+  {
+    uint32_t latency_us = __atomic_load_n(&erase_latency_us, __ATOMIC_ACQUIRE);
+    if (latency_us > 0)
+    {
+      host_freertos_sleep_us(latency_us);
+    }
+    pthread_mutex_lock(&flash_lock);
+    host_flash_io(address + offset, erased, SPI_FLASH_SEC_SIZE, true);
+    stats.erased_sectors++;
+    pthread_mutex_unlock(&flash_lock);
+  }
+}
+
+// NOR flash can only clear bits, so anything written over unerased data is corrupted
+static esp_err_t host_flash_write(uint32_t address, const void *data, size_t len)
+{
+  uint32_t in_progress = __atomic_add_fetch(&writes_in_progress, 1, __ATOMIC_ACQ_REL);
+  uint32_t latency_us = __atomic_load_n(&write_latency_us, __ATOMIC_ACQUIRE);
+  if (latency_us > 0)
+  {
+    host_freertos_sleep_us(latency_us);
+  }
+
+  pthread_mutex_lock(&flash_lock);
+  stats.concurrent_writes = in_progress > stats.concurrent_writes ? in_progress : stats.concurrent_writes;
+  esp_err_t result = ESP_OK;
+  if (fail_error != ESP_OK && fail_after == 0)
+  {
+    result = fail_error;
+  }
+  else
+  {
+    if (fail_after > 0)
+    {
+      fail_after--;
+    }
+
+    uint8_t *flash = (uint8_t *)malloc(len);
+    const uint8_t *bytes = (const uint8_t *)data;
+    bool dirty = false;
+    host_flash_io(address, flash, len, false);
+    for (size_t i = 0; i < len; i++)
+    {
+      dirty = dirty || (flash[i] & bytes[i]) != bytes[i];
+      flash[i] &= bytes[i];
+    }
+    host_flash_io(address, flash, len, true);
+    free(flash);
+
+    if (stats.writes < HOST_FLASH_WRITE_LOG)
+    {
+      stats.log[stats.writes].address = address;
+      stats.log[stats.writes].len = len;
+    }
+    stats.writes++;
+    stats.bytes_written += len;
+    stats.dirty_writes += dirty ? 1 : 0;
+  }
+  pthread_mutex_unlock(&flash_lock);
+
+  __atomic_sub_fetch(&writes_in_progress, 1, __ATOMIC_ACQ_REL);
+  return result;
+}
+
+// The length of the image in a partition, 0 if there isn't a valid one
+static size_t host_image_len(int index, bool *hash_appended)
+{
+  uint8_t header[HOST_IMAGE_HEADER_LEN];
+  pthread_mutex_lock(&flash_lock);
+  host_flash_io(partitions[index].address, header, sizeof(header), false);
+  pthread_mutex_unlock(&flash_lock);
+
+  size_t len = (size_t)header[4] | (size_t)header[5] << 8 | (size_t)header[6] << 16 | (size_t)header[7] << 24;
+  *hash_appended = header[HOST_IMAGE_HASH_APPENDED] == 1;
+  size_t min_len = HOST_IMAGE_HEADER_LEN + (*hash_appended ? HOST_IMAGE_DIGEST_LEN : 0);
+  if (header[0] != ESP_IMAGE_HEADER_MAGIC || len < min_len || len > partitions[index].size)
+  {
+    return 0;
+  }
+  return len;
+}
+
+// As esp_image_verify, an image with a digest appended must match it
+static esp_err_t host_image_digest(int index, uint8_t *digest)
+{
+  bool hash_appended;
+  size_t len = host_image_len(index, &hash_appended);
+  if (len == 0)
+  {
+    return ESP_ERR_IMAGE_INVALID;
+  }
+
+  uint8_t *image = (uint8_t *)malloc(len);
+  host_flash_read(&partitions[index], 0, image, len);
+  size_t hashed_len = hash_appended ? len - HOST_IMAGE_DIGEST_LEN : len;
+  mbedtls_sha256_ret(image, hashed_len, digest, 0);
+  bool matches = !hash_appended || memcmp(digest, image + hashed_len, HOST_IMAGE_DIGEST_LEN) == 0;
+  free(image);
+  return matches ? ESP_OK : ESP_ERR_IMAGE_INVALID;
+}
+
+void host_flash_image_header(void *image, size_t image_len)
+{
+  uint8_t *header = (uint8_t *)image;
+  header[0] = ESP_IMAGE_HEADER_MAGIC;
+  header[4] = image_len & 0xff;
+  header[5] = (image_len >> 8) & 0xff;
+  header[6] = (image_len >> 16) & 0xff;
+  header[7] = (image_len >> 24) & 0xff;
+  header[HOST_IMAGE_HASH_APPENDED] = 1;
+  mbedtls_sha256_ret(header, image_len - HOST_IMAGE_DIGEST_LEN, header + image_len - HOST_IMAGE_DIGEST_LEN, 0);
+}
+
+void host_flash_reset()
+{
+  host_flash_latency(0, 0);
+  host_flash_erase(partitions[0].address, HOST_FLASH_PARTITIONS * HOST_FLASH_PARTITION_SIZE);
+  pthread_mutex_lock(&flash_lock);
+  memset(&stats, 0, sizeof(stats));
+  memset(otas, 0, sizeof(otas));
+  fail_after = 0;
+  fail_error = ESP_OK;
+  running = 0;
+  boot = 0;
+  states[0] = ESP_OTA_IMG_VALID;
+  states[1] = ESP_OTA_IMG_UNDEFINED;
+  rolled_back = false;
+  pthread_mutex_unlock(&flash_lock);
+}
+
+void host_flash_latency(uint32_t write_us, uint32_t erase_us)
+{
+  __atomic_store_n(&write_latency_us, write_us, __ATOMIC_RELEASE);
+  __atomic_store_n(&erase_latency_us, erase_us, __ATOMIC_RELEASE);
+}
+
+void host_flash_fail_after(uint32_t writes, esp_err_t error)
+{
+  pthread_mutex_lock(&flash_lock);
+  fail_after = writes;
+  fail_error = error;
+  pthread_mutex_unlock(&flash_lock);
+}
+
+void host_flash_stats(host_flash_stats_t *output)
+{
+  pthread_mutex_lock(&flash_lock);
+  memcpy(output, &stats, sizeof(stats));
+  pthread_mutex_unlock(&flash_lock);
+}
+
+const esp_partition_t *host_flash_partition(int index)
+{
+  return index >= 0 && index < HOST_FLASH_PARTITIONS ? &partitions[index] : NULL;
+}
+
+void host_flash_load(const esp_partition_t *partition, const void *image, size_t image_len)
+{
+  int index = host_partition_index(partition);
+  assert(index >= 0 && image_len <= HOST_FLASH_PARTITION_SIZE);
+  pthread_mutex_lock(&flash_lock);
+  uint8_t *erased = (uint8_t *)malloc(HOST_FLASH_PARTITION_SIZE);
+  memset(erased, 0xff, HOST_FLASH_PARTITION_SIZE);
+  memcpy(erased, image, image_len);
+  host_flash_io(partitions[index].address, erased, HOST_FLASH_PARTITION_SIZE, true);
+  free(erased);
+  pthread_mutex_unlock(&flash_lock);
+}
+
+void host_flash_read(const esp_partition_t *partition, size_t offset, void *output, size_t len)
+{
+  int index = host_partition_index(partition);
+  assert(index >= 0 && offset + len <= HOST_FLASH_PARTITION_SIZE);
+  pthread_mutex_lock(&flash_lock);
+  host_flash_io(partitions[index].address + offset, output, len, false);
+  pthread_mutex_unlock(&flash_lock);
+}
+
+// With rollback enabled, a new image has to be confirmed after its first boot
+void host_flash_reboot()
+{
+  pthread_mutex_lock(&flash_lock);
+  running = boot;
+  if (states[running] == ESP_OTA_IMG_NEW)
+  {
+    states[running] = ESP_OTA_IMG_PENDING_VERIFY;
+  }
+  pthread_mutex_unlock(&flash_lock);
+}
+
+bool host_flash_rolled_back()
+{
+  pthread_mutex_lock(&flash_lock);
+  bool result = rolled_back;
+  pthread_mutex_unlock(&flash_lock);
+  return result;
+}
+
+esp_partition_iterator_t esp_partition_find(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+  esp_partition_iterator_t iterator = (esp_partition_iterator_t)calloc(1, sizeof(struct esp_partition_iterator_opaque_));
+  iterator->index = -1;
+  iterator->type = type;
+  iterator->subtype = subtype;
+  iterator->label = label;
+  return esp_partition_next(iterator);
+}
+
+const esp_partition_t *esp_partition_get(esp_partition_iterator_t iterator)
+{
+  return &partitions[iterator->index];
+}
+
+// As in ESP-IDF, the iterator is released once there are no more partitions
+esp_partition_iterator_t esp_partition_next(esp_partition_iterator_t iterator)
+{
+  for (int i = iterator->index + 1; i < HOST_FLASH_PARTITIONS; i++)
+  {
+    const esp_partition_t *partition = &partitions[i];
+    if (partition->type == iterator->type && (iterator->subtype == ESP_PARTITION_SUBTYPE_ANY || partition->subtype == iterator->subtype) && (iterator->label == NULL || strcmp(partition->label, iterator->label) == 0))
+    {
+      iterator->index = i;
+      return iterator;
+    }
+  }
+  free(iterator);
+  return NULL;
+}
+
+void esp_partition_iterator_release(esp_partition_iterator_t iterator)
+{
+  free(iterator);
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+  int index = host_partition_index(partition);
+  if (index < 0 || dst == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (src_offset > partition->size || size > partition->size - src_offset)
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  pthread_mutex_lock(&flash_lock);
+  host_flash_io(partitions[index].address + src_offset, dst, size, false);
+  pthread_mutex_unlock(&flash_lock);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+  int index = host_partition_index(partition);
+  if (index < 0 || src == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (dst_offset > partition->size || size > partition->size - dst_offset)
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  return host_flash_write(partitions[index].address + dst_offset, src, size);
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+  int index = host_partition_index(partition);
+  if (index < 0 || offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (offset > partition->size || size > partition->size - offset)
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  host_flash_erase(partitions[index].address + offset, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_get_sha256(const esp_partition_t *partition, uint8_t *sha_256)
+{
+  int index = host_partition_index(partition);
+  if (index < 0 || sha_256 == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  return host_image_digest(index, sha_256);
+}
+
+static host_ota_t *host_ota_find(esp_ota_handle_t handle)
+{
+  for (int i = 0; i < HOST_OTA_HANDLES; i++)
+  {
+    if (handle != 0 && otas[i].handle == handle)
+    {
+      return &otas[i];
+    }
+  }
+  return NULL;
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t image_size, esp_ota_handle_t *out_handle)
+{
+  if (partition == NULL || out_handle == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  int index = host_partition_index(partition);
+  if (index < 0)
+  {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  pthread_mutex_lock(&flash_lock);
+  bool conflict = index == running;
+  host_ota_t *ota = NULL;
+  for (int i = 0; i < HOST_OTA_HANDLES && ota == NULL; i++)
+  {
+    ota = otas[i].handle == 0 ? &otas[i] : NULL;
+  }
+  pthread_mutex_unlock(&flash_lock);
+  if (conflict)
+  {
+    return ESP_ERR_OTA_PARTITION_CONFLICT;
+  }
+  if (ota == NULL)
+  {
+    return ESP_ERR_NO_MEM;
+  }
+  if (image_size != OTA_SIZE_UNKNOWN && image_size != OTA_WITH_SEQUENTIAL_WRITES && image_size > partition->size)
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  // Only as much as the image needs is erased when its size is known
+  size_t erase_size = 0;
+  if (image_size == OTA_SIZE_UNKNOWN)
+  {
+    erase_size = partition->size;
+  }
+  else if (image_size != OTA_WITH_SEQUENTIAL_WRITES)
+  {
+    erase_size = (image_size + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+  }
+  host_flash_erase(partitions[index].address, erase_size);
+
+  pthread_mutex_lock(&flash_lock);
+  memset(ota, 0, sizeof(host_ota_t));
+  ota->handle = next_handle++;
+  ota->partition = index;
+  ota->erased_to = erase_size;
+  ota->sequential_erase = image_size == OTA_WITH_SEQUENTIAL_WRITES;
+  states[index] = ESP_OTA_IMG_UNDEFINED;
+  stats.ota_begins++;
+  *out_handle = ota->handle;
+  pthread_mutex_unlock(&flash_lock);
+  return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t size)
+{
+  if (data == NULL || size == 0)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  pthread_mutex_lock(&flash_lock);
+  host_ota_t *ota = host_ota_find(handle);
+  host_ota_t copy;
+  if (ota != NULL)
+  {
+    copy = *ota;
+  }
+  pthread_mutex_unlock(&flash_lock);
+  if (ota == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  const esp_partition_t *partition = &partitions[copy.partition];
+  if (copy.wrote_size == 0 && ((const uint8_t *)data)[0] != ESP_IMAGE_HEADER_MAGIC)
+  {
+    return ESP_ERR_OTA_VALIDATE_FAILED;
+  }
+  if (size > partition->size - copy.wrote_size)
+  {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  while (copy.sequential_erase && copy.erased_to < copy.wrote_size + size)
+  {
+    host_flash_erase(partition->address + copy.erased_to, SPI_FLASH_SEC_SIZE);
+    copy.erased_to += SPI_FLASH_SEC_SIZE;
+  }
+
+  esp_err_t result = host_flash_write(partition->address + copy.wrote_size, data, size);
+  if (result == ESP_OK)
+  {
+    copy.wrote_size += size;
+  }
+
+  pthread_mutex_lock(&flash_lock);
+  ota->wrote_size = copy.wrote_size;
+  ota->erased_to = copy.erased_to;
+  pthread_mutex_unlock(&flash_lock);
+  return result;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+  pthread_mutex_lock(&flash_lock);
+  host_ota_t *ota = host_ota_find(handle);
+  host_ota_t copy;
+  if (ota != NULL)
+  {
+    copy = *ota;
+    memset(ota, 0, sizeof(host_ota_t));
+    stats.ota_ends++;
+  }
+  pthread_mutex_unlock(&flash_lock);
+  if (ota == NULL)
+  {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  bool hash_appended;
+  uint8_t digest[HOST_IMAGE_DIGEST_LEN];
+  size_t len = host_image_len(copy.partition, &hash_appended);
+  if (copy.wrote_size == 0 || len == 0 || len > copy.wrote_size || host_image_digest(copy.partition, digest) != ESP_OK)
+  {
+    return ESP_ERR_OTA_VALIDATE_FAILED;
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle)
+{
+  pthread_mutex_lock(&flash_lock);
+  host_ota_t *ota = host_ota_find(handle);
+  if (ota != NULL)
+  {
+    memset(ota, 0, sizeof(host_ota_t));
+    stats.ota_aborts++;
+  }
+  pthread_mutex_unlock(&flash_lock);
+  return ota != NULL ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+  if (partition == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  int index = host_partition_index(partition);
+  if (index < 0)
+  {
+    return ESP_ERR_NOT_FOUND;
+  }
+  uint8_t digest[HOST_IMAGE_DIGEST_LEN];
+  if (host_image_digest(index, digest) != ESP_OK)
+  {
+    return ESP_ERR_OTA_VALIDATE_FAILED;
+  }
+
+  pthread_mutex_lock(&flash_lock);
+  boot = index;
+  if (index != running)
+  {
+    states[index] = ESP_OTA_IMG_NEW;
+  }
+  pthread_mutex_unlock(&flash_lock);
+  return ESP_OK;
+}
+
+const esp_partition_t *esp_ota_get_boot_partition(void)
+{
+  pthread_mutex_lock(&flash_lock);
+  const esp_partition_t *partition = &partitions[boot];
+  pthread_mutex_unlock(&flash_lock);
+  return partition;
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+  pthread_mutex_lock(&flash_lock);
+  const esp_partition_t *partition = &partitions[running];
+  pthread_mutex_unlock(&flash_lock);
+  return partition;
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from)
+{
+  int index = start_from != NULL ? host_partition_index(start_from) : -1;
+  pthread_mutex_lock(&flash_lock);
+  if (index < 0)
+  {
+    index = running;
+  }
+  pthread_mutex_unlock(&flash_lock);
+  return &partitions[(index + 1) % HOST_FLASH_PARTITIONS];
+}
+
+esp_err_t esp_ota_get_state_partition(const esp_partition_t *partition, esp_ota_img_states_t *ota_state)
+{
+  if (partition == NULL || ota_state == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  int index = host_partition_index(partition);
+  if (index < 0)
+  {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  pthread_mutex_lock(&flash_lock);
+  *ota_state = states[index];
+  pthread_mutex_unlock(&flash_lock);
+  return *ota_state == ESP_OTA_IMG_UNDEFINED ? ESP_ERR_NOT_FOUND : ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void)
+{
+  pthread_mutex_lock(&flash_lock);
+  states[running] = ESP_OTA_IMG_VALID;
+  pthread_mutex_unlock(&flash_lock);
+  return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void)
+{
+  pthread_mutex_lock(&flash_lock);
+  int other = (running + 1) % HOST_FLASH_PARTITIONS;
+  esp_err_t result = ESP_ERR_OTA_ROLLBACK_FAILED;
+  if (states[other] == ESP_OTA_IMG_VALID)
+  {
+    states[running] = ESP_OTA_IMG_INVALID;
+    running = other;
+    boot = other;
+    rolled_back = true;
+    result = ESP_OK;
+  }
+  pthread_mutex_unlock(&flash_lock);
+  return result;
+}
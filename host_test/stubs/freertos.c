@@ -0,0 +1,544 @@
+#include "freertos/FreeRTOS.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "host_internal.h"
+#include "host_stubs.h"
+
+// Host code needs far more stack than the same code on an ESP32, so tasks get
+// a large stack of their own and only how much of it they use is reported
+#define HOST_TASK_STACK_SIZE (1024 * 1024)
+#define HOST_STACK_PAINT 0xa5
+// Left unpainted below the frame that paints, for the calls it makes
+#define HOST_STACK_MARGIN 1024
+// How often a task waiting on virtual time looks at the clock, should it miss being woken
+#define HOST_VIRTUAL_POLL_US 1000
+
+struct host_task
+{
+  TaskFunction_t function;
+  void *parameters;
+  uint32_t stack_depth;
+  uint8_t *stack_low;
+  uint8_t *stack_start;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint32_t notified;
+  // Under clock_lock, while the task waits with virtual time
+  bool blocked;
+  uint64_t wake_at;
+  pthread_cond_t *waiting_on;
+  struct host_task *next_blocked;
+};
+
+struct host_semaphore
+{
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  UBaseType_t count;
+  UBaseType_t max;
+  bool is_static;
+};
+
+typedef struct
+{
+  TickType_t ticks;
+  struct timespec deadline;
+  uint64_t wake_at;
+} host_wait_t;
+
+_Static_assert(sizeof(struct host_semaphore) <= sizeof(StaticSemaphore_t), "StaticSemaphore_t is too small for the host semaphore");
+
+static __thread struct host_task *current_task;
+static uint32_t running_tasks;
+
+static pthread_mutex_t clock_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t tick_base;
+static int64_t real_base_us;
+static bool virtual_time;
+// Tasks waiting on the virtual clock, see host_clock_advance_locked
+static struct host_task *blocked_tasks;
+
+static int64_t host_monotonic_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint64_t host_ticks_locked()
+{
+  if (virtual_time)
+  {
+    return tick_base;
+  }
+  int64_t now_us = host_monotonic_us();
+  if (real_base_us == 0)
+  {
+    real_base_us = now_us;
+  }
+  return tick_base + (uint64_t)(now_us - real_base_us) * configTICK_RATE_HZ / 1000000;
+}
+
+static uint64_t host_ticks()
+{
+  pthread_mutex_lock(&clock_lock);
+  uint64_t ticks = host_ticks_locked();
+  pthread_mutex_unlock(&clock_lock);
+  return ticks;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+  return (TickType_t)host_ticks();
+}
+
+static void host_unblock_locked(struct host_task *task)
+{
+  if (!task->blocked)
+  {
+    return;
+  }
+  struct host_task **link = &blocked_tasks;
+  while (*link != task)
+  {
+    link = &(*link)->next_blocked;
+  }
+  *link = task->next_blocked;
+  task->blocked = false;
+}
+
+// Virtual time stands still while any task, the test's own thread included,
+// has something to do. Once every one of them waits, it jumps to the first
+// deadline and wakes whoever was waiting for it.
+static void host_clock_advance_locked()
+{
+  uint32_t blocked = 0;
+  uint64_t wake_at = UINT64_MAX;
+  for (struct host_task *task = blocked_tasks; task != NULL; task = task->next_blocked)
+  {
+    blocked++;
+    wake_at = task->wake_at < wake_at ? task->wake_at : wake_at;
+  }
+  if (blocked < __atomic_load_n(&running_tasks, __ATOMIC_ACQUIRE) + 1 || wake_at == UINT64_MAX)
+  {
+    return;
+  }
+
+  tick_base = wake_at > tick_base ? wake_at : tick_base;
+  struct host_task *task = blocked_tasks;
+  while (task != NULL)
+  {
+    struct host_task *next = task->next_blocked;
+    if (task->wake_at <= tick_base)
+    {
+      host_unblock_locked(task);
+      // Without the waiter's lock this wake can be missed, which its next poll makes up for
+      pthread_cond_broadcast(task->waiting_on);
+    }
+    task = next;
+  }
+}
+
+static void host_block_locked(struct host_task *task, pthread_cond_t *cond, uint64_t wake_at)
+{
+  task->waiting_on = cond;
+  task->wake_at = wake_at;
+  if (!task->blocked)
+  {
+    task->blocked = true;
+    task->next_blocked = blocked_tasks;
+    blocked_tasks = task;
+  }
+  host_clock_advance_locked();
+}
+
+// The first task waiting on cond has what it waited for, so it counts as running again
+static void host_wake_waiter(pthread_cond_t *cond)
+{
+  pthread_mutex_lock(&clock_lock);
+  for (struct host_task *task = blocked_tasks; task != NULL; task = task->next_blocked)
+  {
+    if (task->waiting_on == cond)
+    {
+      host_unblock_locked(task);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&clock_lock);
+}
+
+void host_freertos_virtual_time(bool enabled)
+{
+  pthread_mutex_lock(&clock_lock);
+  tick_base = host_ticks_locked();
+  real_base_us = host_monotonic_us();
+  virtual_time = enabled;
+  pthread_mutex_unlock(&clock_lock);
+}
+
+uint32_t host_freertos_running_tasks()
+{
+  return __atomic_load_n(&running_tasks, __ATOMIC_ACQUIRE);
+}
+
+static struct timespec host_deadline_us(int64_t us)
+{
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  int64_t ns = deadline.tv_nsec + us * 1000;
+  deadline.tv_sec += ns / 1000000000;
+  deadline.tv_nsec = ns % 1000000000;
+  return deadline;
+}
+
+static void host_cond_init(pthread_cond_t *cond)
+{
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(cond, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+static void host_wait_begin(host_wait_t *wait, TickType_t ticks)
+{
+  wait->ticks = ticks;
+  wait->deadline = host_deadline_us((int64_t)ticks * (1000000 / configTICK_RATE_HZ));
+  wait->wake_at = ticks == portMAX_DELAY ? UINT64_MAX : host_ticks() + ticks;
+}
+
+// Waits on cond until woken, the deadline or forever with portMAX_DELAY.
+// Returns false once the wait has timed out. With virtual time, the wait is
+// polled, and the task counts as waiting until host_wait_end.
+static bool host_cond_wait(struct host_task *task, pthread_cond_t *cond, pthread_mutex_t *lock, const host_wait_t *wait)
+{
+  if (wait->ticks == 0)
+  {
+    return false;
+  }
+
+  pthread_mutex_lock(&clock_lock);
+  bool is_virtual = virtual_time;
+  bool waiting = is_virtual && tick_base < wait->wake_at;
+  if (waiting)
+  {
+    host_block_locked(task, cond, wait->wake_at);
+  }
+  pthread_mutex_unlock(&clock_lock);
+  if (is_virtual)
+  {
+    if (waiting)
+    {
+      struct timespec poll = host_deadline_us(HOST_VIRTUAL_POLL_US);
+      pthread_cond_timedwait(cond, lock, &poll);
+    }
+    return waiting;
+  }
+
+  if (wait->ticks == portMAX_DELAY)
+  {
+    pthread_cond_wait(cond, lock);
+    return true;
+  }
+  return pthread_cond_timedwait(cond, lock, &wait->deadline) != ETIMEDOUT;
+}
+
+static void host_wait_end(struct host_task *task)
+{
+  pthread_mutex_lock(&clock_lock);
+  host_unblock_locked(task);
+  pthread_mutex_unlock(&clock_lock);
+}
+
+void host_freertos_sleep_us(uint32_t us)
+{
+  pthread_mutex_lock(&clock_lock);
+  bool is_virtual = virtual_time;
+  pthread_mutex_unlock(&clock_lock);
+  if (is_virtual)
+  {
+    vTaskDelay((TickType_t)((us * (uint64_t)configTICK_RATE_HZ + 999999) / 1000000));
+  }
+  else if (us > 0)
+  {
+    usleep(us);
+  }
+}
+
+static struct host_task *host_task_new(TaskFunction_t function, void *parameters, uint32_t stack_depth)
+{
+  struct host_task *task = (struct host_task *)calloc(1, sizeof(struct host_task));
+  if (task == NULL)
+  {
+    return NULL;
+  }
+  task->function = function;
+  task->parameters = parameters;
+  task->stack_depth = stack_depth;
+  pthread_mutex_init(&task->lock, NULL);
+  host_cond_init(&task->cond);
+  return task;
+}
+
+// Threads that weren't started with xTaskCreate, like main, get a task too
+static struct host_task *host_current_task()
+{
+  if (current_task == NULL)
+  {
+    current_task = host_task_new(NULL, NULL, 0);
+  }
+  return current_task;
+}
+
+// Fill the unused stack below this frame, so the high-water mark can be found later
+__attribute__((noinline)) static void host_task_paint(struct host_task *task)
+{
+  pthread_attr_t attr;
+  void *stack_addr;
+  size_t stack_size;
+
+  if (pthread_getattr_np(pthread_self(), &attr) != 0)
+  {
+    return;
+  }
+  pthread_attr_getstack(&attr, &stack_addr, &stack_size);
+  pthread_attr_destroy(&attr);
+
+  uint8_t *start = (uint8_t *)__builtin_frame_address(0);
+  uint8_t *low = (uint8_t *)stack_addr + getpagesize();
+  if (start - HOST_STACK_MARGIN <= low)
+  {
+    return;
+  }
+  memset(low, HOST_STACK_PAINT, start - HOST_STACK_MARGIN - low);
+  task->stack_low = low;
+  task->stack_start = start;
+}
+
+static void *host_task_run(void *arguments)
+{
+  struct host_task *task = (struct host_task *)arguments;
+  current_task = task;
+  host_task_paint(task);
+  task->function(task->parameters);
+
+  fprintf(stderr, "A task returned instead of calling vTaskDelete(NULL)\n");
+  abort();
+}
+
+BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char *const pcName, const configSTACK_DEPTH_TYPE usStackDepth, void *const pvParameters, UBaseType_t uxPriority, TaskHandle_t *const pvCreatedTask)
+{
+  struct host_task *task = host_task_new(pvTaskCode, pvParameters, usStackDepth);
+  if (task == NULL)
+  {
+    return pdFAIL;
+  }
+
+  pthread_t thread;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, HOST_TASK_STACK_SIZE);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if (pvCreatedTask != NULL)
+  {
+    *pvCreatedTask = task;
+  }
+  __atomic_add_fetch(&running_tasks, 1, __ATOMIC_ACQ_REL);
+  int result = pthread_create(&thread, &attr, host_task_run, task);
+  pthread_attr_destroy(&attr);
+  if (result != 0)
+  {
+    __atomic_sub_fetch(&running_tasks, 1, __ATOMIC_ACQ_REL);
+    if (pvCreatedTask != NULL)
+    {
+      *pvCreatedTask = NULL;
+    }
+    free(task);
+    return pdFAIL;
+  }
+  return pdPASS;
+}
+
+// The task itself is never freed, as another task may still notify it
+void vTaskDelete(TaskHandle_t xTaskToDelete)
+{
+  if (xTaskToDelete != NULL && xTaskToDelete != current_task)
+  {
+    fprintf(stderr, "vTaskDelete can only delete the calling task on the host\n");
+    abort();
+  }
+  pthread_mutex_lock(&clock_lock);
+  __atomic_sub_fetch(&running_tasks, 1, __ATOMIC_ACQ_REL);
+  // The tasks left may all be waiting
+  if (virtual_time)
+  {
+    host_clock_advance_locked();
+  }
+  pthread_mutex_unlock(&clock_lock);
+  pthread_exit(NULL);
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+  if (xTicksToDelay == 0)
+  {
+    sched_yield();
+    return;
+  }
+  struct host_task *task = host_current_task();
+  host_wait_t wait;
+  host_wait_begin(&wait, xTicksToDelay);
+
+  pthread_mutex_lock(&task->lock);
+  while (host_cond_wait(task, &task->cond, &task->lock, &wait))
+  {
+  }
+  pthread_mutex_unlock(&task->lock);
+  host_wait_end(task);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+  return host_current_task();
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask)
+{
+  struct host_task *task = xTask != NULL ? xTask : current_task;
+  if (task == NULL || task->stack_low == NULL)
+  {
+    return 0;
+  }
+
+  uint8_t *touched = task->stack_low;
+  uint8_t *painted_to = task->stack_start - HOST_STACK_MARGIN;
+  while (touched < painted_to && *touched == HOST_STACK_PAINT)
+  {
+    touched++;
+  }
+  size_t used = task->stack_start - touched;
+  return used < task->stack_depth ? task->stack_depth - used : 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify)
+{
+  pthread_mutex_lock(&xTaskToNotify->lock);
+  xTaskToNotify->notified++;
+  host_wake_waiter(&xTaskToNotify->cond);
+  pthread_cond_signal(&xTaskToNotify->cond);
+  pthread_mutex_unlock(&xTaskToNotify->lock);
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+  struct host_task *task = host_current_task();
+  host_wait_t wait;
+  host_wait_begin(&wait, xTicksToWait);
+
+  pthread_mutex_lock(&task->lock);
+  while (task->notified == 0 && host_cond_wait(task, &task->cond, &task->lock, &wait))
+  {
+  }
+  uint32_t value = task->notified;
+  if (value > 0)
+  {
+    task->notified = xClearCountOnExit ? 0 : value - 1;
+  }
+  pthread_mutex_unlock(&task->lock);
+  host_wait_end(task);
+  return value;
+}
+
+static void host_semaphore_init(struct host_semaphore *semaphore, UBaseType_t max, UBaseType_t initial, bool is_static)
+{
+  pthread_mutex_init(&semaphore->lock, NULL);
+  host_cond_init(&semaphore->cond);
+  semaphore->count = initial;
+  semaphore->max = max;
+  semaphore->is_static = is_static;
+}
+
+static SemaphoreHandle_t host_semaphore_new(UBaseType_t max, UBaseType_t initial)
+{
+  struct host_semaphore *semaphore = (struct host_semaphore *)calloc(1, sizeof(struct host_semaphore));
+  if (semaphore != NULL)
+  {
+    host_semaphore_init(semaphore, max, initial, false);
+  }
+  return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+  return host_semaphore_new(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+  return host_semaphore_new(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *pxSemaphoreBuffer)
+{
+  struct host_semaphore *semaphore = (struct host_semaphore *)pxSemaphoreBuffer;
+  host_semaphore_init(semaphore, 1, 0, true);
+  return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t uxMaxCount, UBaseType_t uxInitialCount)
+{
+  return host_semaphore_new(uxMaxCount, uxInitialCount);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime)
+{
+  struct host_task *task = host_current_task();
+  host_wait_t wait;
+  host_wait_begin(&wait, xBlockTime);
+
+  pthread_mutex_lock(&xSemaphore->lock);
+  while (xSemaphore->count == 0 && host_cond_wait(task, &xSemaphore->cond, &xSemaphore->lock, &wait))
+  {
+  }
+  bool taken = xSemaphore->count > 0;
+  if (taken)
+  {
+    xSemaphore->count--;
+  }
+  pthread_mutex_unlock(&xSemaphore->lock);
+  host_wait_end(task);
+  return taken ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore)
+{
+  pthread_mutex_lock(&xSemaphore->lock);
+  bool given = xSemaphore->count < xSemaphore->max;
+  if (given)
+  {
+    xSemaphore->count++;
+    host_wake_waiter(&xSemaphore->cond);
+    pthread_cond_signal(&xSemaphore->cond);
+  }
+  pthread_mutex_unlock(&xSemaphore->lock);
+  return given ? pdTRUE : pdFALSE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t xSemaphore)
+{
+  pthread_cond_destroy(&xSemaphore->cond);
+  pthread_mutex_destroy(&xSemaphore->lock);
+  if (!xSemaphore->is_static)
+  {
+    free(xSemaphore);
+  }
+}
@@ -0,0 +1,19 @@
+#ifndef _HOST_INTERNAL_h
+#define _HOST_INTERNAL_h
+// Shared between the stand-ins, not for tests
+#include <stdbool.h>
+#include <stdint.h>
+#include "host_stubs.h"
+
+void host_flash_reset();
+void host_nvs_reset();
+void host_http_reset();
+void host_httpd_reset();
+void host_mdns_reset();
+void host_system_reset();
+
+// Sleeps in real or virtual time, whichever the ticks count
+void host_freertos_sleep_us(uint32_t us);
+// Answers a request with the server listening on port, false when there is none
+bool host_httpd_handle(uint16_t port, const host_http_request_t *request, host_http_response_t *response);
+#endif
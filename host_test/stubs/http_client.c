@@ -0,0 +1,464 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include "esp_http_client.h"
+#include "host_internal.h"
+
+// Behaves as the ESP-IDF 4.3 client does when things go wrong:
+//  - a body cut short, by a drop or a read timeout, still finishes the request,
+//    closes the connection and returns ESP_OK
+//  - a kept-alive connection the server has closed fails with
+//    ESP_ERR_HTTP_FETCH_HEADER once the request is sent, and stays open until
+//    esp_http_client_close
+//  - closing the connection from an event handler stops the body there
+
+#define HOST_HTTP_ROUTES 16
+#define HOST_HTTP_URL_LEN 512
+#define HOST_HTTP_DEFAULT_TIMEOUT_MS 5000
+
+typedef struct
+{
+  char prefix[HOST_HTTP_URL_LEN];
+  host_http_handler_t handler;
+  void *user_data;
+} host_http_route_t;
+
+struct esp_http_client
+{
+  char url[HOST_HTTP_URL_LEN];
+  esp_http_client_method_t method;
+  host_http_header_t headers[HOST_HTTP_HEADERS];
+  size_t header_count;
+  http_event_handle_cb event_handler;
+  void *user_data;
+  int timeout_ms;
+  bool connected;
+  char origin[HOST_HTTP_URL_LEN];
+  uint32_t generation;
+  uint32_t connection_requests;
+  int status;
+  int content_length;
+};
+
+static pthread_mutex_t http_lock = PTHREAD_MUTEX_INITIALIZER;
+static host_http_route_t routes[HOST_HTTP_ROUTES];
+static host_http_stats_t stats;
+static uint32_t generation;
+
+void host_http_reset()
+{
+  pthread_mutex_lock(&http_lock);
+  memset(routes, 0, sizeof(routes));
+  memset(&stats, 0, sizeof(stats));
+  generation++;
+  pthread_mutex_unlock(&http_lock);
+}
+
+void host_http_route(const char *prefix, host_http_handler_t handler, void *user_data)
+{
+  pthread_mutex_lock(&http_lock);
+  for (int i = 0; i < HOST_HTTP_ROUTES; i++)
+  {
+    if (routes[i].handler == NULL || strcmp(routes[i].prefix, prefix) == 0)
+    {
+      strncpy(routes[i].prefix, prefix, HOST_HTTP_URL_LEN - 1);
+      routes[i].handler = handler;
+      routes[i].user_data = user_data;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&http_lock);
+}
+
+void host_http_stats(host_http_stats_t *out)
+{
+  pthread_mutex_lock(&http_lock);
+  *out = stats;
+  pthread_mutex_unlock(&http_lock);
+}
+
+void host_http_drop_connections()
+{
+  pthread_mutex_lock(&http_lock);
+  generation++;
+  pthread_mutex_unlock(&http_lock);
+}
+
+const char *host_http_header(const host_http_request_t *request, const char *key)
+{
+  for (size_t i = 0; i < request->header_count; i++)
+  {
+    if (strcasecmp(request->headers[i].key, key) == 0)
+    {
+      return request->headers[i].value;
+    }
+  }
+  return NULL;
+}
+
+void host_http_set_header(host_http_response_t *response, const char *key, const char *value)
+{
+  size_t i = 0;
+  while (i < response->header_count && strcasecmp(response->headers[i].key, key) != 0)
+  {
+    i++;
+  }
+  if (i == HOST_HTTP_HEADERS)
+  {
+    return;
+  }
+  strncpy(response->headers[i].key, key, HOST_HTTP_KEY_LEN - 1);
+  strncpy(response->headers[i].value, value, HOST_HTTP_VALUE_LEN - 1);
+  response->headers[i].value[HOST_HTTP_VALUE_LEN - 1] = '\0';
+  if (i == response->header_count)
+  {
+    response->header_count++;
+  }
+}
+
+void host_http_replay(const host_http_request_t *request, host_http_response_t *response, void *user_data)
+{
+  const host_http_recording_t *recording = (const host_http_recording_t *)user_data;
+  response->status = recording->status;
+  for (int i = 0; i < HOST_HTTP_HEADERS && recording->headers[i][0] != NULL; i++)
+  {
+    host_http_set_header(response, recording->headers[i][0], recording->headers[i][1]);
+  }
+  response->body = (const uint8_t *)recording->body;
+  response->body_len = recording->body_len;
+  for (int i = 0; i < HOST_HTTP_CHUNKS && recording->chunks[i] > 0; i++)
+  {
+    response->chunks[response->chunk_count++] = recording->chunks[i];
+  }
+}
+
+// scheme://host[:port] of a URL, and where its path starts
+static const char *host_http_split(const char *url, char *origin)
+{
+  const char *host = strstr(url, "://");
+  host = host != NULL ? host + 3 : url;
+  const char *path = strchr(host, '/');
+  if (path == NULL)
+  {
+    path = host + strlen(host);
+  }
+  if (origin != NULL)
+  {
+    size_t len = path - url < HOST_HTTP_URL_LEN ? path - url : HOST_HTTP_URL_LEN - 1;
+    memcpy(origin, url, len);
+    origin[len] = '\0';
+  }
+  return path;
+}
+
+static uint16_t host_http_port(const char *url)
+{
+  char origin[HOST_HTTP_URL_LEN];
+  host_http_split(url, origin);
+  const char *host = strstr(origin, "://");
+  host = host != NULL ? host + 3 : origin;
+  const char *port = strrchr(host, ':');
+  if (port != NULL)
+  {
+    return (uint16_t)atoi(port + 1);
+  }
+  return strncmp(url, "https", 5) == 0 ? 443 : 80;
+}
+
+static esp_err_t host_http_dispatch(esp_http_client_handle_t client, esp_http_client_event_id_t event_id, void *data, int data_len, char *key, char *value)
+{
+  if (client->event_handler == NULL)
+  {
+    return ESP_OK;
+  }
+  esp_http_client_event_t evt = {
+      .event_id = event_id,
+      .client = client,
+      .data = data,
+      .data_len = data_len,
+      .user_data = client->user_data,
+      .header_key = key,
+      .header_value = value};
+  return client->event_handler(&evt);
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+  if (config == NULL || config->url == NULL || strlen(config->url) >= HOST_HTTP_URL_LEN)
+  {
+    return NULL;
+  }
+  esp_http_client_handle_t client = calloc(1, sizeof(struct esp_http_client));
+  if (client == NULL)
+  {
+    return NULL;
+  }
+  strcpy(client->url, config->url);
+  client->method = config->method;
+  client->event_handler = config->event_handler;
+  client->user_data = config->user_data;
+  client->timeout_ms = config->timeout_ms > 0 ? config->timeout_ms : HOST_HTTP_DEFAULT_TIMEOUT_MS;
+  client->content_length = -1;
+  return client;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url)
+{
+  if (client == NULL || url == NULL || strlen(url) >= HOST_HTTP_URL_LEN)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  char origin[HOST_HTTP_URL_LEN];
+  host_http_split(url, origin);
+  // A different server needs a different connection
+  if (client->connected && strcmp(origin, client->origin) != 0)
+  {
+    esp_http_client_close(client);
+  }
+  strcpy(client->url, url);
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method)
+{
+  client->method = method;
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+  size_t i = 0;
+  while (i < client->header_count && strcasecmp(client->headers[i].key, key) != 0)
+  {
+    i++;
+  }
+  if (i == HOST_HTTP_HEADERS || strlen(key) >= HOST_HTTP_KEY_LEN || strlen(value) >= HOST_HTTP_VALUE_LEN)
+  {
+    return ESP_ERR_NO_MEM;
+  }
+  strcpy(client->headers[i].key, key);
+  strcpy(client->headers[i].value, value);
+  if (i == client->header_count)
+  {
+    client->header_count++;
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_get_header(esp_http_client_handle_t client, const char *key, char **value)
+{
+  *value = NULL;
+  for (size_t i = 0; i < client->header_count; i++)
+  {
+    if (strcasecmp(client->headers[i].key, key) == 0)
+    {
+      *value = client->headers[i].value;
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char *key)
+{
+  for (size_t i = 0; i < client->header_count; i++)
+  {
+    if (strcasecmp(client->headers[i].key, key) == 0)
+    {
+      memmove(&client->headers[i], &client->headers[i + 1], (client->header_count - i - 1) * sizeof(host_http_header_t));
+      client->header_count--;
+      return ESP_OK;
+    }
+  }
+  return ESP_ERR_NOT_FOUND;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+  return client->status;
+}
+
+int esp_http_client_get_content_length(esp_http_client_handle_t client)
+{
+  return client->content_length;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+  if (client->connected)
+  {
+    client->connected = false;
+    host_http_dispatch(client, HTTP_EVENT_DISCONNECTED, NULL, 0, NULL, NULL);
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+  if (client == NULL)
+  {
+    return ESP_FAIL;
+  }
+  esp_http_client_close(client);
+  free(client);
+  return ESP_OK;
+}
+
+// Hands the request to a routed handler, or the server on the URL's port
+static bool host_http_answer(const host_http_request_t *request, host_http_response_t *response)
+{
+  host_http_handler_t handler = NULL;
+  void *user_data = NULL;
+  size_t matched = 0;
+
+  pthread_mutex_lock(&http_lock);
+  for (int i = 0; i < HOST_HTTP_ROUTES && routes[i].handler != NULL; i++)
+  {
+    size_t len = strlen(routes[i].prefix);
+    if (len > matched && strncmp(request->url, routes[i].prefix, len) == 0)
+    {
+      handler = routes[i].handler;
+      user_data = routes[i].user_data;
+      matched = len;
+    }
+  }
+  pthread_mutex_unlock(&http_lock);
+
+  if (handler != NULL)
+  {
+    handler(request, response, user_data);
+    return true;
+  }
+  return host_httpd_handle(host_http_port(request->url), request, response);
+}
+
+static void host_http_free_response(host_http_response_t *response)
+{
+  if (response->free_body)
+  {
+    free((void *)response->body);
+  }
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client)
+{
+  static const char *methods[] = {"GET", "POST", "PUT", "PATCH", "DELETE", "HEAD"};
+
+  pthread_mutex_lock(&http_lock);
+  bool stale = client->connected && client->generation != generation;
+  pthread_mutex_unlock(&http_lock);
+
+  // The request goes out on the dead connection, and reading the reply fails
+  if (stale)
+  {
+    host_http_dispatch(client, HTTP_EVENT_HEADER_SENT, NULL, 0, NULL, NULL);
+    return ESP_ERR_HTTP_FETCH_HEADER;
+  }
+
+  host_http_request_t request = {
+      .method = methods[client->method < HTTP_METHOD_MAX ? client->method : 0],
+      .url = client->url,
+      .path = host_http_split(client->url, NULL),
+      .headers = client->headers,
+      .header_count = client->header_count,
+      .connection_requests = client->connected ? client->connection_requests : 0,
+      .timeout_ms = client->timeout_ms};
+  host_http_response_t *response = calloc(1, sizeof(host_http_response_t));
+  response->status = 200;
+  if (!host_http_answer(&request, response))
+  {
+    response->connect_error = ESP_ERR_HTTP_CONNECT;
+  }
+
+  if (response->connect_error != ESP_OK)
+  {
+    host_http_free_response(response);
+    free(response);
+    if (client->connected)
+    {
+      // Refused on a kept-alive connection, so the server must have closed it
+      host_http_dispatch(client, HTTP_EVENT_HEADER_SENT, NULL, 0, NULL, NULL);
+      return ESP_ERR_HTTP_FETCH_HEADER;
+    }
+    pthread_mutex_lock(&http_lock);
+    stats.connect_failures++;
+    pthread_mutex_unlock(&http_lock);
+    host_http_dispatch(client, HTTP_EVENT_ERROR, NULL, 0, NULL, NULL);
+    return ESP_ERR_HTTP_CONNECT;
+  }
+
+  pthread_mutex_lock(&http_lock);
+  stats.requests++;
+  if (!client->connected)
+  {
+    stats.connections++;
+    client->generation = generation;
+  }
+  pthread_mutex_unlock(&http_lock);
+
+  if (!client->connected)
+  {
+    client->connected = true;
+    client->connection_requests = 0;
+    host_http_split(client->url, client->origin);
+    host_http_dispatch(client, HTTP_EVENT_ON_CONNECTED, NULL, 0, NULL, NULL);
+  }
+  client->connection_requests++;
+  client->status = response->status;
+  client->content_length = response->chunked ? -1 : (int)response->body_len;
+  host_http_dispatch(client, HTTP_EVENT_HEADER_SENT, NULL, 0, NULL, NULL);
+
+  char length[16];
+  snprintf(length, sizeof(length), "%d", client->content_length);
+  host_http_set_header(response, response->chunked ? "Transfer-Encoding" : "Content-Length", response->chunked ? "chunked" : length);
+  for (size_t i = 0; i < response->header_count && client->connected; i++)
+  {
+    host_http_dispatch(client, HTTP_EVENT_ON_HEADER, NULL, 0, response->headers[i].key, response->headers[i].value);
+  }
+
+  size_t sent = 0;
+  size_t chunk = 0;
+  size_t body_len = response->drop && response->drop_after < response->body_len ? response->drop_after : response->body_len;
+  // A chunked body without its last chunk is cut short too
+  bool cut_short = body_len < response->body_len || (response->drop && response->chunked);
+  while (sent < body_len && client->connected)
+  {
+    size_t len = body_len - sent;
+    if (chunk < response->chunk_count)
+    {
+      len = response->chunks[chunk++];
+    }
+    else if (response->chunk_len > 0)
+    {
+      len = response->chunk_len;
+    }
+    len = len < body_len - sent ? len : body_len - sent;
+
+    if (response->chunk_delay_ms > 0)
+    {
+      uint32_t delay_ms = response->chunk_delay_ms < (uint32_t)client->timeout_ms ? response->chunk_delay_ms : (uint32_t)client->timeout_ms;
+      host_freertos_sleep_us(delay_ms * 1000);
+      if (response->chunk_delay_ms >= (uint32_t)client->timeout_ms)
+      {
+        cut_short = true;
+        break;
+      }
+    }
+    host_http_dispatch(client, HTTP_EVENT_ON_DATA, (void *)(response->body + sent), (int)len, NULL, NULL);
+    sent += len;
+  }
+  pthread_mutex_lock(&http_lock);
+  stats.body_bytes += sent;
+  pthread_mutex_unlock(&http_lock);
+
+  host_http_dispatch(client, HTTP_EVENT_ON_FINISH, NULL, 0, NULL, NULL);
+  if (response->close || cut_short)
+  {
+    esp_http_client_close(client);
+  }
+  host_http_free_response(response);
+  free(response);
+  return ESP_OK;
+}
@@ -0,0 +1,175 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "esp_http_client.h"
+#include "host_internal.h"
+
+// Forwards requests to a real server. Each gets a connection of its own with
+// Connection: close, and the whole response is read before it is handed to
+// the client, so the server sees a new device every request.
+
+#define HOST_FORWARD_HEAD_LEN 8192
+
+static bool host_forward_send(int fd, const char *data, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+    if (sent <= 0)
+    {
+      return false;
+    }
+    data += sent;
+    len -= sent;
+  }
+  return true;
+}
+
+static int host_forward_connect(const host_http_upstream_t *upstream, int timeout_ms)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    return -1;
+  }
+  struct timeval timeout = {.tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(upstream->port)};
+  if (inet_pton(AF_INET, upstream->host, &address.sin_addr) != 1 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static bool host_forward_request(int fd, const host_http_upstream_t *upstream, const host_http_request_t *request)
+{
+  char head[HOST_FORWARD_HEAD_LEN];
+  int len = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: %s:%u\r\nConnection: close\r\n", request->method, request->path, upstream->host, upstream->port);
+  for (size_t i = 0; i < request->header_count && len < (int)sizeof(head); i++)
+  {
+    len += snprintf(head + len, sizeof(head) - len, "%s: %s\r\n", request->headers[i].key, request->headers[i].value);
+  }
+  len += snprintf(head + len, len < (int)sizeof(head) ? sizeof(head) - len : 0, "\r\n");
+  return len < (int)sizeof(head) && host_forward_send(fd, head, len);
+}
+
+// Reads until the blank line ending the head, returning its length, or 0 if the connection ends first
+static size_t host_forward_head(int fd, char *buffer, size_t *received)
+{
+  *received = 0;
+  while (*received < HOST_FORWARD_HEAD_LEN - 1)
+  {
+    ssize_t len = recv(fd, buffer + *received, HOST_FORWARD_HEAD_LEN - 1 - *received, 0);
+    if (len <= 0)
+    {
+      return 0;
+    }
+    *received += len;
+    buffer[*received] = '\0';
+    char *end = strstr(buffer, "\r\n\r\n");
+    if (end != NULL)
+    {
+      return end + 4 - buffer;
+    }
+  }
+  return 0;
+}
+
+// The status and headers, leaving out those describing the connection, which
+// the client fills in for itself. Returns the content length, or -1 for none.
+static long host_forward_parse(char *head, host_http_response_t *response)
+{
+  long content_length = -1;
+  char *line = strstr(head, "\r\n");
+  *line = '\0';
+  const char *status = strchr(head, ' ');
+  response->status = status != NULL ? atoi(status + 1) : 0;
+
+  for (line += 2; *line != '\r' && *line != '\0';)
+  {
+    char *next = strstr(line, "\r\n");
+    *next = '\0';
+    char *value = strchr(line, ':');
+    if (value != NULL)
+    {
+      *value++ = '\0';
+      value += strspn(value, " ");
+      if (strcasecmp(line, "Content-Length") == 0)
+      {
+        content_length = atol(value);
+      }
+      else if (strcasecmp(line, "Connection") != 0 && strcasecmp(line, "Transfer-Encoding") != 0)
+      {
+        host_http_set_header(response, line, value);
+      }
+    }
+    line = next + 2;
+  }
+  return content_length;
+}
+
+void host_http_forward(const host_http_request_t *request, host_http_response_t *response, void *user_data)
+{
+  const host_http_upstream_t *upstream = (const host_http_upstream_t *)user_data;
+  char *head = malloc(HOST_FORWARD_HEAD_LEN);
+  size_t received = 0;
+  size_t head_len = 0;
+  int fd = host_forward_connect(upstream, request->timeout_ms);
+  if (fd >= 0 && host_forward_request(fd, upstream, request))
+  {
+    head_len = host_forward_head(fd, head, &received);
+  }
+  if (head_len == 0)
+  {
+    response->connect_error = ESP_ERR_HTTP_CONNECT;
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    free(head);
+    return;
+  }
+
+  long content_length = host_forward_parse(head, response);
+  size_t capacity = content_length >= 0 ? (size_t)content_length : HOST_FORWARD_HEAD_LEN;
+  uint8_t *body = malloc(capacity > 0 ? capacity : 1);
+  size_t body_len = received - head_len < capacity ? received - head_len : capacity;
+  memcpy(body, head + head_len, body_len);
+  free(head);
+
+  // Without a length the body runs until the server closes the connection
+  while (content_length < 0 || body_len < (size_t)content_length)
+  {
+    if (body_len == capacity)
+    {
+      capacity *= 2;
+      body = realloc(body, capacity);
+    }
+    ssize_t len = recv(fd, body + body_len, capacity - body_len, 0);
+    if (len <= 0)
+    {
+      break;
+    }
+    body_len += len;
+  }
+  close(fd);
+
+  response->body = body;
+  response->free_body = true;
+  response->close = true;
+  response->body_len = content_length >= 0 ? (size_t)content_length : body_len;
+  if (body_len < response->body_len)
+  {
+    response->drop = true;
+    response->drop_after = body_len;
+  }
+}
@@ -0,0 +1,304 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_http_server.h"
+#include "host_internal.h"
+
+#define HOST_HTTPD_SERVERS 4
+#define HOST_HTTPD_CHUNK_LEN 1024
+
+typedef struct
+{
+  bool used;
+  uint16_t port;
+  httpd_uri_t *handlers;
+  uint16_t handler_count;
+  uint16_t max_handlers;
+} host_httpd_t;
+
+// What the handler has said so far, kept in aux
+typedef struct
+{
+  host_http_response_t *response;
+  size_t body_cap;
+  bool finished;
+} host_httpd_response_t;
+
+// Held for reading while a handler runs, so httpd_stop waits for it as the real one does
+static pthread_rwlock_t httpd_lock = PTHREAD_RWLOCK_INITIALIZER;
+static host_httpd_t servers[HOST_HTTPD_SERVERS];
+
+void host_httpd_reset()
+{
+  pthread_rwlock_wrlock(&httpd_lock);
+  for (int i = 0; i < HOST_HTTPD_SERVERS; i++)
+  {
+    free(servers[i].handlers);
+  }
+  memset(servers, 0, sizeof(servers));
+  pthread_rwlock_unlock(&httpd_lock);
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+  if (handle == NULL || config == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  esp_err_t result = ESP_ERR_HTTPD_TASK;
+  pthread_rwlock_wrlock(&httpd_lock);
+  host_httpd_t *server = NULL;
+  for (int i = 0; i < HOST_HTTPD_SERVERS; i++)
+  {
+    // The port is already bound
+    if (servers[i].used && servers[i].port == config->server_port)
+    {
+      server = NULL;
+      break;
+    }
+    if (!servers[i].used && server == NULL)
+    {
+      server = &servers[i];
+    }
+  }
+  if (server != NULL)
+  {
+    server->handlers = calloc(config->max_uri_handlers, sizeof(httpd_uri_t));
+    if (server->handlers != NULL)
+    {
+      server->used = true;
+      server->port = config->server_port;
+      server->handler_count = 0;
+      server->max_handlers = config->max_uri_handlers;
+      *handle = server;
+      result = ESP_OK;
+    }
+  }
+  pthread_rwlock_unlock(&httpd_lock);
+  return result;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+  host_httpd_t *server = (host_httpd_t *)handle;
+  if (server == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  pthread_rwlock_wrlock(&httpd_lock);
+  free(server->handlers);
+  memset(server, 0, sizeof(host_httpd_t));
+  pthread_rwlock_unlock(&httpd_lock);
+  return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+  host_httpd_t *server = (host_httpd_t *)handle;
+  if (server == NULL || uri_handler == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  esp_err_t result = ESP_OK;
+  pthread_rwlock_wrlock(&httpd_lock);
+  for (uint16_t i = 0; i < server->handler_count; i++)
+  {
+    if (strcmp(server->handlers[i].uri, uri_handler->uri) == 0 && server->handlers[i].method == uri_handler->method)
+    {
+      result = ESP_ERR_HTTPD_HANDLER_EXISTS;
+    }
+  }
+  if (result == ESP_OK && server->handler_count == server->max_handlers)
+  {
+    result = ESP_ERR_HTTPD_HANDLERS_FULL;
+  }
+  if (result == ESP_OK)
+  {
+    server->handlers[server->handler_count++] = *uri_handler;
+  }
+  pthread_rwlock_unlock(&httpd_lock);
+  return result;
+}
+
+bool host_httpd_handle(uint16_t port, const host_http_request_t *request, host_http_response_t *response)
+{
+  static const char *methods[] = {"DELETE", "GET", "HEAD", "POST", "PUT"};
+
+  pthread_rwlock_rdlock(&httpd_lock);
+  host_httpd_t *server = NULL;
+  for (int i = 0; i < HOST_HTTPD_SERVERS; i++)
+  {
+    if (servers[i].used && servers[i].port == port)
+    {
+      server = &servers[i];
+    }
+  }
+  if (server == NULL)
+  {
+    pthread_rwlock_unlock(&httpd_lock);
+    return false;
+  }
+
+  httpd_req_t *req = calloc(1, sizeof(httpd_req_t));
+  host_httpd_response_t state = {.response = response};
+  strncpy((char *)req->uri, request->path, HTTPD_MAX_URI_LEN);
+  req->handle = server;
+  req->aux = &state;
+
+  size_t uri_len = strcspn(request->path, "?");
+  const httpd_uri_t *handler = NULL;
+  for (uint16_t i = 0; i < server->handler_count; i++)
+  {
+    const httpd_uri_t *candidate = &server->handlers[i];
+    if (strlen(candidate->uri) == uri_len && strncmp(candidate->uri, request->path, uri_len) == 0 && strcmp(methods[candidate->method], request->method) == 0)
+    {
+      handler = candidate;
+    }
+  }
+
+  if (handler == NULL)
+  {
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Nothing matches the given URI");
+  }
+  else
+  {
+    req->method = handler->method;
+    req->user_ctx = handler->user_ctx;
+    // A handler that fails closes the connection, as the real server does
+    if (handler->handler(req) != ESP_OK)
+    {
+      response->close = true;
+      if (!state.finished && response->body_len > 0)
+      {
+        response->drop = true;
+        response->drop_after = response->body_len;
+      }
+    }
+  }
+  pthread_rwlock_unlock(&httpd_lock);
+  free(req);
+  return true;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len)
+{
+  const char *query = strchr(r->uri, '?');
+  if (query == NULL)
+  {
+    return ESP_ERR_NOT_FOUND;
+  }
+  query++;
+  if (buf == NULL || buf_len == 0)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  strncpy(buf, query, buf_len - 1);
+  buf[buf_len - 1] = '\0';
+  return strlen(query) < buf_len ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size)
+{
+  if (qry == NULL || key == NULL || val == NULL || val_size == 0)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  size_t key_len = strlen(key);
+  const char *pair = qry;
+  while (pair != NULL && *pair != '\0')
+  {
+    size_t pair_len = strcspn(pair, "&");
+    if (pair_len > key_len && strncmp(pair, key, key_len) == 0 && pair[key_len] == '=')
+    {
+      size_t value_len = pair_len - key_len - 1;
+      size_t copy_len = value_len < val_size ? value_len : val_size - 1;
+      memcpy(val, pair + key_len + 1, copy_len);
+      val[copy_len] = '\0';
+      return value_len < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+    }
+    pair = pair[pair_len] == '&' ? pair + pair_len + 1 : NULL;
+  }
+  return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+  return httpd_resp_set_hdr(r, "Content-Type", type);
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+  host_httpd_response_t *state = (host_httpd_response_t *)r->aux;
+  if (state->response->header_count == HOST_HTTP_HEADERS)
+  {
+    return ESP_ERR_HTTPD_RESP_HDR;
+  }
+  host_http_set_header(state->response, field, value);
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+  host_httpd_response_t *state = (host_httpd_response_t *)r->aux;
+  host_http_response_t *response = state->response;
+  if (state->finished)
+  {
+    return ESP_ERR_HTTPD_INVALID_REQ;
+  }
+
+  response->chunked = true;
+  response->chunk_len = HOST_HTTPD_CHUNK_LEN;
+  if (buf == NULL)
+  {
+    state->finished = true;
+    return ESP_OK;
+  }
+
+  size_t len = buf_len < 0 ? strlen(buf) : (size_t)buf_len;
+  if (response->body_len + len > state->body_cap)
+  {
+    size_t cap = state->body_cap > 0 ? state->body_cap : 4096;
+    while (cap < response->body_len + len)
+    {
+      cap *= 2;
+    }
+    uint8_t *body = realloc((void *)response->body, cap);
+    if (body == NULL)
+    {
+      return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+    response->body = body;
+    response->free_body = true;
+    state->body_cap = cap;
+  }
+  memcpy((uint8_t *)response->body + response->body_len, buf, len);
+  response->body_len += len;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg)
+{
+  static const int statuses[] = {500, 501, 505, 400, 401, 403, 404, 405, 408};
+  host_httpd_response_t *state = (host_httpd_response_t *)req->aux;
+  host_http_response_t *response = state->response;
+  if (state->finished)
+  {
+    return ESP_ERR_HTTPD_INVALID_REQ;
+  }
+
+  response->status = statuses[error];
+  response->chunked = false;
+  if (response->free_body)
+  {
+    free((void *)response->body);
+  }
+  response->body_len = msg != NULL ? strlen(msg) : 0;
+  response->body = malloc(response->body_len + 1);
+  memcpy((void *)response->body, msg != NULL ? msg : "", response->body_len);
+  response->free_body = true;
+  host_http_set_header(response, "Content-Type", "text/html");
+  state->finished = true;
+  return ESP_OK;
+}
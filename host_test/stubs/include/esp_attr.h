@@ -0,0 +1,6 @@
+#pragma once
+// Nothing survives deep sleep on the host, so RTC memory is ordinary memory
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
@@ -0,0 +1,201 @@
+#ifndef _HOST_STUBS_h
+#define _HOST_STUBS_h
+// Controls for the host stand-ins of the IDF components, for tests to set up
+// the device and server and to see what the component did with them.
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+
+// Put every stand-in back to how it was at boot
+void host_reset();
+
+// FreeRTOS
+
+// With virtual time the tick count stands still while any task, the test's own
+// thread included, has something to do, and jumps to the first deadline once
+// they all wait. Tests run through minutes of polling at once and see the same
+// timings every run, however busy the host. Off is real time.
+void host_freertos_virtual_time(bool enabled);
+// Tasks started that haven't deleted themselves yet
+uint32_t host_freertos_running_tasks();
+
+// System
+
+void host_random_seed(uint32_t seed);
+void host_heap_psram(bool available);
+// Sets the free heap esp_get_free_heap_size() reports, counting down as the
+// component allocates. 0 goes back to measuring the process heap.
+void host_heap_free_size(uint32_t free);
+
+// HMAC peripheral, for CONFIG_SECURED_SHARED_KEY
+void host_efuse_set_key(const uint8_t *key, size_t key_len);
+
+// Flash: ota_0 and ota_1 app partitions, backed by a temporary file, with
+// NOR semantics - a write can only clear bits, so writing without erasing
+// first corrupts what is there. The device boots from ota_0.
+
+#define HOST_FLASH_PARTITION_SIZE (1024 * 1024)
+#define HOST_FLASH_WRITE_LOG 256
+
+// App images start with ESP_IMAGE_HEADER_MAGIC and, in place of the segment
+// table, the length of the whole image as a u32 LE at offset 4. As with IDF,
+// byte 23 of the header says whether the image ends with the SHA-256 of
+// everything before it. That is what esp_ota_end and esp_ota_set_boot_partition
+// validate, and esp_partition_get_sha256 reports the appended digest, or
+// hashes the whole image without one.
+#define HOST_IMAGE_HEADER_LEN 24
+#define HOST_IMAGE_HASH_APPENDED 23
+#define HOST_IMAGE_DIGEST_LEN 32
+// Writes the header into the start of image, and appends its digest in the
+// last HOST_IMAGE_DIGEST_LEN bytes, so call it once the rest is filled in
+void host_flash_image_header(void *image, size_t image_len);
+
+typedef struct _host_flash_write
+{
+  uint32_t address;
+  uint32_t len;
+} host_flash_write_t;
+
+typedef struct _host_flash_stats
+{
+  uint32_t writes;
+  uint64_t bytes_written;
+  uint32_t erased_sectors;
+  // Writes to bytes that weren't erased first
+  uint32_t dirty_writes;
+  // The most writes in progress at once, which should never be more than one
+  uint32_t concurrent_writes;
+  uint32_t ota_begins;
+  uint32_t ota_ends;
+  uint32_t ota_aborts;
+  // The first HOST_FLASH_WRITE_LOG writes
+  host_flash_write_t log[HOST_FLASH_WRITE_LOG];
+} host_flash_stats_t;
+
+// Every write and sector erase takes at least this long
+void host_flash_latency(uint32_t write_us, uint32_t erase_us);
+// Writes after the first `writes` fail with error, 0 error to stop failing
+void host_flash_fail_after(uint32_t writes, esp_err_t error);
+void host_flash_stats(host_flash_stats_t *stats);
+const esp_partition_t *host_flash_partition(int index);
+// Writes an image into a partition, ie. the running firmware
+void host_flash_load(const esp_partition_t *partition, const void *image, size_t image_len);
+// Copies out what is in a partition
+void host_flash_read(const esp_partition_t *partition, size_t offset, void *output, size_t len);
+// Switch to the partition esp_ota_set_boot_partition chose, as a reboot would
+void host_flash_reboot();
+bool host_flash_rolled_back();
+
+// NVS is held in memory, and reset by host_reset()
+
+// HTTP: each request made with esp_http_client is answered by the handler
+// whose prefix matches the start of its URL, on the thread that made it.
+
+#define HOST_HTTP_HEADERS 16
+#define HOST_HTTP_KEY_LEN 64
+#define HOST_HTTP_VALUE_LEN 256
+#define HOST_HTTP_CHUNKS 64
+
+typedef struct _host_http_header
+{
+  char key[HOST_HTTP_KEY_LEN];
+  char value[HOST_HTTP_VALUE_LEN];
+} host_http_header_t;
+
+typedef struct _host_http_request
+{
+  const char *method;
+  const char *url;
+  // From the first / after the host, with the query
+  const char *path;
+  const host_http_header_t *headers;
+  size_t header_count;
+  // Requests made on this connection before this one
+  uint32_t connection_requests;
+  // How long the client waits for each read
+  int timeout_ms;
+} host_http_request_t;
+
+typedef struct _host_http_response
+{
+  int status;
+  host_http_header_t headers[HOST_HTTP_HEADERS];
+  size_t header_count;
+  const uint8_t *body;
+  size_t body_len;
+  // Freed once the response has been sent
+  bool free_body;
+  // The body is handed over in the recorded chunk sizes, then in pieces of
+  // chunk_len, or all at once without either
+  size_t chunks[HOST_HTTP_CHUNKS];
+  size_t chunk_count;
+  size_t chunk_len;
+  // Before each chunk. A delay longer than the client's timeout times it out.
+  uint32_t chunk_delay_ms;
+  // Sent with Transfer-Encoding: chunked, so there is no content length
+  bool chunked;
+  // The connection is dropped after this many bytes of the body
+  bool drop;
+  size_t drop_after;
+  // The server closes the connection once the response is sent
+  bool close;
+  // Fail to connect with this instead of answering
+  esp_err_t connect_error;
+} host_http_response_t;
+
+typedef void (*host_http_handler_t)(const host_http_request_t *request, host_http_response_t *response, void *user_data);
+
+typedef struct _host_http_stats
+{
+  // Connections opened, which on a device would each be a TLS handshake
+  uint32_t connections;
+  uint32_t requests;
+  uint32_t connect_failures;
+  // Response body bytes handed to clients
+  uint64_t body_bytes;
+} host_http_stats_t;
+
+void host_http_route(const char *prefix, host_http_handler_t handler, void *user_data);
+const char *host_http_header(const host_http_request_t *request, const char *key);
+void host_http_set_header(host_http_response_t *response, const char *key, const char *value);
+void host_http_stats(host_http_stats_t *stats);
+// Closes every kept-alive connection from the server side, as an idle server would.
+// Clients only find out when they next use them.
+void host_http_drop_connections();
+
+// A recorded response, replayed as it was captured
+typedef struct _host_http_recording
+{
+  int status;
+  const char *headers[HOST_HTTP_HEADERS][2];
+  const char *body;
+  size_t body_len;
+  size_t chunks[HOST_HTTP_CHUNKS];
+} host_http_recording_t;
+
+// A handler that answers with the recording given as its user_data
+void host_http_replay(const host_http_request_t *request, host_http_response_t *response, void *user_data);
+
+// A real server, ie. tools/providore_server.py
+typedef struct _host_http_upstream
+{
+  // An IPv4 address
+  const char *host;
+  uint16_t port;
+} host_http_upstream_t;
+
+// A handler that sends each request to the upstream given as its user_data, on a
+// connection of its own. A reset before the whole head arrives fails to connect,
+// and a body cut short by the server or the client's timeout is dropped where it
+// stopped, as the client would see them.
+void host_http_forward(const host_http_request_t *request, host_http_response_t *response, void *user_data);
+
+// mDNS
+
+void host_mdns_add_peer(const char *ip, uint16_t port, const char *sha256);
+// The sha256 this device advertises, or "" when it advertises nothing
+const char *host_mdns_advertised();
+#endif
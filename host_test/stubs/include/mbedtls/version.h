@@ -0,0 +1,6 @@
+#pragma once
+// mbedtls 2.16, as shipped with ESP-IDF v4.3
+#define MBEDTLS_VERSION_MAJOR 2
+#define MBEDTLS_VERSION_MINOR 16
+#define MBEDTLS_VERSION_PATCH 0
+#define MBEDTLS_VERSION_NUMBER 0x02100000
@@ -0,0 +1,93 @@
+// The Kconfig defaults, with the optional features turned on so the host tests
+// cover them. Any of these can be overridden from the compiler command line.
+#pragma once
+#ifndef CONFIG_IDF_TARGET_ESP32
+#define CONFIG_IDF_TARGET_ESP32 1
+#endif
+#ifndef CONFIG_PROVIDORE_SERVER
+#define CONFIG_PROVIDORE_SERVER "http://providore.test"
+#endif
+#ifndef CONFIG_PROVIDORE_SERVER_TIME
+#define CONFIG_PROVIDORE_SERVER_TIME 1
+#endif
+#ifndef CONFIG_PROVIDORE_TASK_STACK_SIZE
+#define CONFIG_PROVIDORE_TASK_STACK_SIZE 8192
+#endif
+#ifndef CONFIG_PROVIDORE_SCHEDULER_STACK_SIZE
+#define CONFIG_PROVIDORE_SCHEDULER_STACK_SIZE 8192
+#endif
+#ifndef CONFIG_PROVIDORE_URL_LEN
+#define CONFIG_PROVIDORE_URL_LEN 128
+#endif
+#ifndef CONFIG_PROVIDORE_AUTHORIZATION_LEN
+#define CONFIG_PROVIDORE_AUTHORIZATION_LEN 128
+#endif
+#ifndef CONFIG_PROVIDORE_SIGNATURE_LEN
+#define CONFIG_PROVIDORE_SIGNATURE_LEN 256
+#endif
+#ifndef CONFIG_PROVIDORE_MEMORY_BUDGET
+#define CONFIG_PROVIDORE_MEMORY_BUDGET 0
+#endif
+#ifndef CONFIG_PROVIDORE_SESSION_IDLE_TIMEOUT
+#define CONFIG_PROVIDORE_SESSION_IDLE_TIMEOUT 30
+#endif
+#ifndef CONFIG_PROVIDORE_OTA_PIPELINE_BUFFERS
+#define CONFIG_PROVIDORE_OTA_PIPELINE_BUFFERS 2
+#endif
+#ifndef CONFIG_PROVIDORE_OTA_PIPELINE_BUFFER_SIZE
+#define CONFIG_PROVIDORE_OTA_PIPELINE_BUFFER_SIZE 4096
+#endif
+#ifndef CONFIG_PROVIDORE_OTA_PROGRESS_INTERVAL
+#define CONFIG_PROVIDORE_OTA_PROGRESS_INTERVAL 1000
+#endif
+#ifndef CONFIG_PROVIDORE_OTA_PIPELINE_STACK_SIZE
+#define CONFIG_PROVIDORE_OTA_PIPELINE_STACK_SIZE 3072
+#endif
+#ifndef CONFIG_PROVIDORE_OTA_RESUME
+#define CONFIG_PROVIDORE_OTA_RESUME 1
+#endif
+#ifndef CONFIG_PROVIDORE_OTA_CHECKPOINT_INTERVAL
+#define CONFIG_PROVIDORE_OTA_CHECKPOINT_INTERVAL 64
+#endif
+#ifndef CONFIG_PROVIDORE_OTA_MANIFEST
+#define CONFIG_PROVIDORE_OTA_MANIFEST 1
+#endif
+#ifndef CONFIG_PROVIDORE_OTA_DELTA
+#define CONFIG_PROVIDORE_OTA_DELTA 1
+#endif
+#ifndef CONFIG_PROVIDORE_OTA_COMPRESSION
+#define CONFIG_PROVIDORE_OTA_COMPRESSION 1
+#endif
+#ifndef CONFIG_PROVIDORE_OTA_COMPRESSION_WINDOW_BITS
+#define CONFIG_PROVIDORE_OTA_COMPRESSION_WINDOW_BITS 15
+#endif
+#ifndef CONFIG_PROVIDORE_PUSH_WAIT
+#define CONFIG_PROVIDORE_PUSH_WAIT 60
+#endif
+#ifndef CONFIG_PROVIDORE_CONFIG_CACHE
+#define CONFIG_PROVIDORE_CONFIG_CACHE 1
+#endif
+#ifndef CONFIG_PROVIDORE_PEER
+#define CONFIG_PROVIDORE_PEER 1
+#endif
+#ifndef CONFIG_PROVIDORE_PEER_PORT
+#define CONFIG_PROVIDORE_PEER_PORT 8070
+#endif
+#ifndef CONFIG_PROVIDORE_PEER_DISCOVERY_TIMEOUT
+#define CONFIG_PROVIDORE_PEER_DISCOVERY_TIMEOUT 1000
+#endif
+#ifndef CONFIG_PROVIDORE_PEER_TIMEOUT
+#define CONFIG_PROVIDORE_PEER_TIMEOUT 10000
+#endif
+#ifndef CONFIG_PROVIDORE_PEER_STACK_SIZE
+#define CONFIG_PROVIDORE_PEER_STACK_SIZE 4096
+#endif
+#ifndef CONFIG_PROVIDORE_BUFFER_SEGMENT_SIZE
+#define CONFIG_PROVIDORE_BUFFER_SEGMENT_SIZE 1024
+#endif
+#ifndef CONFIG_PROVIDORE_BUFFER_POOL_SEGMENTS
+#define CONFIG_PROVIDORE_BUFFER_POOL_SEGMENTS 4
+#endif
+#ifndef CONFIG_PROVIDORE_BUFFER_INTERNAL_LIMIT
+#define CONFIG_PROVIDORE_BUFFER_INTERNAL_LIMIT 32
+#endif
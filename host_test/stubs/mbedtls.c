@@ -0,0 +1,172 @@
+#include <string.h>
+#include "mbedtls/base64.h"
+#include "mbedtls/sha256.h"
+
+// FIPS 180-4 SHA-256, SHA-224 isn't used by the component
+static const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(mbedtls_sha256_context *ctx, const unsigned char *data)
+{
+  uint32_t w[64];
+  uint32_t s[8];
+
+  for (int i = 0; i < 16; i++)
+  {
+    w[i] = (uint32_t)data[i * 4] << 24 | (uint32_t)data[i * 4 + 1] << 16 | (uint32_t)data[i * 4 + 2] << 8 | data[i * 4 + 3];
+  }
+  for (int i = 16; i < 64; i++)
+  {
+    uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  memcpy(s, ctx->state, sizeof(s));
+  for (int i = 0; i < 64; i++)
+  {
+    uint32_t t1 = s[7] + (ROTR(s[4], 6) ^ ROTR(s[4], 11) ^ ROTR(s[4], 25)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) + K[i] + w[i];
+    uint32_t t2 = (ROTR(s[0], 2) ^ ROTR(s[0], 13) ^ ROTR(s[0], 22)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+    memmove(&s[1], &s[0], 7 * sizeof(uint32_t));
+    s[4] += t1;
+    s[0] = t1 + t2;
+  }
+  for (int i = 0; i < 8; i++)
+  {
+    ctx->state[i] += s[i];
+  }
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx)
+{
+  memset(ctx, 0, sizeof(mbedtls_sha256_context));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx)
+{
+  if (ctx != NULL)
+  {
+    memset(ctx, 0, sizeof(mbedtls_sha256_context));
+  }
+}
+
+void mbedtls_sha256_clone(mbedtls_sha256_context *dst, const mbedtls_sha256_context *src)
+{
+  *dst = *src;
+}
+
+int mbedtls_sha256_starts_ret(mbedtls_sha256_context *ctx, int is224)
+{
+  static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+  ctx->total[0] = 0;
+  ctx->total[1] = 0;
+  memcpy(ctx->state, initial, sizeof(initial));
+  ctx->is224 = is224;
+  return 0;
+}
+
+int mbedtls_sha256_update_ret(mbedtls_sha256_context *ctx, const unsigned char *input, size_t ilen)
+{
+  size_t used = ctx->total[0] & 63;
+  uint64_t total = ((uint64_t)ctx->total[1] << 32 | ctx->total[0]) + ilen;
+  ctx->total[0] = (uint32_t)total;
+  ctx->total[1] = (uint32_t)(total >> 32);
+
+  if (used > 0 && used + ilen >= 64)
+  {
+    memcpy(ctx->buffer + used, input, 64 - used);
+    sha256_block(ctx, ctx->buffer);
+    input += 64 - used;
+    ilen -= 64 - used;
+    used = 0;
+  }
+  while (ilen >= 64)
+  {
+    sha256_block(ctx, input);
+    input += 64;
+    ilen -= 64;
+  }
+  memcpy(ctx->buffer + used, input, ilen);
+  return 0;
+}
+
+int mbedtls_sha256_finish_ret(mbedtls_sha256_context *ctx, unsigned char output[32])
+{
+  uint64_t bits = ((uint64_t)ctx->total[1] << 32 | ctx->total[0]) * 8;
+  size_t used = ctx->total[0] & 63;
+  unsigned char padding[72] = {0x80};
+  size_t padding_len = used < 56 ? 56 - used : 120 - used;
+
+  for (int i = 0; i < 8; i++)
+  {
+    padding[padding_len + i] = (unsigned char)(bits >> (56 - i * 8));
+  }
+  mbedtls_sha256_update_ret(ctx, padding, padding_len + 8);
+  for (int i = 0; i < 8; i++)
+  {
+    output[i * 4] = (unsigned char)(ctx->state[i] >> 24);
+    output[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+    output[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+    output[i * 4 + 3] = (unsigned char)ctx->state[i];
+  }
+  return 0;
+}
+
+int mbedtls_sha256_ret(const unsigned char *input, size_t ilen, unsigned char output[32], int is224)
+{
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts_ret(&ctx, is224);
+  mbedtls_sha256_update_ret(&ctx, input, ilen);
+  mbedtls_sha256_finish_ret(&ctx, output);
+  mbedtls_sha256_free(&ctx);
+  return 0;
+}
+
+// As mbedtls: a dst too small fails and sets olen to the length needed, with the NUL
+int mbedtls_base64_encode(unsigned char *dst, size_t dlen, size_t *olen, const unsigned char *src, size_t slen)
+{
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t needed = (slen + 2) / 3 * 4 + 1;
+
+  if (slen == 0)
+  {
+    *olen = 0;
+    return 0;
+  }
+  if (dst == NULL || dlen < needed)
+  {
+    *olen = needed;
+    return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+  }
+
+  unsigned char *out = dst;
+  for (size_t i = 0; i < slen; i += 3)
+  {
+    uint32_t group = (uint32_t)src[i] << 16;
+    if (i + 1 < slen)
+    {
+      group |= (uint32_t)src[i + 1] << 8;
+    }
+    if (i + 2 < slen)
+    {
+      group |= src[i + 2];
+    }
+    *out++ = alphabet[(group >> 18) & 63];
+    *out++ = alphabet[(group >> 12) & 63];
+    *out++ = i + 1 < slen ? alphabet[(group >> 6) & 63] : '=';
+    *out++ = i + 2 < slen ? alphabet[group & 63] : '=';
+  }
+  *out = '\0';
+  *olen = out - dst;
+  return 0;
+}
@@ -0,0 +1,164 @@
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host_internal.h"
+#include "mdns.h"
+
+#define HOST_MDNS_PEERS 8
+#define HOST_MDNS_SHA256_LEN 65
+
+typedef struct
+{
+  char ip[16];
+  uint16_t port;
+  char sha256[HOST_MDNS_SHA256_LEN];
+} host_mdns_peer_t;
+
+static pthread_mutex_t mdns_lock = PTHREAD_MUTEX_INITIALIZER;
+static host_mdns_peer_t peers[HOST_MDNS_PEERS];
+static size_t peer_count;
+// The one service this device can advertise
+static bool advertising;
+static char advertised[HOST_MDNS_SHA256_LEN];
+
+void host_mdns_reset()
+{
+  pthread_mutex_lock(&mdns_lock);
+  memset(peers, 0, sizeof(peers));
+  peer_count = 0;
+  advertising = false;
+  advertised[0] = '\0';
+  pthread_mutex_unlock(&mdns_lock);
+}
+
+void host_mdns_add_peer(const char *ip, uint16_t port, const char *sha256)
+{
+  pthread_mutex_lock(&mdns_lock);
+  if (peer_count < HOST_MDNS_PEERS)
+  {
+    strncpy(peers[peer_count].ip, ip, sizeof(peers[peer_count].ip) - 1);
+    peers[peer_count].port = port;
+    strncpy(peers[peer_count].sha256, sha256, HOST_MDNS_SHA256_LEN - 1);
+    peer_count++;
+  }
+  pthread_mutex_unlock(&mdns_lock);
+}
+
+const char *host_mdns_advertised()
+{
+  static char copy[HOST_MDNS_SHA256_LEN];
+  pthread_mutex_lock(&mdns_lock);
+  strcpy(copy, advertising ? advertised : "");
+  pthread_mutex_unlock(&mdns_lock);
+  return copy;
+}
+
+static void host_mdns_txt(mdns_txt_item_t txt[], size_t num_items)
+{
+  for (size_t i = 0; i < num_items; i++)
+  {
+    if (strcmp(txt[i].key, "sha256") == 0)
+    {
+      strncpy(advertised, txt[i].value, HOST_MDNS_SHA256_LEN - 1);
+    }
+  }
+}
+
+esp_err_t mdns_service_add(const char *instance_name, const char *service_type, const char *proto, uint16_t port, mdns_txt_item_t txt[], size_t num_items)
+{
+  esp_err_t result = ESP_OK;
+  pthread_mutex_lock(&mdns_lock);
+  if (advertising)
+  {
+    result = ESP_ERR_INVALID_ARG;
+  }
+  else
+  {
+    advertising = true;
+    advertised[0] = '\0';
+    host_mdns_txt(txt, num_items);
+  }
+  pthread_mutex_unlock(&mdns_lock);
+  return result;
+}
+
+esp_err_t mdns_service_remove(const char *service_type, const char *proto)
+{
+  esp_err_t result = ESP_OK;
+  pthread_mutex_lock(&mdns_lock);
+  if (!advertising)
+  {
+    result = ESP_ERR_NOT_FOUND;
+  }
+  advertising = false;
+  advertised[0] = '\0';
+  pthread_mutex_unlock(&mdns_lock);
+  return result;
+}
+
+esp_err_t mdns_service_txt_item_set(const char *service_type, const char *proto, const char *key, const char *value)
+{
+  esp_err_t result = ESP_OK;
+  pthread_mutex_lock(&mdns_lock);
+  if (!advertising)
+  {
+    result = ESP_ERR_NOT_FOUND;
+  }
+  else
+  {
+    mdns_txt_item_t txt[] = {{key, value}};
+    host_mdns_txt(txt, 1);
+  }
+  pthread_mutex_unlock(&mdns_lock);
+  return result;
+}
+
+// Every peer answers straight away, in the order they were added
+esp_err_t mdns_query_ptr(const char *service_type, const char *proto, uint32_t timeout, size_t max_results, mdns_result_t **results)
+{
+  mdns_result_t *first = NULL;
+  mdns_result_t **last = &first;
+
+  pthread_mutex_lock(&mdns_lock);
+  for (size_t i = 0; i < peer_count && i < max_results; i++)
+  {
+    mdns_result_t *result = calloc(1, sizeof(mdns_result_t));
+    result->port = peers[i].port;
+    result->txt = calloc(1, sizeof(mdns_txt_item_t));
+    result->txt_value_len = calloc(1, sizeof(uint8_t));
+    result->txt[0].key = strdup("sha256");
+    result->txt[0].value = strdup(peers[i].sha256);
+    result->txt_value_len[0] = strlen(peers[i].sha256);
+    result->txt_count = 1;
+    result->addr = calloc(1, sizeof(mdns_ip_addr_t));
+    result->addr->addr.type = ESP_IPADDR_TYPE_V4;
+    inet_pton(AF_INET, peers[i].ip, &result->addr->addr.u_addr.ip4.addr);
+    *last = result;
+    last = &result->next;
+  }
+  pthread_mutex_unlock(&mdns_lock);
+
+  *results = first;
+  return ESP_OK;
+}
+
+void mdns_query_results_free(mdns_result_t *results)
+{
+  while (results != NULL)
+  {
+    mdns_result_t *next = results->next;
+    for (size_t i = 0; i < results->txt_count; i++)
+    {
+      free((void *)results->txt[i].key);
+      free((void *)results->txt[i].value);
+    }
+    free(results->txt);
+    free(results->txt_value_len);
+    free(results->addr);
+    free(results->instance_name);
+    free(results->hostname);
+    free(results);
+    results = next;
+  }
+}
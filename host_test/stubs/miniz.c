@@ -0,0 +1,70 @@
+#include <string.h>
+#include "esp32/rom/miniz.h"
+
+// zlib allocates its state and window from the decompressor, which is freed with it
+static voidpf arena_alloc(voidpf opaque, uInt items, uInt size)
+{
+  tinfl_decompressor *r = (tinfl_decompressor *)opaque;
+  size_t len = ((size_t)items * size + 15) & ~(size_t)15;
+  if (r->arena_used + len > sizeof(r->arena))
+  {
+    return Z_NULL;
+  }
+  void *ptr = r->arena + r->arena_used;
+  r->arena_used += len;
+  return ptr;
+}
+
+static void arena_free(voidpf opaque, voidpf ptr)
+{
+}
+
+// Only the wrapping output buffer the component uses is supported: output
+// goes to pOut_buf_next, and the window is zlib's own
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_next, size_t *pIn_buf_size, mz_uint8 *pOut_buf_start, mz_uint8 *pOut_buf_next, size_t *pOut_buf_size, const mz_uint32 decomp_flags)
+{
+  if (r->m_state == 0)
+  {
+    memset(&r->stream, 0, sizeof(z_stream));
+    r->arena_used = 0;
+    r->stream.zalloc = arena_alloc;
+    r->stream.zfree = arena_free;
+    r->stream.opaque = r;
+    if (inflateInit2(&r->stream, (decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER) ? 15 : -15) != Z_OK)
+    {
+      *pIn_buf_size = 0;
+      *pOut_buf_size = 0;
+      return TINFL_STATUS_FAILED;
+    }
+    r->m_state = 1;
+  }
+  if (r->m_state == 2)
+  {
+    *pIn_buf_size = 0;
+    *pOut_buf_size = 0;
+    return TINFL_STATUS_DONE;
+  }
+
+  r->stream.next_in = (Bytef *)pIn_buf_next;
+  r->stream.avail_in = *pIn_buf_size;
+  r->stream.next_out = pOut_buf_next;
+  r->stream.avail_out = *pOut_buf_size;
+  int result = inflate(&r->stream, Z_NO_FLUSH);
+  *pIn_buf_size -= r->stream.avail_in;
+  *pOut_buf_size -= r->stream.avail_out;
+
+  if (result == Z_STREAM_END)
+  {
+    r->m_state = 2;
+    return TINFL_STATUS_DONE;
+  }
+  if (result == Z_OK || result == Z_BUF_ERROR)
+  {
+    if (r->stream.avail_out == 0)
+    {
+      return TINFL_STATUS_HAS_MORE_OUTPUT;
+    }
+    return (decomp_flags & TINFL_FLAG_HAS_MORE_INPUT) ? TINFL_STATUS_NEEDS_MORE_INPUT : TINFL_STATUS_FAILED;
+  }
+  return TINFL_STATUS_FAILED;
+}
@@ -0,0 +1,294 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host_internal.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#define HOST_NVS_ENTRIES 64
+#define HOST_NVS_NAMESPACES 8
+#define HOST_NVS_HANDLES 32
+
+typedef enum
+{
+  HOST_NVS_STR,
+  HOST_NVS_BLOB
+} host_nvs_type_t;
+
+typedef struct
+{
+  bool used;
+  char name_space[NVS_KEY_NAME_MAX_SIZE];
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  host_nvs_type_t type;
+  void *value;
+  size_t len;
+} host_nvs_entry_t;
+
+typedef struct
+{
+  bool open;
+  char name_space[NVS_KEY_NAME_MAX_SIZE];
+  nvs_open_mode_t mode;
+} host_nvs_handle_t;
+
+static pthread_mutex_t nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static host_nvs_entry_t entries[HOST_NVS_ENTRIES];
+static char namespaces[HOST_NVS_NAMESPACES][NVS_KEY_NAME_MAX_SIZE];
+static host_nvs_handle_t handles[HOST_NVS_HANDLES];
+
+void host_nvs_reset()
+{
+  pthread_mutex_lock(&nvs_lock);
+  for (int i = 0; i < HOST_NVS_ENTRIES; i++)
+  {
+    free(entries[i].value);
+  }
+  memset(entries, 0, sizeof(entries));
+  memset(namespaces, 0, sizeof(namespaces));
+  memset(handles, 0, sizeof(handles));
+  pthread_mutex_unlock(&nvs_lock);
+}
+
+esp_err_t nvs_flash_init(void)
+{
+  return ESP_OK;
+}
+
+// Handles are numbered from 1, so 0 is never valid. Called with nvs_lock held.
+static host_nvs_handle_t *host_nvs_handle(nvs_handle_t handle)
+{
+  if (handle == 0 || handle > HOST_NVS_HANDLES || !handles[handle - 1].open)
+  {
+    return NULL;
+  }
+  return &handles[handle - 1];
+}
+
+static host_nvs_entry_t *host_nvs_find(const host_nvs_handle_t *handle, const char *key)
+{
+  for (int i = 0; i < HOST_NVS_ENTRIES; i++)
+  {
+    if (entries[i].used && strcmp(entries[i].name_space, handle->name_space) == 0 && strcmp(entries[i].key, key) == 0)
+    {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+  if (name == NULL || out_handle == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (strlen(name) >= NVS_KEY_NAME_MAX_SIZE)
+  {
+    return ESP_ERR_NVS_KEY_TOO_LONG;
+  }
+
+  pthread_mutex_lock(&nvs_lock);
+  // A namespace only exists once it has been opened for writing
+  int found = -1;
+  int free_slot = -1;
+  for (int i = 0; i < HOST_NVS_NAMESPACES; i++)
+  {
+    if (strcmp(namespaces[i], name) == 0)
+    {
+      found = i;
+    }
+    if (namespaces[i][0] == '\0' && free_slot < 0)
+    {
+      free_slot = i;
+    }
+  }
+  esp_err_t result = ESP_OK;
+  if (found < 0 && open_mode == NVS_READONLY)
+  {
+    result = ESP_ERR_NVS_NOT_FOUND;
+  }
+  else if (found < 0 && free_slot < 0)
+  {
+    result = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+  }
+  else if (found < 0)
+  {
+    strcpy(namespaces[free_slot], name);
+  }
+
+  if (result == ESP_OK)
+  {
+    result = ESP_ERR_NO_MEM;
+    for (int i = 0; i < HOST_NVS_HANDLES; i++)
+    {
+      if (!handles[i].open)
+      {
+        handles[i].open = true;
+        handles[i].mode = open_mode;
+        strcpy(handles[i].name_space, name);
+        *out_handle = i + 1;
+        result = ESP_OK;
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&nvs_lock);
+  return result;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+  pthread_mutex_lock(&nvs_lock);
+  host_nvs_handle_t *open = host_nvs_handle(handle);
+  if (open != NULL)
+  {
+    open->open = false;
+  }
+  pthread_mutex_unlock(&nvs_lock);
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+  pthread_mutex_lock(&nvs_lock);
+  esp_err_t result = host_nvs_handle(handle) != NULL ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+  pthread_mutex_unlock(&nvs_lock);
+  return result;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+  pthread_mutex_lock(&nvs_lock);
+  esp_err_t result = ESP_OK;
+  host_nvs_handle_t *open = host_nvs_handle(handle);
+  if (open == NULL)
+  {
+    result = ESP_ERR_NVS_INVALID_HANDLE;
+  }
+  else if (open->mode == NVS_READONLY)
+  {
+    result = ESP_ERR_NVS_READ_ONLY;
+  }
+  else
+  {
+    host_nvs_entry_t *entry = host_nvs_find(open, key);
+    if (entry == NULL)
+    {
+      result = ESP_ERR_NVS_NOT_FOUND;
+    }
+    else
+    {
+      free(entry->value);
+      memset(entry, 0, sizeof(host_nvs_entry_t));
+    }
+  }
+  pthread_mutex_unlock(&nvs_lock);
+  return result;
+}
+
+static esp_err_t host_nvs_set(nvs_handle_t handle, const char *key, host_nvs_type_t type, const void *value, size_t len)
+{
+  if (key == NULL || value == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE)
+  {
+    return ESP_ERR_NVS_KEY_TOO_LONG;
+  }
+
+  pthread_mutex_lock(&nvs_lock);
+  esp_err_t result = ESP_OK;
+  host_nvs_handle_t *open = host_nvs_handle(handle);
+  if (open == NULL)
+  {
+    result = ESP_ERR_NVS_INVALID_HANDLE;
+  }
+  else if (open->mode == NVS_READONLY)
+  {
+    result = ESP_ERR_NVS_READ_ONLY;
+  }
+  else
+  {
+    host_nvs_entry_t *entry = host_nvs_find(open, key);
+    for (int i = 0; i < HOST_NVS_ENTRIES && entry == NULL; i++)
+    {
+      entry = entries[i].used ? NULL : &entries[i];
+    }
+    if (entry == NULL)
+    {
+      result = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    else
+    {
+      free(entry->value);
+      entry->used = true;
+      strcpy(entry->name_space, open->name_space);
+      strcpy(entry->key, key);
+      entry->type = type;
+      entry->value = malloc(len > 0 ? len : 1);
+      memcpy(entry->value, value, len);
+      entry->len = len;
+    }
+  }
+  pthread_mutex_unlock(&nvs_lock);
+  return result;
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+  return host_nvs_set(handle, key, HOST_NVS_STR, value, value != NULL ? strlen(value) + 1 : 0);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+  return host_nvs_set(handle, key, HOST_NVS_BLOB, value, length);
+}
+
+// As in ESP-IDF: without out_value only the length is returned, and a length
+// too small for the value is an error that also says how much is needed
+static esp_err_t host_nvs_get(nvs_handle_t handle, const char *key, host_nvs_type_t type, void *out_value, size_t *length)
+{
+  pthread_mutex_lock(&nvs_lock);
+  esp_err_t result = ESP_OK;
+  host_nvs_handle_t *open = host_nvs_handle(handle);
+  host_nvs_entry_t *entry = open != NULL && key != NULL ? host_nvs_find(open, key) : NULL;
+  if (open == NULL)
+  {
+    result = ESP_ERR_NVS_INVALID_HANDLE;
+  }
+  else if (entry == NULL || entry->type != type)
+  {
+    result = ESP_ERR_NVS_NOT_FOUND;
+  }
+  else if (length == NULL)
+  {
+    result = ESP_ERR_NVS_INVALID_LENGTH;
+  }
+  else if (out_value == NULL)
+  {
+    *length = entry->len;
+  }
+  else if (*length < entry->len)
+  {
+    *length = entry->len;
+    result = ESP_ERR_NVS_INVALID_LENGTH;
+  }
+  else
+  {
+    memcpy(out_value, entry->value, entry->len);
+    *length = entry->len;
+  }
+  pthread_mutex_unlock(&nvs_lock);
+  return result;
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+  return host_nvs_get(handle, key, HOST_NVS_STR, out_value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+  return host_nvs_get(handle, key, HOST_NVS_BLOB, out_value, length);
+}
@@ -0,0 +1,231 @@
+#include <malloc.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_hmac.h"
+#include "esp_http_client.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_task_wdt.h"
+#include "esp_timer.h"
+#include "host_internal.h"
+#include "host_stubs.h"
+#include "mbedtls/sha256.h"
+#include "nvs.h"
+
+// Roughly what an ESP32 has free once WiFi is up
+#define HOST_HEAP_SIZE (200 * 1024)
+
+static int log_level = -1;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static int64_t started_us;
+static uint32_t random_state = 0x2545f491;
+static pthread_mutex_t random_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool psram_available;
+static uint32_t heap_free_size;
+static uint8_t efuse_key[32];
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+  static const char letters[] = "NEWIDV";
+
+  pthread_mutex_lock(&log_lock);
+  if (log_level < 0)
+  {
+    const char *env = getenv("HOST_LOG_LEVEL");
+    log_level = env != NULL ? atoi(env) : ESP_LOG_WARN;
+  }
+  if ((int)level <= log_level)
+  {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%c (%lld) %s: ", letters[level], (long long)(esp_timer_get_time() / 1000), tag);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+  }
+  pthread_mutex_unlock(&log_lock);
+}
+
+int64_t esp_timer_get_time(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  int64_t us = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+  int64_t expected = 0;
+  __atomic_compare_exchange_n(&started_us, &expected, us, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+  return us - __atomic_load_n(&started_us, __ATOMIC_ACQUIRE);
+}
+
+// xorshift32, so a seeded test sees the same numbers every run
+uint32_t esp_random(void)
+{
+  pthread_mutex_lock(&random_lock);
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  uint32_t value = random_state;
+  pthread_mutex_unlock(&random_lock);
+  return value;
+}
+
+void host_random_seed(uint32_t seed)
+{
+  pthread_mutex_lock(&random_lock);
+  random_state = seed != 0 ? seed : 0x2545f491;
+  pthread_mutex_unlock(&random_lock);
+}
+
+void host_heap_psram(bool available)
+{
+  __atomic_store_n(&psram_available, available, __ATOMIC_RELEASE);
+}
+
+void host_heap_free_size(uint32_t free)
+{
+  __atomic_store_n(&heap_free_size, free, __ATOMIC_RELEASE);
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+  if ((caps & MALLOC_CAP_SPIRAM) && !__atomic_load_n(&psram_available, __ATOMIC_ACQUIRE))
+  {
+    return NULL;
+  }
+  return malloc(size);
+}
+
+void heap_caps_free(void *ptr)
+{
+  free(ptr);
+}
+
+// The whole process heap is counted, so anything the test allocates at the same time is too
+uint32_t esp_get_free_heap_size(void)
+{
+  uint32_t free = __atomic_load_n(&heap_free_size, __ATOMIC_ACQUIRE);
+  if (free > 0)
+  {
+    return free;
+  }
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks < HOST_HEAP_SIZE ? HOST_HEAP_SIZE - info.uordblks : 0;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+  return esp_get_free_heap_size();
+}
+
+esp_err_t esp_task_wdt_reset(void)
+{
+  return ESP_OK;
+}
+
+void host_efuse_set_key(const uint8_t *key, size_t key_len)
+{
+  memset(efuse_key, 0, sizeof(efuse_key));
+  memcpy(efuse_key, key, key_len < sizeof(efuse_key) ? key_len : sizeof(efuse_key));
+}
+
+// HMAC-SHA256 with the 32 byte eFuse key, as the peripheral does it
+esp_err_t esp_hmac_calculate(hmac_key_id_t key_id, const void *message, size_t message_len, uint8_t *hmac)
+{
+  uint8_t pad[64];
+  mbedtls_sha256_context ctx;
+
+  if (key_id >= HMAC_KEY_MAX || message == NULL || hmac == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  memset(pad, 0x36, sizeof(pad));
+  for (size_t i = 0; i < sizeof(efuse_key); i++)
+  {
+    pad[i] ^= efuse_key[i];
+  }
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts_ret(&ctx, 0);
+  mbedtls_sha256_update_ret(&ctx, pad, sizeof(pad));
+  mbedtls_sha256_update_ret(&ctx, (const unsigned char *)message, message_len);
+  mbedtls_sha256_finish_ret(&ctx, hmac);
+
+  memset(pad, 0x5c, sizeof(pad));
+  for (size_t i = 0; i < sizeof(efuse_key); i++)
+  {
+    pad[i] ^= efuse_key[i];
+  }
+  mbedtls_sha256_starts_ret(&ctx, 0);
+  mbedtls_sha256_update_ret(&ctx, pad, sizeof(pad));
+  mbedtls_sha256_update_ret(&ctx, hmac, 32);
+  mbedtls_sha256_finish_ret(&ctx, hmac);
+  mbedtls_sha256_free(&ctx);
+  return ESP_OK;
+}
+
+void host_system_reset()
+{
+  host_random_seed(0);
+  host_heap_psram(false);
+  host_heap_free_size(0);
+  memset(efuse_key, 0, sizeof(efuse_key));
+}
+
+void host_reset()
+{
+  host_system_reset();
+  host_freertos_virtual_time(false);
+  host_flash_reset();
+  host_nvs_reset();
+  host_http_reset();
+  host_httpd_reset();
+  host_mdns_reset();
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+  switch (code)
+  {
+#define HOST_ERR_NAME(err) \
+  case err:                \
+    return #err;
+    HOST_ERR_NAME(ESP_OK)
+    HOST_ERR_NAME(ESP_FAIL)
+    HOST_ERR_NAME(ESP_ERR_NO_MEM)
+    HOST_ERR_NAME(ESP_ERR_INVALID_ARG)
+    HOST_ERR_NAME(ESP_ERR_INVALID_STATE)
+    HOST_ERR_NAME(ESP_ERR_INVALID_SIZE)
+    HOST_ERR_NAME(ESP_ERR_NOT_FOUND)
+    HOST_ERR_NAME(ESP_ERR_NOT_SUPPORTED)
+    HOST_ERR_NAME(ESP_ERR_TIMEOUT)
+    HOST_ERR_NAME(ESP_ERR_INVALID_RESPONSE)
+    HOST_ERR_NAME(ESP_ERR_INVALID_CRC)
+    HOST_ERR_NAME(ESP_ERR_INVALID_VERSION)
+    HOST_ERR_NAME(ESP_ERR_INVALID_MAC)
+    HOST_ERR_NAME(ESP_ERR_FLASH_OP_FAIL)
+    HOST_ERR_NAME(ESP_ERR_FLASH_OP_TIMEOUT)
+    HOST_ERR_NAME(ESP_ERR_OTA_PARTITION_CONFLICT)
+    HOST_ERR_NAME(ESP_ERR_OTA_SELECT_INFO_INVALID)
+    HOST_ERR_NAME(ESP_ERR_OTA_VALIDATE_FAILED)
+    HOST_ERR_NAME(ESP_ERR_NVS_NOT_FOUND)
+    HOST_ERR_NAME(ESP_ERR_NVS_READ_ONLY)
+    HOST_ERR_NAME(ESP_ERR_NVS_INVALID_HANDLE)
+    HOST_ERR_NAME(ESP_ERR_NVS_KEY_TOO_LONG)
+    HOST_ERR_NAME(ESP_ERR_NVS_INVALID_LENGTH)
+    HOST_ERR_NAME(ESP_ERR_HTTP_CONNECT)
+    HOST_ERR_NAME(ESP_ERR_HTTP_FETCH_HEADER)
+    HOST_ERR_NAME(ESP_ERR_HTTP_EAGAIN)
+    HOST_ERR_NAME(ESP_ERR_HTTPD_INVALID_REQ)
+    HOST_ERR_NAME(ESP_ERR_HTTPD_RESULT_TRUNC)
+#undef HOST_ERR_NAME
+  default:
+    return "UNKNOWN ERROR";
+  }
+}
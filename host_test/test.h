@@ -0,0 +1,50 @@
+#ifndef _HOST_TEST_h
+#define _HOST_TEST_h
+// A minimal test runner. Assertions return from the test on failure, so they
+// can only be used in the test function itself.
+#include <stdio.h>
+#include <string.h>
+#include "host_stubs.h"
+
+extern int test_failures;
+extern const char *test_name;
+
+#define TEST_ASSERT_MESSAGE(condition, ...)                                \
+  do                                                                       \
+  {                                                                        \
+    if (!(condition))                                                      \
+    {                                                                      \
+      fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, test_name);       \
+      fprintf(stderr, __VA_ARGS__);                                        \
+      fputc('\n', stderr);                                                 \
+      test_failures++;                                                     \
+      return;                                                              \
+    }                                                                      \
+  } while (0)
+
+#define TEST_ASSERT(condition) TEST_ASSERT_MESSAGE(condition, "%s", #condition)
+
+#define TEST_ASSERT_EQUAL_INT(expected, actual)                                               \
+  do                                                                                          \
+  {                                                                                           \
+    long long test_expected = (long long)(expected);                                          \
+    long long test_actual = (long long)(actual);                                              \
+    TEST_ASSERT_MESSAGE(test_expected == test_actual, "%s is %lld, expected %lld", #actual, test_actual, test_expected); \
+  } while (0)
+
+#define TEST_ASSERT_EQUAL_STRING(expected, actual)                                               \
+  do                                                                                             \
+  {                                                                                              \
+    const char *test_expected = (expected);                                                      \
+    const char *test_actual = (actual);                                                          \
+    TEST_ASSERT_MESSAGE(test_actual != NULL && strcmp(test_expected, test_actual) == 0, "%s is \"%s\", expected \"%s\"", #actual, test_actual != NULL ? test_actual : "(null)", test_expected); \
+  } while (0)
+
+#define TEST_ASSERT_EQUAL_MEMORY(expected, actual, len) TEST_ASSERT_MESSAGE(memcmp((expected), (actual), (len)) == 0, "%s differs from %s", #actual, #expected)
+
+// Puts the stand-ins and the component's own state back as they were at boot, then runs the test
+#define RUN_TEST(test) test_run(#test, test)
+void test_run(const char *name, void (*test)(void));
+// The exit code for main
+int test_end();
+#endif
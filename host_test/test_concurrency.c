@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "providore.h"
+#include "push.h"
+#include "scheduler.h"
+#include "test.h"
+#include "test_support.h"
+
+// Build with -DHOST_TEST_TSAN=ON to have ThreadSanitizer check these as well
+
+#define TASKS 4
+#define REQUESTS_PER_TASK 25
+#define RUNNING_LEN (128 * 1024)
+#define IMAGE_LEN (256 * 1024)
+#define CONFIG "{\"interval\": 60}"
+
+typedef struct
+{
+  SemaphoreHandle_t done;
+  uint32_t ok;
+  uint32_t mismatched;
+  uint32_t failed;
+} requests_t;
+
+static void config_task(void *arguments)
+{
+  requests_t *requests = (requests_t *)arguments;
+  for (int i = 0; i < REQUESTS_PER_TASK; i++)
+  {
+    char config[64];
+    size_t config_len = 0;
+    providore_err_t result = i % 2 == 0 ? providore_get_config(NULL, NULL, sizeof(config), config, &config_len) : providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len);
+    if (result != PROVIDORE_OK)
+    {
+      __atomic_add_fetch(&requests->failed, 1, __ATOMIC_ACQ_REL);
+    }
+    else if (config_len != strlen(CONFIG) || strcmp(config, CONFIG) != 0)
+    {
+      __atomic_add_fetch(&requests->mismatched, 1, __ATOMIC_ACQ_REL);
+    }
+    else
+    {
+      __atomic_add_fetch(&requests->ok, 1, __ATOMIC_ACQ_REL);
+    }
+  }
+  xSemaphoreGive(requests->done);
+  vTaskDelete(NULL);
+}
+
+// Tasks sharing the one session take turns on its connection, and each gets its own response
+static void test_concurrent_config()
+{
+  test_server_t server = {.config = CONFIG, .etag = "\"v1\"", .chunk_len = 3};
+  test_server_start(&server);
+  test_identity();
+  providore_load_identity();
+
+  requests_t requests = {.done = xSemaphoreCreateCounting(TASKS, 0)};
+  for (int i = 0; i < TASKS; i++)
+  {
+    TEST_ASSERT_EQUAL_INT(pdPASS, xTaskCreate(config_task, "config", 16384, &requests, 1, NULL));
+  }
+  for (int i = 0; i < TASKS; i++)
+  {
+    xSemaphoreTake(requests.done, portMAX_DELAY);
+  }
+  vSemaphoreDelete(requests.done);
+
+  TEST_ASSERT_EQUAL_INT(TASKS * REQUESTS_PER_TASK, requests.ok);
+  TEST_ASSERT_EQUAL_INT(0, requests.mismatched);
+  TEST_ASSERT_EQUAL_INT(0, server.unsigned_requests);
+  host_http_stats_t stats;
+  host_http_stats(&stats);
+  TEST_ASSERT_EQUAL_INT(1, stats.connections);
+}
+
+// Hints are read while other tasks' requests are under way, and are always those of a finished response
+static void test_hints_during_requests()
+{
+  test_server_t server = {.config = CONFIG, .poll_interval = 200, .chunk_len = 3};
+  test_server_start(&server);
+  test_identity();
+  providore_load_identity();
+  char config[64];
+  size_t config_len = 0;
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(NULL, NULL, sizeof(config), config, &config_len));
+
+  requests_t requests = {.done = xSemaphoreCreateCounting(TASKS, 0)};
+  for (int i = 0; i < TASKS; i++)
+  {
+    TEST_ASSERT_EQUAL_INT(pdPASS, xTaskCreate(config_task, "config", 16384, &requests, 1, NULL));
+  }
+  uint32_t unexpected = 0;
+  for (int finished = 0; finished < TASKS;)
+  {
+    uint32_t poll_interval;
+    uint32_t retry_after;
+    providore_server_hints(&poll_interval, &retry_after);
+    unexpected += poll_interval != 200 || retry_after != 0;
+    finished += xSemaphoreTake(requests.done, 0) == pdTRUE;
+  }
+  vSemaphoreDelete(requests.done);
+
+  TEST_ASSERT_EQUAL_INT(TASKS * REQUESTS_PER_TASK, requests.ok);
+  TEST_ASSERT_EQUAL_INT(0, unexpected);
+}
+
+typedef struct
+{
+  uint32_t scheduled;
+  uint32_t scheduled_failures;
+  uint32_t pushed;
+  uint32_t firmware;
+} background_t;
+
+static void on_scheduled(providore_err_t result, const char *config, size_t config_len, void *user_data)
+{
+  background_t *background = (background_t *)user_data;
+  __atomic_add_fetch(&background->scheduled, 1, __ATOMIC_ACQ_REL);
+  if (result != PROVIDORE_OK)
+  {
+    __atomic_add_fetch(&background->scheduled_failures, 1, __ATOMIC_ACQ_REL);
+  }
+}
+
+static void on_firmware(providore_err_t result, void *user_data)
+{
+  background_t *background = (background_t *)user_data;
+  __atomic_add_fetch(&background->firmware, 1, __ATOMIC_ACQ_REL);
+}
+
+static void on_pushed(const char *config, size_t config_len, void *user_data)
+{
+  background_t *background = (background_t *)user_data;
+  __atomic_add_fetch(&background->pushed, 1, __ATOMIC_ACQ_REL);
+}
+
+static char scheduled_config[64];
+static char pushed_config[64];
+
+// The poll scheduler, config push and the application all making requests at once
+static void test_scheduler_push_and_requests()
+{
+  uint8_t *running = test_image(RUNNING_LEN, 1);
+  test_running_image(running, RUNNING_LEN);
+  test_server_t server = {.config = CONFIG, .etag = "\"v1\"", .manifest = true, .version = "1.0.0", .image = running, .image_len = RUNNING_LEN};
+  test_server_start(&server);
+  test_identity();
+  providore_load_identity();
+  host_freertos_virtual_time(true);
+
+  background_t background = {0};
+  providore_scheduler_config_t schedule = {
+      .interval = 30,
+      .backoff_min = 10,
+      .backoff_max = 60,
+      .config = scheduled_config,
+      .config_max_len = sizeof(scheduled_config),
+      .on_config = on_scheduled,
+      .firmware = true,
+      .on_firmware = on_firmware,
+      .user_data = &background};
+  providore_push_config_t push = {
+      .interval = 20,
+      .backoff_min = 10,
+      .backoff_max = 60,
+      .config = pushed_config,
+      .config_max_len = sizeof(pushed_config),
+      .on_config = on_pushed,
+      .user_data = &background};
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_scheduler_start(&schedule));
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_push_start(&push));
+
+  requests_t requests = {.done = xSemaphoreCreateCounting(2, 0)};
+  for (int i = 0; i < 2; i++)
+  {
+    TEST_ASSERT_EQUAL_INT(pdPASS, xTaskCreate(config_task, "config", 16384, &requests, 1, NULL));
+  }
+  for (int i = 0; i < 2; i++)
+  {
+    xSemaphoreTake(requests.done, portMAX_DELAY);
+  }
+  vSemaphoreDelete(requests.done);
+  // Clear of the poll at 300, which would otherwise race the stop
+  vTaskDelay(315 * configTICK_RATE_HZ);
+  providore_scheduler_stop();
+  providore_push_stop();
+  while (host_freertos_running_tasks() > 0)
+  {
+    usleep(1000);
+  }
+
+  TEST_ASSERT_EQUAL_INT(2 * REQUESTS_PER_TASK, requests.ok);
+  // At 0, 30, ... 300, each with a firmware check
+  TEST_ASSERT_EQUAL_INT(11, background.scheduled);
+  TEST_ASSERT_EQUAL_INT(0, background.scheduled_failures);
+  TEST_ASSERT_EQUAL_INT(background.scheduled, background.firmware);
+  // Only the first config is new to the push task
+  TEST_ASSERT_EQUAL_INT(1, background.pushed);
+  TEST_ASSERT_EQUAL_STRING(CONFIG, pushed_config);
+  TEST_ASSERT_EQUAL_INT(0, server.unsigned_requests);
+  free(running);
+}
+
+typedef struct
+{
+  SemaphoreHandle_t done;
+  uint32_t ok;
+  uint32_t busy;
+} upgrades_t;
+
+static void upgrade_task(void *arguments)
+{
+  upgrades_t *upgrades = (upgrades_t *)arguments;
+  providore_err_t result = providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK);
+  __atomic_add_fetch(result == PROVIDORE_OK ? &upgrades->ok : &upgrades->busy, 1, __ATOMIC_ACQ_REL);
+  xSemaphoreGive(upgrades->done);
+  vTaskDelete(NULL);
+}
+
+// Upgrades started together: one downloads, the rest are turned away
+static void test_concurrent_upgrades()
+{
+  uint8_t *running = test_image(RUNNING_LEN, 1);
+  test_running_image(running, RUNNING_LEN);
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  test_server_t server = {.manifest = true, .image = image, .image_len = IMAGE_LEN, .chunk_len = 4096, .chunk_delay_ms = 2};
+  test_server_start(&server);
+  test_identity();
+
+  upgrades_t upgrades = {.done = xSemaphoreCreateCounting(TASKS, 0)};
+  for (int i = 0; i < TASKS; i++)
+  {
+    TEST_ASSERT_EQUAL_INT(pdPASS, xTaskCreate(upgrade_task, "upgrade", 16384, &upgrades, 1, NULL));
+  }
+  for (int i = 0; i < TASKS; i++)
+  {
+    xSemaphoreTake(upgrades.done, portMAX_DELAY);
+  }
+  vSemaphoreDelete(upgrades.done);
+
+  TEST_ASSERT_EQUAL_INT(1, upgrades.ok);
+  TEST_ASSERT_EQUAL_INT(TASKS - 1, upgrades.busy);
+  TEST_ASSERT_EQUAL_INT(1, server.firmware_requests);
+  host_flash_stats_t stats;
+  host_flash_stats(&stats);
+  TEST_ASSERT_EQUAL_INT(1, stats.concurrent_writes);
+  free(image);
+  free(running);
+}
+
+int main()
+{
+  RUN_TEST(test_concurrent_config);
+  RUN_TEST(test_hints_during_requests);
+  RUN_TEST(test_scheduler_push_and_requests);
+  RUN_TEST(test_concurrent_upgrades);
+  return test_end();
+}
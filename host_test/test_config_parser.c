@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <string.h>
+#include "config_parser.h"
+#include "test.h"
+#include "test_support.h"
+
+// Every value the parser calls back with, as key=value lines
+typedef struct
+{
+  char log[2048];
+  size_t len;
+  uint32_t values;
+} parsed_t;
+
+static void parsed_value(const char *key, const config_value_t *value, void *user_data)
+{
+  parsed_t *parsed = (parsed_t *)user_data;
+  char *output = parsed->log + parsed->len;
+  size_t remaining = sizeof(parsed->log) - parsed->len;
+  switch (value->type)
+  {
+  case CONFIG_VALUE_STRING:
+    parsed->len += snprintf(output, remaining, "%s=\"%.*s\"\n", key, (int)value->string_len, value->string);
+    break;
+  case CONFIG_VALUE_INTEGER:
+    parsed->len += snprintf(output, remaining, "%s=%lld\n", key, (long long)value->integer);
+    break;
+  case CONFIG_VALUE_NUMBER:
+    parsed->len += snprintf(output, remaining, "%s=%g\n", key, value->number);
+    break;
+  case CONFIG_VALUE_BOOL:
+    parsed->len += snprintf(output, remaining, "%s=%s\n", key, value->boolean ? "true" : "false");
+    break;
+  case CONFIG_VALUE_NULL:
+    parsed->len += snprintf(output, remaining, "%s=null\n", key);
+    break;
+  }
+  parsed->values++;
+}
+
+// Feeds json in pieces of chunk_len bytes, as it would arrive over HTTP
+static esp_err_t parse(const char *json, size_t chunk_len, parsed_t *parsed)
+{
+  config_parser_t parser;
+  memset(parsed, 0, sizeof(parsed_t));
+  config_parser_begin(&parser, parsed_value, parsed);
+  size_t len = strlen(json);
+  for (size_t offset = 0; offset < len; offset += chunk_len)
+  {
+    esp_err_t result = config_parser_write(&parser, json + offset, len - offset < chunk_len ? len - offset : chunk_len);
+    if (result != ESP_OK)
+    {
+      return result;
+    }
+  }
+  return config_parser_finish(&parser);
+}
+
+static const char *nested = "{\"wifi\": {\"ssid\": \"home\", \"channels\": [1, 6, 11]},\n"
+                            " \"sensors\": [{\"pin\": 4, \"scale\": 0.5}, {\"pin\": -2, \"scale\": 1e3}],\n"
+                            " \"enabled\": true, \"debug\": false, \"name\": null, \"empty\": {}, \"none\": []}";
+
+static const char *nested_values = "wifi.ssid=\"home\"\n"
+                                   "wifi.channels[0]=1\n"
+                                   "wifi.channels[1]=6\n"
+                                   "wifi.channels[2]=11\n"
+                                   "sensors[0].pin=4\n"
+                                   "sensors[0].scale=0.5\n"
+                                   "sensors[1].pin=-2\n"
+                                   "sensors[1].scale=1000\n"
+                                   "enabled=true\n"
+                                   "debug=false\n"
+                                   "name=null\n";
+
+static void test_nested_paths()
+{
+  parsed_t parsed;
+  TEST_ASSERT_EQUAL_INT(ESP_OK, parse(nested, strlen(nested), &parsed));
+  TEST_ASSERT_EQUAL_STRING(nested_values, parsed.log);
+}
+
+// Chunk boundaries can fall anywhere, including inside keys, numbers and escapes
+static void test_any_chunk_size()
+{
+  parsed_t parsed;
+  for (size_t chunk_len = 1; chunk_len < 16; chunk_len++)
+  {
+    TEST_ASSERT_EQUAL_INT(ESP_OK, parse(nested, chunk_len, &parsed));
+    TEST_ASSERT_EQUAL_STRING(nested_values, parsed.log);
+  }
+}
+
+static void test_escapes()
+{
+  parsed_t parsed;
+  TEST_ASSERT_EQUAL_INT(ESP_OK, parse("{\"a\\\"b\": \"tab\\there\\n\\u00e9\\u20ac\\ud83d\\ude00\\/\"}", 3, &parsed));
+  TEST_ASSERT_EQUAL_STRING("a\"b=\"tab\there\n\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80/\"\n", parsed.log);
+}
+
+static void test_scalar_at_end()
+{
+  parsed_t parsed;
+  TEST_ASSERT_EQUAL_INT(ESP_OK, parse("42", 1, &parsed));
+  TEST_ASSERT_EQUAL_STRING("=42\n", parsed.log);
+  TEST_ASSERT_EQUAL_INT(ESP_OK, parse("true", 4, &parsed));
+  TEST_ASSERT_EQUAL_STRING("=true\n", parsed.log);
+}
+
+static void test_invalid()
+{
+  static const char *invalid[] = {
+      "{\"a\": }",
+      "{\"a\" 1}",
+      "[1, 2,, 3]",
+      "{\"a\": tru}",
+      "{\"a\": \"\\x\"}",
+      "{\"a\": \"\\ude00\"}",
+      "{\"a\": 1} x",
+      "{\"a\": \"line\nbreak\"}",
+  };
+  parsed_t parsed;
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+  {
+    TEST_ASSERT_MESSAGE(parse(invalid[i], 2, &parsed) != ESP_OK, "%s parsed", invalid[i]);
+  }
+}
+
+static void test_limits()
+{
+  parsed_t parsed;
+  char json[CONFIG_PARSER_VALUE_LEN + 64];
+
+  // Nesting one deeper than the stack
+  size_t len = 0;
+  for (int i = 0; i <= CONFIG_PARSER_DEPTH; i++)
+  {
+    json[len++] = '[';
+  }
+  json[len] = '\0';
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_SIZE, parse(json, 4, &parsed));
+
+  // A string that fills the value buffer, leaving no room for its terminator
+  len = sprintf(json, "{\"a\": \"");
+  memset(json + len, 'x', CONFIG_PARSER_VALUE_LEN);
+  strcpy(json + len + CONFIG_PARSER_VALUE_LEN, "\"}");
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_SIZE, parse(json, 64, &parsed));
+
+  // One shorter fits
+  strcpy(json + len + CONFIG_PARSER_VALUE_LEN - 1, "\"}");
+  TEST_ASSERT_EQUAL_INT(ESP_OK, parse(json, 64, &parsed));
+  TEST_ASSERT_EQUAL_INT(1, parsed.values);
+}
+
+static void test_ended_early()
+{
+  parsed_t parsed;
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_SIZE, parse("{\"a\": [1, 2", 4, &parsed));
+  TEST_ASSERT_EQUAL_INT(2, parsed.values);
+}
+
+static void test_error_is_sticky()
+{
+  config_parser_t parser;
+  parsed_t parsed;
+  memset(&parsed, 0, sizeof(parsed));
+  config_parser_begin(&parser, parsed_value, &parsed);
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_RESPONSE, config_parser_write(&parser, "{]", 2));
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_STATE, config_parser_write(&parser, "}", 1));
+}
+
+int main()
+{
+  RUN_TEST(test_nested_paths);
+  RUN_TEST(test_any_chunk_size);
+  RUN_TEST(test_escapes);
+  RUN_TEST(test_scalar_at_end);
+  RUN_TEST(test_invalid);
+  RUN_TEST(test_limits);
+  RUN_TEST(test_ended_early);
+  RUN_TEST(test_error_is_sticky);
+  return test_end();
+}
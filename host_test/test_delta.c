@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "delta.h"
+#include "test.h"
+#include "test_support.h"
+
+#define IMAGE_LEN (256 * 1024)
+#define BENCH_IMAGE_LEN (HOST_FLASH_PARTITION_SIZE - 4096)
+
+// What the patch rebuilt, as ota.c would have written it to flash
+typedef struct
+{
+  uint8_t *data;
+  size_t len;
+  size_t capacity;
+  uint32_t writes;
+  esp_err_t result;
+} rebuilt_t;
+
+static esp_err_t rebuilt_write(void *user_data, const void *data, size_t data_len)
+{
+  rebuilt_t *rebuilt = (rebuilt_t *)user_data;
+  if (rebuilt->result != ESP_OK)
+  {
+    return rebuilt->result;
+  }
+  if (rebuilt->data != NULL && rebuilt->len + data_len <= rebuilt->capacity)
+  {
+    memcpy(rebuilt->data + rebuilt->len, data, data_len);
+  }
+  rebuilt->len += data_len;
+  rebuilt->writes++;
+  return ESP_OK;
+}
+
+static esp_err_t apply(const uint8_t *patch_data, size_t patch_len, size_t chunk_len, rebuilt_t *rebuilt)
+{
+  delta_patch_t patch;
+  delta_patch_begin(&patch, host_flash_partition(0), rebuilt_write, rebuilt);
+  for (size_t offset = 0; offset < patch_len; offset += chunk_len)
+  {
+    esp_err_t result = delta_patch_write(&patch, patch_data + offset, patch_len - offset < chunk_len ? patch_len - offset : chunk_len);
+    if (result != ESP_OK)
+    {
+      return result;
+    }
+  }
+  return delta_patch_finish(&patch);
+}
+
+// The new firmware: the running one with a few changed regions, and longer
+static uint8_t *new_image(const uint8_t *running, size_t running_len, size_t len)
+{
+  uint8_t *image = test_image(len, 2);
+  memcpy(image, running, running_len < len ? running_len : len);
+  for (size_t offset = 16 * 1024; offset + 256 < running_len; offset += 64 * 1024)
+  {
+    for (size_t i = 0; i < 256; i++)
+    {
+      image[offset + i] ^= (uint8_t)(i + 1);
+    }
+  }
+  host_flash_image_header(image, len);
+  return image;
+}
+
+static void test_rebuilds_image()
+{
+  uint8_t *running = test_image(IMAGE_LEN, 1);
+  test_running_image(running, IMAGE_LEN);
+  uint8_t *target = new_image(running, IMAGE_LEN, IMAGE_LEN + 10000);
+  uint8_t *patch;
+  size_t patch_len = test_delta(running, IMAGE_LEN, target, IMAGE_LEN + 10000, &patch);
+
+  // Commands and data split at every kind of boundary
+  static const size_t chunk_lens[] = {1, 7, 9, 1000, 4096, SIZE_MAX};
+  for (size_t i = 0; i < sizeof(chunk_lens) / sizeof(chunk_lens[0]); i++)
+  {
+    rebuilt_t rebuilt = {.data = malloc(IMAGE_LEN + 10000), .capacity = IMAGE_LEN + 10000};
+    TEST_ASSERT_EQUAL_INT(ESP_OK, apply(patch, patch_len, chunk_lens[i], &rebuilt));
+    TEST_ASSERT_EQUAL_INT(IMAGE_LEN + 10000, rebuilt.len);
+    TEST_ASSERT_EQUAL_MEMORY(target, rebuilt.data, rebuilt.len);
+    free(rebuilt.data);
+  }
+  free(patch);
+  free(target);
+  free(running);
+}
+
+static void test_invalid_patches()
+{
+  uint8_t *running = test_image(IMAGE_LEN, 1);
+  test_running_image(running, IMAGE_LEN);
+  uint8_t *patch;
+  size_t patch_len = test_delta(running, IMAGE_LEN, running, IMAGE_LEN, &patch);
+  rebuilt_t rebuilt = {0};
+
+  // Cut off before END
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_SIZE, apply(patch, patch_len - DELTA_COMMAND_LEN, 64, &rebuilt));
+
+  // Anything after END
+  uint8_t *longer = malloc(patch_len + 1);
+  memcpy(longer, patch, patch_len);
+  longer[patch_len] = 0;
+  memset(&rebuilt, 0, sizeof(rebuilt));
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_SIZE, apply(longer, patch_len + 1, 64, &rebuilt));
+  free(longer);
+
+  // The image size in the header is smaller than the commands rebuild
+  patch[4] = 0x10;
+  patch[5] = patch[6] = patch[7] = 0;
+  memset(&rebuilt, 0, sizeof(rebuilt));
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_SIZE, apply(patch, patch_len, 64, &rebuilt));
+  TEST_ASSERT(rebuilt.len <= 0x10);
+
+  // Copying past the end of the running partition
+  static const uint8_t past_end[] = {'P', 'D', 'L', 'T', 0, 1, 0, 0, DELTA_COPY, 0, 0xf0, 0x0f, 0, 0, 0x20, 0, 0};
+  memset(&rebuilt, 0, sizeof(rebuilt));
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_ARG, apply(past_end, sizeof(past_end), 64, &rebuilt));
+  TEST_ASSERT_EQUAL_INT(0, rebuilt.len);
+
+  static const uint8_t unknown[] = {'P', 'D', 'L', 'T', 0, 1, 0, 0, 9, 0, 0, 0, 0, 0, 0, 0, 0};
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_ARG, apply(unknown, sizeof(unknown), 64, &rebuilt));
+
+  // Not a patch at all
+  patch[0] = 'X';
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_ARG, apply(patch, patch_len, 64, &rebuilt));
+  free(patch);
+  free(running);
+}
+
+static void test_write_error_propagates()
+{
+  uint8_t *running = test_image(IMAGE_LEN, 1);
+  test_running_image(running, IMAGE_LEN);
+  uint8_t *patch;
+  size_t patch_len = test_delta(running, IMAGE_LEN, running, IMAGE_LEN, &patch);
+  rebuilt_t rebuilt = {.result = ESP_ERR_FLASH_OP_FAIL};
+
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_FLASH_OP_FAIL, apply(patch, patch_len, 4096, &rebuilt));
+  TEST_ASSERT_EQUAL_INT(0, rebuilt.len);
+  free(patch);
+  free(running);
+}
+
+typedef struct
+{
+  const uint8_t *patch;
+  size_t patch_len;
+  esp_err_t result;
+} bench_run_t;
+
+static void bench_apply(void *arguments)
+{
+  bench_run_t *run = (bench_run_t *)arguments;
+  rebuilt_t rebuilt = {0};
+  run->result = apply(run->patch, run->patch_len, 1436, &rebuilt);
+}
+
+// Patching speed and the RAM it takes, for a near full partition. Nothing is
+// allocated, so the RAM is the patch state itself plus stack.
+static void test_bench_throughput_and_ram()
+{
+  uint8_t *running = test_image(BENCH_IMAGE_LEN, 1);
+  test_running_image(running, BENCH_IMAGE_LEN);
+  uint8_t *target = new_image(running, BENCH_IMAGE_LEN, BENCH_IMAGE_LEN);
+  bench_run_t run = {0};
+  run.patch_len = test_delta(running, BENCH_IMAGE_LEN, target, BENCH_IMAGE_LEN, (uint8_t **)&run.patch);
+
+  uint64_t allocations = test_allocations();
+  int64_t started = test_now_us();
+  bench_apply(&run);
+  int64_t elapsed_us = test_now_us() - started;
+  allocations = test_allocations() - allocations;
+  TEST_ASSERT_EQUAL_INT(ESP_OK, run.result);
+  TEST_ASSERT_EQUAL_INT(0, allocations);
+
+  size_t stack = test_stack_peak(bench_apply, &run);
+  TEST_ASSERT_EQUAL_INT(ESP_OK, run.result);
+  printf("BENCH delta: %zu byte patch rebuilt %u bytes in %lld us, %.1f MB/s, %llu allocations, %zu bytes state, %zu bytes host stack\n",
+         run.patch_len, BENCH_IMAGE_LEN, (long long)elapsed_us, BENCH_IMAGE_LEN / (double)(elapsed_us > 0 ? elapsed_us : 1), (unsigned long long)allocations,
+         sizeof(delta_patch_t), stack);
+  free((void *)run.patch);
+  free(target);
+  free(running);
+}
+
+int main()
+{
+  RUN_TEST(test_rebuilds_image);
+  RUN_TEST(test_invalid_patches);
+  RUN_TEST(test_write_error_propagates);
+  RUN_TEST(test_bench_throughput_and_ram);
+  return test_end();
+}
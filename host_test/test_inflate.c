@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+#include "inflate.h"
+#include "test.h"
+#include "test_support.h"
+
+#define IMAGE_LEN (200 * 1024)
+#define BENCH_IMAGE_LEN (HOST_FLASH_PARTITION_SIZE - 4096)
+
+typedef struct
+{
+  uint8_t *data;
+  size_t len;
+  size_t capacity;
+  esp_err_t result;
+} inflated_t;
+
+static esp_err_t inflated_write(void *user_data, const void *data, size_t data_len)
+{
+  inflated_t *inflated = (inflated_t *)user_data;
+  if (inflated->result != ESP_OK)
+  {
+    return inflated->result;
+  }
+  if (inflated->data != NULL && inflated->len + data_len <= inflated->capacity)
+  {
+    memcpy(inflated->data + inflated->len, data, data_len);
+  }
+  inflated->len += data_len;
+  return ESP_OK;
+}
+
+// The stream holds its window, so it lives on the heap as it does in ota.c
+static esp_err_t decompress(inflate_format_t format, const uint8_t *data, size_t len, size_t chunk_len, inflated_t *inflated)
+{
+  inflate_stream_t *stream = malloc(sizeof(inflate_stream_t));
+  inflate_begin(stream, format, inflated_write, inflated);
+  esp_err_t result = ESP_OK;
+  for (size_t offset = 0; offset < len && result == ESP_OK; offset += chunk_len)
+  {
+    result = inflate_write(stream, data + offset, len - offset < chunk_len ? len - offset : chunk_len);
+  }
+  if (result == ESP_OK)
+  {
+    result = inflate_finish(stream);
+  }
+  free(stream);
+  return result;
+}
+
+static void test_formats()
+{
+  uint8_t *image = test_image(IMAGE_LEN, 1);
+  static const size_t chunk_lens[] = {1, 3, 1436, 4096, SIZE_MAX};
+  for (int gzip = 0; gzip < 2; gzip++)
+  {
+    uint8_t *compressed;
+    size_t compressed_len = test_compress(image, IMAGE_LEN, gzip, &compressed);
+    TEST_ASSERT(compressed_len < IMAGE_LEN);
+    for (size_t i = 0; i < sizeof(chunk_lens) / sizeof(chunk_lens[0]); i++)
+    {
+      // A byte at a time through the whole image is slow and proves nothing more
+      size_t len = chunk_lens[i] == 1 ? compressed_len / 8 : compressed_len;
+      inflated_t inflated = {.data = malloc(IMAGE_LEN), .capacity = IMAGE_LEN};
+      esp_err_t result = decompress(gzip ? INFLATE_GZIP : INFLATE_DEFLATE, compressed, len, chunk_lens[i], &inflated);
+      if (len == compressed_len)
+      {
+        TEST_ASSERT_EQUAL_INT(ESP_OK, result);
+        TEST_ASSERT_EQUAL_INT(IMAGE_LEN, inflated.len);
+      }
+      else
+      {
+        TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_SIZE, result);
+      }
+      TEST_ASSERT_EQUAL_MEMORY(image, inflated.data, inflated.len);
+      free(inflated.data);
+    }
+    free(compressed);
+  }
+  free(image);
+}
+
+// A gzip stream with every optional header field, which servers rarely send
+static void test_gzip_optional_fields()
+{
+  static const char *message = "optional header fields are skipped";
+  uint8_t stream[256];
+  size_t len = 0;
+  static const uint8_t header[] = {0x1f, 0x8b, 8, (1 << 1) | (1 << 2) | (1 << 3) | (1 << 4), 0, 0, 0, 0, 0, 3};
+  memcpy(stream, header, sizeof(header));
+  len = sizeof(header);
+  // FEXTRA of 5 bytes, FNAME, FCOMMENT and FHCRC
+  stream[len++] = 5;
+  stream[len++] = 0;
+  memcpy(stream + len, "ABCDE", 5);
+  len += 5;
+  memcpy(stream + len, "image.bin", 10);
+  len += 10;
+  memcpy(stream + len, "a comment", 10);
+  len += 10;
+  stream[len++] = 0x12;
+  stream[len++] = 0x34;
+
+  z_stream deflater;
+  memset(&deflater, 0, sizeof(deflater));
+  deflateInit2(&deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+  deflater.next_in = (Bytef *)message;
+  deflater.avail_in = strlen(message);
+  deflater.next_out = stream + len;
+  deflater.avail_out = sizeof(stream) - len - 8;
+  deflate(&deflater, Z_FINISH);
+  len += deflater.total_out;
+  deflateEnd(&deflater);
+  // The trailer isn't checked
+  memset(stream + len, 0, 8);
+  len += 8;
+
+  for (size_t chunk_len = 1; chunk_len < 32; chunk_len++)
+  {
+    char output[64] = {0};
+    inflated_t inflated = {.data = (uint8_t *)output, .capacity = sizeof(output) - 1};
+    TEST_ASSERT_EQUAL_INT(ESP_OK, decompress(INFLATE_GZIP, stream, len, chunk_len, &inflated));
+    TEST_ASSERT_EQUAL_STRING(message, output);
+  }
+}
+
+static void test_invalid()
+{
+  uint8_t *image = test_image(IMAGE_LEN, 1);
+  uint8_t *compressed;
+  size_t compressed_len = test_compress(image, IMAGE_LEN, true, &compressed);
+  inflated_t inflated = {0};
+
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_SIZE, decompress(INFLATE_GZIP, compressed, compressed_len - 100, 512, &inflated));
+
+  // Data after the trailer
+  uint8_t *longer = malloc(compressed_len + 4);
+  memcpy(longer, compressed, compressed_len);
+  memset(longer + compressed_len, 0, 4);
+  memset(&inflated, 0, sizeof(inflated));
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_SIZE, decompress(INFLATE_GZIP, longer, compressed_len + 4, 512, &inflated));
+  free(longer);
+
+  // zlib's header isn't gzip's
+  free(compressed);
+  compressed_len = test_compress(image, IMAGE_LEN, false, &compressed);
+  memset(&inflated, 0, sizeof(inflated));
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_RESPONSE, decompress(INFLATE_GZIP, compressed, compressed_len, 512, &inflated));
+  TEST_ASSERT_EQUAL_INT(0, inflated.len);
+
+  // A corrupt block
+  memset(compressed + 64, 0xff, 32);
+  memset(&inflated, 0, sizeof(inflated));
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_RESPONSE, decompress(INFLATE_DEFLATE, compressed, compressed_len, 512, &inflated));
+  free(compressed);
+  free(image);
+}
+
+static void test_write_error_propagates()
+{
+  uint8_t *image = test_image(IMAGE_LEN, 1);
+  uint8_t *compressed;
+  size_t compressed_len = test_compress(image, IMAGE_LEN, false, &compressed);
+  inflated_t inflated = {.result = ESP_ERR_FLASH_OP_FAIL};
+
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_FLASH_OP_FAIL, decompress(INFLATE_DEFLATE, compressed, compressed_len, 1436, &inflated));
+  free(compressed);
+  free(image);
+}
+
+static esp_err_t discard_write(void *user_data, const void *data, size_t data_len)
+{
+  return ESP_OK;
+}
+
+// What compression saves on the wire against what inflating costs, per format.
+// CPU time is for inflating alone, as though the body had already arrived.
+static void test_bench_wire_bytes_and_cpu()
+{
+  uint8_t *image = test_image(BENCH_IMAGE_LEN, 1);
+  for (int gzip = 0; gzip < 2; gzip++)
+  {
+    uint8_t *compressed;
+    size_t compressed_len = test_compress(image, BENCH_IMAGE_LEN, gzip, &compressed);
+    inflate_stream_t *stream = malloc(sizeof(inflate_stream_t));
+
+    clock_t cpu = clock();
+    int64_t started = test_now_us();
+    inflate_begin(stream, gzip ? INFLATE_GZIP : INFLATE_DEFLATE, discard_write, NULL);
+    esp_err_t result = ESP_OK;
+    for (size_t offset = 0; offset < compressed_len && result == ESP_OK; offset += 1436)
+    {
+      result = inflate_write(stream, compressed + offset, compressed_len - offset < 1436 ? compressed_len - offset : 1436);
+    }
+    if (result == ESP_OK)
+    {
+      result = inflate_finish(stream);
+    }
+    int64_t wall_us = test_now_us() - started;
+    double cpu_ms = (clock() - cpu) * 1000.0 / CLOCKS_PER_SEC;
+    TEST_ASSERT_EQUAL_INT(ESP_OK, result);
+    TEST_ASSERT_EQUAL_INT(BENCH_IMAGE_LEN, stream->inflated);
+
+    printf("BENCH inflate %s: %u bytes image, %zu bytes on the wire (%.0f%%), %.1f ms CPU, %.1f ms wall, %.1f MB/s inflated, %zu bytes state\n",
+           gzip ? "gzip" : "deflate", BENCH_IMAGE_LEN, compressed_len, compressed_len * 100.0 / BENCH_IMAGE_LEN, cpu_ms, wall_us / 1000.0,
+           BENCH_IMAGE_LEN / (double)(wall_us > 0 ? wall_us : 1), sizeof(inflate_stream_t));
+    free(stream);
+    free(compressed);
+  }
+  free(image);
+}
+
+int main()
+{
+  RUN_TEST(test_formats);
+  RUN_TEST(test_gzip_optional_fields);
+  RUN_TEST(test_invalid);
+  RUN_TEST(test_write_error_propagates);
+  RUN_TEST(test_bench_wire_bytes_and_cpu);
+  return test_end();
+}
@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ota_checkpoint.h"
+#include "ota_pipeline.h"
+#include "signature.h"
+#include "signer.h"
+#include "test.h"
+#include "test_support.h"
+
+#define IMAGE_LEN (256 * 1024)
+// A typical TCP segment, which is what esp_http_client hands over at a time
+#define HTTP_CHUNK_LEN 1436
+
+typedef struct
+{
+  providore_signer_t signer;
+  signature_verifier_t verifier;
+  ota_checkpoint_t checkpoint;
+  esp_ota_handle_t ota_handle;
+  const esp_partition_t *partition;
+  uint8_t *image;
+  char signature[TEST_SIGNATURE_LEN];
+} update_t;
+
+static void update_begin(update_t *update, size_t image_len)
+{
+  memset(update, 0, sizeof(update_t));
+  update->image = test_image(image_len, 2);
+  test_sign(TEST_PSK, update->image, image_len, TEST_CREATED_AT, TEST_EXPIRY, update->signature);
+  providore_signer_init(&update->signer, TEST_DEVICE_ID, TEST_PSK);
+  signature_verify_begin(&update->verifier, &update->signer);
+  update->partition = host_flash_partition(1);
+  update->checkpoint.partition_address = update->partition->address;
+  esp_ota_begin(update->partition, image_len, &update->ota_handle);
+}
+
+static void update_end(update_t *update)
+{
+  signature_verify_free(&update->verifier);
+  free(update->image);
+}
+
+// Hands data over in HTTP sized pieces, with a pause before each as the network would
+static esp_err_t download(ota_pipeline_t *pipeline, const uint8_t *data, size_t len, size_t chunk_len, TickType_t network_ticks)
+{
+  esp_err_t result = ESP_OK;
+  for (size_t offset = 0; offset < len && result == ESP_OK; offset += chunk_len)
+  {
+    if (network_ticks > 0)
+    {
+      vTaskDelay(network_ticks);
+    }
+    result = ota_pipeline_write(pipeline, data + offset, len - offset < chunk_len ? len - offset : chunk_len);
+  }
+  return result;
+}
+
+static bool flash_matches(const esp_partition_t *partition, const uint8_t *image, size_t len)
+{
+  uint8_t *flash = malloc(len);
+  host_flash_read(partition, 0, flash, len);
+  bool matches = memcmp(flash, image, len) == 0;
+  free(flash);
+  return matches;
+}
+
+static void test_writes_and_verifies_image()
+{
+  update_t update;
+  update_begin(&update, IMAGE_LEN);
+  ota_pipeline_t *pipeline = ota_pipeline_create(update.ota_handle, update.partition, &update.checkpoint, &update.verifier);
+  TEST_ASSERT(pipeline != NULL);
+
+  TEST_ASSERT_EQUAL_INT(ESP_OK, download(pipeline, update.image, IMAGE_LEN, HTTP_CHUNK_LEN, 0));
+  TEST_ASSERT_EQUAL_INT(ESP_OK, ota_pipeline_finish(pipeline));
+  TEST_ASSERT_EQUAL_INT(IMAGE_LEN, pipeline->written);
+  ota_pipeline_destroy(pipeline);
+
+  TEST_ASSERT_EQUAL_INT(ESP_OK, esp_ota_end(update.ota_handle));
+  TEST_ASSERT(flash_matches(update.partition, update.image, IMAGE_LEN));
+  // The verifier is fed what was written to flash
+  TEST_ASSERT(signature_verify_finish(&update.verifier, TEST_CREATED_AT, TEST_EXPIRY, update.signature));
+  update_end(&update);
+}
+
+// However the body is chunked, flash is written a whole sector at a time,
+// starting on a sector boundary
+static void test_writes_coalesced_into_sectors()
+{
+  static const size_t chunk_lens[] = {1, 100, HTTP_CHUNK_LEN, 4095, 4097, 16384};
+  for (size_t i = 0; i < sizeof(chunk_lens) / sizeof(chunk_lens[0]); i++)
+  {
+    host_reset();
+    update_t update;
+    size_t image_len = IMAGE_LEN + 1000;
+    update_begin(&update, image_len);
+    ota_pipeline_t *pipeline = ota_pipeline_create(update.ota_handle, update.partition, &update.checkpoint, &update.verifier);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, download(pipeline, update.image, image_len, chunk_lens[i], 0));
+    TEST_ASSERT_EQUAL_INT(ESP_OK, ota_pipeline_finish(pipeline));
+    ota_pipeline_destroy(pipeline);
+
+    host_flash_stats_t stats;
+    host_flash_stats(&stats);
+    TEST_ASSERT_EQUAL_INT((image_len + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE, stats.writes);
+    for (uint32_t write = 0; write < stats.writes && write < HOST_FLASH_WRITE_LOG; write++)
+    {
+      TEST_ASSERT_EQUAL_INT(0, (stats.log[write].address - update.partition->address) % SPI_FLASH_SEC_SIZE);
+      TEST_ASSERT_EQUAL_INT(write + 1 < stats.writes ? SPI_FLASH_SEC_SIZE : image_len % SPI_FLASH_SEC_SIZE, stats.log[write].len);
+    }
+    TEST_ASSERT_EQUAL_INT(0, stats.dirty_writes);
+    TEST_ASSERT_EQUAL_INT(1, stats.concurrent_writes);
+    TEST_ASSERT(flash_matches(update.partition, update.image, image_len));
+    esp_ota_abort(update.ota_handle);
+    update_end(&update);
+  }
+}
+
+// With slow flash the download blocks rather than buffering without limit,
+// and the network and flash overlap rather than taking turns. Timed in virtual
+// time, so the figures are exact however busy the host is.
+static void test_backpressure_and_overlap()
+{
+  const TickType_t flash_ticks = 2;
+  const TickType_t network_ticks = 1;
+  const uint32_t sectors = IMAGE_LEN / SPI_FLASH_SEC_SIZE;
+  const uint32_t chunks = (IMAGE_LEN + HTTP_CHUNK_LEN - 1) / HTTP_CHUNK_LEN;
+  update_t update;
+  update_begin(&update, IMAGE_LEN);
+  host_flash_latency(flash_ticks * 1000000 / configTICK_RATE_HZ, 0);
+  host_freertos_virtual_time(true);
+
+  // As fast as the network allows, the download is held to the pace of flash
+  ota_pipeline_t *pipeline = ota_pipeline_create(update.ota_handle, update.partition, &update.checkpoint, &update.verifier);
+  TickType_t started = xTaskGetTickCount();
+  TEST_ASSERT_EQUAL_INT(ESP_OK, download(pipeline, update.image, IMAGE_LEN, HTTP_CHUNK_LEN, 0));
+  TickType_t blocked = xTaskGetTickCount() - started;
+  TEST_ASSERT_EQUAL_INT(ESP_OK, ota_pipeline_finish(pipeline));
+  ota_pipeline_destroy(pipeline);
+  TEST_ASSERT_EQUAL_INT((sectors - OTA_PIPELINE_BUFFERS) * flash_ticks, blocked);
+  esp_ota_abort(update.ota_handle);
+  update_end(&update);
+
+  host_reset();
+  update_begin(&update, IMAGE_LEN);
+  host_flash_latency(flash_ticks * 1000000 / configTICK_RATE_HZ, 0);
+  host_freertos_virtual_time(true);
+  pipeline = ota_pipeline_create(update.ota_handle, update.partition, &update.checkpoint, &update.verifier);
+  started = xTaskGetTickCount();
+  TEST_ASSERT_EQUAL_INT(ESP_OK, download(pipeline, update.image, IMAGE_LEN, HTTP_CHUNK_LEN, network_ticks));
+  TEST_ASSERT_EQUAL_INT(ESP_OK, ota_pipeline_finish(pipeline));
+  TickType_t overlapped = xTaskGetTickCount() - started;
+  ota_pipeline_destroy(pipeline);
+
+  // The network is the slower here, so overlapped the update takes as long as
+  // the download and then the last sector, where taking turns would take both
+  TEST_ASSERT_EQUAL_INT(chunks * network_ticks + flash_ticks, overlapped);
+  esp_ota_abort(update.ota_handle);
+  update_end(&update);
+}
+
+// A failed flash write comes back to the download, which stops rather than
+// blocking on a writer that has given up
+static void test_flash_error_propagates()
+{
+  update_t update;
+  update_begin(&update, IMAGE_LEN);
+  host_flash_fail_after(3, ESP_ERR_FLASH_OP_FAIL);
+  host_flash_latency(500, 0);
+  ota_pipeline_t *pipeline = ota_pipeline_create(update.ota_handle, update.partition, &update.checkpoint, &update.verifier);
+
+  size_t offset = 0;
+  esp_err_t result = ESP_OK;
+  for (; offset < IMAGE_LEN && result == ESP_OK; offset += HTTP_CHUNK_LEN)
+  {
+    result = ota_pipeline_write(pipeline, update.image + offset, HTTP_CHUNK_LEN);
+  }
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_FLASH_OP_FAIL, result);
+  // Found out within the buffers that were already queued
+  TEST_ASSERT(offset <= (3 + 1 + OTA_PIPELINE_BUFFERS + 1) * SPI_FLASH_SEC_SIZE);
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_FLASH_OP_FAIL, ota_pipeline_write(pipeline, update.image, HTTP_CHUNK_LEN));
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_FLASH_OP_FAIL, ota_pipeline_finish(pipeline));
+  TEST_ASSERT_EQUAL_INT(3 * SPI_FLASH_SEC_SIZE, pipeline->written);
+  ota_pipeline_destroy(pipeline);
+  esp_ota_abort(update.ota_handle);
+  update_end(&update);
+}
+
+// Dropping a download part way, as ota.c does on an HTTP error, stops the writer
+static void test_destroy_part_way()
+{
+  update_t update;
+  update_begin(&update, IMAGE_LEN);
+  host_flash_latency(1000, 0);
+  ota_pipeline_t *pipeline = ota_pipeline_create(update.ota_handle, update.partition, &update.checkpoint, &update.verifier);
+  TEST_ASSERT_EQUAL_INT(ESP_OK, download(pipeline, update.image, 10 * SPI_FLASH_SEC_SIZE + 100, HTTP_CHUNK_LEN, 0));
+  ota_pipeline_destroy(pipeline);
+
+  host_flash_stats_t stats;
+  host_flash_stats(&stats);
+  TEST_ASSERT(stats.writes <= 11);
+  esp_ota_abort(update.ota_handle);
+  update_end(&update);
+}
+
+// Checkpoints are taken on sector boundaries as the download goes, and a new
+// pipeline without an OTA handle carries on from the last one
+static void test_checkpoint_and_resume()
+{
+  update_t update;
+  update_begin(&update, IMAGE_LEN);
+  ota_pipeline_t *pipeline = ota_pipeline_create(update.ota_handle, update.partition, &update.checkpoint, &update.verifier);
+  TEST_ASSERT_EQUAL_INT(ESP_OK, download(pipeline, update.image, 200 * 1024, HTTP_CHUNK_LEN, 0));
+  TEST_ASSERT_EQUAL_INT(ESP_OK, ota_pipeline_finish(pipeline));
+  ota_pipeline_destroy(pipeline);
+  esp_ota_abort(update.ota_handle);
+
+  // As though after a reboot
+  ota_checkpoint_t checkpoint;
+  TEST_ASSERT_EQUAL_INT(ESP_OK, ota_checkpoint_load(&checkpoint));
+  TEST_ASSERT_EQUAL_INT(3 * CONFIG_PROVIDORE_OTA_CHECKPOINT_INTERVAL * 1024, checkpoint.offset);
+  TEST_ASSERT_EQUAL_INT(update.partition->address, checkpoint.partition_address);
+
+  // Whatever was written past the checkpoint is written again, over erased flash
+  signature_verifier_t resumed;
+  TEST_ASSERT(signature_verify_resume(&resumed, &update.signer, &checkpoint.hash));
+  pipeline = ota_pipeline_create(0, update.partition, &checkpoint, &resumed);
+  TEST_ASSERT_EQUAL_INT(ESP_OK, download(pipeline, update.image + checkpoint.offset, IMAGE_LEN - checkpoint.offset, HTTP_CHUNK_LEN, 0));
+  TEST_ASSERT_EQUAL_INT(ESP_OK, ota_pipeline_finish(pipeline));
+  ota_pipeline_destroy(pipeline);
+
+  host_flash_stats_t stats;
+  host_flash_stats(&stats);
+  TEST_ASSERT_EQUAL_INT(0, stats.dirty_writes);
+  TEST_ASSERT(flash_matches(update.partition, update.image, IMAGE_LEN));
+  TEST_ASSERT(signature_verify_finish(&resumed, TEST_CREATED_AT, TEST_EXPIRY, update.signature));
+  signature_verify_free(&resumed);
+  update_end(&update);
+}
+
+// What each call into the pipeline costs the HTTP handler, and each sector the
+// writer, for the chunk sizes a download could arrive in
+static void test_bench_cost_per_call_and_sector()
+{
+  static const size_t chunk_lens[] = {512, HTTP_CHUNK_LEN, 4096, 16384};
+  const size_t image_len = HOST_FLASH_PARTITION_SIZE - SPI_FLASH_SEC_SIZE;
+  for (size_t i = 0; i < sizeof(chunk_lens) / sizeof(chunk_lens[0]); i++)
+  {
+    host_reset();
+    update_t update;
+    update_begin(&update, image_len);
+    ota_pipeline_t *pipeline = ota_pipeline_create(update.ota_handle, update.partition, &update.checkpoint, &update.verifier);
+    size_t calls = (image_len + chunk_lens[i] - 1) / chunk_lens[i];
+
+    int64_t started = test_now_us();
+    TEST_ASSERT_EQUAL_INT(ESP_OK, download(pipeline, update.image, image_len, chunk_lens[i], 0));
+    int64_t handler_us = test_now_us() - started;
+    TEST_ASSERT_EQUAL_INT(ESP_OK, ota_pipeline_finish(pipeline));
+    int64_t total_us = test_now_us() - started;
+
+    host_flash_stats_t stats;
+    host_flash_stats(&stats);
+    printf("BENCH pipeline %zu byte chunks: %zu calls at %.2f us, %u flash writes at %.2f us a sector, %.1f MB/s\n", chunk_lens[i], calls,
+           handler_us / (double)calls, stats.writes, pipeline->flash_us / (double)stats.writes, image_len / (double)(total_us > 0 ? total_us : 1));
+    TEST_ASSERT_EQUAL_INT(image_len / SPI_FLASH_SEC_SIZE, stats.writes);
+    ota_pipeline_destroy(pipeline);
+    esp_ota_abort(update.ota_handle);
+    update_end(&update);
+  }
+}
+
+int main()
+{
+  RUN_TEST(test_writes_and_verifies_image);
+  RUN_TEST(test_writes_coalesced_into_sectors);
+  RUN_TEST(test_backpressure_and_overlap);
+  RUN_TEST(test_flash_error_propagates);
+  RUN_TEST(test_destroy_part_way);
+  RUN_TEST(test_checkpoint_and_resume);
+  RUN_TEST(test_bench_cost_per_call_and_sector);
+  return test_end();
+}
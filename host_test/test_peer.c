@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_http_client.h"
+#include "esp_ota_ops.h"
+#include "providore.h"
+#include "test.h"
+#include "test_support.h"
+
+#define RUNNING_LEN (128 * 1024)
+#define IMAGE_LEN (256 * 1024)
+#define NEIGHBOUR "http://10.0.0.2:8070/"
+
+static uint8_t *running_image()
+{
+  uint8_t *running = test_image(RUNNING_LEN, 1);
+  test_running_image(running, RUNNING_LEN);
+  return running;
+}
+
+static bool boot_partition_holds(const uint8_t *image, size_t len)
+{
+  const esp_partition_t *boot = esp_ota_get_boot_partition();
+  if (boot == NULL || boot->address != host_flash_partition(1)->address)
+  {
+    return false;
+  }
+  uint8_t *flash = malloc(len);
+  host_flash_read(boot, 0, flash, len);
+  bool matches = memcmp(flash, image, len) == 0;
+  free(flash);
+  return matches;
+}
+
+// A neighbour sharing an image, signed by the server as it was when the neighbour downloaded it
+typedef struct
+{
+  const uint8_t *image;
+  size_t image_len;
+  uint32_t requests;
+} neighbour_t;
+
+static void neighbour_handle(const host_http_request_t *request, host_http_response_t *response, void *user_data)
+{
+  neighbour_t *neighbour = (neighbour_t *)user_data;
+  __atomic_add_fetch(&neighbour->requests, 1, __ATOMIC_ACQ_REL);
+  test_sign_response(response, TEST_PSK, neighbour->image, neighbour->image_len);
+  host_http_set_header(response, "Content-Type", "application/octet-stream");
+  response->body = neighbour->image;
+  response->body_len = neighbour->image_len;
+  response->chunk_len = 1024;
+  response->chunked = true;
+}
+
+typedef struct
+{
+  uint8_t *body;
+  size_t len;
+  size_t capacity;
+  char created_at[32];
+  char expiry[32];
+  char signature[TEST_SIGNATURE_LEN];
+} download_t;
+
+static esp_err_t download_event(esp_http_client_event_t *evt)
+{
+  download_t *download = (download_t *)evt->user_data;
+  if (evt->event_id == HTTP_EVENT_ON_HEADER)
+  {
+    if (strcmp(evt->header_key, "created-at") == 0)
+    {
+      snprintf(download->created_at, sizeof(download->created_at), "%s", evt->header_value);
+    }
+    if (strcmp(evt->header_key, "expiry") == 0)
+    {
+      snprintf(download->expiry, sizeof(download->expiry), "%s", evt->header_value);
+    }
+    if (strcmp(evt->header_key, "signature") == 0)
+    {
+      snprintf(download->signature, sizeof(download->signature), "%s", evt->header_value);
+    }
+  }
+  if (evt->event_id == HTTP_EVENT_ON_DATA && download->len + evt->data_len <= download->capacity)
+  {
+    memcpy(download->body + download->len, evt->data, evt->data_len);
+    download->len += evt->data_len;
+  }
+  return ESP_OK;
+}
+
+// What a neighbour gets asking this device for an image
+static int fetch_shared(const char *sha256, download_t *download)
+{
+  char url[160];
+  snprintf(url, sizeof(url), "http://127.0.0.1:%u" PEER_FIRMWARE_PATH "?sha256=%s", CONFIG_PROVIDORE_PEER_PORT, sha256);
+  esp_http_client_config_t config = {.url = url, .event_handler = download_event, .user_data = download};
+  esp_http_client_handle_t client = esp_http_client_init(&config);
+  esp_err_t result = esp_http_client_perform(client);
+  int status = result == ESP_OK ? esp_http_client_get_status_code(client) : -1;
+  esp_http_client_cleanup(client);
+  return status;
+}
+
+// Once downloaded and verified, the image is advertised and served to neighbours
+// with the server's signature, and still is after a reboot
+static void test_shares_downloaded_image()
+{
+  uint8_t *running = running_image();
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  char sha256[TEST_SHA256_LEN];
+  test_image_sha256(image, IMAGE_LEN, sha256);
+  test_server_t server = {.manifest = true, .image = image, .image_len = IMAGE_LEN};
+  test_server_start(&server);
+  test_identity();
+
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_peer_start());
+  TEST_ASSERT_EQUAL_STRING("", host_mdns_advertised());
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+  TEST_ASSERT_EQUAL_INT(1, server.firmware_requests);
+  TEST_ASSERT_EQUAL_STRING(sha256, host_mdns_advertised());
+  // That is the digest IDF appends to the image, as the manifest names it
+  char appended[TEST_SHA256_LEN];
+  for (int i = 0; i < 32; i++)
+  {
+    sprintf(appended + i * 2, "%02x", image[IMAGE_LEN - 32 + i]);
+  }
+  TEST_ASSERT_EQUAL_STRING(appended, host_mdns_advertised());
+
+  download_t download = {.body = malloc(IMAGE_LEN), .capacity = IMAGE_LEN};
+  TEST_ASSERT_EQUAL_INT(200, fetch_shared(sha256, &download));
+  TEST_ASSERT_EQUAL_INT(IMAGE_LEN, download.len);
+  TEST_ASSERT_EQUAL_MEMORY(image, download.body, IMAGE_LEN);
+  char expected[TEST_SIGNATURE_LEN];
+  test_sign(TEST_PSK, image, IMAGE_LEN, download.created_at, download.expiry, expected);
+  TEST_ASSERT_EQUAL_STRING(expected, download.signature);
+
+  // Only the image asked for is served
+  download_t other = {.body = malloc(16), .capacity = 16};
+  TEST_ASSERT_EQUAL_INT(404, fetch_shared("0000000000000000000000000000000000000000000000000000000000000000", &other));
+  free(other.body);
+
+  providore_peer_stop();
+  TEST_ASSERT_EQUAL_STRING("", host_mdns_advertised());
+  host_flash_reboot();
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_peer_start());
+  TEST_ASSERT_EQUAL_STRING(sha256, host_mdns_advertised());
+  download.len = 0;
+  TEST_ASSERT_EQUAL_INT(200, fetch_shared(sha256, &download));
+  TEST_ASSERT_EQUAL_MEMORY(image, download.body, IMAGE_LEN);
+  free(download.body);
+  free(image);
+  free(running);
+}
+
+// A neighbour advertising the image saves downloading it from the server
+static void test_fetches_from_neighbour()
+{
+  uint8_t *running = running_image();
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  char sha256[TEST_SHA256_LEN];
+  test_image_sha256(image, IMAGE_LEN, sha256);
+  test_server_t server = {.manifest = true, .image = image, .image_len = IMAGE_LEN};
+  test_server_start(&server);
+  test_identity();
+  neighbour_t neighbour = {.image = image, .image_len = IMAGE_LEN};
+  host_http_route(NEIGHBOUR, neighbour_handle, &neighbour);
+  host_mdns_add_peer("10.0.0.2", CONFIG_PROVIDORE_PEER_PORT, sha256);
+
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_peer_start());
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+  TEST_ASSERT_EQUAL_INT(1, neighbour.requests);
+  TEST_ASSERT_EQUAL_INT(1, server.manifest_requests);
+  TEST_ASSERT_EQUAL_INT(0, server.firmware_requests);
+  TEST_ASSERT(boot_partition_holds(image, IMAGE_LEN));
+  // And passes it on
+  TEST_ASSERT_EQUAL_STRING(sha256, host_mdns_advertised());
+  free(image);
+  free(running);
+}
+
+// An image from a neighbour that isn't the one in the manifest is never booted
+static void test_falls_back_to_server()
+{
+  uint8_t *running = running_image();
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  uint8_t *other = test_image(IMAGE_LEN, 3);
+  char sha256[TEST_SHA256_LEN];
+  test_image_sha256(image, IMAGE_LEN, sha256);
+  test_server_t server = {.manifest = true, .image = image, .image_len = IMAGE_LEN};
+  test_server_start(&server);
+  test_identity();
+  neighbour_t neighbour = {.image = other, .image_len = IMAGE_LEN};
+  host_http_route(NEIGHBOUR, neighbour_handle, &neighbour);
+  host_mdns_add_peer("10.0.0.2", CONFIG_PROVIDORE_PEER_PORT, sha256);
+
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_peer_start());
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+  TEST_ASSERT_EQUAL_INT(1, neighbour.requests);
+  TEST_ASSERT_EQUAL_INT(1, server.firmware_requests);
+  TEST_ASSERT(boot_partition_holds(image, IMAGE_LEN));
+  free(other);
+  free(image);
+  free(running);
+}
+
+// Without the sharing server running, a device doesn't look for neighbours
+static void test_only_when_sharing()
+{
+  uint8_t *running = running_image();
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  char sha256[TEST_SHA256_LEN];
+  test_image_sha256(image, IMAGE_LEN, sha256);
+  test_server_t server = {.manifest = true, .image = image, .image_len = IMAGE_LEN};
+  test_server_start(&server);
+  test_identity();
+  neighbour_t neighbour = {.image = image, .image_len = IMAGE_LEN};
+  host_http_route(NEIGHBOUR, neighbour_handle, &neighbour);
+  host_mdns_add_peer("10.0.0.2", CONFIG_PROVIDORE_PEER_PORT, sha256);
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+  TEST_ASSERT_EQUAL_INT(0, neighbour.requests);
+  TEST_ASSERT_EQUAL_INT(1, server.firmware_requests);
+  TEST_ASSERT_EQUAL_STRING("", host_mdns_advertised());
+  free(image);
+  free(running);
+}
+
+int main()
+{
+  RUN_TEST(test_shares_downloaded_image);
+  RUN_TEST(test_fetches_from_neighbour);
+  RUN_TEST(test_falls_back_to_server);
+  RUN_TEST(test_only_when_sharing);
+  return test_end();
+}
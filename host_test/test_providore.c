@@ -0,0 +1,695 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mbedtls/sha256.h"
+#include "nvs.h"
+#include "ota.h"
+#include "providore.h"
+#include "test.h"
+#include "test_support.h"
+
+// The running image, which has to be the same for every test in the process
+#define RUNNING_LEN (128 * 1024)
+#define IMAGE_LEN (320 * 1024)
+#define CONFIG "{\"interval\": 60, \"wifi\": {\"ssid\": \"home\", \"channel\": 6}}"
+
+static uint8_t *running_image()
+{
+  uint8_t *running = test_image(RUNNING_LEN, 1);
+  test_running_image(running, RUNNING_LEN);
+  return running;
+}
+
+static bool boot_partition_holds(const uint8_t *image, size_t len)
+{
+  const esp_partition_t *boot = esp_ota_get_boot_partition();
+  if (boot == NULL || boot->address != host_flash_partition(1)->address)
+  {
+    return false;
+  }
+  uint8_t *flash = malloc(len);
+  host_flash_read(boot, 0, flash, len);
+  bool matches = memcmp(flash, image, len) == 0;
+  free(flash);
+  return matches;
+}
+
+static bool still_boots_running_image()
+{
+  const esp_partition_t *boot = esp_ota_get_boot_partition();
+  return boot != NULL && boot->address == host_flash_partition(0)->address;
+}
+
+static void test_get_config()
+{
+  char config[128];
+  size_t config_len = 0;
+  test_server_t server = {.config = CONFIG};
+  test_server_start(&server);
+  test_identity();
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len));
+  TEST_ASSERT_EQUAL_STRING(CONFIG, config);
+  TEST_ASSERT_EQUAL_INT(strlen(CONFIG), config_len);
+
+  // The identity saved in NVS signs requests without passing it each time
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_load_identity());
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(NULL, NULL, sizeof(config), config, &config_len));
+  TEST_ASSERT_EQUAL_INT(0, server.unsigned_requests);
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_RESPONSE_TOO_LARGE, providore_get_config(NULL, NULL, 16, config, &config_len));
+  server.bad_signature = true;
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_SIG_MISMATCH, providore_get_config(NULL, NULL, sizeof(config), config, &config_len));
+  server.bad_signature = false;
+  server.config_status = 500;
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_SIG_MISMATCH, providore_get_config(NULL, NULL, sizeof(config), config, &config_len));
+
+  // Signed with the wrong key, the server turns it away
+  server.config_status = 0;
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_SIG_MISMATCH, providore_get_config(TEST_DEVICE_ID, "not the key", sizeof(config), config, &config_len));
+  TEST_ASSERT_EQUAL_INT(1, server.unsigned_requests);
+
+  // With nothing listening the request never reaches a server to verify
+  host_reset();
+  test_identity();
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_CONNECTION_FAIL, providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len));
+}
+
+static void test_config_cache()
+{
+  char config[128];
+  size_t config_len = 0;
+  test_server_t server = {.config = CONFIG, .etag = "\"v1\""};
+  test_server_start(&server);
+  test_identity();
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len));
+  TEST_ASSERT_EQUAL_INT(0, server.not_modified);
+
+  // Unchanged, so the server skips the body and it comes from NVS
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len));
+  TEST_ASSERT_EQUAL_INT(1, server.not_modified);
+  TEST_ASSERT_EQUAL_STRING(CONFIG, config);
+  TEST_ASSERT_EQUAL_INT(strlen(CONFIG), config_len);
+
+  // A cached copy that no longer matches its signature is fetched again in full
+  nvs_handle_t handle;
+  nvs_open("providore", NVS_READWRITE, &handle);
+  nvs_set_blob(handle, "config_body", "{\"interval\": 1}", 15);
+  nvs_commit(handle);
+  nvs_close(handle);
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len));
+  TEST_ASSERT_EQUAL_STRING(CONFIG, config);
+  TEST_ASSERT_EQUAL_INT(2, server.not_modified);
+  TEST_ASSERT_EQUAL_INT(4, server.config_requests);
+
+  // A changed config replaces the cached one
+  server.config = "{\"interval\": 120}";
+  server.etag = "\"v2\"";
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len));
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len));
+  TEST_ASSERT_EQUAL_STRING("{\"interval\": 120}", config);
+  TEST_ASSERT_EQUAL_INT(3, server.not_modified);
+}
+
+typedef struct
+{
+  int interval;
+  char ssid[32];
+  int fields;
+} parsed_t;
+
+static void parsed_field(const char *key, const config_value_t *value, void *user_data)
+{
+  parsed_t *parsed = (parsed_t *)user_data;
+  parsed->fields++;
+  if (strcmp(key, "interval") == 0 && value->type == CONFIG_VALUE_INTEGER)
+  {
+    parsed->interval = (int)value->integer;
+  }
+  if (strcmp(key, "wifi.ssid") == 0 && value->type == CONFIG_VALUE_STRING)
+  {
+    snprintf(parsed->ssid, sizeof(parsed->ssid), "%s", value->string);
+  }
+}
+
+static void test_get_config_parsed()
+{
+  parsed_t parsed = {0};
+  test_server_t server = {.config = CONFIG, .chunk_len = 7};
+  test_server_start(&server);
+  test_identity();
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config_parsed(TEST_DEVICE_ID, TEST_PSK, parsed_field, &parsed));
+  TEST_ASSERT_EQUAL_INT(60, parsed.interval);
+  TEST_ASSERT_EQUAL_STRING("home", parsed.ssid);
+  TEST_ASSERT_EQUAL_INT(3, parsed.fields);
+
+  server.config = "{\"interval\": ";
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_INVALID_CONFIG, providore_get_config_parsed(TEST_DEVICE_ID, TEST_PSK, parsed_field, &parsed));
+  server.config = CONFIG;
+  server.bad_signature = true;
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_SIG_MISMATCH, providore_get_config_parsed(TEST_DEVICE_ID, TEST_PSK, parsed_field, &parsed));
+}
+
+static char *large_config(size_t len)
+{
+  char *config = malloc(len + 1);
+  memset(config, 'x', len);
+  memcpy(config, "{\"blob\": \"", 10);
+  memcpy(config + len - 2, "\"}", 2);
+  config[len] = '\0';
+  return config;
+}
+
+// Bigger than any fixed output buffer would be, up to the internal RAM limit
+static void test_get_config_buffer()
+{
+  size_t len = (CONFIG_PROVIDORE_BUFFER_INTERNAL_LIMIT - 8) * 1024;
+  char *config = large_config(len);
+  test_server_t server = {.config = config, .chunk_len = 1436};
+  test_server_start(&server);
+  test_identity();
+
+  providore_buffer_t buffer;
+  char *copy = malloc(len);
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config_buffer(TEST_DEVICE_ID, TEST_PSK, &buffer));
+  TEST_ASSERT_EQUAL_INT(len, buffer.len);
+  TEST_ASSERT_EQUAL_INT(len, providore_buffer_read(&buffer, 0, copy, len));
+  TEST_ASSERT_EQUAL_MEMORY(config, copy, len);
+  providore_buffer_free(&buffer);
+  free(copy);
+  free(config);
+
+  // Past the limit it fails rather than taking the rest of the heap
+  config = large_config((CONFIG_PROVIDORE_BUFFER_INTERNAL_LIMIT + 8) * 1024);
+  server.config = config;
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_NO_MEM, providore_get_config_buffer(TEST_DEVICE_ID, TEST_PSK, &buffer));
+  providore_buffer_free(&buffer);
+  buffer_pool_trim();
+  buffer_pool_usage_t usage;
+  buffer_pool_usage(&usage);
+  TEST_ASSERT_EQUAL_INT(0, usage.internal_bytes);
+  free(config);
+}
+
+static void test_sync()
+{
+  static const char *names[] = {"config", "certificates", "unused"};
+  static const char *bodies[] = {"{\"interval\": 60}", "-----BEGIN CERTIFICATE-----", "ignored"};
+  uint8_t *body;
+  size_t body_len = test_sync_body(names, bodies, 3, &body);
+  test_server_t server = {.sync = body, .sync_len = body_len, .chunk_len = 5};
+  test_server_start(&server);
+  test_identity();
+
+  parsed_t parsed = {0};
+  config_parser_t parser;
+  config_parser_begin(&parser, parsed_field, &parsed);
+  providore_buffer_t certificates;
+  providore_buffer_init(&certificates);
+  sync_handler_t handlers[] = {{"config", sync_parser_part, &parser}, {"certificates", sync_buffer_part, &certificates}};
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_sync(TEST_DEVICE_ID, TEST_PSK, handlers, 2));
+  TEST_ASSERT_EQUAL_STRING("/sync?resources=config,certificates", server.sync_path);
+  TEST_ASSERT_EQUAL_INT(60, parsed.interval);
+  char certificate[64] = {0};
+  providore_buffer_read(&certificates, 0, certificate, sizeof(certificate) - 1);
+  TEST_ASSERT_EQUAL_STRING("-----BEGIN CERTIFICATE-----", certificate);
+  providore_buffer_free(&certificates);
+
+  server.bad_signature = true;
+  providore_buffer_init(&certificates);
+  config_parser_begin(&parser, parsed_field, &parsed);
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_SIG_MISMATCH, providore_sync(TEST_DEVICE_ID, TEST_PSK, handlers, 2));
+  providore_buffer_free(&certificates);
+  free(body);
+}
+
+static void test_firmware_manifest()
+{
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  char sha256[TEST_SHA256_LEN];
+  test_image_sha256(image, IMAGE_LEN, sha256);
+  test_server_t server = {.manifest = true, .version = "2.1.0", .image = image, .image_len = IMAGE_LEN};
+  test_server_start(&server);
+  test_identity();
+
+  firmware_manifest_t manifest;
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_manifest(TEST_DEVICE_ID, TEST_PSK, &manifest));
+  TEST_ASSERT_EQUAL_STRING("2.1.0", manifest.version);
+  TEST_ASSERT_EQUAL_INT(IMAGE_LEN, manifest.size);
+  TEST_ASSERT_EQUAL_STRING(sha256, manifest.sha256);
+
+  server.manifest = false;
+  TEST_ASSERT(providore_firmware_manifest(TEST_DEVICE_ID, TEST_PSK, &manifest) != PROVIDORE_OK);
+  free(image);
+}
+
+// As on IDF, an app partition's SHA-256 is the digest appended to the image,
+// which covers everything before it, and only an image without one is hashed
+// whole. That is what the manifest and the delta base are matched against.
+static void test_image_sha256_is_idf_digest()
+{
+  uint8_t *running = running_image();
+  uint8_t digest[32];
+  char hex[TEST_SHA256_LEN];
+  char whole_hex[TEST_SHA256_LEN];
+  mbedtls_sha256_ret(running, RUNNING_LEN - sizeof(digest), digest, 0);
+  TEST_ASSERT_EQUAL_INT(1, running[HOST_IMAGE_HASH_APPENDED]);
+  TEST_ASSERT_EQUAL_INT(0, memcmp(digest, running + RUNNING_LEN - sizeof(digest), sizeof(digest)));
+  for (int i = 0; i < 32; i++)
+  {
+    sprintf(hex + i * 2, "%02x", digest[i]);
+  }
+  mbedtls_sha256_ret(running, RUNNING_LEN, digest, 0);
+  for (int i = 0; i < 32; i++)
+  {
+    sprintf(whole_hex + i * 2, "%02x", digest[i]);
+  }
+  TEST_ASSERT_EQUAL_STRING(hex, providore_ota_running_sha256());
+  TEST_ASSERT(strcmp(whole_hex, providore_ota_running_sha256()) != 0);
+
+  // Without an appended digest the whole image is hashed
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  image[HOST_IMAGE_HASH_APPENDED] = 0;
+  host_flash_load(host_flash_partition(1), image, IMAGE_LEN);
+  mbedtls_sha256_ret(image, IMAGE_LEN, digest, 0);
+  uint8_t reported[32];
+  TEST_ASSERT_EQUAL_INT(ESP_OK, esp_partition_get_sha256(host_flash_partition(1), reported));
+  TEST_ASSERT_EQUAL_INT(0, memcmp(digest, reported, sizeof(digest)));
+
+  // And an image that doesn't match its digest isn't valid
+  image[HOST_IMAGE_HASH_APPENDED] = 1;
+  image[IMAGE_LEN / 2] ^= 0xff;
+  host_flash_load(host_flash_partition(1), image, IMAGE_LEN);
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, esp_partition_get_sha256(host_flash_partition(1), reported));
+  free(image);
+  free(running);
+}
+
+static void test_firmware_upgrade()
+{
+  uint8_t *running = running_image();
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  test_server_t server = {.manifest = true, .image = image, .image_len = IMAGE_LEN, .chunk_len = 1436};
+  test_server_start(&server);
+  test_identity();
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+  TEST_ASSERT(boot_partition_holds(image, IMAGE_LEN));
+  TEST_ASSERT_EQUAL_INT(1, server.manifest_requests);
+  TEST_ASSERT_EQUAL_INT(1, server.firmware_requests);
+
+  host_flash_stats_t stats;
+  host_flash_stats(&stats);
+  TEST_ASSERT_EQUAL_INT(1, stats.ota_begins);
+  TEST_ASSERT_EQUAL_INT(1, stats.ota_ends);
+  TEST_ASSERT_EQUAL_INT(0, stats.dirty_writes);
+  TEST_ASSERT_EQUAL_INT(1, stats.concurrent_writes);
+
+  // The manifest says the running firmware is current, so nothing is downloaded
+  server.image = running;
+  server.image_len = RUNNING_LEN;
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_NO_UPDATE, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+  TEST_ASSERT_EQUAL_INT(1, server.firmware_requests);
+  free(image);
+  free(running);
+}
+
+static void test_firmware_compressed()
+{
+  static const char *encodings[] = {"gzip", "deflate"};
+  uint8_t *running = running_image();
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  for (int i = 0; i < 2; i++)
+  {
+    host_reset();
+    test_running_image(running, RUNNING_LEN);
+    test_server_t server = {.manifest = true, .image = image, .image_len = IMAGE_LEN, .encoding = encodings[i], .chunk_len = 1436};
+    test_server_start(&server);
+    test_identity();
+
+    TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+    TEST_ASSERT_EQUAL_INT(1, server.compressed);
+    TEST_ASSERT(boot_partition_holds(image, IMAGE_LEN));
+  }
+  free(image);
+  free(running);
+}
+
+static void test_firmware_delta()
+{
+  uint8_t *running = running_image();
+  char running_sha256[TEST_SHA256_LEN];
+  test_image_sha256(running, RUNNING_LEN, running_sha256);
+
+  // The running image with a few blocks changed and more on the end
+  uint8_t *next = test_image(RUNNING_LEN + 16 * 1024, 3);
+  memcpy(next + HOST_IMAGE_HEADER_LEN, running + HOST_IMAGE_HEADER_LEN, RUNNING_LEN - HOST_IMAGE_HEADER_LEN);
+  memset(next + 10 * 1024, 0x5a, 3 * 1024);
+  memset(next + 90 * 1024, 0xa5, 1024);
+  host_flash_image_header(next, RUNNING_LEN + 16 * 1024);
+  uint8_t *delta;
+  size_t delta_len = test_delta(running, RUNNING_LEN, next, RUNNING_LEN + 16 * 1024, &delta);
+  TEST_ASSERT(delta_len < 32 * 1024);
+
+  test_server_t server = {.manifest = true, .image = next, .image_len = RUNNING_LEN + 16 * 1024, .delta = delta, .delta_len = delta_len, .delta_base = running_sha256, .chunk_len = 1436};
+  test_server_start(&server);
+  test_identity();
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+  TEST_ASSERT_EQUAL_INT(1, server.deltas);
+  TEST_ASSERT(boot_partition_holds(next, RUNNING_LEN + 16 * 1024));
+
+  // Compressed as well
+  host_reset();
+  test_running_image(running, RUNNING_LEN);
+  test_server_start(&server);
+  test_identity();
+  server.encoding = "gzip";
+  server.deltas = 0;
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+  TEST_ASSERT_EQUAL_INT(1, server.deltas);
+  TEST_ASSERT_EQUAL_INT(1, server.compressed);
+  TEST_ASSERT(boot_partition_holds(next, RUNNING_LEN + 16 * 1024));
+  free(delta);
+  free(next);
+  free(running);
+}
+
+// A dropped download picks up from its last checkpoint rather than starting again
+static void test_firmware_resumes()
+{
+  uint8_t *running = running_image();
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  test_server_t server = {.manifest = true, .image = image, .image_len = IMAGE_LEN, .firmware_etag = "\"fw-2\"", .ranges = true, .drop_after = 200 * 1024, .chunk_len = 1436};
+  test_server_start(&server);
+  test_identity();
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_FIRMWARE_FAIL, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+  TEST_ASSERT(still_boots_running_image());
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+  TEST_ASSERT_EQUAL_INT(1, server.ranges_served);
+  TEST_ASSERT_EQUAL_STRING("bytes=196608-", server.range);
+  TEST_ASSERT(boot_partition_holds(image, IMAGE_LEN));
+
+  // A changed image on the server can't be resumed, so it starts over
+  host_reset();
+  test_running_image(running, RUNNING_LEN);
+  test_server_start(&server);
+  test_identity();
+  server.drop_after = 200 * 1024;
+  server.ranges_served = 0;
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_FIRMWARE_FAIL, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+  server.firmware_etag = "\"fw-3\"";
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+  TEST_ASSERT_EQUAL_INT(0, server.ranges_served);
+  TEST_ASSERT(boot_partition_holds(image, IMAGE_LEN));
+  free(image);
+  free(running);
+}
+
+static void test_firmware_bad_signature()
+{
+  uint8_t *running = running_image();
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  test_server_t server = {.manifest = true, .image = image, .image_len = IMAGE_LEN, .bad_signature = true};
+  test_server_start(&server);
+  test_identity();
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_FIRMWARE_FAIL, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+  TEST_ASSERT(still_boots_running_image());
+  host_flash_stats_t stats;
+  host_flash_stats(&stats);
+  TEST_ASSERT_EQUAL_INT(0, stats.ota_ends);
+  free(image);
+  free(running);
+}
+
+// An error page must never reach the OTA partition
+static void test_firmware_error_page()
+{
+  uint8_t *running = running_image();
+  test_server_t server = {0};
+  test_server_start(&server);
+  test_identity();
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_FIRMWARE_FAIL, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+  host_flash_stats_t stats;
+  host_flash_stats(&stats);
+  TEST_ASSERT_EQUAL_INT(0, stats.ota_begins);
+  TEST_ASSERT_EQUAL_INT(0, stats.writes);
+  TEST_ASSERT(still_boots_running_image());
+  free(running);
+}
+
+typedef struct
+{
+  providore_err_t result;
+  uint32_t completed;
+  size_t downloaded;
+  size_t total;
+} completion_t;
+
+static void on_progress(size_t downloaded, size_t total, void *user_data)
+{
+  completion_t *completion = (completion_t *)user_data;
+  completion->downloaded = downloaded;
+  completion->total = total;
+}
+
+static void on_complete(providore_err_t result, void *user_data)
+{
+  completion_t *completion = (completion_t *)user_data;
+  completion->result = result;
+  __atomic_add_fetch(&completion->completed, 1, __ATOMIC_ACQ_REL);
+}
+
+static void wait_for(providore_request_t *request)
+{
+  while (providore_request_running(request))
+  {
+    vTaskDelay(1);
+  }
+}
+
+static void test_async()
+{
+  char config[128];
+  size_t config_len = 0;
+  uint8_t *running = running_image();
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  test_server_t server = {.config = CONFIG, .manifest = true, .image = image, .image_len = IMAGE_LEN, .chunk_len = 4096};
+  test_server_start(&server);
+  test_identity();
+  // The timeouts only run out while nothing is happening, however slow the host
+  host_freertos_virtual_time(true);
+
+  providore_request_t request;
+  completion_t completion = {0};
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config_async(&request, TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len, 5000, on_complete, &completion));
+  wait_for(&request);
+  TEST_ASSERT_EQUAL_INT(1, completion.completed);
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, completion.result);
+  TEST_ASSERT_EQUAL_STRING(CONFIG, config);
+
+  memset(&completion, 0, sizeof(completion));
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade_async(&request, TEST_DEVICE_ID, TEST_PSK, 5000, on_progress, on_complete, &completion));
+  wait_for(&request);
+  TEST_ASSERT_EQUAL_INT(1, completion.completed);
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, completion.result);
+  TEST_ASSERT_EQUAL_INT(IMAGE_LEN, completion.downloaded);
+  TEST_ASSERT_EQUAL_INT(IMAGE_LEN, completion.total);
+  TEST_ASSERT(boot_partition_holds(image, IMAGE_LEN));
+  free(image);
+  free(running);
+}
+
+// A slow download, stopped part way by cancelling it or by running out of time
+static void test_async_cancel_and_timeout()
+{
+  uint8_t *running = running_image();
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  test_server_t server = {.manifest = true, .image = image, .image_len = IMAGE_LEN, .chunk_len = 4096, .chunk_delay_ms = 20};
+  test_server_start(&server);
+  test_identity();
+  host_freertos_virtual_time(true);
+
+  providore_request_t request;
+  completion_t completion = {0};
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade_async(&request, TEST_DEVICE_ID, TEST_PSK, 0, on_progress, on_complete, &completion));
+  vTaskDelay(pdMS_TO_TICKS(300));
+  TEST_ASSERT(providore_request_running(&request));
+  providore_cancel(&request);
+  wait_for(&request);
+  TEST_ASSERT_EQUAL_INT(1, completion.completed);
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_CANCELLED, completion.result);
+  TEST_ASSERT(still_boots_running_image());
+
+  memset(&completion, 0, sizeof(completion));
+  TickType_t started = xTaskGetTickCount();
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade_async(&request, TEST_DEVICE_ID, TEST_PSK, 300, on_progress, on_complete, &completion));
+  wait_for(&request);
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_TIMEOUT, completion.result);
+  // At the first chunk after the time is up
+  TickType_t took = xTaskGetTickCount() - started;
+  TEST_ASSERT_MESSAGE(took >= pdMS_TO_TICKS(300) && took <= pdMS_TO_TICKS(320), "timed out after %u ticks", took);
+  TEST_ASSERT(still_boots_running_image());
+
+  host_flash_stats_t stats;
+  host_flash_stats(&stats);
+  TEST_ASSERT_EQUAL_INT(2, stats.ota_aborts);
+  free(image);
+  free(running);
+}
+
+// A server that goes quiet can't hold a request past its timeout, as the client gives up in time too
+static void test_async_timeout_while_waiting()
+{
+  char config[128];
+  size_t config_len = 0;
+  test_server_t server = {.config = CONFIG, .chunk_delay_ms = 3000};
+  test_server_start(&server);
+  test_identity();
+  host_freertos_virtual_time(true);
+
+  providore_request_t request;
+  completion_t completion = {0};
+  TickType_t started = xTaskGetTickCount();
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config_async(&request, TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len, 300, on_complete, &completion));
+  wait_for(&request);
+  TickType_t took = xTaskGetTickCount() - started;
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_TIMEOUT, completion.result);
+  TEST_ASSERT_MESSAGE(took >= pdMS_TO_TICKS(300) && took <= pdMS_TO_TICKS(320), "timed out after %u ticks", took);
+
+  // Requests without a timeout get the usual client back
+  server.chunk_delay_ms = 1000;
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len));
+  TEST_ASSERT_EQUAL_STRING(CONFIG, config);
+}
+
+// Only one upgrade can write to the OTA partition at a time
+static void test_upgrade_busy()
+{
+  uint8_t *running = running_image();
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  test_server_t server = {.manifest = true, .image = image, .image_len = IMAGE_LEN, .chunk_len = 4096, .chunk_delay_ms = 20};
+  test_server_start(&server);
+  test_identity();
+
+  providore_request_t request;
+  completion_t completion = {0};
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade_async(&request, TEST_DEVICE_ID, TEST_PSK, 0, NULL, on_complete, &completion));
+  usleep(100 * 1000);
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_BUSY, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+  providore_cancel(&request);
+  wait_for(&request);
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_CANCELLED, completion.result);
+
+  server.chunk_delay_ms = 0;
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK));
+  free(image);
+  free(running);
+}
+
+// A download holds its own connection, so config requests don't wait for it to finish
+static void test_config_during_upgrade()
+{
+  char config[128];
+  size_t config_len = 0;
+  uint8_t *running = running_image();
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  test_server_t server = {.config = CONFIG, .manifest = true, .image = image, .image_len = IMAGE_LEN, .chunk_len = 4096, .chunk_delay_ms = 50};
+  test_server_start(&server);
+  test_identity();
+  host_freertos_virtual_time(true);
+
+  providore_request_t request;
+  completion_t completion = {0};
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade_async(&request, TEST_DEVICE_ID, TEST_PSK, 0, NULL, on_complete, &completion));
+  while (__atomic_load_n(&server.firmware_requests, __ATOMIC_ACQUIRE) == 0)
+  {
+    vTaskDelay(1);
+  }
+  // The download takes 80 chunks of 50ms
+  TickType_t started = xTaskGetTickCount();
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len));
+  TickType_t took = xTaskGetTickCount() - started;
+  TEST_ASSERT_EQUAL_STRING(CONFIG, config);
+  TEST_ASSERT_MESSAGE(took < pdMS_TO_TICKS(500), "config took %u ticks", took);
+
+  wait_for(&request);
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, completion.result);
+  TEST_ASSERT(boot_partition_holds(image, IMAGE_LEN));
+  free(image);
+  free(running);
+}
+
+// Requests share a kept-alive connection, so there is one handshake rather than one a request
+static void test_connection_reuse()
+{
+  char config[128];
+  size_t config_len = 0;
+  test_server_t server = {.config = CONFIG};
+  test_server_start(&server);
+  test_identity();
+
+  for (int i = 0; i < 5; i++)
+  {
+    TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len));
+  }
+  host_http_stats_t stats;
+  host_http_stats(&stats);
+  TEST_ASSERT_EQUAL_INT(1, stats.connections);
+  TEST_ASSERT_EQUAL_INT(5, stats.requests);
+
+  providore_close_session();
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len));
+  host_http_stats(&stats);
+  TEST_ASSERT_EQUAL_INT(2, stats.connections);
+
+  // The server closing an idle connection costs one reconnect, not a failed request
+  host_http_drop_connections();
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len));
+  TEST_ASSERT_EQUAL_STRING(CONFIG, config);
+  host_http_stats(&stats);
+  TEST_ASSERT_EQUAL_INT(3, stats.connections);
+  TEST_ASSERT_EQUAL_INT(7, server.config_requests);
+
+  // A server that closes after every response costs a connection each time
+  server.close = true;
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len));
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len));
+  host_http_stats(&stats);
+  TEST_ASSERT_EQUAL_INT(4, stats.connections);
+}
+
+int main()
+{
+  RUN_TEST(test_get_config);
+  RUN_TEST(test_config_cache);
+  RUN_TEST(test_get_config_parsed);
+  RUN_TEST(test_get_config_buffer);
+  RUN_TEST(test_sync);
+  RUN_TEST(test_firmware_manifest);
+  RUN_TEST(test_image_sha256_is_idf_digest);
+  RUN_TEST(test_firmware_upgrade);
+  RUN_TEST(test_firmware_compressed);
+  RUN_TEST(test_firmware_delta);
+  RUN_TEST(test_firmware_resumes);
+  RUN_TEST(test_firmware_bad_signature);
+  RUN_TEST(test_firmware_error_page);
+  RUN_TEST(test_async);
+  RUN_TEST(test_async_cancel_and_timeout);
+  RUN_TEST(test_async_timeout_while_waiting);
+  RUN_TEST(test_upgrade_busy);
+  RUN_TEST(test_config_during_upgrade);
+  RUN_TEST(test_connection_reuse);
+  return test_end();
+}
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "providore.h"
+#include "scheduler.h"
+#include "test.h"
+#include "test_support.h"
+
+static const providore_scheduler_config_t policy = {
+    .interval = 300,
+    .jitter_percent = 0,
+    .backoff_min = 10,
+    .backoff_max = 160,
+};
+
+static void test_interval_and_server_hint()
+{
+  providore_scheduler_state_t state = {0};
+  TEST_ASSERT_EQUAL_INT(300, providore_scheduler_next_delay(&policy, &state, PROVIDORE_OK, 0, 0, 12345));
+  TEST_ASSERT_EQUAL_INT(45, providore_scheduler_next_delay(&policy, &state, PROVIDORE_OK, 45, 0, 12345));
+  TEST_ASSERT_EQUAL_INT(0, state.failures);
+}
+
+static void test_backoff_doubles_to_max()
+{
+  static const uint32_t expected[] = {10, 20, 40, 80, 160, 160, 160};
+  providore_scheduler_state_t state = {0};
+  for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+  {
+    TEST_ASSERT_EQUAL_INT(expected[i], providore_scheduler_next_delay(&policy, &state, PROVIDORE_CONNECTION_FAIL, 0, 0, 0));
+  }
+  TEST_ASSERT_EQUAL_INT(7, state.failures);
+
+  // Success starts over
+  TEST_ASSERT_EQUAL_INT(300, providore_scheduler_next_delay(&policy, &state, PROVIDORE_OK, 0, 0, 0));
+  TEST_ASSERT_EQUAL_INT(10, providore_scheduler_next_delay(&policy, &state, PROVIDORE_TIMEOUT, 0, 0, 0));
+
+  // Many failures in a row don't overflow
+  state.failures = 1000;
+  TEST_ASSERT_EQUAL_INT(160, providore_scheduler_next_delay(&policy, &state, PROVIDORE_TIMEOUT, 0, 0, 0));
+}
+
+static void test_jitter_bounds()
+{
+  providore_scheduler_config_t config = policy;
+  config.jitter_percent = 10;
+  providore_scheduler_state_t state = {0};
+  uint32_t low = UINT32_MAX;
+  uint32_t high = 0;
+  for (uint32_t random = 0; random < 1000; random++)
+  {
+    uint32_t delay = providore_scheduler_next_delay(&config, &state, PROVIDORE_OK, 0, 0, random * 2654435761u);
+    low = delay < low ? delay : low;
+    high = delay > high ? delay : high;
+  }
+  TEST_ASSERT_EQUAL_INT(270, low);
+  TEST_ASSERT_EQUAL_INT(330, high);
+
+  // Too short a delay to spread is left alone, and never 0
+  config.interval = 5;
+  TEST_ASSERT_EQUAL_INT(5, providore_scheduler_next_delay(&config, &state, PROVIDORE_OK, 0, 0, 7));
+  TEST_ASSERT_EQUAL_INT(1, providore_scheduler_next_delay(&config, &state, PROVIDORE_OK, 1, 0, 7));
+}
+
+static void test_retry_after_is_a_floor()
+{
+  providore_scheduler_config_t config = policy;
+  config.jitter_percent = 50;
+  providore_scheduler_state_t state = {0};
+  for (uint32_t random = 0; random < 100; random++)
+  {
+    TEST_ASSERT(providore_scheduler_next_delay(&config, &state, PROVIDORE_CONNECTION_FAIL, 0, 600, random) >= 600);
+  }
+  // A shorter Retry-After doesn't bring the next poll forward
+  state.failures = 0;
+  config.jitter_percent = 0;
+  TEST_ASSERT_EQUAL_INT(300, providore_scheduler_next_delay(&config, &state, PROVIDORE_OK, 0, 30, 0));
+}
+
+typedef struct
+{
+  uint32_t configs;
+  uint32_t failures;
+  uint32_t firmware;
+  providore_err_t firmware_result;
+  TickType_t polled_at[32];
+} polls_t;
+
+static void on_config(providore_err_t result, const char *config, size_t config_len, void *user_data)
+{
+  polls_t *polls = (polls_t *)user_data;
+  uint32_t poll = __atomic_fetch_add(&polls->configs, 1, __ATOMIC_ACQ_REL);
+  if (poll < 32)
+  {
+    polls->polled_at[poll] = xTaskGetTickCount();
+  }
+  if (result != PROVIDORE_OK)
+  {
+    __atomic_add_fetch(&polls->failures, 1, __ATOMIC_ACQ_REL);
+  }
+}
+
+static void on_firmware(providore_err_t result, void *user_data)
+{
+  polls_t *polls = (polls_t *)user_data;
+  polls->firmware_result = result;
+  __atomic_add_fetch(&polls->firmware, 1, __ATOMIC_ACQ_REL);
+}
+
+static char scheduled_config[256];
+
+static providore_scheduler_config_t task_config(polls_t *polls)
+{
+  providore_scheduler_config_t config = policy;
+  config.interval = 60;
+  config.config = scheduled_config;
+  config.config_max_len = sizeof(scheduled_config);
+  config.on_config = on_config;
+  config.on_firmware = on_firmware;
+  config.user_data = polls;
+  return config;
+}
+
+// Waits for virtual seconds to pass, then stops the scheduler and waits for its last poll
+static void run_for(uint32_t seconds)
+{
+  vTaskDelay(seconds * configTICK_RATE_HZ);
+  providore_scheduler_stop();
+  while (host_freertos_running_tasks() > 0)
+  {
+    usleep(1000);
+  }
+}
+
+static void start_device(test_server_t *server)
+{
+  test_server_start(server);
+  test_identity();
+  providore_load_identity();
+  host_freertos_virtual_time(true);
+}
+
+static void test_polls_on_interval()
+{
+  polls_t polls = {0};
+  test_server_t server = {.config = "{\"interval\": 60}"};
+  start_device(&server);
+  providore_scheduler_config_t config = task_config(&polls);
+
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_scheduler_start(&config));
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_STATE, providore_scheduler_start(&config));
+  run_for(630);
+
+  // At 0, 60, ... 600
+  TEST_ASSERT_EQUAL_INT(11, polls.configs);
+  TEST_ASSERT_EQUAL_INT(0, polls.failures);
+  TEST_ASSERT_EQUAL_INT(polls.configs, server.config_requests);
+  // A poll takes no virtual time, so the next comes exactly an interval later
+  for (uint32_t i = 1; i < polls.configs; i++)
+  {
+    TEST_ASSERT_EQUAL_INT(60 * configTICK_RATE_HZ, polls.polled_at[i] - polls.polled_at[i - 1]);
+  }
+  TEST_ASSERT_EQUAL_STRING("{\"interval\": 60}", scheduled_config);
+}
+
+static void test_follows_poll_interval_hint()
+{
+  polls_t polls = {0};
+  test_server_t server = {.config = "{}", .poll_interval = 200};
+  start_device(&server);
+  providore_scheduler_config_t config = task_config(&polls);
+
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_scheduler_start(&config));
+  run_for(630);
+
+  // At 0, 200, 400, 600 rather than every minute
+  TEST_ASSERT_EQUAL_INT(4, polls.configs);
+}
+
+static void test_backs_off_while_failing()
+{
+  polls_t polls = {0};
+  test_server_t server = {.config = "{}", .config_status = 500};
+  start_device(&server);
+  providore_scheduler_config_t config = task_config(&polls);
+
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_scheduler_start(&config));
+  run_for(330);
+
+  // At 0, 10, 30, 70, 150 and 310
+  static const uint32_t gaps[] = {10, 20, 40, 80, 160};
+  TEST_ASSERT_EQUAL_INT(6, polls.configs);
+  TEST_ASSERT_EQUAL_INT(polls.configs, polls.failures);
+  for (uint32_t i = 1; i < polls.configs; i++)
+  {
+    TEST_ASSERT_EQUAL_INT(gaps[i - 1] * configTICK_RATE_HZ, polls.polled_at[i] - polls.polled_at[i - 1]);
+  }
+  // Firmware isn't checked while config fails
+  TEST_ASSERT_EQUAL_INT(0, polls.firmware);
+}
+
+static void test_retry_after_holds_off()
+{
+  polls_t polls = {0};
+  test_server_t server = {.config = "{}", .config_status = 503, .retry_after = 300};
+  start_device(&server);
+  providore_scheduler_config_t config = task_config(&polls);
+
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_scheduler_start(&config));
+  run_for(630);
+
+  // At 0, 300 and 600 instead of backing off from 10 seconds
+  TEST_ASSERT_EQUAL_INT(3, polls.configs);
+}
+
+static void test_poll_now_and_startup_delay()
+{
+  polls_t polls = {0};
+  test_server_t server = {.config = "{}"};
+  start_device(&server);
+  providore_scheduler_config_t config = task_config(&polls);
+  config.interval = 3600;
+  config.startup_delay_max = 3600;
+  host_random_seed(1);
+
+  TickType_t started = xTaskGetTickCount();
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_scheduler_start(&config));
+  providore_scheduler_poll_now();
+  vTaskDelay(10 * configTICK_RATE_HZ);
+  TEST_ASSERT_EQUAL_INT(1, __atomic_load_n(&polls.configs, __ATOMIC_ACQUIRE));
+  // Rather than after the startup delay
+  TEST_ASSERT_EQUAL_INT(started, polls.polled_at[0]);
+  providore_scheduler_poll_now();
+  run_for(10);
+  TEST_ASSERT_EQUAL_INT(2, polls.configs);
+}
+
+static void test_checks_firmware()
+{
+  polls_t polls = {0};
+  uint8_t *running = test_image(64 * 1024, 1);
+  test_running_image(running, 64 * 1024);
+  test_server_t server = {.config = "{}", .manifest = true, .version = "1.0.0", .image = running, .image_len = 64 * 1024};
+  start_device(&server);
+  providore_scheduler_config_t config = task_config(&polls);
+  config.firmware = true;
+
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_scheduler_start(&config));
+  run_for(90);
+
+  TEST_ASSERT_EQUAL_INT(2, polls.configs);
+  TEST_ASSERT_EQUAL_INT(2, polls.firmware);
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_NO_UPDATE, polls.firmware_result);
+  TEST_ASSERT_EQUAL_INT(0, server.firmware_requests);
+  free(running);
+}
+
+static void test_rejects_bad_config()
+{
+  polls_t polls = {0};
+  providore_scheduler_config_t config = task_config(&polls);
+  config.backoff_max = 5;
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_ARG, providore_scheduler_start(&config));
+  config = task_config(&polls);
+  config.interval = 0;
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_ARG, providore_scheduler_start(&config));
+  config = task_config(&polls);
+  config.config = NULL;
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_ARG, providore_scheduler_start(&config));
+}
+
+int main()
+{
+  RUN_TEST(test_interval_and_server_hint);
+  RUN_TEST(test_backoff_doubles_to_max);
+  RUN_TEST(test_jitter_bounds);
+  RUN_TEST(test_retry_after_is_a_floor);
+  RUN_TEST(test_polls_on_interval);
+  RUN_TEST(test_follows_poll_interval_hint);
+  RUN_TEST(test_backs_off_while_failing);
+  RUN_TEST(test_retry_after_holds_off);
+  RUN_TEST(test_poll_now_and_startup_delay);
+  RUN_TEST(test_checks_firmware);
+  RUN_TEST(test_rejects_bad_config);
+  return test_end();
+}
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_ota_ops.h"
+#include "providore.h"
+#include "test.h"
+#include "test_support.h"
+
+// The component against tools/providore_server.py over a real socket, so the
+// server and the component are checked against each other rather than each
+// against the in-process stand-in. Built with both signers.
+
+#define RUNNING_LEN (128 * 1024)
+#define IMAGE_LEN (320 * 1024)
+#define CONFIG "{\"interval\": 60, \"wifi\": {\"ssid\": \"home\", \"channel\": 6}}"
+
+static void identity()
+{
+  test_identity();
+#ifdef CONFIG_SECURED_SHARED_KEY
+  host_efuse_set_key((const uint8_t *)TEST_PSK, strlen(TEST_PSK));
+#endif
+}
+
+// A key the server doesn't know
+static const char *wrong_key()
+{
+#ifdef CONFIG_SECURED_SHARED_KEY
+  host_efuse_set_key((const uint8_t *)"another key", 11);
+#endif
+  return "another psk";
+}
+
+static bool boot_partition_holds(const uint8_t *image, size_t len)
+{
+  const esp_partition_t *boot = esp_ota_get_boot_partition();
+  if (boot == NULL || boot->address != host_flash_partition(1)->address)
+  {
+    return false;
+  }
+  uint8_t *flash = malloc(len);
+  host_flash_read(boot, 0, flash, len);
+  bool matches = memcmp(flash, image, len) == 0;
+  free(flash);
+  return matches;
+}
+
+static void test_config()
+{
+  test_script_server_t server;
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  TEST_ASSERT(test_script_server_start(&server, CONFIG, image, IMAGE_LEN, NULL));
+  test_script_server_route(&server);
+  identity();
+
+  char config[128] = {0};
+  size_t config_len = 0;
+  providore_err_t first = providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len);
+  // Unchanged, so a cached config is answered with 304
+  providore_err_t again = providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len);
+  char unverified[128];
+  size_t unverified_len = 0;
+  providore_err_t refused = providore_get_config(TEST_DEVICE_ID, wrong_key(), sizeof(unverified), unverified, &unverified_len);
+  test_script_server_stop(&server);
+  free(image);
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, first);
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, again);
+  TEST_ASSERT_EQUAL_STRING(CONFIG, config);
+  TEST_ASSERT_EQUAL_INT(strlen(CONFIG), config_len);
+  // The server answers a request it can't verify with an unsigned 401
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_SIG_MISMATCH, refused);
+}
+
+static void test_sync()
+{
+  test_script_server_t server;
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  TEST_ASSERT(test_script_server_start(&server, CONFIG, image, IMAGE_LEN, NULL));
+  test_script_server_route(&server);
+  identity();
+
+  providore_buffer_t config;
+  providore_buffer_t manifest;
+  providore_buffer_init(&config);
+  providore_buffer_init(&manifest);
+  sync_handler_t handlers[] = {{"config", sync_buffer_part, &config}, {"manifest", sync_buffer_part, &manifest}};
+  providore_err_t result = providore_sync(TEST_DEVICE_ID, TEST_PSK, handlers, 2);
+  test_script_server_stop(&server);
+
+  char copy[128] = {0};
+  size_t copied = providore_buffer_read(&config, 0, copy, sizeof(copy) - 1);
+  char sha256[TEST_SHA256_LEN];
+  test_image_sha256(image, IMAGE_LEN, sha256);
+  char *named = calloc(1, manifest.len + 1);
+  providore_buffer_read(&manifest, 0, named, manifest.len);
+  bool names_image = strstr(named, sha256) != NULL;
+  free(named);
+  providore_buffer_free(&config);
+  providore_buffer_free(&manifest);
+  free(image);
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, result);
+  TEST_ASSERT_EQUAL_INT(strlen(CONFIG), copied);
+  TEST_ASSERT_EQUAL_STRING(CONFIG, copy);
+  TEST_ASSERT(names_image);
+}
+
+static void test_firmware_upgrade()
+{
+  test_script_server_t server;
+  uint8_t *running = test_image(RUNNING_LEN, 1);
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  test_running_image(running, RUNNING_LEN);
+  TEST_ASSERT(test_script_server_start(&server, CONFIG, image, IMAGE_LEN, NULL));
+  test_script_server_route(&server);
+  identity();
+
+  providore_err_t upgraded = providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK);
+  bool holds = boot_partition_holds(image, IMAGE_LEN);
+  // The manifest names the image the device is running, so there is nothing to do
+  test_script_server_serve(&server, NULL, running, RUNNING_LEN);
+  providore_err_t current = providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK);
+  test_script_server_stop(&server);
+  free(image);
+  free(running);
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, upgraded);
+  TEST_ASSERT(holds);
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_NO_UPDATE, current);
+}
+
+// Cut off downloads pick up where they stopped with a Range request
+static void test_firmware_resumes()
+{
+  static const char *const args[] = {"--truncate-rate", "0.5", "--seed", "1", NULL};
+  test_script_server_t server;
+  uint8_t *running = test_image(RUNNING_LEN, 1);
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  test_running_image(running, RUNNING_LEN);
+  TEST_ASSERT(test_script_server_start(&server, CONFIG, image, IMAGE_LEN, args));
+  test_script_server_route(&server);
+  identity();
+
+  int failed = 0;
+  providore_err_t result = PROVIDORE_FIRMWARE_FAIL;
+  for (int attempt = 0; attempt < 20 && result != PROVIDORE_OK; attempt++)
+  {
+    result = providore_firmware_upgrade(TEST_DEVICE_ID, TEST_PSK);
+    failed += result != PROVIDORE_OK;
+  }
+  test_script_server_stop(&server);
+  providore_stats_t stats;
+  providore_get_stats(&stats);
+  bool holds = boot_partition_holds(image, IMAGE_LEN);
+  free(image);
+  free(running);
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, result);
+  TEST_ASSERT(holds);
+  TEST_ASSERT(failed > 0);
+  // Starting over would take at least half the image again for each cut off download
+  TEST_ASSERT_MESSAGE(stats.bytes_received < IMAGE_LEN + IMAGE_LEN / 2, "%llu bytes received", (unsigned long long)stats.bytes_received);
+}
+
+int main()
+{
+  RUN_TEST(test_config);
+  RUN_TEST(test_sync);
+  RUN_TEST(test_firmware_upgrade);
+  RUN_TEST(test_firmware_resumes);
+  return test_end();
+}
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "providore.h"
+#include "server_time.h"
+#include "test.h"
+#include "test_support.h"
+
+static void timestamp(time_t when, char *output)
+{
+  struct tm tm;
+  gmtime_r(&when, &tm);
+  strftime(output, 32, "%FT%TZ", &tm);
+}
+
+// A response signed at the given time, expiring 15 minutes later as the server's do
+static void learn(time_t signed_at)
+{
+  char created_at[32];
+  char expiry[32];
+  timestamp(signed_at, created_at);
+  timestamp(signed_at + 900, expiry);
+  providore_server_time_learn(created_at, expiry);
+}
+
+static time_t utc(int year, int month, int day, int hour, int minute, int second)
+{
+  struct tm tm = {.tm_year = year - 1900, .tm_mon = month - 1, .tm_mday = day, .tm_hour = hour, .tm_min = minute, .tm_sec = second};
+  return timegm(&tm);
+}
+
+static void test_no_offset_until_learned()
+{
+  int64_t offset;
+  TEST_ASSERT(!providore_server_time_offset(&offset));
+  time_t now = time(NULL);
+  TEST_ASSERT(llabs((long long)(providore_server_time_now() - now)) <= 1);
+}
+
+static void test_learns_offset()
+{
+  char created_at[32];
+  char expiry[32];
+  int64_t offset;
+  learn(time(NULL) + 3600);
+  TEST_ASSERT(providore_server_time_offset(&offset));
+  TEST_ASSERT(llabs((long long)(offset - 3600)) <= 1);
+  TEST_ASSERT(llabs((long long)(providore_server_time_now() - time(NULL) - 3600)) <= 1);
+
+  // A server clock that is behind, with fractional seconds
+  providore_server_time_reset();
+  timestamp(time(NULL) - 86400 * 400, created_at);
+  timestamp(time(NULL) - 86400 * 400 + 900, expiry);
+  created_at[19] = '\0';
+  strcat(created_at, ".250Z");
+  providore_server_time_learn(created_at, expiry);
+  TEST_ASSERT(providore_server_time_offset(&offset));
+  TEST_ASSERT(llabs((long long)(offset + 86400 * 400)) <= 1);
+
+  providore_server_time_reset();
+  TEST_ASSERT(!providore_server_time_offset(&offset));
+}
+
+// Calendar edge cases, checked against the C library's own conversion
+static void test_dates()
+{
+  static const int dates[][6] = {
+      {1970, 1, 1, 0, 0, 0},
+      {2000, 2, 29, 12, 30, 45},
+      {2024, 2, 29, 23, 59, 59},
+      {2026, 10, 16, 9, 0, 0},
+      {2100, 3, 1, 0, 0, 0},
+  };
+  for (size_t i = 0; i < sizeof(dates) / sizeof(dates[0]); i++)
+  {
+    char created_at[32];
+    int64_t offset;
+    const int *date = dates[i];
+    time_t expected = utc(date[0], date[1], date[2], date[3], date[4], date[5]);
+    snprintf(created_at, sizeof(created_at), "%04d-%02d-%02dT%02d:%02d:%02dZ", date[0], date[1], date[2], date[3], date[4], date[5]);
+    time_t now = time(NULL);
+    providore_server_time_reset();
+    providore_server_time_learn(created_at, "2100-12-31T23:59:59Z");
+    TEST_ASSERT(providore_server_time_offset(&offset));
+    TEST_ASSERT_MESSAGE(llabs((long long)(now + offset - expected)) <= 1, "%s read as %lld", created_at, (long long)(now + offset));
+  }
+}
+
+static void test_ignores_invalid()
+{
+  static const char *invalid[] = {"", "yesterday", "2026-13-01T00:00:00Z", "2026-10-32T00:00:00Z", "2026-10-16T24:00:00Z", "2026-10-16"};
+  int64_t offset;
+  providore_server_time_learn(NULL, NULL);
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+  {
+    providore_server_time_learn(invalid[i], TEST_EXPIRY);
+    TEST_ASSERT_MESSAGE(!providore_server_time_offset(&offset), "learned from %s", invalid[i]);
+    providore_server_time_learn(TEST_CREATED_AT, invalid[i]);
+    TEST_ASSERT_MESSAGE(!providore_server_time_offset(&offset), "learned with expiry %s", invalid[i]);
+  }
+}
+
+// A replayed response can't wind the clock back to when it was signed
+static void test_only_moves_forward()
+{
+  int64_t offset;
+  learn(time(NULL) + 3600);
+
+  // Signed ten minutes earlier, so still inside its expiry, but behind
+  learn(time(NULL) + 3000);
+  TEST_ASSERT(providore_server_time_offset(&offset));
+  TEST_ASSERT(llabs((long long)(offset - 3600)) <= 1);
+
+  // Expired 45 minutes ago by the server's clock, though not by ours
+  learn(time(NULL));
+  TEST_ASSERT(providore_server_time_offset(&offset));
+  TEST_ASSERT(llabs((long long)(offset - 3600)) <= 1);
+
+  learn(time(NULL) + 7200);
+  TEST_ASSERT(providore_server_time_offset(&offset));
+  TEST_ASSERT(llabs((long long)(offset - 7200)) <= 1);
+
+  // Until it is reset, ie. once SNTP has set the clock
+  providore_server_time_reset();
+  learn(time(NULL) - 60);
+  TEST_ASSERT(providore_server_time_offset(&offset));
+  TEST_ASSERT(llabs((long long)(offset + 60)) <= 1);
+}
+
+// A device whose clock was never set signs its first request with the wrong time,
+// then every one after with the server's
+static void test_requests_signed_with_server_time()
+{
+  char config[64];
+  size_t config_len;
+  test_server_t server = {.config = "{}"};
+  test_server_start(&server);
+  test_identity();
+
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len));
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config(TEST_DEVICE_ID, TEST_PSK, sizeof(config), config, &config_len));
+  TEST_ASSERT_EQUAL_INT(2, server.config_requests);
+
+  struct tm tm = {0};
+  TEST_ASSERT(strptime(server.created_at, "%Y-%m-%dT%H:%M:%SZ", &tm) != NULL);
+  time_t signed_at = timegm(&tm);
+  time_t served_at = utc(2026, 10, 16, 9, 0, 0);
+  TEST_ASSERT_MESSAGE(llabs((long long)(signed_at - served_at)) <= 2, "signed at %s", server.created_at);
+}
+
+int main()
+{
+  RUN_TEST(test_no_offset_until_learned);
+  RUN_TEST(test_learns_offset);
+  RUN_TEST(test_dates);
+  RUN_TEST(test_ignores_invalid);
+  RUN_TEST(test_only_moves_forward);
+  RUN_TEST(test_requests_signed_with_server_time);
+  return test_end();
+}
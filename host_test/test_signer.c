@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mbedtls/base64.h"
+#include "signature.h"
+#include "signer.h"
+#include "test.h"
+#include "test_support.h"
+
+#define BENCH_SIGNATURES 20000
+
+static void hex(const uint8_t *digest, char *output)
+{
+  for (int i = 0; i < HMAC_DIGEST_LEN; i++)
+  {
+    sprintf(output + i * 2, "%02x", digest[i]);
+  }
+}
+
+// RFC 4231 test case 2, and a key that fills the whole block
+static void test_hmac_vectors()
+{
+  providore_signer_t signer;
+  uint8_t digest[HMAC_DIGEST_LEN];
+  char digest_hex[HMAC_DIGEST_LEN * 2 + 1];
+
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_signer_init(&signer, TEST_DEVICE_ID, "Jefe"));
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_signer_hmac(&signer, "what do ya want for nothing?", 28, digest));
+  hex(digest, digest_hex);
+  TEST_ASSERT_EQUAL_STRING("5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843", digest_hex);
+
+  char key[PSK_LEN];
+  uint8_t expected[HMAC_DIGEST_LEN];
+  memset(key, 'k', PSK_LEN - 1);
+  key[PSK_LEN - 1] = '\0';
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_signer_init(&signer, TEST_DEVICE_ID, key));
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_signer_hmac(&signer, "message", 7, digest));
+  test_hmac(key, PSK_LEN - 1, "message", 7, expected);
+  TEST_ASSERT_EQUAL_MEMORY(expected, digest, HMAC_DIGEST_LEN);
+}
+
+static void test_identity_limits()
+{
+  providore_signer_t signer;
+  char too_long[PSK_LEN + 1];
+  memset(too_long, 'x', PSK_LEN);
+  too_long[PSK_LEN] = '\0';
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_SIZE, providore_signer_init(&signer, TEST_DEVICE_ID, too_long));
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_SIZE, providore_signer_init(&signer, too_long, TEST_PSK));
+
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_signer_init(&signer, TEST_DEVICE_ID, TEST_PSK));
+  TEST_ASSERT(providore_signer_matches(&signer, TEST_DEVICE_ID, TEST_PSK));
+  TEST_ASSERT(!providore_signer_matches(&signer, TEST_DEVICE_ID, "other"));
+  TEST_ASSERT(!providore_signer_matches(&signer, "device-2", TEST_PSK));
+}
+
+static void test_load_from_nvs()
+{
+  providore_signer_t signer;
+  TEST_ASSERT(providore_signer_load(&signer) != ESP_OK);
+
+  test_identity();
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_signer_load(&signer));
+  TEST_ASSERT(providore_signer_matches(&signer, TEST_DEVICE_ID, TEST_PSK));
+}
+
+// The request signature the server checks, over the canonical request fields
+static void test_authorization()
+{
+  providore_signer_t signer;
+  char authorization[CONFIG_PROVIDORE_AUTHORIZATION_LEN];
+  providore_signer_init(&signer, TEST_DEVICE_ID, TEST_PSK);
+  providore_signer_authorization(&signer, authorization, sizeof(authorization), "GET", "/config", "1.0.0", TEST_CREATED_AT, TEST_EXPIRY);
+
+  static const char *message = "GET\n/config\n1.0.0\n" TEST_CREATED_AT "\n" TEST_EXPIRY;
+  uint8_t digest[HMAC_DIGEST_LEN];
+  char expected[TEST_SIGNATURE_LEN];
+  test_hmac(TEST_PSK, strlen(TEST_PSK), message, strlen(message), digest);
+  size_t olen;
+  mbedtls_base64_encode((unsigned char *)expected, sizeof(expected), &olen, digest, sizeof(digest));
+
+  char header[CONFIG_PROVIDORE_AUTHORIZATION_LEN];
+  snprintf(header, sizeof(header), "Hmac key-id=%s, signature=%s", TEST_DEVICE_ID, expected);
+  TEST_ASSERT_EQUAL_STRING(header, authorization);
+}
+
+static void test_verify_response()
+{
+  providore_signer_t signer;
+  signature_verifier_t verifier;
+  char signature[TEST_SIGNATURE_LEN];
+  static const char *body = "{\"interval\": 60}";
+  providore_signer_init(&signer, TEST_DEVICE_ID, TEST_PSK);
+  test_sign(TEST_PSK, body, strlen(body), TEST_CREATED_AT, TEST_EXPIRY, signature);
+
+  // Fed in pieces, as the body arrives
+  signature_verify_begin(&verifier, &signer);
+  signature_verify_update(&verifier, body, 5);
+  signature_verify_update(&verifier, body + 5, strlen(body) - 5);
+  TEST_ASSERT(signature_verify_finish(&verifier, TEST_CREATED_AT, TEST_EXPIRY, signature));
+  signature_verify_free(&verifier);
+
+  // The signed headers are covered too
+  signature_verify_begin(&verifier, &signer);
+  signature_verify_update(&verifier, body, strlen(body));
+  TEST_ASSERT(!signature_verify_finish(&verifier, TEST_CREATED_AT, "2026-10-16T10:15:00Z", signature));
+  signature_verify_free(&verifier);
+
+  signature_verify_begin(&verifier, &signer);
+  signature_verify_update(&verifier, "{\"interval\": 61}", strlen(body));
+  TEST_ASSERT(!signature_verify_finish(&verifier, TEST_CREATED_AT, TEST_EXPIRY, signature));
+  signature_verify_free(&verifier);
+}
+
+// A resumed download carries on hashing from the state saved in its checkpoint
+static void test_verify_resumes_from_checkpoint()
+{
+  providore_signer_t signer;
+  signature_verifier_t verifier;
+  mbedtls_sha256_context state;
+  char signature[TEST_SIGNATURE_LEN];
+  uint8_t *image = test_image(64 * 1024, 1);
+  providore_signer_init(&signer, TEST_DEVICE_ID, TEST_PSK);
+  test_sign(TEST_PSK, image, 64 * 1024, TEST_CREATED_AT, TEST_EXPIRY, signature);
+
+  signature_verify_begin(&verifier, &signer);
+  signature_verify_update(&verifier, image, 40 * 1024);
+  TEST_ASSERT(signature_verify_checkpoint(&verifier, &state));
+  signature_verify_free(&verifier);
+
+  // As though after a reboot
+  signature_verifier_t resumed;
+  memset(&resumed, 0, sizeof(resumed));
+  TEST_ASSERT(signature_verify_resume(&resumed, &signer, &state));
+  signature_verify_update(&resumed, image + 40 * 1024, 24 * 1024);
+  TEST_ASSERT(signature_verify_finish(&resumed, TEST_CREATED_AT, TEST_EXPIRY, signature));
+  signature_verify_free(&resumed);
+  mbedtls_sha256_free(&state);
+  free(image);
+}
+
+// Every request is signed and every response verified, so this is paid on each
+// one. Against computing the HMAC from the key every time, as it used to be.
+static void test_bench_signatures_per_second()
+{
+  providore_signer_t signer;
+  char authorization[CONFIG_PROVIDORE_AUTHORIZATION_LEN];
+  uint8_t digest[HMAC_DIGEST_LEN];
+  static const char *message = "GET\n/config\n1.0.0\n" TEST_CREATED_AT "\n" TEST_EXPIRY;
+  providore_signer_init(&signer, TEST_DEVICE_ID, TEST_PSK);
+
+  uint64_t allocations = test_allocations();
+  int64_t started = test_now_us();
+  for (int i = 0; i < BENCH_SIGNATURES; i++)
+  {
+    providore_signer_authorization(&signer, authorization, sizeof(authorization), "GET", "/config", "1.0.0", TEST_CREATED_AT, TEST_EXPIRY);
+  }
+  int64_t signer_us = test_now_us() - started;
+  allocations = test_allocations() - allocations;
+
+  started = test_now_us();
+  for (int i = 0; i < BENCH_SIGNATURES; i++)
+  {
+    test_hmac(TEST_PSK, strlen(TEST_PSK), message, strlen(message), digest);
+  }
+  int64_t naive_us = test_now_us() - started;
+
+  char signature[TEST_SIGNATURE_LEN];
+  static const char *body = "{\"interval\": 60, \"wifi\": {\"ssid\": \"home\"}}";
+  test_sign(TEST_PSK, body, strlen(body), TEST_CREATED_AT, TEST_EXPIRY, signature);
+  started = test_now_us();
+  for (int i = 0; i < BENCH_SIGNATURES; i++)
+  {
+    signature_verifier_t verifier;
+    signature_verify_begin(&verifier, &signer);
+    signature_verify_update(&verifier, body, strlen(body));
+    TEST_ASSERT(signature_verify_finish(&verifier, TEST_CREATED_AT, TEST_EXPIRY, signature));
+    signature_verify_free(&verifier);
+  }
+  int64_t verify_us = test_now_us() - started;
+
+  TEST_ASSERT_EQUAL_INT(0, allocations);
+  printf("BENCH signer: %.0f authorizations/s, %.0f from the key each time, %.0f verifications/s, %llu allocations\n",
+         BENCH_SIGNATURES * 1e6 / signer_us, BENCH_SIGNATURES * 1e6 / naive_us, BENCH_SIGNATURES * 1e6 / verify_us, (unsigned long long)allocations);
+}
+
+int main()
+{
+  RUN_TEST(test_hmac_vectors);
+  RUN_TEST(test_identity_limits);
+  RUN_TEST(test_load_from_nvs);
+  RUN_TEST(test_authorization);
+  RUN_TEST(test_verify_response);
+  RUN_TEST(test_verify_resumes_from_checkpoint);
+  RUN_TEST(test_bench_signatures_per_second);
+  return test_end();
+}
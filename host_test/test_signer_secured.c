@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_ota_ops.h"
+#include "nvs.h"
+#include "providore.h"
+#include "signature.h"
+#include "signer.h"
+#include "test.h"
+#include "test_support.h"
+
+#define RUNNING_LEN (128 * 1024)
+#define IMAGE_LEN (320 * 1024)
+#define CONFIG_LEN (8 * 1024)
+
+// Built against providore_secured, where the key is burnt into eFuse and only
+// the HMAC peripheral can use it. The server holds the same key as its psk.
+static void burn_key()
+{
+  host_efuse_set_key((const uint8_t *)TEST_PSK, strlen(TEST_PSK));
+}
+
+static void test_authorization()
+{
+  providore_signer_t signer;
+  char authorization[CONFIG_PROVIDORE_AUTHORIZATION_LEN];
+  burn_key();
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_signer_init(&signer, TEST_DEVICE_ID, NULL));
+  providore_signer_authorization(&signer, authorization, sizeof(authorization), "GET", "/config", "1.0.0", TEST_CREATED_AT, TEST_EXPIRY);
+
+  host_http_request_t request = {.method = "GET", .path = "/config"};
+  host_http_header_t headers[] = {
+      {"Authorization", ""},
+      {"X-Firmware-Version", "1.0.0"},
+      {"Created-At", TEST_CREATED_AT},
+      {"Expiry", TEST_EXPIRY},
+  };
+  strcpy(headers[0].value, authorization);
+  request.headers = headers;
+  request.header_count = 4;
+  TEST_ASSERT(test_request_signed(&request, TEST_PSK));
+}
+
+static void test_identity_without_psk()
+{
+  providore_signer_t signer;
+  nvs_handle_t handle;
+  burn_key();
+  nvs_open("providore", NVS_READWRITE, &handle);
+  nvs_set_str(handle, "device_id", TEST_DEVICE_ID);
+  nvs_close(handle);
+
+  TEST_ASSERT_EQUAL_INT(ESP_OK, providore_signer_load(&signer));
+  TEST_ASSERT(providore_signer_matches(&signer, TEST_DEVICE_ID, NULL));
+}
+
+static void test_verify_response()
+{
+  providore_signer_t signer;
+  signature_verifier_t verifier;
+  char signature[TEST_SIGNATURE_LEN];
+  static const char *body = "{\"interval\": 60}";
+  burn_key();
+  providore_signer_init(&signer, TEST_DEVICE_ID, NULL);
+  test_sign(TEST_PSK, body, strlen(body), TEST_CREATED_AT, TEST_EXPIRY, signature);
+
+  signature_verify_begin(&verifier, &signer);
+  signature_verify_update(&verifier, body, 5);
+  signature_verify_update(&verifier, body + 5, strlen(body) - 5);
+  TEST_ASSERT(signature_verify_finish(&verifier, TEST_CREATED_AT, TEST_EXPIRY, signature));
+
+  // A different key in eFuse
+  host_efuse_set_key((const uint8_t *)"another key", 11);
+  signature_verify_begin(&verifier, &signer);
+  signature_verify_update(&verifier, body, strlen(body));
+  TEST_ASSERT(!signature_verify_finish(&verifier, TEST_CREATED_AT, TEST_EXPIRY, signature));
+}
+
+static bool boot_partition_holds(const uint8_t *image, size_t len)
+{
+  const esp_partition_t *boot = esp_ota_get_boot_partition();
+  if (boot == NULL || boot->address != host_flash_partition(1)->address)
+  {
+    return false;
+  }
+  uint8_t *flash = malloc(len);
+  host_flash_read(boot, 0, flash, len);
+  bool matches = memcmp(flash, image, len) == 0;
+  free(flash);
+  return matches;
+}
+
+// The peripheral HMACs the digest, so the size of a response doesn't matter
+static void test_large_config()
+{
+  char *config = malloc(CONFIG_LEN + 1);
+  memset(config, 'x', CONFIG_LEN);
+  config[0] = '"';
+  config[CONFIG_LEN - 1] = '"';
+  config[CONFIG_LEN] = '\0';
+  test_server_t server = {.config = config, .chunk_len = 1436};
+  burn_key();
+  test_server_start(&server);
+  test_identity();
+
+  providore_buffer_t buffer;
+  char *copy = malloc(CONFIG_LEN);
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_get_config_buffer(TEST_DEVICE_ID, NULL, &buffer));
+  TEST_ASSERT_EQUAL_INT(CONFIG_LEN, buffer.len);
+  TEST_ASSERT_EQUAL_INT(CONFIG_LEN, providore_buffer_read(&buffer, 0, copy, CONFIG_LEN));
+  TEST_ASSERT_EQUAL_MEMORY(config, copy, CONFIG_LEN);
+  providore_buffer_free(&buffer);
+
+  server.bad_signature = true;
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_SIG_MISMATCH, providore_get_config_buffer(TEST_DEVICE_ID, NULL, &buffer));
+  providore_buffer_free(&buffer);
+  free(copy);
+  free(config);
+}
+
+static void test_firmware_upgrade()
+{
+  uint8_t *running = test_image(RUNNING_LEN, 1);
+  uint8_t *image = test_image(IMAGE_LEN, 2);
+  test_running_image(running, RUNNING_LEN);
+  test_server_t server = {.manifest = true, .image = image, .image_len = IMAGE_LEN, .firmware_etag = "\"fw-2\"", .ranges = true, .drop_after = 200 * 1024, .chunk_len = 1436};
+  burn_key();
+  test_server_start(&server);
+  test_identity();
+
+  // The dropped download resumes from its checkpoint
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_FIRMWARE_FAIL, providore_firmware_upgrade(TEST_DEVICE_ID, NULL));
+  TEST_ASSERT_EQUAL_INT(PROVIDORE_OK, providore_firmware_upgrade(TEST_DEVICE_ID, NULL));
+  TEST_ASSERT_EQUAL_INT(1, server.ranges_served);
+  TEST_ASSERT(boot_partition_holds(image, IMAGE_LEN));
+  free(image);
+  free(running);
+}
+
+int main()
+{
+  RUN_TEST(test_authorization);
+  RUN_TEST(test_identity_without_psk);
+  RUN_TEST(test_verify_response);
+  RUN_TEST(test_large_config);
+  RUN_TEST(test_firmware_upgrade);
+  return test_end();
+}
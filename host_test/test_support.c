@@ -0,0 +1,672 @@
+#include "test_support.h"
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mbedtls/base64.h"
+#include "mbedtls/sha256.h"
+#include "nvs.h"
+#include "peer.h"
+#include "push.h"
+#include "providore.h"
+#include "scheduler.h"
+#include "server_time.h"
+#include "test.h"
+
+#define TEST_TASKS_TIMEOUT_US (10 * 1000000)
+#define TEST_STACK_SIZE (512 * 1024)
+
+int test_failures;
+const char *test_name = "";
+static int test_count;
+
+#ifndef HOST_TEST_TSAN
+// Counted on the way through to glibc. ThreadSanitizer has its own allocator to intercept.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+static uint64_t allocations;
+
+void *malloc(size_t size)
+{
+  __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+  __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  return __libc_realloc(ptr, size);
+}
+
+uint64_t test_allocations()
+{
+  return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+#else
+uint64_t test_allocations()
+{
+  return 0;
+}
+#endif
+
+int64_t test_now_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void test_run(const char *name, void (*test)(void))
+{
+  int failures = test_failures;
+  test_name = name;
+
+  // The component keeps its own state for the life of the process
+  providore_scheduler_stop();
+  providore_push_stop();
+  providore_peer_stop();
+  providore_close_session();
+  providore_reset_stats();
+  providore_server_time_reset();
+  host_reset();
+
+  test();
+  test_count++;
+
+  // Tasks from one test must not carry on into the next
+  int64_t deadline = test_now_us() + TEST_TASKS_TIMEOUT_US;
+  while (host_freertos_running_tasks() > 0 && test_now_us() < deadline)
+  {
+    usleep(1000);
+  }
+  if (host_freertos_running_tasks() > 0)
+  {
+    fprintf(stderr, "%s: %u tasks still running\n", name, host_freertos_running_tasks());
+    test_failures++;
+  }
+  printf("%s %s\n", test_failures == failures ? "PASS" : "FAIL", name);
+  fflush(stdout);
+}
+
+int test_end()
+{
+  printf("%d tests, %d failures\n", test_count, test_failures);
+  return test_failures == 0 ? 0 : 1;
+}
+
+void test_hmac(const void *key, size_t key_len, const void *message, size_t message_len, uint8_t *digest)
+{
+  uint8_t block[64];
+  uint8_t pad[64];
+  mbedtls_sha256_context ctx;
+
+  memset(block, 0, sizeof(block));
+  if (key_len > sizeof(block))
+  {
+    mbedtls_sha256_ret(key, key_len, block, 0);
+  }
+  else
+  {
+    memcpy(block, key, key_len);
+  }
+
+  for (int i = 0; i < 64; i++)
+  {
+    pad[i] = block[i] ^ 0x36;
+  }
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts_ret(&ctx, 0);
+  mbedtls_sha256_update_ret(&ctx, pad, sizeof(pad));
+  mbedtls_sha256_update_ret(&ctx, message, message_len);
+  mbedtls_sha256_finish_ret(&ctx, digest);
+
+  for (int i = 0; i < 64; i++)
+  {
+    pad[i] = block[i] ^ 0x5c;
+  }
+  mbedtls_sha256_starts_ret(&ctx, 0);
+  mbedtls_sha256_update_ret(&ctx, pad, sizeof(pad));
+  mbedtls_sha256_update_ret(&ctx, digest, 32);
+  mbedtls_sha256_finish_ret(&ctx, digest);
+  mbedtls_sha256_free(&ctx);
+}
+
+void test_sign(const char *psk, const void *body, size_t body_len, const char *created_at, const char *expiry, char *signature)
+{
+  uint8_t digest[32];
+  size_t olen;
+  size_t message_len = body_len + strlen(created_at) + strlen(expiry) + 2;
+  uint8_t *message = malloc(message_len);
+
+  memcpy(message, body, body_len);
+  sprintf((char *)message + body_len, "\n%s\n%s", created_at, expiry);
+#ifdef CONFIG_SECURED_SHARED_KEY
+  // The eFuse key signs the message's digest rather than the message
+  mbedtls_sha256_ret(message, message_len, digest, 0);
+  test_hmac(psk, strlen(psk), digest, sizeof(digest), digest);
+#else
+  test_hmac(psk, strlen(psk), message, message_len, digest);
+#endif
+  free(message);
+  mbedtls_base64_encode((unsigned char *)signature, TEST_SIGNATURE_LEN, &olen, digest, sizeof(digest));
+}
+
+void test_sign_response(host_http_response_t *response, const char *psk, const void *body, size_t body_len)
+{
+  char signature[TEST_SIGNATURE_LEN];
+  test_sign(psk, body, body_len, TEST_CREATED_AT, TEST_EXPIRY, signature);
+  host_http_set_header(response, "created-at", TEST_CREATED_AT);
+  host_http_set_header(response, "expiry", TEST_EXPIRY);
+  host_http_set_header(response, "signature", signature);
+}
+
+bool test_request_signed(const host_http_request_t *request, const char *psk)
+{
+  const char *authorization = host_http_header(request, "Authorization");
+  const char *version = host_http_header(request, "X-Firmware-Version");
+  const char *created_at = host_http_header(request, "Created-At");
+  const char *expiry = host_http_header(request, "Expiry");
+  if (authorization == NULL || version == NULL || created_at == NULL || expiry == NULL)
+  {
+    return false;
+  }
+
+  char message[512];
+  uint8_t digest[32];
+  char base64[TEST_SIGNATURE_LEN];
+  char expected[160];
+  size_t olen;
+  int message_len = snprintf(message, sizeof(message), "%s\n%s\n%s\n%s\n%s", request->method, request->path, version, created_at, expiry);
+  test_hmac(psk, strlen(psk), message, message_len, digest);
+  mbedtls_base64_encode((unsigned char *)base64, sizeof(base64), &olen, digest, sizeof(digest));
+  snprintf(expected, sizeof(expected), "Hmac key-id=%s, signature=%s", TEST_DEVICE_ID, base64);
+  return strcmp(authorization, expected) == 0;
+}
+
+void test_identity()
+{
+  nvs_handle_t handle;
+  nvs_open("providore", NVS_READWRITE, &handle);
+  nvs_set_str(handle, "device_id", TEST_DEVICE_ID);
+  nvs_set_str(handle, "psk", TEST_PSK);
+  nvs_commit(handle);
+  nvs_close(handle);
+}
+
+// Compressible, like real firmware: runs of repeated words between random bytes
+uint8_t *test_image(size_t len, uint32_t seed)
+{
+  uint8_t *image = malloc(len);
+  uint32_t state = seed * 2654435761u + 1;
+  for (size_t i = 0; i < len; i += 4)
+  {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    uint32_t word = (state & 0x30) == 0 ? state : (uint32_t)(i / 512);
+    memcpy(image + i, &word, len - i < 4 ? len - i : 4);
+  }
+  host_flash_image_header(image, len);
+  return image;
+}
+
+void test_image_sha256(const void *image, size_t len, char *hex)
+{
+  const uint8_t *bytes = (const uint8_t *)image;
+  uint8_t digest[32];
+  if (bytes[HOST_IMAGE_HASH_APPENDED] == 1)
+  {
+    memcpy(digest, bytes + len - sizeof(digest), sizeof(digest));
+  }
+  else
+  {
+    mbedtls_sha256_ret(image, len, digest, 0);
+  }
+  for (int i = 0; i < 32; i++)
+  {
+    sprintf(hex + i * 2, "%02x", digest[i]);
+  }
+}
+
+void test_running_image(const uint8_t *image, size_t len)
+{
+  host_flash_load(host_flash_partition(0), image, len);
+}
+
+size_t test_compress(const void *data, size_t len, bool gzip, uint8_t **output)
+{
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, gzip ? 16 + 15 : 15, 8, Z_DEFAULT_STRATEGY);
+  size_t capacity = deflateBound(&stream, len);
+  *output = malloc(capacity);
+  stream.next_in = (Bytef *)data;
+  stream.avail_in = len;
+  stream.next_out = *output;
+  stream.avail_out = capacity;
+  deflate(&stream, Z_FINISH);
+  size_t compressed = stream.total_out;
+  deflateEnd(&stream);
+  return compressed;
+}
+
+static size_t test_delta_command(uint8_t *output, uint8_t opcode, uint32_t offset, uint32_t len)
+{
+  output[0] = opcode;
+  for (int i = 0; i < 4; i++)
+  {
+    output[1 + i] = (uint8_t)(offset >> (i * 8));
+    output[5 + i] = (uint8_t)(len >> (i * 8));
+  }
+  return 9;
+}
+
+size_t test_delta(const uint8_t *source, size_t source_len, const uint8_t *target, size_t target_len, uint8_t **output)
+{
+  const size_t block = 1024;
+  // At worst every block is an ADD or INSERT with its data
+  uint8_t *patch = malloc(8 + target_len + (target_len / block + 2) * 9);
+  size_t len = 0;
+
+  memcpy(patch, "PDLT", 4);
+  for (int i = 0; i < 4; i++)
+  {
+    patch[4 + i] = (uint8_t)(target_len >> (i * 8));
+  }
+  len = 8;
+
+  for (size_t offset = 0; offset < target_len; offset += block)
+  {
+    size_t block_len = target_len - offset < block ? target_len - offset : block;
+    if (offset + block_len > source_len)
+    {
+      len += test_delta_command(patch + len, 2, 0, block_len);
+      memcpy(patch + len, target + offset, block_len);
+      len += block_len;
+    }
+    else if (memcmp(source + offset, target + offset, block_len) == 0)
+    {
+      len += test_delta_command(patch + len, 1, offset, block_len);
+    }
+    else
+    {
+      len += test_delta_command(patch + len, 3, offset, block_len);
+      for (size_t i = 0; i < block_len; i++)
+      {
+        patch[len + i] = target[offset + i] - source[offset + i];
+      }
+      len += block_len;
+    }
+  }
+  len += test_delta_command(patch + len, 0, 0, 0);
+  *output = patch;
+  return len;
+}
+
+size_t test_sync_body(const char *const *names, const char *const *bodies, size_t count, uint8_t **output)
+{
+  size_t capacity = 4;
+  for (size_t i = 0; i < count; i++)
+  {
+    capacity += 5 + strlen(names[i]) + strlen(bodies[i]);
+  }
+  uint8_t *body = malloc(capacity);
+  size_t len = 4;
+  memcpy(body, "PSYN", 4);
+  for (size_t i = 0; i < count; i++)
+  {
+    size_t name_len = strlen(names[i]);
+    uint32_t part_len = strlen(bodies[i]);
+    body[len++] = (uint8_t)name_len;
+    memcpy(body + len, names[i], name_len);
+    len += name_len;
+    for (int j = 0; j < 4; j++)
+    {
+      body[len++] = (uint8_t)(part_len >> (j * 8));
+    }
+    memcpy(body + len, bodies[i], part_len);
+    len += part_len;
+  }
+  *output = body;
+  return len;
+}
+
+typedef struct
+{
+  void (*function)(void *);
+  void *arguments;
+  size_t used;
+  SemaphoreHandle_t done;
+} test_stack_run_t;
+
+static void test_stack_task(void *arguments)
+{
+  test_stack_run_t *run = (test_stack_run_t *)arguments;
+  run->function(run->arguments);
+  run->used = TEST_STACK_SIZE - uxTaskGetStackHighWaterMark(NULL);
+  xSemaphoreGive(run->done);
+  vTaskDelete(NULL);
+}
+
+size_t test_stack_peak(void (*function)(void *), void *arguments)
+{
+  test_stack_run_t run = {.function = function, .arguments = arguments, .done = xSemaphoreCreateBinary()};
+  xTaskCreate(test_stack_task, "test_stack", TEST_STACK_SIZE, &run, 1, NULL);
+  xSemaphoreTake(run.done, portMAX_DELAY);
+  vSemaphoreDelete(run.done);
+  return run.used;
+}
+
+static void test_server_count(uint32_t *counter)
+{
+  __atomic_add_fetch(counter, 1, __ATOMIC_ACQ_REL);
+}
+
+// Requests from several tasks can be handled at once, each noting what it was sent
+static pthread_mutex_t server_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void test_server_record(char *field, size_t len, const char *value)
+{
+  pthread_mutex_lock(&server_lock);
+  snprintf(field, len, "%s", value != NULL ? value : "");
+  pthread_mutex_unlock(&server_lock);
+}
+
+static void test_server_body(test_server_t *server, host_http_response_t *response, const void *body, size_t len, bool owned)
+{
+  response->body = body;
+  response->body_len = len;
+  response->free_body = owned;
+  response->chunk_len = server->chunk_len;
+  response->chunk_delay_ms = server->chunk_delay_ms;
+  response->close = server->close;
+}
+
+static void test_server_firmware(test_server_t *server, const host_http_request_t *request, host_http_response_t *response)
+{
+  test_server_count(&server->firmware_requests);
+  test_sign_response(response, server->bad_signature ? "wrong" : server->psk, server->image, server->image_len);
+  if (server->firmware_etag != NULL)
+  {
+    host_http_set_header(response, "ETag", server->firmware_etag);
+  }
+
+  const char *range = host_http_header(request, "Range");
+  const char *if_range = host_http_header(request, "If-Range");
+  test_server_record(server->range, sizeof(server->range), range);
+  size_t offset = 0;
+  if (range != NULL && server->ranges && (if_range == NULL || (server->firmware_etag != NULL && strcmp(if_range, server->firmware_etag) == 0)))
+  {
+    offset = strtoul(range + strlen("bytes="), NULL, 10);
+    offset = offset < server->image_len ? offset : server->image_len;
+    char content_range[64];
+    snprintf(content_range, sizeof(content_range), "bytes %zu-%zu/%zu", offset, server->image_len - 1, server->image_len);
+    host_http_set_header(response, "Content-Range", content_range);
+    response->status = 206;
+    test_server_count(&server->ranges_served);
+  }
+
+  const char *running = host_http_header(request, "X-Firmware-Sha256");
+  const char *accept = host_http_header(request, "Accept-Encoding");
+  const uint8_t *body = server->image + offset;
+  size_t body_len = server->image_len - offset;
+  if (offset == 0 && server->delta != NULL && running != NULL && server->delta_base != NULL && strcmp(running, server->delta_base) == 0)
+  {
+    host_http_set_header(response, "Content-Type", "application/vnd.providore.delta");
+    body = server->delta;
+    body_len = server->delta_len;
+    test_server_count(&server->deltas);
+  }
+  else
+  {
+    host_http_set_header(response, "Content-Type", "application/octet-stream");
+  }
+
+  if (offset == 0 && server->encoding != NULL && accept != NULL && strstr(accept, server->encoding) != NULL)
+  {
+    uint8_t *compressed;
+    size_t compressed_len = test_compress(body, body_len, strcmp(server->encoding, "gzip") == 0, &compressed);
+    host_http_set_header(response, "Content-Encoding", server->encoding);
+    test_server_body(server, response, compressed, compressed_len, true);
+    test_server_count(&server->compressed);
+  }
+  else
+  {
+    test_server_body(server, response, body, body_len, false);
+  }
+
+  size_t drop_after = __atomic_exchange_n(&server->drop_after, 0, __ATOMIC_ACQ_REL);
+  if (drop_after > 0)
+  {
+    response->drop = true;
+    response->drop_after = drop_after;
+  }
+}
+
+static void test_server_handle(const host_http_request_t *request, host_http_response_t *response, void *user_data)
+{
+  test_server_t *server = (test_server_t *)user_data;
+  test_server_count(&server->requests);
+  const char *created_at = host_http_header(request, "Created-At");
+  test_server_record(server->created_at, sizeof(server->created_at), created_at);
+  if (!test_request_signed(request, server->psk))
+  {
+    test_server_count(&server->unsigned_requests);
+    response->status = 401;
+    return;
+  }
+
+  if (server->poll_interval > 0)
+  {
+    char value[16];
+    snprintf(value, sizeof(value), "%u", server->poll_interval);
+    host_http_set_header(response, "X-Poll-Interval", value);
+  }
+  if (server->retry_after > 0)
+  {
+    char value[16];
+    snprintf(value, sizeof(value), "%u", server->retry_after);
+    host_http_set_header(response, "Retry-After", value);
+  }
+
+  if (strcmp(request->path, "/config") == 0)
+  {
+    test_server_count(&server->config_requests);
+    if (server->config_status != 0)
+    {
+      response->status = server->config_status;
+      return;
+    }
+    const char *if_none_match = host_http_header(request, "If-None-Match");
+    if (server->etag != NULL)
+    {
+      host_http_set_header(response, "ETag", server->etag);
+      if (if_none_match != NULL && strcmp(if_none_match, server->etag) == 0)
+      {
+        test_server_count(&server->not_modified);
+        response->status = 304;
+        return;
+      }
+    }
+    test_sign_response(response, server->bad_signature ? "wrong" : server->psk, server->config, strlen(server->config));
+    host_http_set_header(response, "Content-Type", "application/json");
+    test_server_body(server, response, server->config, strlen(server->config), false);
+  }
+  else if (strcmp(request->path, "/firmware/manifest") == 0 && server->manifest)
+  {
+    test_server_count(&server->manifest_requests);
+    char sha256[TEST_SHA256_LEN];
+    char *manifest = malloc(256);
+    test_image_sha256(server->image, server->image_len, sha256);
+    int len = snprintf(manifest, 256, "{\"version\":\"%s\",\"size\":%zu,\"sha256\":\"%s\"}", server->version != NULL ? server->version : "2.0.0", server->image_len, sha256);
+    test_sign_response(response, server->psk, manifest, len);
+    test_server_body(server, response, manifest, len, true);
+  }
+  else if (strcmp(request->path, "/firmware") == 0 && server->image != NULL)
+  {
+    test_server_firmware(server, request, response);
+  }
+  else if (strncmp(request->path, "/sync?", 6) == 0 && server->sync != NULL)
+  {
+    test_server_count(&server->sync_requests);
+    test_server_record(server->sync_path, sizeof(server->sync_path), request->path);
+    test_sign_response(response, server->bad_signature ? "wrong" : server->psk, server->sync, server->sync_len);
+    host_http_set_header(response, "Content-Type", "application/vnd.providore.sync");
+    test_server_body(server, response, server->sync, server->sync_len, false);
+  }
+  else
+  {
+    // With a page, as a web server or proxy would send
+    static const char not_found[] = "<html><body>Not Found</body></html>";
+    response->status = 404;
+    test_server_body(server, response, not_found, sizeof(not_found) - 1, false);
+  }
+}
+
+void test_server_start(test_server_t *server)
+{
+  if (server->psk == NULL)
+  {
+    server->psk = TEST_PSK;
+  }
+  host_http_route(CONFIG_PROVIDORE_SERVER, test_server_handle, server);
+}
+
+#ifdef PROVIDORE_SERVER_SCRIPT
+#define TEST_SCRIPT_ARGS 32
+
+extern char **environ;
+
+static void test_write_file(const char *path, const void *data, size_t len)
+{
+  // Written alongside and renamed, so the server never reads half a file
+  char partial[80];
+  snprintf(partial, sizeof(partial), "%s.partial", path);
+  FILE *file = fopen(partial, "wb");
+  fwrite(data, 1, len, file);
+  fclose(file);
+  rename(partial, path);
+}
+
+static void test_temporary_path(char *path, const char *name)
+{
+  snprintf(path, 64, "/tmp/providore-%s-XXXXXX", name);
+  close(mkstemp(path));
+}
+
+void test_script_server_serve(test_script_server_t *server, const char *config, const uint8_t *image, size_t image_len)
+{
+  if (config != NULL)
+  {
+    test_write_file(server->config_path, config, strlen(config));
+  }
+  if (image != NULL)
+  {
+    test_write_file(server->firmware_path, image, image_len);
+  }
+}
+
+bool test_script_server_start(test_script_server_t *server, const char *config, const uint8_t *image, size_t image_len, const char *const *args)
+{
+  memset(server, 0, sizeof(*server));
+  test_temporary_path(server->config_path, "config");
+  test_temporary_path(server->firmware_path, "firmware");
+  test_script_server_serve(server, config, image, image_len);
+
+#ifdef CONFIG_SECURED_SHARED_KEY
+  char key[2 * sizeof(TEST_PSK)] = {0};
+  for (size_t i = 0; i < strlen(TEST_PSK); i++)
+  {
+    sprintf(key + 2 * i, "%02x", (uint8_t)TEST_PSK[i]);
+  }
+  const char *key_arg = "--key-hex";
+#else
+  const char *key = TEST_PSK;
+  const char *key_arg = "--psk";
+#endif
+  const char *argv[TEST_SCRIPT_ARGS] = {
+      PROVIDORE_PYTHON, PROVIDORE_SERVER_SCRIPT, "--port", "0", "--quiet", "--device-id", TEST_DEVICE_ID, key_arg, key,
+      "--config", server->config_path, "--firmware", server->firmware_path, "--firmware-version", "2.0.0"};
+  size_t argc = 15;
+  for (size_t i = 0; args != NULL && args[i] != NULL && argc < TEST_SCRIPT_ARGS - 1; i++)
+  {
+    argv[argc++] = args[i];
+  }
+
+  // It prints the port it picked once it is listening
+  int output[2];
+  if (pipe(output) != 0)
+  {
+    return false;
+  }
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, output[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addclose(&actions, output[0]);
+  pid_t pid;
+  int spawned = posix_spawn(&pid, PROVIDORE_PYTHON, &actions, NULL, (char *const *)argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(output[1]);
+  if (spawned != 0)
+  {
+    close(output[0]);
+    return false;
+  }
+  server->pid = pid;
+
+  FILE *started = fdopen(output[0], "r");
+  char line[256];
+  unsigned port = 0;
+  while (port == 0 && fgets(line, sizeof(line), started) != NULL)
+  {
+    const char *at = strstr(line, "on port ");
+    port = at != NULL ? (unsigned)atoi(at + 8) : 0;
+  }
+  fclose(started);
+  server->upstream.host = "127.0.0.1";
+  server->upstream.port = (uint16_t)port;
+  if (port == 0)
+  {
+    test_script_server_stop(server);
+    return false;
+  }
+  return true;
+}
+
+void test_script_server_route(test_script_server_t *server)
+{
+  host_http_route(CONFIG_PROVIDORE_SERVER, host_http_forward, &server->upstream);
+}
+
+int64_t test_script_server_stop(test_script_server_t *server)
+{
+  struct rusage usage = {0};
+  if (server->pid > 0)
+  {
+    int status;
+    kill(server->pid, SIGTERM);
+    wait4(server->pid, &status, 0, &usage);
+    server->pid = 0;
+  }
+  unlink(server->config_path);
+  unlink(server->firmware_path);
+  return (int64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+#endif
@@ -0,0 +1,126 @@
+#ifndef _HOST_TEST_SUPPORT_h
+#define _HOST_TEST_SUPPORT_h
+// A providore server and device for the tests to run the component against
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "host_stubs.h"
+
+#define TEST_DEVICE_ID "device-1"
+#define TEST_PSK "3f5a0c1d2e4b6a8c9d0e1f2a3b4c5d6e"
+#define TEST_CREATED_AT "2026-10-16T09:00:00Z"
+#define TEST_EXPIRY "2026-10-16T09:15:00Z"
+#define TEST_SIGNATURE_LEN 48
+#define TEST_SHA256_LEN 65
+
+void test_hmac(const void *key, size_t key_len, const void *message, size_t message_len, uint8_t *digest);
+// The providore signature of a response body
+void test_sign(const char *psk, const void *body, size_t body_len, const char *created_at, const char *expiry, char *signature);
+// Adds the created-at, expiry and signature headers for body
+void test_sign_response(host_http_response_t *response, const char *psk, const void *body, size_t body_len);
+// Whether the Authorization header was made with psk, for the signed fields the request carries
+bool test_request_signed(const host_http_request_t *request, const char *psk);
+
+// Saves the identity to NVS, as provisioning would
+void test_identity();
+// A valid app image of len bytes, different for each seed
+uint8_t *test_image(size_t len, uint32_t seed);
+// What the manifest names an image by: the digest IDF appends to it, or the
+// SHA-256 of the whole image when it has none, as esp_partition_get_sha256 reports
+void test_image_sha256(const void *image, size_t len, char *hex);
+// The device boots from ota_0 with this image. The component hashes the running
+// image once per process, so a test executable must always load the same one.
+void test_running_image(const uint8_t *image, size_t len);
+
+// zlib's own compressor, as the server would use
+size_t test_compress(const void *data, size_t len, bool gzip, uint8_t **output);
+// A delta patch from source to target: unchanged blocks are copied, changed
+// ones added to the source, and anything past the end of the source inserted
+size_t test_delta(const uint8_t *source, size_t source_len, const uint8_t *target, size_t target_len, uint8_t **output);
+// A sync body with a part for each name
+size_t test_sync_body(const char *const *names, const char *const *bodies, size_t count, uint8_t **output);
+
+// Heap allocations made since the process started. Not counted under ThreadSanitizer.
+uint64_t test_allocations();
+// Runs function on a task of its own and returns the most stack it used, in host bytes
+size_t test_stack_peak(void (*function)(void *), void *arguments);
+int64_t test_now_us();
+
+typedef struct _test_server
+{
+  const char *psk;
+
+  // GET /config, with 304 when If-None-Match matches etag
+  const char *config;
+  const char *etag;
+  int config_status;
+  uint32_t poll_interval;
+  uint32_t retry_after;
+
+  // GET /firmware/manifest
+  bool manifest;
+  const char *version;
+
+  // GET /firmware, honouring Range (with If-Range against firmware_etag)
+  // and Accept-Encoding, and sending delta when X-Firmware-Sha256 is delta_base
+  const uint8_t *image;
+  size_t image_len;
+  const char *firmware_etag;
+  const char *encoding;
+  const uint8_t *delta;
+  size_t delta_len;
+  const char *delta_base;
+  bool ranges;
+  // The next firmware response is cut off after this many bytes, then it is served in full
+  size_t drop_after;
+
+  // GET /sync, with whatever body the test built
+  const uint8_t *sync;
+  size_t sync_len;
+
+  // Applied to every response
+  size_t chunk_len;
+  uint32_t chunk_delay_ms;
+  bool bad_signature;
+  bool close;
+
+  // What the server saw, updated atomically
+  uint32_t requests;
+  uint32_t config_requests;
+  uint32_t not_modified;
+  uint32_t manifest_requests;
+  uint32_t firmware_requests;
+  uint32_t sync_requests;
+  uint32_t unsigned_requests;
+  uint32_t compressed;
+  uint32_t deltas;
+  uint32_t ranges_served;
+  char range[64];
+  char created_at[32];
+  char sync_path[128];
+} test_server_t;
+
+// Answers requests to CONFIG_PROVIDORE_SERVER
+void test_server_start(test_server_t *server);
+
+#ifdef PROVIDORE_SERVER_SCRIPT
+// tools/providore_server.py on a free local port, for TEST_DEVICE_ID with TEST_PSK
+// as its key, serving the config and firmware from temporary files
+typedef struct _test_script_server
+{
+  host_http_upstream_t upstream;
+  int pid;
+  char config_path[64];
+  char firmware_path[64];
+} test_script_server_t;
+
+// args are more command line arguments, NULL terminated, or NULL for none
+bool test_script_server_start(test_script_server_t *server, const char *config, const uint8_t *image, size_t image_len, const char *const *args);
+// Replaces what it serves, leaving either one as it is when NULL
+void test_script_server_serve(test_script_server_t *server, const char *config, const uint8_t *image, size_t image_len);
+// Sends requests to CONFIG_PROVIDORE_SERVER to it
+void test_script_server_route(test_script_server_t *server);
+// Stops it and returns the CPU time it used, in microseconds
+int64_t test_script_server_stop(test_script_server_t *server);
+#endif
+#endif
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer_pool.h"
+#include "config_parser.h"
+#include "sync.h"
+#include "test.h"
+#include "test_support.h"
+
+static const char *names[] = {"config", "manifest", "ca", "empty"};
+static const char *bodies[] = {"{\"interval\": 60}", "{\"version\": \"2.0.0\"}", "-----BEGIN CERTIFICATE-----", ""};
+
+// Reassembles a part from its pieces, checking each one lines up with the last
+typedef struct
+{
+  char data[256];
+  size_t len;
+  uint32_t calls;
+  bool out_of_order;
+  esp_err_t result;
+} part_t;
+
+static esp_err_t part_piece(const char *name, size_t offset, const void *data, size_t data_len, size_t part_len, void *user_data)
+{
+  part_t *part = (part_t *)user_data;
+  part->calls++;
+  if (offset != part->len || offset + data_len > part_len)
+  {
+    part->out_of_order = true;
+  }
+  memcpy(part->data + part->len, data, data_len);
+  part->len += data_len;
+  return part->result;
+}
+
+static esp_err_t decode(const uint8_t *body, size_t body_len, size_t chunk_len, const sync_handler_t *handlers, size_t handler_count)
+{
+  sync_decoder_t decoder;
+  sync_decoder_begin(&decoder, handlers, handler_count);
+  for (size_t offset = 0; offset < body_len; offset += chunk_len)
+  {
+    esp_err_t result = sync_decoder_write(&decoder, body + offset, body_len - offset < chunk_len ? body_len - offset : chunk_len);
+    if (result != ESP_OK)
+    {
+      return result;
+    }
+  }
+  return sync_decoder_finish(&decoder);
+}
+
+static void test_parts_in_any_chunk_size()
+{
+  uint8_t *body;
+  size_t body_len = test_sync_body(names, bodies, 4, &body);
+
+  for (size_t chunk_len = 1; chunk_len <= body_len; chunk_len++)
+  {
+    part_t parts[4];
+    memset(parts, 0, sizeof(parts));
+    sync_handler_t handlers[4];
+    for (int i = 0; i < 4; i++)
+    {
+      handlers[i] = (sync_handler_t){.name = names[i], .on_part = part_piece, .user_data = &parts[i]};
+    }
+
+    TEST_ASSERT_EQUAL_INT(ESP_OK, decode(body, body_len, chunk_len, handlers, 4));
+    for (int i = 0; i < 4; i++)
+    {
+      TEST_ASSERT(!parts[i].out_of_order);
+      TEST_ASSERT_EQUAL_INT(strlen(bodies[i]), parts[i].len);
+      TEST_ASSERT_EQUAL_MEMORY(bodies[i], parts[i].data, parts[i].len);
+    }
+    // An empty part still gets its one call
+    TEST_ASSERT_EQUAL_INT(1, parts[3].calls);
+  }
+  free(body);
+}
+
+static void test_unhandled_parts_skipped()
+{
+  uint8_t *body;
+  size_t body_len = test_sync_body(names, bodies, 4, &body);
+  part_t part;
+  memset(&part, 0, sizeof(part));
+  sync_handler_t handler = {.name = "ca", .on_part = part_piece, .user_data = &part};
+
+  TEST_ASSERT_EQUAL_INT(ESP_OK, decode(body, body_len, 7, &handler, 1));
+  TEST_ASSERT_EQUAL_INT(strlen(bodies[2]), part.len);
+  TEST_ASSERT_EQUAL_MEMORY(bodies[2], part.data, part.len);
+  free(body);
+}
+
+static void count_interval(const char *key, const config_value_t *value, void *user_data)
+{
+  if (strcmp(key, "interval") == 0 && value->type == CONFIG_VALUE_INTEGER && value->integer == 60)
+  {
+    (*(uint32_t *)user_data)++;
+  }
+}
+
+static void test_ready_made_handlers()
+{
+  uint8_t *body;
+  size_t body_len = test_sync_body(names, bodies, 2, &body);
+  providore_buffer_t manifest;
+  providore_buffer_init(&manifest);
+
+  config_parser_t parser;
+  uint32_t values = 0;
+  config_parser_begin(&parser, count_interval, &values);
+
+  sync_handler_t handlers[] = {
+      {.name = "config", .on_part = sync_parser_part, .user_data = &parser},
+      {.name = "manifest", .on_part = sync_buffer_part, .user_data = &manifest},
+  };
+  TEST_ASSERT_EQUAL_INT(ESP_OK, decode(body, body_len, 5, handlers, 2));
+  TEST_ASSERT_EQUAL_INT(1, values);
+  TEST_ASSERT_EQUAL_INT(strlen(bodies[1]), manifest.len);
+
+  char copy[64];
+  TEST_ASSERT_EQUAL_INT(manifest.len, providore_buffer_read(&manifest, 0, copy, sizeof(copy)));
+  TEST_ASSERT_EQUAL_MEMORY(bodies[1], copy, manifest.len);
+  providore_buffer_free(&manifest);
+  free(body);
+}
+
+// An empty config is no values rather than invalid JSON, and a handler the
+// response has no part for is told so
+static void test_empty_and_missing_parts()
+{
+  static const char *empty_names[] = {"config", "ca"};
+  static const char *empty_bodies[] = {"", "-----BEGIN CERTIFICATE-----"};
+  uint8_t *body;
+  size_t body_len = test_sync_body(empty_names, empty_bodies, 2, &body);
+
+  config_parser_t parser;
+  uint32_t values = 0;
+  config_parser_begin(&parser, count_interval, &values);
+  part_t manifest;
+  memset(&manifest, 0, sizeof(manifest));
+  bool config_received = false;
+  bool manifest_received = true;
+  bool ca_received = false;
+  providore_buffer_t ca;
+  providore_buffer_init(&ca);
+  sync_handler_t handlers[] = {
+      {.name = "config", .on_part = sync_parser_part, .user_data = &parser, .received = &config_received},
+      {.name = "manifest", .on_part = part_piece, .user_data = &manifest, .received = &manifest_received},
+      {.name = "ca", .on_part = sync_buffer_part, .user_data = &ca, .received = &ca_received},
+  };
+
+  TEST_ASSERT_EQUAL_INT(ESP_OK, decode(body, body_len, 3, handlers, 3));
+  TEST_ASSERT_EQUAL_INT(0, values);
+  TEST_ASSERT(config_received);
+  TEST_ASSERT(!manifest_received);
+  TEST_ASSERT_EQUAL_INT(0, manifest.calls);
+  TEST_ASSERT(ca_received);
+  TEST_ASSERT_EQUAL_INT(strlen(empty_bodies[1]), ca.len);
+  providore_buffer_free(&ca);
+  free(body);
+}
+
+static void test_handler_error_stops_decoding()
+{
+  uint8_t *body;
+  size_t body_len = test_sync_body(names, bodies, 2, &body);
+  part_t part;
+  memset(&part, 0, sizeof(part));
+  part.result = ESP_ERR_NO_MEM;
+  sync_handler_t handler = {.name = "config", .on_part = part_piece, .user_data = &part};
+
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_NO_MEM, decode(body, body_len, 4, &handler, 1));
+  TEST_ASSERT_EQUAL_INT(1, part.calls);
+  free(body);
+}
+
+static void test_invalid()
+{
+  uint8_t *body;
+  size_t body_len = test_sync_body(names, bodies, 2, &body);
+
+  // Cut off part way through the second part
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_SIZE, decode(body, body_len - 3, 8, NULL, 0));
+
+  // Not a sync response
+  body[0] = 'X';
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_RESPONSE, decode(body, body_len, 8, NULL, 0));
+
+  // A name that can't be held
+  body[0] = 'P';
+  body[4] = SYNC_NAME_LEN;
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_RESPONSE, decode(body, body_len, 8, NULL, 0));
+  body[4] = 0;
+  TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_RESPONSE, decode(body, body_len, 8, NULL, 0));
+  free(body);
+
+  // Just the magic is a response with no parts
+  TEST_ASSERT_EQUAL_INT(ESP_OK, decode((const uint8_t *)SYNC_MAGIC, 4, 1, NULL, 0));
+}
+
+int main()
+{
+  RUN_TEST(test_parts_in_any_chunk_size);
+  RUN_TEST(test_unhandled_parts_skipped);
+  RUN_TEST(test_ready_made_handlers);
+  RUN_TEST(test_empty_and_missing_parts);
+  RUN_TEST(test_handler_error_stops_decoding);
+  RUN_TEST(test_invalid);
+  return test_end();
+}
@@ -0,0 +1,51 @@
+#ifndef _PROVIDORE_BUFFER_POOL_h
+#define _PROVIDORE_BUFFER_POOL_h
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#define BUFFER_SEGMENT_LEN CONFIG_PROVIDORE_BUFFER_SEGMENT_SIZE
+
+typedef struct _buffer_segment
+{
+  struct _buffer_segment *next;
+  size_t len;
+  bool psram;
+  uint8_t data[BUFFER_SEGMENT_LEN];
+} buffer_segment_t;
+
+// A response of any size, held as a chain of fixed size segments so it can
+// grow without reallocating or copying what has already arrived. Walk it with
+//   for (buffer_segment_t *segment = buffer.head; segment != NULL; segment = segment->next)
+// or copy it out with providore_buffer_read.
+typedef struct _providore_buffer
+{
+  buffer_segment_t *head;
+  buffer_segment_t *tail;
+  size_t len;
+} providore_buffer_t;
+
+typedef struct _buffer_pool_usage
+{
+  size_t internal_bytes;
+  size_t internal_peak;
+  size_t psram_bytes;
+  size_t psram_peak;
+  uint32_t allocations;
+  uint32_t reuses;
+  uint32_t failures;
+} buffer_pool_usage_t;
+
+void providore_buffer_init(providore_buffer_t *buffer);
+esp_err_t providore_buffer_append(providore_buffer_t *buffer, const void *data, size_t data_len);
+// Copies up to output_len bytes starting at offset, returning how many were copied
+size_t providore_buffer_read(const providore_buffer_t *buffer, size_t offset, void *output, size_t output_len);
+// Hands the segments back to the pool
+void providore_buffer_free(providore_buffer_t *buffer);
+
+void buffer_pool_usage(buffer_pool_usage_t *usage);
+// Give the segments kept for reuse back to the heap
+void buffer_pool_trim();
+#endif
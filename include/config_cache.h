@@ -0,0 +1,22 @@
+#ifndef _PROVIDORE_CONFIG_CACHE_h
+#define _PROVIDORE_CONFIG_CACHE_h
+#include <stddef.h>
+#include "esp_err.h"
+#include "types.h"
+
+// The last verified config is kept in NVS with the headers it was signed with,
+// so an unchanged config (304 Not Modified) can be served and re-verified locally.
+typedef struct _config_cache
+{
+  char created_at[ISO8601_DATE_LEN];
+  char expiry[ISO8601_DATE_LEN];
+  char signature[SIGNATURE_LEN];
+  char etag[ETAG_LEN];
+  char last_modified[HTTP_DATE_LEN];
+} config_cache_t;
+
+esp_err_t config_cache_load(config_cache_t *cache);
+esp_err_t config_cache_load_body(void *output, size_t *length);
+esp_err_t config_cache_save(const config_cache_t *cache, const void *body, size_t body_len);
+esp_err_t config_cache_clear();
+#endif
@@ -0,0 +1,84 @@
+#ifndef _PROVIDORE_CONFIG_PARSER_h
+#define _PROVIDORE_CONFIG_PARSER_h
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define CONFIG_PARSER_DEPTH 8
+#define CONFIG_PARSER_KEY_LEN 96
+#define CONFIG_PARSER_VALUE_LEN 256
+
+typedef enum _config_value_type
+{
+  CONFIG_VALUE_STRING,
+  CONFIG_VALUE_INTEGER,
+  CONFIG_VALUE_NUMBER,
+  CONFIG_VALUE_BOOL,
+  CONFIG_VALUE_NULL
+} config_value_type_t;
+
+typedef struct _config_value
+{
+  config_value_type_t type;
+  const char *string;
+  size_t string_len;
+  int64_t integer;
+  double number;
+  bool boolean;
+} config_value_t;
+
+// Called once for every scalar in the config. The key is the path to it, with
+// nested objects joined by dots and array elements indexed, ie. "wifi.ssid" or
+// "sensors[2].pin". Both key and value are only valid for the duration of the call.
+typedef void (*config_parser_cb)(const char *key, const config_value_t *value, void *user_data);
+
+typedef enum _config_parser_state
+{
+  CONFIG_PARSER_VALUE,
+  CONFIG_PARSER_OBJECT_START,
+  CONFIG_PARSER_KEY,
+  CONFIG_PARSER_KEY_STRING,
+  CONFIG_PARSER_COLON,
+  CONFIG_PARSER_ARRAY_START,
+  CONFIG_PARSER_STRING,
+  CONFIG_PARSER_NUMBER,
+  CONFIG_PARSER_LITERAL,
+  CONFIG_PARSER_NEXT,
+  CONFIG_PARSER_DONE,
+  CONFIG_PARSER_ERROR
+} config_parser_state_t;
+
+typedef struct _config_parser_frame
+{
+  bool array;
+  uint16_t key_len;
+  uint32_t index;
+} config_parser_frame_t;
+
+// A push parser for JSON config. It is fed the body as it arrives and calls
+// back with each value as soon as it is complete, so the config never has to
+// be held in memory. Only the current key path and value are buffered, so
+// keys longer than CONFIG_PARSER_KEY_LEN, strings longer than
+// CONFIG_PARSER_VALUE_LEN and nesting deeper than CONFIG_PARSER_DEPTH fail.
+typedef struct _config_parser
+{
+  config_parser_cb callback;
+  void *user_data;
+  config_parser_state_t state;
+  config_parser_frame_t stack[CONFIG_PARSER_DEPTH];
+  size_t depth;
+  char key[CONFIG_PARSER_KEY_LEN];
+  size_t key_len;
+  char value[CONFIG_PARSER_VALUE_LEN];
+  size_t value_len;
+  uint8_t escape;
+  uint32_t codepoint;
+  uint32_t high_surrogate;
+  size_t position;
+} config_parser_t;
+
+void config_parser_begin(config_parser_t *parser, config_parser_cb callback, void *user_data);
+esp_err_t config_parser_write(config_parser_t *parser, const void *data, size_t data_len);
+esp_err_t config_parser_finish(config_parser_t *parser);
+#endif
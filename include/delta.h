@@ -0,0 +1,60 @@
+#ifndef _PROVIDORE_DELTA_h
+#define _PROVIDORE_DELTA_h
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#define DELTA_CONTENT_TYPE "application/vnd.providore.delta"
+#define DELTA_MAGIC "PDLT"
+#define DELTA_HEADER_LEN 8
+#define DELTA_COMMAND_LEN 9
+#define DELTA_BUFFER_LEN 256
+
+// A delta patch rebuilds the new firmware from the running one. It starts with
+// the magic and the size of the new image (little endian), followed by commands
+// of one opcode byte, a source offset and a length:
+//   COPY   - copy length bytes from the running image at offset
+//   INSERT - the next length bytes of the patch are new data
+//   ADD    - the next length bytes of the patch are added to the running image at offset
+//   END    - the image is complete
+// The new image is only ever written in order, so it can be streamed straight
+// into an OTA partition. The providore signature covers the rebuilt image, not
+// the patch.
+typedef enum _delta_opcode
+{
+  DELTA_END = 0,
+  DELTA_COPY = 1,
+  DELTA_INSERT = 2,
+  DELTA_ADD = 3
+} delta_opcode_t;
+
+typedef enum _delta_state
+{
+  DELTA_READING_HEADER,
+  DELTA_READING_COMMAND,
+  DELTA_INSERTING,
+  DELTA_ADDING,
+  DELTA_DONE
+} delta_state_t;
+
+typedef esp_err_t (*delta_write_cb)(void *user_data, const void *data, size_t data_len);
+
+typedef struct _delta_patch
+{
+  const esp_partition_t *source;
+  delta_write_cb write;
+  void *user_data;
+  delta_state_t state;
+  uint8_t fields[DELTA_COMMAND_LEN];
+  size_t fields_len;
+  uint32_t offset;
+  uint32_t remaining;
+  size_t image_size;
+  size_t written;
+  uint8_t buffer[DELTA_BUFFER_LEN];
+} delta_patch_t;
+
+void delta_patch_begin(delta_patch_t *patch, const esp_partition_t *source, delta_write_cb write, void *user_data);
+esp_err_t delta_patch_write(delta_patch_t *patch, const void *data, size_t data_len);
+esp_err_t delta_patch_finish(delta_patch_t *patch);
+#endif
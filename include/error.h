@@ -4,6 +4,15 @@ typedef enum _providore_err
 {
   PROVIDORE_OK = 0,
   PROVIDORE_SIG_MISMATCH = 1 << 0,
-  PROVIDORE_FIRMWARE_FAIL = 1 << 1
+  PROVIDORE_FIRMWARE_FAIL = 1 << 1,
+  PROVIDORE_RESPONSE_TOO_LARGE = 1 << 2,
+  PROVIDORE_CANCELLED = 1 << 3,
+  PROVIDORE_TIMEOUT = 1 << 4,
+  PROVIDORE_NO_MEM = 1 << 5,
+  PROVIDORE_INVALID_CONFIG = 1 << 6,
+  PROVIDORE_INVALID_RESPONSE = 1 << 7,
+  PROVIDORE_NO_UPDATE = 1 << 8,
+  PROVIDORE_BUSY = 1 << 9,
+  PROVIDORE_CONNECTION_FAIL = 1 << 10
 } providore_err_t;
 #endif
\ No newline at end of file
@@ -0,0 +1,22 @@
+#ifndef _PROVIDORE_FOOTPRINT_h
+#define _PROVIDORE_FOOTPRINT_h
+#include <stddef.h>
+
+// The most RAM the component itself can be using at once, worked out at
+// compile time from the Kconfig sizes. This assumes one request at a time
+// with the scheduler, config push and firmware sharing running. esp_http_client and TLS are not included, as
+// their use depends on the server and the mbedtls configuration.
+typedef struct _providore_footprint
+{
+  // Session, signer, OTA context, stats and other static state
+  size_t static_ram;
+  // A request task, the OTA flash writer, the scheduler, config push and the
+  // firmware sharing server
+  size_t stacks;
+  // OTA pipeline buffers, delta and inflate state, and internal RAM response buffers
+  size_t heap;
+  size_t total;
+} providore_footprint_t;
+
+void providore_get_footprint(providore_footprint_t *footprint);
+#endif
@@ -0,0 +1,68 @@
+#ifndef _PROVIDORE_INFLATE_h
+#define _PROVIDORE_INFLATE_h
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#if CONFIG_IDF_TARGET_ESP32
+#include "esp32/rom/miniz.h"
+#elif CONFIG_IDF_TARGET_ESP32S2
+#include "esp32s2/rom/miniz.h"
+#elif CONFIG_IDF_TARGET_ESP32S3
+#include "esp32s3/rom/miniz.h"
+#elif CONFIG_IDF_TARGET_ESP32C3
+#include "esp32c3/rom/miniz.h"
+#endif
+
+#ifdef CONFIG_PROVIDORE_OTA_COMPRESSION_WINDOW_BITS
+#define INFLATE_WINDOW_BITS CONFIG_PROVIDORE_OTA_COMPRESSION_WINDOW_BITS
+#else
+#define INFLATE_WINDOW_BITS 15
+#endif
+// The server has to compress with a window no bigger than this
+#define INFLATE_WINDOW_LEN (1 << INFLATE_WINDOW_BITS)
+#define GZIP_HEADER_LEN 10
+#define GZIP_TRAILER_LEN 8
+
+typedef enum _inflate_format
+{
+  INFLATE_NONE = 0,
+  INFLATE_DEFLATE,
+  INFLATE_GZIP
+} inflate_format_t;
+
+typedef enum _inflate_state
+{
+  INFLATE_GZIP_HEADER,
+  INFLATE_GZIP_EXTRA_LEN,
+  INFLATE_GZIP_EXTRA,
+  INFLATE_GZIP_NAME,
+  INFLATE_GZIP_COMMENT,
+  INFLATE_GZIP_HEADER_CRC,
+  INFLATE_DATA,
+  INFLATE_TRAILER
+} inflate_state_t;
+
+typedef esp_err_t (*inflate_write_cb)(void *user_data, const void *data, size_t data_len);
+
+// Decompresses a gzip or deflate (zlib) body as it streams in, using the ROM
+// inflater and a fixed size window. Output is handed on as it is produced.
+typedef struct _inflate_stream
+{
+  tinfl_decompressor decompressor;
+  uint8_t window[INFLATE_WINDOW_LEN];
+  size_t window_pos;
+  inflate_format_t format;
+  inflate_state_t state;
+  uint8_t header[GZIP_HEADER_LEN];
+  size_t header_len;
+  size_t skip;
+  inflate_write_cb write;
+  void *user_data;
+  size_t compressed;
+  size_t inflated;
+} inflate_stream_t;
+
+void inflate_begin(inflate_stream_t *stream, inflate_format_t format, inflate_write_cb write, void *user_data);
+esp_err_t inflate_write(inflate_stream_t *stream, const void *data, size_t data_len);
+esp_err_t inflate_finish(inflate_stream_t *stream);
+#endif
@@ -0,0 +1,96 @@
+#ifndef _PROVIDORE_METRICS_h
+#define _PROVIDORE_METRICS_h
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "buffer_pool.h"
+
+// Bucket 0 is under 1ms, bucket n is [2^(n-1), 2^n) ms and the last bucket
+// takes everything from 2^(PROVIDORE_METRICS_BUCKETS - 2) ms up.
+#define PROVIDORE_METRICS_BUCKETS 16
+
+// esp_http_client does not report DNS, TCP and TLS separately, so they are
+// all timed together as CONNECT - from the start of the request to
+// HTTP_EVENT_ON_CONNECTED. A reused connection has no CONNECT sample.
+typedef enum _providore_phase
+{
+  PROVIDORE_PHASE_CONNECT,
+  PROVIDORE_PHASE_FIRST_BYTE,
+  PROVIDORE_PHASE_BODY,
+  PROVIDORE_PHASE_SIGN,
+  PROVIDORE_PHASE_VERIFY,
+  PROVIDORE_PHASE_OTA_BEGIN,
+  PROVIDORE_PHASE_OTA_WRITE,
+  PROVIDORE_PHASE_OTA_END,
+  PROVIDORE_PHASE_MAX
+} providore_phase_t;
+
+// Tasks the component starts, whose stack use is reported
+typedef enum _providore_task
+{
+  PROVIDORE_TASK_REQUEST,
+  PROVIDORE_TASK_FIRMWARE,
+  PROVIDORE_TASK_SCHEDULER,
+  PROVIDORE_TASK_OTA_WRITER,
+  PROVIDORE_TASK_PUSH,
+  PROVIDORE_TASK_MAX
+} providore_task_t;
+
+typedef enum _providore_operation
+{
+  PROVIDORE_OPERATION_CONFIG,
+  PROVIDORE_OPERATION_MANIFEST,
+  PROVIDORE_OPERATION_SYNC,
+  PROVIDORE_OPERATION_FIRMWARE,
+  PROVIDORE_OPERATION_MAX
+} providore_operation_t;
+
+// Stack use is taken from the task's high-water mark when it finishes
+typedef struct _providore_stack_usage
+{
+  uint32_t size;
+  uint32_t peak;
+} providore_stack_usage_t;
+
+// Heap use is the drop in free heap from the start of a request, sampled on
+// every HTTP event, so anything another task allocates at the same time is
+// counted too. It includes esp_http_client and TLS.
+typedef struct _providore_heap_usage
+{
+  uint32_t count;
+  uint32_t peak;
+  uint32_t last;
+} providore_heap_usage_t;
+
+typedef struct _providore_histogram
+{
+  uint32_t count;
+  uint32_t max_us;
+  uint64_t total_us;
+  uint32_t buckets[PROVIDORE_METRICS_BUCKETS];
+} providore_histogram_t;
+
+typedef struct _providore_stats
+{
+  providore_histogram_t phases[PROVIDORE_PHASE_MAX];
+  uint32_t requests;
+  uint32_t retries;
+  uint32_t failures;
+  uint64_t bytes_received;
+  buffer_pool_usage_t memory;
+  providore_stack_usage_t stacks[PROVIDORE_TASK_MAX];
+  providore_heap_usage_t heap[PROVIDORE_OPERATION_MAX];
+} providore_stats_t;
+
+// A copy of everything recorded since boot, or the last providore_reset_stats()
+void providore_get_stats(providore_stats_t *stats);
+void providore_reset_stats();
+
+void providore_metrics_record(providore_phase_t phase, int64_t elapsed_us);
+void providore_metrics_request(bool failed);
+void providore_metrics_retry();
+void providore_metrics_received(size_t len);
+// Call from the end of the task itself
+void providore_metrics_stack(providore_task_t task, uint32_t stack_size);
+void providore_metrics_heap(providore_operation_t operation, size_t used);
+#endif
@@ -0,0 +1,14 @@
+#ifndef _PROVIDORE_ONCE_h
+#define _PROVIDORE_ONCE_h
+#include <stdbool.h>
+#include <stdint.h>
+
+// Lazy, one-time initialisation that is safe to race from several tasks
+typedef volatile uint32_t providore_once_t;
+#define PROVIDORE_ONCE_INIT 0
+
+// Returns true to exactly one caller, which must initialise and then call
+// providore_once_end. Everyone else waits for that and gets false.
+bool providore_once_begin(providore_once_t *once);
+void providore_once_end(providore_once_t *once);
+#endif
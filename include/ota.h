@@ -2,7 +2,22 @@
 #define _PROVIDORE_OTA_h
 #include "esp_err.h"
 #include "esp_http_client.h"
+#include "esp_partition.h"
 #include "error.h"
+#include "types.h"
 
 esp_err_t providore_ota_firmware_event_handle(esp_http_client_event_t *evt);
+// The hex digest firmware is named by in the manifest, X-Firmware-Sha256 and
+// to peers: what esp_partition_get_sha256 reports for the image in partition,
+// which is the SHA-256 IDF appends to it, or of the whole image without one.
+// False if there is no valid image there.
+bool providore_ota_partition_sha256(const esp_partition_t *partition, char *hex);
+// The digest of the running image, which a delta update is patched against
+const char *providore_ota_running_sha256();
+// Fills a firmware_manifest_t from the manifest JSON, as a config_parser_cb
+void providore_ota_manifest_field(const char *key, const config_value_t *value, void *user_data);
+// Compares by hash when the manifest has one, otherwise by version
+bool providore_ota_manifest_differs(const firmware_manifest_t *manifest);
+// Stop the flash writer and throw away a partially written update
+void providore_ota_abort(ota_request_context_t *context);
 #endif
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef _PROVIDORE_OTA_CHECKPOINT_h
+#define _PROVIDORE_OTA_CHECKPOINT_h
+#include <stdint.h>
+#include "esp_err.h"
+#include "mbedtls/sha256.h"
+
+#define ETAG_LEN 64
+
+// How far a firmware download got, saved to NVS so an interrupted download can
+// carry on from there with a Range request instead of starting from scratch.
+// The hash state is saved as it is in memory, so layout records what wrote it
+// and a checkpoint from a different mbedtls or IDF build is thrown away.
+typedef struct _ota_checkpoint
+{
+  uint32_t layout;
+  uint32_t partition_address;
+  uint32_t offset;
+  mbedtls_sha256_context hash;
+  char etag[ETAG_LEN];
+} ota_checkpoint_t;
+
+esp_err_t ota_checkpoint_load(ota_checkpoint_t *checkpoint);
+esp_err_t ota_checkpoint_save(const ota_checkpoint_t *checkpoint);
+esp_err_t ota_checkpoint_clear();
+#endif
@@ -0,0 +1,67 @@
+#ifndef _PROVIDORE_OTA_PIPELINE_h
+#define _PROVIDORE_OTA_PIPELINE_h
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_ota_ops.h"
+#include "esp_spi_flash.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "ota_checkpoint.h"
+#include "signature.h"
+
+#define OTA_PIPELINE_BUFFERS CONFIG_PROVIDORE_OTA_PIPELINE_BUFFERS
+// Whole sectors, so with checkpoints only ever taken on a sector boundary every
+// flash write starts on one too, and HTTP chunks of any size are coalesced
+// into as few flash writes as possible.
+#define OTA_PIPELINE_BUFFER_LEN ((CONFIG_PROVIDORE_OTA_PIPELINE_BUFFER_SIZE + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE)
+
+typedef struct _ota_pipeline_buffer
+{
+  uint8_t data[OTA_PIPELINE_BUFFER_LEN];
+  size_t len;
+} ota_pipeline_buffer_t;
+
+// Decouples the download from flash writes: the HTTP handler fills a fixed pool
+// of buffers and a writer task drains them with esp_ota_write. The ring has a
+// single producer and a single consumer, each of which only ever moves its own
+// index, so no lock is needed. The semaphores only count buffers so either side
+// can block - the handler blocks when every buffer is waiting on flash.
+// Data is hashed once it has been written, so a checkpoint never gets ahead of
+// what is actually in flash.
+typedef struct _ota_pipeline
+{
+  ota_pipeline_buffer_t buffers[OTA_PIPELINE_BUFFERS];
+  volatile uint32_t head;
+  volatile uint32_t tail;
+  bool owned;
+  bool running;
+  SemaphoreHandle_t filled;
+  SemaphoreHandle_t free;
+  SemaphoreHandle_t done;
+  TaskHandle_t writer;
+  esp_ota_handle_t ota_handle;
+  const esp_partition_t *partition;
+  size_t offset;
+  size_t erased_to;
+  ota_checkpoint_t *checkpoint;
+  signature_verifier_t *verifier;
+  // Both read by the handler while the writer updates them, so only through __atomic builtins
+  esp_err_t error;
+  size_t written;
+  int64_t flash_us;
+  int64_t started_at;
+  int64_t finished_at;
+} ota_pipeline_t;
+
+// Without an ota_handle, data is written straight to the partition starting at
+// checkpoint->offset, erasing as it goes - used when resuming a download.
+// Without a checkpoint, progress is not saved
+ota_pipeline_t *ota_pipeline_create(esp_ota_handle_t ota_handle, const esp_partition_t *partition, ota_checkpoint_t *checkpoint, signature_verifier_t *verifier);
+esp_err_t ota_pipeline_write(ota_pipeline_t *pipeline, const void *data, size_t data_len);
+esp_err_t ota_pipeline_finish(ota_pipeline_t *pipeline);
+void ota_pipeline_destroy(ota_pipeline_t *pipeline);
+// Bytes per second written to flash so far
+size_t ota_pipeline_throughput(ota_pipeline_t *pipeline);
+#endif
@@ -0,0 +1,33 @@
+#ifndef _PROVIDORE_PEER_h
+#define _PROVIDORE_PEER_h
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#define PEER_SERVICE_TYPE "_providore"
+#define PEER_SERVICE_PROTO "_tcp"
+#define PEER_FIRMWARE_PATH "/providore/firmware"
+
+struct _ota_request_context;
+
+// Share the last verified firmware image with other devices on the LAN: it is
+// served over HTTP from the partition it was written to, and advertised over
+// mDNS with its SHA-256. mDNS has to be initialised, with a hostname, first.
+// The image is readable by anything on the LAN.
+esp_err_t providore_peer_start();
+void providore_peer_stop();
+
+// Called once an OTA has been verified and the image in partition can be shared
+void providore_peer_offer(const esp_partition_t *partition, size_t image_len, const char *created_at, const char *expiry, const char *signature);
+// Called before partition is overwritten
+void providore_peer_forget(const esp_partition_t *partition);
+
+// Download the image with this SHA-256, from the signed manifest, from a peer.
+// The image is checked against the SHA-256 once it is in flash, rather than
+// against the peer's signature, which is made with the peer's own key. Only
+// tried once providore_peer_start has been called. On failure the context is
+// left ready to download from the server, except ESP_ERR_TIMEOUT, which means
+// the request was cancelled or ran out of time and shouldn't carry on.
+esp_err_t providore_peer_fetch(struct _ota_request_context *context, const char *sha256);
+#endif
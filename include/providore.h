@@ -3,10 +3,108 @@
 #include <string.h>
 #include "error.h"
 #include <stdbool.h>
+#include "esp_err.h"
+#include "buffer_pool.h"
+#include "config_parser.h"
+#include "sync.h"
+#include "freertos/FreeRTOS.h"
+#include "footprint.h"
+#include "metrics.h"
+#include "peer.h"
+#include "server_time.h"
+
+typedef enum _providore_request_type
+{
+  PROVIDORE_REQUEST_CONFIG,
+  PROVIDORE_REQUEST_FIRMWARE
+} providore_request_type_t;
+
+// Callbacks are made from the request's own task, so keep them short
+typedef void (*providore_progress_cb)(size_t downloaded, size_t total, void *user_data);
+typedef void (*providore_complete_cb)(providore_err_t result, void *user_data);
+
+#define MANIFEST_VERSION_LEN 32
+#define MANIFEST_SHA256_LEN 65
+
+// What /firmware/manifest says the current firmware is. size is the size of
+// the complete, uncompressed image.
+typedef struct _firmware_manifest
+{
+  char version[MANIFEST_VERSION_LEN];
+  size_t size;
+  char sha256[MANIFEST_SHA256_LEN];
+} firmware_manifest_t;
+
+// An asynchronous request. The caller owns it, and it has to stay around until
+// on_complete has been called.
+typedef struct _providore_request
+{
+  providore_request_type_t type;
+  struct _providore_signer *signer;
+  size_t output_max_len;
+  const char *output;
+  size_t *output_len;
+  providore_progress_cb on_progress;
+  providore_complete_cb on_complete;
+  void *user_data;
+  TickType_t started;
+  TickType_t timeout;
+  volatile bool cancelled;
+  volatile bool running;
+} providore_request_t;
 
 void providore_confirm_upgrade();
+// Load the device_id and psk from NVS once, after which NULL can be passed for
+// them to providore_get_config and providore_firmware_upgrade
+esp_err_t providore_load_identity();
 providore_err_t providore_get_config(const char *device_id, const char *psk, size_t output_max_len, const char *output, size_t *output_len);
+// Long-poll for a config that differs from the cached one, which the server
+// holds the request open for, for up to CONFIG_PROVIDORE_PUSH_WAIT seconds.
+// Returns PROVIDORE_NO_UPDATE when nothing changed in that time. This runs
+// on a connection of its own, so other requests aren't held up behind it.
+// Needs CONFIG_PROVIDORE_CONFIG_CACHE, PROVIDORE_INVALID_CONFIG without it.
+providore_err_t providore_wait_config(const char *device_id, const char *psk, size_t output_max_len, const char *output, size_t *output_len);
+// Stream the config through a JSON parser instead of into a buffer, so its size
+// isn't limited by memory. Values arrive before the signature has been checked:
+// stage them, and only apply them once this returns PROVIDORE_OK. Parsed
+// configs are not cached.
+providore_err_t providore_get_config_parsed(const char *device_id, const char *psk, config_parser_cb callback, void *user_data);
+// Fetch a config of any size into a chain of pooled segments. Free it with
+// providore_buffer_free whatever the result. Buffered configs are not cached.
+providore_err_t providore_get_config_buffer(const char *device_id, const char *psk, providore_buffer_t *output);
+// Fetch several resources, ie. config, the firmware manifest and certificates, in
+// one signed request, handing each part of the response to the handler with its
+// name. As with the parsed config, parts arrive before the signature has been
+// checked, so only apply them once this returns PROVIDORE_OK. Resources the
+// server has none of are left out, so their handlers aren't called; a
+// handler's received flag says whether it had a part.
+providore_err_t providore_sync(const char *device_id, const char *psk, const sync_handler_t *handlers, size_t handler_count);
+providore_err_t providore_firmware_manifest(const char *device_id, const char *psk, firmware_manifest_t *manifest);
+// Returns PROVIDORE_NO_UPDATE when the manifest shows the running firmware is current
 providore_err_t providore_firmware_upgrade(const char *device_id, const char *psk);
+// Start a request and return straight away. on_complete gets the same result the
+// blocking version would have returned, or PROVIDORE_CANCELLED / PROVIDORE_TIMEOUT.
+// A timeout_ms of 0 never times out. If these don't return PROVIDORE_OK the request
+// was not started, and on_complete will not be called.
+providore_err_t providore_get_config_async(providore_request_t *request, const char *device_id, const char *psk, size_t output_max_len, const char *output, size_t *output_len, uint32_t timeout_ms, providore_complete_cb on_complete, void *user_data);
+providore_err_t providore_firmware_upgrade_async(providore_request_t *request, const char *device_id, const char *psk, uint32_t timeout_ms, providore_progress_cb on_progress, providore_complete_cb on_complete, void *user_data);
+// Ask a running request to stop. It still completes through on_complete.
+// A request notices the timeout or cancelling as headers or data arrive, and
+// while waiting for them once the time left is shorter than the client's
+// usual 5 s, as the connection is then opened again with the time left as
+// its timeout. Cancelling in between waits for the next read, at most 5 s,
+// and DNS lookups are not bounded at all.
+void providore_cancel(providore_request_t *request);
+// Only false once on_complete has returned and the request is no longer used,
+// after which it can be freed or reused
+bool providore_request_running(const providore_request_t *request);
+// X-Poll-Interval and Retry-After from the last config, manifest or sync request to
+// finish, from any task, in seconds, 0 when not sent
+void providore_server_hints(uint32_t *poll_interval, uint32_t *retry_after);
+// Drop the kept-alive connection to the providore server, ie before deep sleep.
+// esp_http_client on IDF 4.3 can't resume TLS sessions, so the next connection
+// is a full handshake.
+void providore_close_session();
 
 bool providore_self_test_required();
 void providore_confirm_upgrade();
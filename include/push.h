@@ -0,0 +1,34 @@
+#ifndef _PROVIDORE_PUSH_h
+#define _PROVIDORE_PUSH_h
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "error.h"
+#include "sdkconfig.h"
+
+#define PUSH_STACK_SIZE CONFIG_PROVIDORE_TASK_STACK_SIZE
+
+typedef void (*providore_push_cb)(const char *config, size_t config_len, void *user_data);
+
+typedef struct _providore_push_config
+{
+  // Seconds between requests when the server answers without holding them
+  uint32_t interval;
+  // Failed requests wait backoff_min seconds, doubling each time up to backoff_max
+  uint32_t backoff_min;
+  uint32_t backoff_max;
+  char *config;
+  size_t config_max_len;
+  // Called with every verified config that differs from the last, starting with the current one
+  providore_push_cb on_config;
+  void *user_data;
+} providore_push_config_t;
+
+// Keeps a config long-poll open on a task of its own, so config changes arrive
+// as soon as the server has them. Identity comes from providore_load_identity().
+// Needs CONFIG_PROVIDORE_CONFIG_CACHE, ESP_ERR_NOT_SUPPORTED without it.
+esp_err_t providore_push_start(const providore_push_config_t *config);
+// A long-poll that is already waiting finishes first, which can take up to
+// CONFIG_PROVIDORE_PUSH_WAIT seconds
+void providore_push_stop();
+#endif
@@ -0,0 +1,49 @@
+#ifndef _PROVIDORE_SCHEDULER_h
+#define _PROVIDORE_SCHEDULER_h
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "error.h"
+
+typedef void (*providore_config_poll_cb)(providore_err_t result, const char *config, size_t config_len, void *user_data);
+typedef void (*providore_firmware_poll_cb)(providore_err_t result, void *user_data);
+
+typedef struct _providore_scheduler_config
+{
+  // Used until the server sends an X-Poll-Interval
+  uint32_t interval;
+  // Each delay is randomly moved by up to this much either way
+  uint32_t jitter_percent;
+  // The first poll happens at a random point up to this far after starting,
+  // so devices that boot together don't all poll together
+  uint32_t startup_delay_max;
+  // Failed polls wait backoff_min, doubling each time up to backoff_max
+  uint32_t backoff_min;
+  uint32_t backoff_max;
+  bool firmware;
+  char *config;
+  size_t config_max_len;
+  providore_config_poll_cb on_config;
+  providore_firmware_poll_cb on_firmware;
+  void *user_data;
+} providore_scheduler_config_t;
+
+// Everything the next delay depends on, kept apart from the task so the policy
+// can be driven by a virtual clock
+typedef struct _providore_scheduler_state
+{
+  uint32_t failures;
+} providore_scheduler_state_t;
+
+// All times are in seconds. poll_interval and retry_after are the server's hints,
+// 0 when it didn't send them, and random is any uniformly distributed value.
+// The result is never less than retry_after.
+uint32_t providore_scheduler_next_delay(const providore_scheduler_config_t *config, providore_scheduler_state_t *state, providore_err_t result, uint32_t poll_interval, uint32_t retry_after, uint32_t random);
+
+// Polls /config, and /firmware if asked to, on a task of its own. Identity
+// comes from providore_load_identity(). Callbacks are made from that task.
+esp_err_t providore_scheduler_start(const providore_scheduler_config_t *config);
+void providore_scheduler_poll_now();
+void providore_scheduler_stop();
+#endif
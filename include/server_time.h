@@ -0,0 +1,20 @@
+#ifndef _PROVIDORE_SERVER_TIME_h
+#define _PROVIDORE_SERVER_TIME_h
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// The difference between the server's clock and ours, learned from the signed
+// created-at header of every verified response. It is kept in RTC memory, so
+// it survives deep sleep but not a power cycle. Once learned the offset only
+// moves forward, and responses already expired by the corrected clock are
+// ignored; reset it to follow a clock that has been set back.
+void providore_server_time_learn(const char *created_at, const char *expiry);
+bool providore_server_time_offset(int64_t *offset);
+// Forget the offset, ie. once SNTP has set the clock
+void providore_server_time_reset();
+
+// The time to sign requests with. With CONFIG_PROVIDORE_SERVER_TIME this is
+// the local clock corrected by the learned offset, otherwise the local clock.
+time_t providore_server_time_now();
+#endif
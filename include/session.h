@@ -0,0 +1,63 @@
+#ifndef _PROVIDORE_SESSION_h
+#define _PROVIDORE_SESSION_h
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_http_client.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "types.h"
+
+// A session keeps a single HTTP(S) connection to the providore server open
+// so config, firmware and any other endpoint can share one TLS handshake.
+typedef struct _providore_session
+{
+  char url[URL_BUFFER_LEN];
+  esp_http_client_handle_t client;
+  SemaphoreHandle_t lock;
+  http_event_handle_cb event_handler;
+  void *user_data;
+  TickType_t last_used;
+  const volatile bool *cancelled;
+  TickType_t started;
+  TickType_t timeout;
+  int64_t requested_at;
+  int64_t sent_at;
+  int64_t first_byte_at;
+  // Set before the first request. With a wait, the server is asked to hold
+  // each request open for up to that many seconds, ie. for a long-poll.
+  uint32_t wait;
+  int timeout_ms;
+  // What the current client was created with, which can be less for a request running out of time
+  int client_timeout_ms;
+  // Server hints from the response in progress, in seconds, 0 if not sent
+  uint32_t poll_interval;
+  uint32_t retry_after;
+  // Those of the last request to finish, poll_interval in the high half, so
+  // other tasks can read both at once without waiting for the lock
+  uint64_t hints;
+  // Free heap when the request began, and the least seen since
+  size_t heap_free_at_begin;
+  size_t heap_free_min;
+  bool connected;
+  bool reused;
+  bool received;
+  bool aborted;
+} providore_session_t;
+
+esp_err_t providore_session_init(providore_session_t *session);
+esp_http_client_handle_t providore_session_begin(providore_session_t *session, const char *path, http_event_handle_cb event_handler, void *user_data);
+// Abort the current request once *cancelled is set or timeout ticks have passed since started.
+// A timeout of 0 never expires. Cleared by providore_session_end. Call it before setting
+// any headers and make the request with the client it returns: with less time left than
+// the client's timeout, the client is replaced by one that gives up in time. NULL when
+// that fails, and the session has been ended.
+esp_http_client_handle_t providore_session_watch(providore_session_t *session, const volatile bool *cancelled, TickType_t started, TickType_t timeout);
+esp_err_t providore_session_perform(providore_session_t *session);
+// How much the free heap has dropped since providore_session_begin, at its lowest
+size_t providore_session_heap_used(const providore_session_t *session);
+void providore_session_end(providore_session_t *session);
+// The server's hints from the last request to finish on the session
+void providore_session_hints(const providore_session_t *session, uint32_t *poll_interval, uint32_t *retry_after);
+void providore_session_close(providore_session_t *session);
+void providore_session_cleanup(providore_session_t *session);
+#endif
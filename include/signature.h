@@ -0,0 +1,30 @@
+#ifndef _PROVIDORE_SIGNATURE_h
+#define _PROVIDORE_SIGNATURE_h
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "mbedtls/sha256.h"
+#include "signer.h"
+
+// Incrementally checks the providore signature of a response: the body is fed in
+// as it arrives, then the signed created-at and expiry headers are appended.
+// The hash state can be saved and picked up again later, ie. when resuming a
+// firmware download. With the software signer it is the HMAC's inner hash. The
+// eFuse signer can only HMAC a whole message at once, so it is a plain SHA-256
+// of the message, and the peripheral HMACs that digest.
+typedef struct _signature_verifier
+{
+  const providore_signer_t *signer;
+  mbedtls_sha256_context inner;
+  // Time spent hashing so far, recorded as one PROVIDORE_PHASE_VERIFY sample
+  int64_t elapsed_us;
+} signature_verifier_t;
+
+void signature_verify_begin(signature_verifier_t *verifier, const providore_signer_t *signer);
+bool signature_verify_resume(signature_verifier_t *verifier, const providore_signer_t *signer, const mbedtls_sha256_context *state);
+void signature_verify_update(signature_verifier_t *verifier, const void *data, size_t data_len);
+bool signature_verify_checkpoint(signature_verifier_t *verifier, mbedtls_sha256_context *state);
+bool signature_verify_finish(signature_verifier_t *verifier, const char *created_at, const char *expiry, const char *signature);
+void signature_verify_free(signature_verifier_t *verifier);
+#endif
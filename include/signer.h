@@ -0,0 +1,41 @@
+#ifndef _PROVIDORE_SIGNER_h
+#define _PROVIDORE_SIGNER_h
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "mbedtls/sha256.h"
+
+#define DEVICE_ID_LEN 64
+#define PSK_LEN 65
+#define HMAC_BLOCK_LEN 64
+#define HMAC_DIGEST_LEN 32
+
+// Holds a device's identity and everything needed to sign with its key, worked
+// out once rather than on every request. With the software backend the SHA-256
+// states after the HMAC inner and outer pads are kept, so each signature only
+// hashes the message itself. With CONFIG_SECURED_SHARED_KEY the key never
+// leaves eFuse and signing goes through the HMAC peripheral.
+typedef struct _providore_signer
+{
+  char device_id[DEVICE_ID_LEN];
+#ifndef CONFIG_SECURED_SHARED_KEY
+  char psk[PSK_LEN];
+  mbedtls_sha256_context inner;
+  mbedtls_sha256_context outer;
+#endif
+} providore_signer_t;
+
+esp_err_t providore_signer_init(providore_signer_t *signer, const char *device_id, const char *psk);
+// Load the device_id (and psk, unless it is in eFuse) from NVS
+esp_err_t providore_signer_load(providore_signer_t *signer);
+bool providore_signer_matches(const providore_signer_t *signer, const char *device_id, const char *psk);
+// Writes the Authorization header value for a request
+void providore_signer_authorization(const providore_signer_t *signer, char *output, size_t output_len, const char *method, const char *path, const char *version, const char *created_at, const char *expiry);
+// One-shot HMAC of a message, for backends that can't hash incrementally
+esp_err_t providore_signer_hmac(const providore_signer_t *signer, const void *message, size_t message_len, uint8_t *digest);
+#ifndef CONFIG_SECURED_SHARED_KEY
+void providore_signer_hmac_begin(const providore_signer_t *signer, mbedtls_sha256_context *inner);
+void providore_signer_hmac_finish(const providore_signer_t *signer, mbedtls_sha256_context *inner, uint8_t *digest);
+#endif
+#endif
@@ -0,0 +1,71 @@
+#ifndef _PROVIDORE_SYNC_h
+#define _PROVIDORE_SYNC_h
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define SYNC_CONTENT_TYPE "application/vnd.providore.sync"
+#define SYNC_MAGIC "PSYN"
+#define SYNC_NAME_LEN 32
+#define SYNC_HANDLER_MAX 32
+
+// Called with each piece of a part as it arrives. offset is where the piece
+// starts within the part and part_len is the size of the whole part, so the
+// first piece has an offset of 0 and the last ends at part_len. An empty part
+// gets a single call with no data.
+typedef esp_err_t (*sync_part_cb)(const char *name, size_t offset, const void *data, size_t data_len, size_t part_len, void *user_data);
+
+// The server leaves out resources it has none of, so a handler may not be
+// called at all. When received is set it tells the two apart once the
+// response has been decoded.
+typedef struct _sync_handler
+{
+  const char *name;
+  sync_part_cb on_part;
+  void *user_data;
+  bool *received;
+} sync_handler_t;
+
+typedef enum _sync_state
+{
+  SYNC_READING_MAGIC,
+  SYNC_READING_NAME_LEN,
+  SYNC_READING_NAME,
+  SYNC_READING_LENGTH,
+  SYNC_READING_BODY
+} sync_state_t;
+
+// A sync response carries several resources in one signed body. It starts with
+// the magic, followed by parts of a one byte name length, the name, the body
+// length (u32 little endian) and the body. The providore signature covers the
+// whole response, so parts are handed on before it has been checked.
+typedef struct _sync_decoder
+{
+  const sync_handler_t *handlers;
+  size_t handler_count;
+  const sync_handler_t *current;
+  sync_state_t state;
+  uint8_t fields[4];
+  size_t fields_len;
+  char name[SYNC_NAME_LEN];
+  size_t name_len;
+  size_t part_len;
+  size_t part_offset;
+  uint32_t parts;
+  // A bit for each handler that has had its part
+  uint32_t handled;
+} sync_decoder_t;
+
+// Takes up to SYNC_HANDLER_MAX handlers. Finishing logs each handler that got
+// no part and sets its received flag.
+void sync_decoder_begin(sync_decoder_t *decoder, const sync_handler_t *handlers, size_t handler_count);
+esp_err_t sync_decoder_write(sync_decoder_t *decoder, const void *data, size_t data_len);
+esp_err_t sync_decoder_finish(sync_decoder_t *decoder);
+
+// Ready made handlers: user_data is a providore_buffer_t, or a config_parser_t
+// that has been through config_parser_begin. An empty config part is parsed
+// as no values rather than invalid JSON.
+esp_err_t sync_buffer_part(const char *name, size_t offset, const void *data, size_t data_len, size_t part_len, void *user_data);
+esp_err_t sync_parser_part(const char *name, size_t offset, const void *data, size_t data_len, size_t part_len, void *user_data);
+#endif
@@ -1,14 +1,23 @@
 #ifndef _PROVIDORE_TYPES_h
 #define _PROVIDORE_TYPES_h
 
+#include "sdkconfig.h"
 #include "esp_ota_ops.h"
-#include "freertos/event_groups.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "delta.h"
+#include "inflate.h"
+#include "ota_checkpoint.h"
+#include "ota_pipeline.h"
+#include "providore.h"
+#include "signature.h"
+#include "signer.h"
 
 #define ISO8601_DATE_LEN 21
-#define HMAC_BUFFER_LEN 128
-#define URL_BUFFER_LEN 128
-#define SIGNATURE_LEN 256
-#define RESPONSE_BUFFER 1024
+#define HTTP_DATE_LEN 32
+#define HMAC_BUFFER_LEN CONFIG_PROVIDORE_AUTHORIZATION_LEN
+#define URL_BUFFER_LEN CONFIG_PROVIDORE_URL_LEN
+#define SIGNATURE_LEN CONFIG_PROVIDORE_SIGNATURE_LEN
 #define FIRMWARE_VERSION "1.0.0"
 
 typedef enum _ota_state
@@ -19,19 +28,33 @@ typedef enum _ota_state
   OTA_COMPLETED = 1 << 3,
   OTA_ERROR = 1 << 4,
   OTA_FAILED = 1 << 5,
+  OTA_UP_TO_DATE = 1 << 6,
 } ota_state_t;
 
 typedef struct _ota_request_context
 {
-  char url[URL_BUFFER_LEN];
   char created_at[ISO8601_DATE_LEN];
   char expiry[ISO8601_DATE_LEN];
   char signature[SIGNATURE_LEN];
-  char *device_id;
-  char *psk;
-  EventGroupHandle_t event_group;
+  providore_signer_t *signer;
+  SemaphoreHandle_t done;
+  StaticSemaphore_t done_buffer;
+  providore_err_t result;
   esp_ota_handle_t ota_handle;
+  ota_pipeline_t *pipeline;
+  ota_checkpoint_t checkpoint;
+  delta_patch_t *delta;
+  bool delta_encoded;
+  inflate_stream_t *inflate;
+  inflate_format_t content_encoding;
+  signature_verifier_t verifier;
   ota_state_t ota_state;
   size_t downloaded;
+  size_t total;
+  size_t image_size;
+  int64_t reported_at;
+  const providore_request_t *request;
+  // Set when downloading from a peer, whose image is checked against the manifest instead
+  const char *expected_sha256;
 } ota_request_context_t;
 #endif
\ No newline at end of file
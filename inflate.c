@@ -0,0 +1,201 @@
+#include "inflate.h"
+#include <string.h>
+#include "esp_log.h"
+
+static const char *TAG = "PROVIDORE_INFLATE";
+
+#define GZIP_FLAG_HEADER_CRC (1 << 1)
+#define GZIP_FLAG_EXTRA (1 << 2)
+#define GZIP_FLAG_NAME (1 << 3)
+#define GZIP_FLAG_COMMENT (1 << 4)
+
+// Work out which optional gzip header field comes after the given state
+static inflate_state_t inflate_gzip_next(inflate_stream_t *stream, inflate_state_t state)
+{
+  uint8_t flags = stream->header[3];
+  switch (state)
+  {
+  case INFLATE_GZIP_HEADER:
+    if (flags & GZIP_FLAG_EXTRA)
+    {
+      stream->header_len = 0;
+      return INFLATE_GZIP_EXTRA_LEN;
+    }
+    // fall through
+  case INFLATE_GZIP_EXTRA_LEN:
+  case INFLATE_GZIP_EXTRA:
+    if (flags & GZIP_FLAG_NAME)
+    {
+      return INFLATE_GZIP_NAME;
+    }
+    // fall through
+  case INFLATE_GZIP_NAME:
+    if (flags & GZIP_FLAG_COMMENT)
+    {
+      return INFLATE_GZIP_COMMENT;
+    }
+    // fall through
+  case INFLATE_GZIP_COMMENT:
+    if (flags & GZIP_FLAG_HEADER_CRC)
+    {
+      stream->skip = 2;
+      return INFLATE_GZIP_HEADER_CRC;
+    }
+    // fall through
+  default:
+    return INFLATE_DATA;
+  }
+}
+
+// Consumes gzip header bytes, returning how many were used
+static size_t inflate_gzip_header(inflate_stream_t *stream, const uint8_t *data, size_t data_len, esp_err_t *result)
+{
+  size_t len = 0;
+  switch (stream->state)
+  {
+  case INFLATE_GZIP_HEADER:
+  case INFLATE_GZIP_EXTRA_LEN:
+  {
+    size_t needed = (stream->state == INFLATE_GZIP_HEADER ? GZIP_HEADER_LEN : 2) - stream->header_len;
+    len = data_len < needed ? data_len : needed;
+    if (stream->state == INFLATE_GZIP_HEADER)
+    {
+      memcpy(stream->header + stream->header_len, data, len);
+    }
+    else
+    {
+      // The extra field length is little endian
+      stream->skip |= (size_t)data[0] << (8 * stream->header_len);
+      if (len > 1)
+      {
+        stream->skip |= (size_t)data[1] << 8;
+      }
+    }
+    stream->header_len += len;
+    if (len < needed)
+    {
+      break;
+    }
+
+    if (stream->state == INFLATE_GZIP_HEADER && (stream->header[0] != 0x1f || stream->header[1] != 0x8b || stream->header[2] != 8))
+    {
+      ESP_LOGE(TAG, "Not a gzip stream");
+      *result = ESP_ERR_INVALID_RESPONSE;
+      break;
+    }
+    stream->state = stream->state == INFLATE_GZIP_HEADER ? inflate_gzip_next(stream, INFLATE_GZIP_HEADER) : INFLATE_GZIP_EXTRA;
+  }
+  break;
+  case INFLATE_GZIP_EXTRA:
+  case INFLATE_GZIP_HEADER_CRC:
+    len = data_len < stream->skip ? data_len : stream->skip;
+    stream->skip -= len;
+    if (stream->skip == 0)
+    {
+      stream->state = inflate_gzip_next(stream, stream->state);
+    }
+    break;
+  case INFLATE_GZIP_NAME:
+  case INFLATE_GZIP_COMMENT:
+  {
+    // Zero terminated strings
+    const uint8_t *end = memchr(data, 0, data_len);
+    len = end == NULL ? data_len : (size_t)(end - data) + 1;
+    if (end != NULL)
+    {
+      stream->state = inflate_gzip_next(stream, stream->state);
+    }
+  }
+  break;
+  default:
+    break;
+  }
+  return len;
+}
+
+void inflate_begin(inflate_stream_t *stream, inflate_format_t format, inflate_write_cb write, void *user_data)
+{
+  tinfl_init(&stream->decompressor);
+  stream->window_pos = 0;
+  stream->format = format;
+  stream->state = format == INFLATE_GZIP ? INFLATE_GZIP_HEADER : INFLATE_DATA;
+  stream->header_len = 0;
+  stream->skip = 0;
+  stream->write = write;
+  stream->user_data = user_data;
+  stream->compressed = 0;
+  stream->inflated = 0;
+}
+
+esp_err_t inflate_write(inflate_stream_t *stream, const void *data, size_t data_len)
+{
+  const uint8_t *data_ptr = (const uint8_t *)data;
+  esp_err_t result = ESP_OK;
+  stream->compressed += data_len;
+
+  while (data_len > 0 && stream->state != INFLATE_DATA && stream->state != INFLATE_TRAILER && result == ESP_OK)
+  {
+    size_t len = inflate_gzip_header(stream, data_ptr, data_len, &result);
+    data_ptr += len;
+    data_len -= len;
+  }
+
+  while (stream->state == INFLATE_DATA && result == ESP_OK)
+  {
+    size_t in_len = data_len;
+    size_t out_len = INFLATE_WINDOW_LEN - stream->window_pos;
+    mz_uint32 flags = TINFL_FLAG_HAS_MORE_INPUT | (stream->format == INFLATE_DEFLATE ? TINFL_FLAG_PARSE_ZLIB_HEADER : 0);
+
+    // The window is used as a ring, so it doubles as the deflate dictionary
+    tinfl_status status = tinfl_decompress(&stream->decompressor, data_ptr, &in_len, stream->window, stream->window + stream->window_pos, &out_len, flags);
+    data_ptr += in_len;
+    data_len -= in_len;
+
+    if (out_len > 0)
+    {
+      result = stream->write(stream->user_data, stream->window + stream->window_pos, out_len);
+      stream->inflated += out_len;
+      stream->window_pos = (stream->window_pos + out_len) & (INFLATE_WINDOW_LEN - 1);
+    }
+
+    if (status == TINFL_STATUS_DONE)
+    {
+      stream->state = INFLATE_TRAILER;
+      stream->skip = stream->format == INFLATE_GZIP ? GZIP_TRAILER_LEN : 0;
+    }
+    else if (status < TINFL_STATUS_DONE)
+    {
+      ESP_LOGE(TAG, "Unable to decompress firmware (%i)", status);
+      result = ESP_ERR_INVALID_RESPONSE;
+    }
+    else if (status == TINFL_STATUS_NEEDS_MORE_INPUT && data_len == 0)
+    {
+      break;
+    }
+  }
+
+  // The gzip trailer is not checked - the providore signature covers the image
+  if (stream->state == INFLATE_TRAILER && result == ESP_OK)
+  {
+    if (data_len > stream->skip)
+    {
+      ESP_LOGE(TAG, "Unexpected data after the end of the compressed firmware");
+      return ESP_ERR_INVALID_SIZE;
+    }
+    stream->skip -= data_len;
+  }
+
+  return result;
+}
+
+esp_err_t inflate_finish(inflate_stream_t *stream)
+{
+  if (stream->state != INFLATE_TRAILER)
+  {
+    ESP_LOGE(TAG, "Compressed firmware ended early");
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  ESP_LOGI(TAG, "Inflated %i bytes to %i bytes", stream->compressed, stream->inflated);
+  return ESP_OK;
+}
@@ -0,0 +1,122 @@
+#include "metrics.h"
+#include <stdbool.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Recorded from the request task and the OTA writer, so updates are kept short
+// and done in a critical section.
+static providore_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t metrics_bucket(int64_t elapsed_us)
+{
+  uint32_t bucket = 0;
+  int64_t ms = elapsed_us / 1000;
+  while (ms > 0 && bucket < PROVIDORE_METRICS_BUCKETS - 1)
+  {
+    ms >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+void providore_metrics_record(providore_phase_t phase, int64_t elapsed_us)
+{
+  if (phase >= PROVIDORE_PHASE_MAX || elapsed_us < 0)
+  {
+    return;
+  }
+
+  uint32_t bucket = metrics_bucket(elapsed_us);
+  uint32_t us = elapsed_us > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed_us;
+
+  portENTER_CRITICAL(&stats_lock);
+  providore_histogram_t *histogram = &stats.phases[phase];
+  histogram->count++;
+  histogram->total_us += elapsed_us;
+  if (us > histogram->max_us)
+  {
+    histogram->max_us = us;
+  }
+  histogram->buckets[bucket]++;
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+void providore_metrics_request(bool failed)
+{
+  portENTER_CRITICAL(&stats_lock);
+  stats.requests++;
+  if (failed)
+  {
+    stats.failures++;
+  }
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+void providore_metrics_retry()
+{
+  portENTER_CRITICAL(&stats_lock);
+  stats.retries++;
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+void providore_metrics_received(size_t len)
+{
+  portENTER_CRITICAL(&stats_lock);
+  stats.bytes_received += len;
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+void providore_metrics_stack(providore_task_t task, uint32_t stack_size)
+{
+  if (task >= PROVIDORE_TASK_MAX)
+  {
+    return;
+  }
+
+  // ESP-IDF measures stacks in bytes
+  uint32_t free = uxTaskGetStackHighWaterMark(NULL);
+  uint32_t used = free < stack_size ? stack_size - free : 0;
+
+  portENTER_CRITICAL(&stats_lock);
+  stats.stacks[task].size = stack_size;
+  if (used > stats.stacks[task].peak)
+  {
+    stats.stacks[task].peak = used;
+  }
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+void providore_metrics_heap(providore_operation_t operation, size_t used)
+{
+  if (operation >= PROVIDORE_OPERATION_MAX)
+  {
+    return;
+  }
+
+  portENTER_CRITICAL(&stats_lock);
+  providore_heap_usage_t *heap = &stats.heap[operation];
+  heap->count++;
+  heap->last = used;
+  if (used > heap->peak)
+  {
+    heap->peak = used;
+  }
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+void providore_get_stats(providore_stats_t *output)
+{
+  portENTER_CRITICAL(&stats_lock);
+  memcpy(output, &stats, sizeof(providore_stats_t));
+  portEXIT_CRITICAL(&stats_lock);
+  buffer_pool_usage(&output->memory);
+}
+
+void providore_reset_stats()
+{
+  portENTER_CRITICAL(&stats_lock);
+  bzero(&stats, sizeof(providore_stats_t));
+  portEXIT_CRITICAL(&stats_lock);
+}
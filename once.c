@@ -0,0 +1,27 @@
+#include "once.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define ONCE_UNINITIALISED 0
+#define ONCE_RUNNING 1
+#define ONCE_DONE 2
+
+bool providore_once_begin(providore_once_t *once)
+{
+  uint32_t expected = ONCE_UNINITIALISED;
+  if (__atomic_compare_exchange_n(once, &expected, ONCE_RUNNING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+  {
+    return true;
+  }
+
+  while (__atomic_load_n(once, __ATOMIC_ACQUIRE) != ONCE_DONE)
+  {
+    vTaskDelay(1);
+  }
+  return false;
+}
+
+void providore_once_end(providore_once_t *once)
+{
+  __atomic_store_n(once, ONCE_DONE, __ATOMIC_RELEASE);
+}
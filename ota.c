@@ -2,76 +2,366 @@
 #include "esp_ota_ops.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/event_groups.h"
+#include <stdlib.h>
 #include <string.h>
 #include "types.h"
+#include "ota_checkpoint.h"
+#include "ota_pipeline.h"
 #include "esp_task_wdt.h"
+#include "esp_timer.h"
+#include "metrics.h"
+#include "once.h"
+#include "peer.h"
+#include "server_time.h"
 
 static const char *TAG = "PROVIDORE_OTA";
 
-esp_err_t providore_ota_firmware_event_handle(esp_http_client_event_t *evt)
+bool providore_ota_partition_sha256(const esp_partition_t *partition, char *hex)
 {
-  ota_request_context_t *context = (ota_request_context_t *)evt->user_data;
-  switch (evt->event_id)
+  uint8_t sha256[32];
+  if (partition == NULL || esp_partition_get_sha256(partition, (uint8_t *)&sha256) != ESP_OK)
   {
-  case HTTP_EVENT_ERROR:
-    context->ota_state = OTA_FAILED;
-    ESP_LOGE(TAG, "OTA Failed: HTTP Error");
-    break;
-  case HTTP_EVENT_ON_CONNECTED:
+    return false;
+  }
+  for (int i = 0; i < 32; i++)
+  {
+    sprintf(hex + (i * 2), "%02x", sha256[i]);
+  }
+  return true;
+}
+
+const char *providore_ota_running_sha256()
+{
+  // Verifying the running image means reading all of it, so only do it once per boot
+  static char hex[MANIFEST_SHA256_LEN];
+  static providore_once_t hashed = PROVIDORE_ONCE_INIT;
+  if (providore_once_begin(&hashed))
+  {
+    providore_ota_partition_sha256(esp_ota_get_running_partition(), hex);
+    providore_once_end(&hashed);
+  }
+  return hex[0] != '\0' ? hex : NULL;
+}
+
+void providore_ota_manifest_field(const char *key, const config_value_t *value, void *user_data)
+{
+  firmware_manifest_t *manifest = (firmware_manifest_t *)user_data;
+  if (strcmp(key, "version") == 0 && value->type == CONFIG_VALUE_STRING)
+  {
+    strncpy(manifest->version, value->string, MANIFEST_VERSION_LEN - 1);
+  }
+  else if (strcmp(key, "size") == 0 && value->type == CONFIG_VALUE_INTEGER && value->integer > 0)
+  {
+    manifest->size = (size_t)value->integer;
+  }
+  else if (strcmp(key, "sha256") == 0 && value->type == CONFIG_VALUE_STRING)
+  {
+    strncpy(manifest->sha256, value->string, MANIFEST_SHA256_LEN - 1);
+  }
+}
+
+bool providore_ota_manifest_differs(const firmware_manifest_t *manifest)
+{
+  const char *running_sha256 = providore_ota_running_sha256();
+  if (strlen(manifest->sha256) > 0 && running_sha256 != NULL)
+  {
+    return strcasecmp(manifest->sha256, running_sha256) != 0;
+  }
+  return strcmp(manifest->version, FIRMWARE_VERSION) != 0;
+}
+
+static bool ota_partition_matches(const esp_partition_t *partition, const char *sha256)
+{
+  char hex[MANIFEST_SHA256_LEN];
+  return providore_ota_partition_sha256(partition, hex) && strcasecmp(hex, sha256) == 0;
+}
+
+static esp_err_t ota_delta_write(void *user_data, const void *data, size_t data_len)
+{
+  return ota_pipeline_write((ota_pipeline_t *)user_data, data, data_len);
+}
+
+// Firmware data is decompressed, then patched if it is a delta, then queued for flash
+static esp_err_t ota_image_write(ota_request_context_t *context, const void *data, size_t data_len)
+{
+  if (context->delta != NULL)
   {
-    esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
-    esp_err_t res = esp_ota_begin(partition, OTA_SIZE_UNKNOWN, &(context->ota_handle));
-    switch (res)
+    return delta_patch_write(context->delta, data, data_len);
+  }
+  return ota_pipeline_write(context->pipeline, data, data_len);
+}
+
+static esp_err_t ota_inflate_write(void *user_data, const void *data, size_t data_len)
+{
+  return ota_image_write((ota_request_context_t *)user_data, data, data_len);
+}
+
+// Started on the first chunk of data rather than on connect, as a kept-alive
+// session may already be connected when the firmware request is made.
+static void ota_begin(ota_request_context_t *context, int status_code)
+{
+  const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+#ifdef CONFIG_PROVIDORE_PEER
+  providore_peer_forget(partition);
+#endif
+
+  if (context->checkpoint.offset > 0)
+  {
+    if (status_code == 206 && context->checkpoint.partition_address == partition->address && signature_verify_resume(&context->verifier, context->signer, &context->checkpoint.hash))
     {
-    case ESP_OK:
+      // esp_ota_begin would erase the partition, so the pipeline writes to it directly
+      ESP_LOGI(TAG, "Resuming OTA from %i bytes...", context->checkpoint.offset);
+      context->downloaded = context->checkpoint.offset;
+      context->pipeline = ota_pipeline_create(0, partition, &context->checkpoint, &context->verifier);
+      if (context->pipeline == NULL)
+      {
+        context->ota_state = OTA_ERROR;
+        ESP_LOGE(TAG, "Error resuming OTA: Cannot allocate memory for the flash writer.");
+        return;
+      }
       context->ota_state = OTA_WAITING;
-      ESP_LOGI(TAG, "Starting OTA...");
-      break;
-    case ESP_ERR_INVALID_ARG:
-      context->ota_state = OTA_ERROR;
-      ESP_LOGE(TAG, "Error starting OTA: Partition or Handle is NULL, or partition doesn't point to an OTA app partition.");
-      break;
-    case ESP_ERR_NO_MEM:
-      context->ota_state = OTA_ERROR;
-      ESP_LOGE(TAG, "Error starting OTA: Cannot allocate memory for OTA operation.");
-      break;
-    case ESP_ERR_OTA_PARTITION_CONFLICT:
-      context->ota_state = OTA_ERROR;
-      ESP_LOGE(TAG, "Error starting OTA: Partition holds the currently running firmware, cannot update in place.");
-      break;
-    case ESP_ERR_NOT_FOUND:
-      context->ota_state = OTA_ERROR;
-      ESP_LOGE(TAG, "Error starting OTA: Partition argument not found in partition table.");
-      break;
-    case ESP_ERR_OTA_SELECT_INFO_INVALID:
-      context->ota_state = OTA_ERROR;
-      ESP_LOGE(TAG, "Error starting OTA: The OTA data partition contains invalid data.");
-      break;
-    case ESP_ERR_INVALID_SIZE:
-      context->ota_state = OTA_ERROR;
-      ESP_LOGE(TAG, "Error starting OTA: Partition doesn't fit in configured flash size");
-      break;
-    case ESP_ERR_FLASH_OP_TIMEOUT:
+      return;
+    }
+
+    ota_checkpoint_clear();
+    context->checkpoint.offset = 0;
+
+    // A ranged body can only be written where it belongs, never from the start
+    // of the partition. Fail, and the next attempt starts again without a Range.
+    if (status_code == 206)
+    {
+      ESP_LOGE(TAG, "Unable to resume OTA, it will start again next time");
       context->ota_state = OTA_ERROR;
-      ESP_LOGE(TAG, "Error starting OTA: Error starting OTA: Flash write timed out.");
-      break;
-    case ESP_ERR_FLASH_OP_FAIL:
+      return;
+    }
+    ESP_LOGW(TAG, "Unable to resume OTA, starting again");
+  }
+  else if (status_code == 206)
+  {
+    ESP_LOGE(TAG, "OTA failed: Partial content without a Range request");
+    context->ota_state = OTA_ERROR;
+    return;
+  }
+  context->checkpoint.partition_address = partition->address;
+
+  // With the size from the manifest, only the space the image needs is erased
+  int64_t started_at = esp_timer_get_time();
+  esp_err_t res = esp_ota_begin(partition, context->image_size > 0 ? context->image_size : OTA_SIZE_UNKNOWN, &(context->ota_handle));
+  providore_metrics_record(PROVIDORE_PHASE_OTA_BEGIN, esp_timer_get_time() - started_at);
+  switch (res)
+  {
+  case ESP_OK:
+    signature_verify_begin(&context->verifier, context->signer);
+    // Nothing from a peer is checkpointed, as only the server can resume it
+    context->pipeline = ota_pipeline_create(context->ota_handle, partition, context->expected_sha256 == NULL ? &context->checkpoint : NULL, &context->verifier);
+    if (context->pipeline == NULL)
+    {
       context->ota_state = OTA_ERROR;
-      ESP_LOGE(TAG, "Error starting OTA: Error starting OTA: Flash write failed.");
+      ESP_LOGE(TAG, "Error starting OTA: Cannot allocate memory for the flash writer.");
       break;
     }
+    if (context->delta_encoded)
+    {
+      // The new image is rebuilt from the running one as the patch streams in
+      context->delta = (delta_patch_t *)malloc(sizeof(delta_patch_t));
+      if (context->delta == NULL)
+      {
+        context->ota_state = OTA_ERROR;
+        ESP_LOGE(TAG, "Error starting OTA: Cannot allocate memory for the delta patch.");
+        break;
+      }
+      delta_patch_begin(context->delta, esp_ota_get_running_partition(), ota_delta_write, (void *)context->pipeline);
+      ESP_LOGI(TAG, "Applying delta patch to the running firmware");
+    }
+    if (context->content_encoding != INFLATE_NONE)
+    {
+      context->inflate = (inflate_stream_t *)malloc(sizeof(inflate_stream_t));
+      if (context->inflate == NULL)
+      {
+        context->ota_state = OTA_ERROR;
+        ESP_LOGE(TAG, "Error starting OTA: Cannot allocate memory for decompression.");
+        break;
+      }
+      inflate_begin(context->inflate, context->content_encoding, ota_inflate_write, (void *)context);
+    }
+    context->ota_state = OTA_WAITING;
+    ESP_LOGI(TAG, "Starting OTA...");
+    break;
+  case ESP_ERR_INVALID_ARG:
+    context->ota_state = OTA_ERROR;
+    ESP_LOGE(TAG, "Error starting OTA: Partition or Handle is NULL, or partition doesn't point to an OTA app partition.");
+    break;
+  case ESP_ERR_NO_MEM:
+    context->ota_state = OTA_ERROR;
+    ESP_LOGE(TAG, "Error starting OTA: Cannot allocate memory for OTA operation.");
+    break;
+  case ESP_ERR_OTA_PARTITION_CONFLICT:
+    context->ota_state = OTA_ERROR;
+    ESP_LOGE(TAG, "Error starting OTA: Partition holds the currently running firmware, cannot update in place.");
+    break;
+  case ESP_ERR_NOT_FOUND:
+    context->ota_state = OTA_ERROR;
+    ESP_LOGE(TAG, "Error starting OTA: Partition argument not found in partition table.");
+    break;
+  case ESP_ERR_OTA_SELECT_INFO_INVALID:
+    context->ota_state = OTA_ERROR;
+    ESP_LOGE(TAG, "Error starting OTA: The OTA data partition contains invalid data.");
+    break;
+  case ESP_ERR_INVALID_SIZE:
+    context->ota_state = OTA_ERROR;
+    ESP_LOGE(TAG, "Error starting OTA: Partition doesn't fit in configured flash size");
+    break;
+  case ESP_ERR_FLASH_OP_TIMEOUT:
+    context->ota_state = OTA_ERROR;
+    ESP_LOGE(TAG, "Error starting OTA: Error starting OTA: Flash write timed out.");
+    break;
+  case ESP_ERR_FLASH_OP_FAIL:
+    context->ota_state = OTA_ERROR;
+    ESP_LOGE(TAG, "Error starting OTA: Error starting OTA: Flash write failed.");
+    break;
   }
-  break;
+}
+
+// The flash writer only reports an error code - the handler owns ota_state.
+static void ota_write_failed(ota_request_context_t *context, esp_err_t result)
+{
+  context->ota_state = OTA_ERROR;
+  switch (result)
+  {
+  case ESP_ERR_INVALID_ARG:
+    ESP_LOGE(TAG, "OTA error writing to partition: Invalid Argument");
+    break;
+  case ESP_ERR_OTA_VALIDATE_FAILED:
+    ESP_LOGE(TAG, "OTA error writing to partition: Handle is invalid");
+    break;
+  case ESP_ERR_FLASH_OP_TIMEOUT:
+    ESP_LOGE(TAG, "OTA error writing to partition: Flash write timed out");
+    break;
+  case ESP_ERR_FLASH_OP_FAIL:
+    ESP_LOGE(TAG, "OTA error writing to partition: Flash write failed");
+    break;
+  case ESP_ERR_OTA_SELECT_INFO_INVALID:
+    ESP_LOGE(TAG, "OTA error writing to partition: OTA data partition has invalid contents");
+    break;
+  default:
+    ESP_LOGE(TAG, "OTA error writing to partition: %s", esp_err_to_name(result));
+  }
+}
+
+void providore_ota_abort(ota_request_context_t *context)
+{
+  // Stop the writer before the handle it writes to goes away
+  ota_pipeline_destroy(context->pipeline);
+  context->pipeline = NULL;
+  free(context->delta);
+  context->delta = NULL;
+  free(context->inflate);
+  context->inflate = NULL;
+  if (context->ota_handle)
+  {
+    esp_ota_abort(context->ota_handle);
+    context->ota_handle = 0;
+  }
+  signature_verify_free(&context->verifier);
+}
+
+// Chunks can be a few hundred bytes, so only report every
+// CONFIG_PROVIDORE_OTA_PROGRESS_INTERVAL ms, and once the download is complete
+static void ota_report_progress(ota_request_context_t *context)
+{
+  int64_t now = esp_timer_get_time();
+  bool complete = context->total > 0 && context->downloaded >= context->total;
+  if (!complete && now - context->reported_at < (int64_t)CONFIG_PROVIDORE_OTA_PROGRESS_INTERVAL * 1000)
+  {
+    return;
+  }
+  context->reported_at = now;
+
+  size_t throughput = context->pipeline != NULL ? ota_pipeline_throughput(context->pipeline) : 0;
+  if (context->total > 0)
+  {
+    ESP_LOGI(TAG, "Downloaded %i of %i bytes (%i%%), writing %i bytes/s", context->downloaded, context->total, (int)((uint64_t)context->downloaded * 100 / context->total), throughput);
+  }
+  else
+  {
+    ESP_LOGI(TAG, "Downloaded %i bytes, writing %i bytes/s", context->downloaded, throughput);
+  }
+
+  if (context->request != NULL && context->request->on_progress != NULL)
+  {
+    context->request->on_progress(context->downloaded, context->total, context->request->user_data);
+  }
+}
+
+esp_err_t providore_ota_firmware_event_handle(esp_http_client_event_t *evt)
+{
+  ota_request_context_t *context = (ota_request_context_t *)evt->user_data;
+  switch (evt->event_id)
+  {
+  case HTTP_EVENT_ERROR:
+    context->ota_state = OTA_FAILED;
+    ESP_LOGE(TAG, "OTA Failed: HTTP Error");
+    break;
+  case HTTP_EVENT_ON_CONNECTED:
+    break;
   case HTTP_EVENT_HEADER_SENT:
     break;
   case HTTP_EVENT_ON_HEADER:
+    if (strncmp(evt->header_key, "created-at", 10) == 0)
+    {
+      strncpy(context->created_at, evt->header_value, ISO8601_DATE_LEN - 1);
+      context->created_at[ISO8601_DATE_LEN - 1] = '\0';
+    }
+    if (strncmp(evt->header_key, "expiry", 6) == 0)
+    {
+      strncpy(context->expiry, evt->header_value, ISO8601_DATE_LEN - 1);
+      context->expiry[ISO8601_DATE_LEN - 1] = '\0';
+    }
+    if (strncmp(evt->header_key, "signature", 9) == 0)
+    {
+      strncpy(context->signature, evt->header_value, SIGNATURE_LEN - 1);
+    }
+    if (strncasecmp(evt->header_key, "content-type", 12) == 0)
+    {
+      context->delta_encoded = strncmp(evt->header_value, DELTA_CONTENT_TYPE, strlen(DELTA_CONTENT_TYPE)) == 0;
+    }
+    if (strncasecmp(evt->header_key, "content-encoding", 16) == 0)
+    {
+      if (strncasecmp(evt->header_value, "gzip", 4) == 0)
+      {
+        context->content_encoding = INFLATE_GZIP;
+      }
+      else if (strncasecmp(evt->header_value, "deflate", 7) == 0)
+      {
+        context->content_encoding = INFLATE_DEFLATE;
+      }
+    }
+    if (strncasecmp(evt->header_key, "etag", 4) == 0)
+    {
+      strncpy(context->checkpoint.etag, evt->header_value, ETAG_LEN - 1);
+    }
     break;
   case HTTP_EVENT_ON_DATA:
   {
     // This can get CPU heavy - feed the watchdog.
     esp_task_wdt_reset();
 
+    int status_code = esp_http_client_get_status_code(evt->client);
+    if (context->ota_state == OTA_READY && status_code != 200 && status_code != 206)
+    {
+      // Don't write an error page to flash
+      ESP_LOGE(TAG, "OTA failed: HTTP status %i", status_code);
+      context->ota_state = OTA_ERROR;
+    }
+
+    if (context->ota_state == OTA_READY)
+    {
+      ota_begin(context, status_code);
+      // A resumed download only sends what is left
+      int content_length = esp_http_client_get_content_length(evt->client);
+      context->total = content_length > 0 ? context->downloaded + content_length : 0;
+    }
+
     if (context->ota_state == OTA_WAITING)
     {
       context->ota_state = OTA_IN_PROGRESS;
@@ -79,42 +369,77 @@ esp_err_t providore_ota_firmware_event_handle(esp_http_client_event_t *evt)
 
     if (context->ota_state == OTA_IN_PROGRESS)
     {
-      esp_err_t result = esp_ota_write(context->ota_handle, evt->data, evt->data_len);
-      switch (result)
+      esp_err_t result = context->inflate != NULL ? inflate_write(context->inflate, evt->data, evt->data_len) : ota_image_write(context, evt->data, evt->data_len);
+      if (result == ESP_OK)
       {
-      case ESP_OK:
         context->downloaded += evt->data_len;
-        ESP_LOGI(TAG, "Written %i bytes", context->downloaded);
-        break;
-      case ESP_ERR_INVALID_ARG:
-        context->ota_state = OTA_ERROR;
-        ESP_LOGE(TAG, "OTA error writing to partition: Invalid Argument");
-        break;
-      case ESP_ERR_OTA_VALIDATE_FAILED:
-        context->ota_state = OTA_ERROR;
-        ESP_LOGE(TAG, "OTA error writing to partition: Handle is invalid");
-        break;
-      case ESP_ERR_FLASH_OP_TIMEOUT:
-        context->ota_state = OTA_ERROR;
-        ESP_LOGE(TAG, "OTA error writing to partition: Flash write timed out");
-        break;
-      case ESP_ERR_FLASH_OP_FAIL:
-        context->ota_state = OTA_ERROR;
-        ESP_LOGE(TAG, "OTA error writing to partition: Flash write failed");
-        break;
-      case ESP_ERR_OTA_SELECT_INFO_INVALID:
-        context->ota_state = OTA_ERROR;
-        ESP_LOGE(TAG, "OTA error writing to partition: OTA data partition has invalid contents");
+        ota_report_progress(context);
+      }
+      else
+      {
+        ota_write_failed(context, result);
       }
     }
   }
   break;
   case HTTP_EVENT_ON_FINISH:
   {
+    // A dropped connection still finishes the request. Don't let the signature
+    // check of a partial image throw away the checkpoint it can resume from.
+    if (context->ota_state == OTA_IN_PROGRESS && context->total > 0 && context->downloaded < context->total)
+    {
+      ESP_LOGE(TAG, "OTA failed: Download cut short at %i of %i bytes", context->downloaded, context->total);
+      context->ota_state = OTA_FAILED;
+    }
+
+    if (context->ota_state == OTA_IN_PROGRESS && context->inflate != NULL)
+    {
+      esp_err_t result = inflate_finish(context->inflate);
+      if (result != ESP_OK)
+      {
+        ota_write_failed(context, result);
+      }
+    }
+
+    if (context->ota_state == OTA_IN_PROGRESS && context->delta != NULL)
+    {
+      esp_err_t result = delta_patch_finish(context->delta);
+      if (result != ESP_OK)
+      {
+        ota_write_failed(context, result);
+      }
+    }
+
     if (context->ota_state == OTA_IN_PROGRESS)
     {
+      // Wait for the writer to flush everything that is still queued
+      esp_err_t result = ota_pipeline_finish(context->pipeline);
+      if (result != ESP_OK)
+      {
+        ota_write_failed(context, result);
+      }
+    }
+
+    if (context->ota_state == OTA_IN_PROGRESS && context->expected_sha256 != NULL)
+    {
+      // The image is checked against the manifest once esp_ota_end has validated it
+      signature_verify_free(&context->verifier);
       context->ota_state = OTA_COMPLETED;
     }
+    else if (context->ota_state == OTA_IN_PROGRESS)
+    {
+      if (signature_verify_finish(&context->verifier, context->created_at, context->expiry, context->signature))
+      {
+        providore_server_time_learn(context->created_at, context->expiry);
+        context->ota_state = OTA_COMPLETED;
+      }
+      else
+      {
+        ESP_LOGE(TAG, "OTA failed: Firmware signature mismatch");
+        ota_checkpoint_clear();
+        context->ota_state = OTA_FAILED;
+      }
+    }
     else
     {
       context->ota_state = OTA_FAILED;
@@ -123,17 +448,47 @@ esp_err_t providore_ota_firmware_event_handle(esp_http_client_event_t *evt)
     if (context->ota_state == OTA_COMPLETED)
     {
       ESP_LOGI(TAG, "OTA finished");
-      esp_err_t result = esp_ota_end(context->ota_handle);
+      size_t image_len = context->pipeline->offset;
+      ota_pipeline_destroy(context->pipeline);
+      context->pipeline = NULL;
+      free(context->delta);
+      context->delta = NULL;
+      free(context->inflate);
+      context->inflate = NULL;
+      ota_checkpoint_clear();
+
+      // A resumed download has no handle to end - the image is still validated
+      // by esp_ota_set_boot_partition.
+      esp_err_t result = ESP_OK;
+      if (context->ota_handle)
+      {
+        int64_t started_at = esp_timer_get_time();
+        result = esp_ota_end(context->ota_handle);
+        providore_metrics_record(PROVIDORE_PHASE_OTA_END, esp_timer_get_time() - started_at);
+        context->ota_handle = 0;
+      }
+
+      const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+      if (result == ESP_OK && context->expected_sha256 != NULL && !ota_partition_matches(partition, context->expected_sha256))
+      {
+        ESP_LOGE(TAG, "OTA failed: Firmware from peer does not match the manifest");
+        result = ESP_ERR_INVALID_CRC;
+      }
 
       if (result == ESP_OK)
       {
         ESP_LOGI(TAG, "OTA complete");
-        esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
         result = esp_ota_set_boot_partition(partition);
         if (result != ESP_OK)
         {
           context->ota_state = OTA_FAILED;
         }
+#ifdef CONFIG_PROVIDORE_PEER
+        else
+        {
+          providore_peer_offer(partition, image_len, context->created_at, context->expiry, context->signature);
+        }
+#endif
       }
       else
       {
@@ -186,17 +541,9 @@ esp_err_t providore_ota_firmware_event_handle(esp_http_client_event_t *evt)
   break;
   }
 
-  if (context->ota_state == OTA_COMPLETED)
-  {
-    xEventGroupSetBits(context->event_group, OTA_COMPLETED);
-  }
-  else if (context->ota_state == OTA_FAILED)
+  if (context->ota_state == OTA_FAILED)
   {
-    if (context->ota_handle)
-    {
-      esp_ota_abort(context->ota_handle);
-    }
-    xEventGroupSetBits(context->event_group, OTA_FAILED);
+    providore_ota_abort(context);
   }
   return ESP_OK;
 }
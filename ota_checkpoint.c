@@ -0,0 +1,99 @@
+#include "ota_checkpoint.h"
+#include <string.h>
+#include "nvs_flash.h"
+#include "esp_log.h"
+#include "esp_idf_version.h"
+#include "mbedtls/version.h"
+
+static const char *TAG = "PROVIDORE_OTA_CHECKPOINT";
+
+// Bump when ota_checkpoint_t changes
+#define OTA_CHECKPOINT_VERSION 1
+
+static uint32_t ota_checkpoint_layout()
+{
+  // FNV-1a over everything that decides how the saved hash state is laid out
+  const uint32_t parts[] = {OTA_CHECKPOINT_VERSION, sizeof(mbedtls_sha256_context), MBEDTLS_VERSION_NUMBER, ESP_IDF_VERSION};
+  const uint8_t *bytes = (const uint8_t *)parts;
+  uint32_t layout = 2166136261u;
+  for (size_t i = 0; i < sizeof(parts); i++)
+  {
+    layout = (layout ^ bytes[i]) * 16777619u;
+  }
+  return layout;
+}
+
+esp_err_t ota_checkpoint_load(ota_checkpoint_t *checkpoint)
+{
+  bzero(checkpoint, sizeof(ota_checkpoint_t));
+
+  nvs_handle_t handle;
+  esp_err_t result = nvs_open("providore", NVS_READONLY, &handle);
+  if (result != ESP_OK)
+  {
+    return result;
+  }
+
+  size_t length = sizeof(ota_checkpoint_t);
+  result = nvs_get_blob(handle, "ota_resume", checkpoint, &length);
+  nvs_close(handle);
+
+  if (result != ESP_OK || length != sizeof(ota_checkpoint_t))
+  {
+    bzero(checkpoint, sizeof(ota_checkpoint_t));
+    return result == ESP_OK ? ESP_ERR_INVALID_SIZE : result;
+  }
+
+  if (checkpoint->layout != ota_checkpoint_layout())
+  {
+    ESP_LOGW(TAG, "Discarding OTA checkpoint saved by a different build");
+    bzero(checkpoint, sizeof(ota_checkpoint_t));
+    ota_checkpoint_clear();
+    return ESP_ERR_INVALID_VERSION;
+  }
+  return ESP_OK;
+}
+
+esp_err_t ota_checkpoint_save(const ota_checkpoint_t *checkpoint)
+{
+  nvs_handle_t handle;
+  esp_err_t result = nvs_open("providore", NVS_READWRITE, &handle);
+  if (result != ESP_OK)
+  {
+    ESP_LOGW(TAG, "Unable to save OTA checkpoint: %s", esp_err_to_name(result));
+    return result;
+  }
+
+  ota_checkpoint_t record = *checkpoint;
+  record.layout = ota_checkpoint_layout();
+  result = nvs_set_blob(handle, "ota_resume", &record, sizeof(ota_checkpoint_t));
+  if (result == ESP_OK)
+  {
+    result = nvs_commit(handle);
+  }
+  nvs_close(handle);
+
+  if (result != ESP_OK)
+  {
+    ESP_LOGW(TAG, "Unable to save OTA checkpoint: %s", esp_err_to_name(result));
+  }
+  return result;
+}
+
+esp_err_t ota_checkpoint_clear()
+{
+  nvs_handle_t handle;
+  esp_err_t result = nvs_open("providore", NVS_READWRITE, &handle);
+  if (result != ESP_OK)
+  {
+    return result;
+  }
+
+  result = nvs_erase_key(handle, "ota_resume");
+  if (result == ESP_OK)
+  {
+    result = nvs_commit(handle);
+  }
+  nvs_close(handle);
+  return result == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : result;
+}
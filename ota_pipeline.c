@@ -0,0 +1,241 @@
+#include "ota_pipeline.h"
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_spi_flash.h"
+#include "esp_timer.h"
+#include "metrics.h"
+
+static const char *TAG = "PROVIDORE_OTA_PIPELINE";
+
+static esp_err_t ota_pipeline_flash_write(ota_pipeline_t *pipeline, const void *data, size_t data_len)
+{
+  if (pipeline->ota_handle)
+  {
+    return esp_ota_write(pipeline->ota_handle, data, data_len);
+  }
+
+  // A resumed download has no OTA handle, as esp_ota_begin would erase what has already been written
+  while (pipeline->erased_to < pipeline->offset + data_len)
+  {
+    esp_err_t result = esp_partition_erase_range(pipeline->partition, pipeline->erased_to, SPI_FLASH_SEC_SIZE);
+    if (result != ESP_OK)
+    {
+      return result;
+    }
+    pipeline->erased_to += SPI_FLASH_SEC_SIZE;
+  }
+  return esp_partition_write(pipeline->partition, pipeline->offset, data, data_len);
+}
+
+#ifdef CONFIG_PROVIDORE_OTA_RESUME
+static void ota_pipeline_checkpoint(ota_pipeline_t *pipeline)
+{
+  // Only checkpoint on a sector boundary, so resuming never has to erase data it needs
+  if (pipeline->checkpoint == NULL || pipeline->offset % SPI_FLASH_SEC_SIZE != 0 || pipeline->offset - pipeline->checkpoint->offset < CONFIG_PROVIDORE_OTA_CHECKPOINT_INTERVAL * 1024)
+  {
+    return;
+  }
+
+  if (signature_verify_checkpoint(pipeline->verifier, &pipeline->checkpoint->hash))
+  {
+    pipeline->checkpoint->offset = pipeline->offset;
+    ota_checkpoint_save(pipeline->checkpoint);
+  }
+}
+#endif
+
+// The first error sticks, whether it came from flash or from destroying the pipeline
+static void ota_pipeline_fail(ota_pipeline_t *pipeline, esp_err_t error)
+{
+  esp_err_t expected = ESP_OK;
+  __atomic_compare_exchange_n(&pipeline->error, &expected, error, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static void ota_pipeline_writer_task(void *arguments)
+{
+  ota_pipeline_t *pipeline = (ota_pipeline_t *)arguments;
+
+  for (;;)
+  {
+    xSemaphoreTake(pipeline->filled, portMAX_DELAY);
+    ota_pipeline_buffer_t *buffer = &pipeline->buffers[pipeline->tail % OTA_PIPELINE_BUFFERS];
+
+    // An empty buffer marks the end of the stream
+    if (buffer->len == 0)
+    {
+      break;
+    }
+
+    // Once a write has failed, keep draining so the handler never blocks
+    if (__atomic_load_n(&pipeline->error, __ATOMIC_ACQUIRE) == ESP_OK)
+    {
+      int64_t started_at = esp_timer_get_time();
+      esp_err_t result = ota_pipeline_flash_write(pipeline, buffer->data, buffer->len);
+      pipeline->flash_us += esp_timer_get_time() - started_at;
+      if (result == ESP_OK)
+      {
+        signature_verify_update(pipeline->verifier, buffer->data, buffer->len);
+        pipeline->offset += buffer->len;
+        __atomic_add_fetch(&pipeline->written, buffer->len, __ATOMIC_RELAXED);
+#ifdef CONFIG_PROVIDORE_OTA_RESUME
+        ota_pipeline_checkpoint(pipeline);
+#endif
+      }
+      else
+      {
+        ota_pipeline_fail(pipeline, result);
+      }
+    }
+
+    pipeline->tail++;
+    xSemaphoreGive(pipeline->free);
+  }
+
+  pipeline->finished_at = esp_timer_get_time();
+  providore_metrics_stack(PROVIDORE_TASK_OTA_WRITER, CONFIG_PROVIDORE_OTA_PIPELINE_STACK_SIZE);
+  xSemaphoreGive(pipeline->done);
+  vTaskDelete(NULL);
+}
+
+// Hand the buffer being filled over to the writer
+static void ota_pipeline_push(ota_pipeline_t *pipeline, size_t len)
+{
+  pipeline->buffers[pipeline->head % OTA_PIPELINE_BUFFERS].len = len;
+  pipeline->head++;
+  pipeline->owned = false;
+  xSemaphoreGive(pipeline->filled);
+}
+
+// Claim the next free buffer, waiting on the writer if they are all in use
+static void ota_pipeline_claim(ota_pipeline_t *pipeline)
+{
+  if (!pipeline->owned)
+  {
+    xSemaphoreTake(pipeline->free, portMAX_DELAY);
+    pipeline->buffers[pipeline->head % OTA_PIPELINE_BUFFERS].len = 0;
+    pipeline->owned = true;
+  }
+}
+
+static void ota_pipeline_stop(ota_pipeline_t *pipeline)
+{
+  if (!pipeline->running)
+  {
+    return;
+  }
+
+  if (pipeline->owned && pipeline->buffers[pipeline->head % OTA_PIPELINE_BUFFERS].len > 0)
+  {
+    ota_pipeline_push(pipeline, pipeline->buffers[pipeline->head % OTA_PIPELINE_BUFFERS].len);
+  }
+  ota_pipeline_claim(pipeline);
+  ota_pipeline_push(pipeline, 0);
+
+  xSemaphoreTake(pipeline->done, portMAX_DELAY);
+  pipeline->running = false;
+}
+
+ota_pipeline_t *ota_pipeline_create(esp_ota_handle_t ota_handle, const esp_partition_t *partition, ota_checkpoint_t *checkpoint, signature_verifier_t *verifier)
+{
+  ota_pipeline_t *pipeline = (ota_pipeline_t *)calloc(1, sizeof(ota_pipeline_t));
+  if (pipeline == NULL)
+  {
+    return NULL;
+  }
+
+  pipeline->ota_handle = ota_handle;
+  pipeline->partition = partition;
+  pipeline->checkpoint = checkpoint;
+  pipeline->verifier = verifier;
+  pipeline->offset = checkpoint != NULL ? checkpoint->offset : 0;
+  pipeline->erased_to = pipeline->offset;
+  pipeline->error = ESP_OK;
+  pipeline->filled = xSemaphoreCreateCounting(OTA_PIPELINE_BUFFERS, 0);
+  pipeline->free = xSemaphoreCreateCounting(OTA_PIPELINE_BUFFERS, OTA_PIPELINE_BUFFERS);
+  pipeline->done = xSemaphoreCreateBinary();
+  if (pipeline->filled == NULL || pipeline->free == NULL || pipeline->done == NULL)
+  {
+    ota_pipeline_destroy(pipeline);
+    return NULL;
+  }
+
+  pipeline->started_at = esp_timer_get_time();
+  if (xTaskCreate(ota_pipeline_writer_task, "ota_writer", CONFIG_PROVIDORE_OTA_PIPELINE_STACK_SIZE, (void *)pipeline, 1, &pipeline->writer) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Unable to start the flash writer task");
+    ota_pipeline_destroy(pipeline);
+    return NULL;
+  }
+  pipeline->running = true;
+
+  return pipeline;
+}
+
+esp_err_t ota_pipeline_write(ota_pipeline_t *pipeline, const void *data, size_t data_len)
+{
+  const uint8_t *data_ptr = (const uint8_t *)data;
+
+  while (data_len > 0 && __atomic_load_n(&pipeline->error, __ATOMIC_ACQUIRE) == ESP_OK)
+  {
+    ota_pipeline_claim(pipeline);
+
+    ota_pipeline_buffer_t *buffer = &pipeline->buffers[pipeline->head % OTA_PIPELINE_BUFFERS];
+    size_t len = OTA_PIPELINE_BUFFER_LEN - buffer->len < data_len ? OTA_PIPELINE_BUFFER_LEN - buffer->len : data_len;
+    memcpy(buffer->data + buffer->len, data_ptr, len);
+    buffer->len += len;
+    data_ptr += len;
+    data_len -= len;
+
+    if (buffer->len == OTA_PIPELINE_BUFFER_LEN)
+    {
+      ota_pipeline_push(pipeline, buffer->len);
+    }
+  }
+
+  return __atomic_load_n(&pipeline->error, __ATOMIC_ACQUIRE);
+}
+
+esp_err_t ota_pipeline_finish(ota_pipeline_t *pipeline)
+{
+  ota_pipeline_stop(pipeline);
+  providore_metrics_record(PROVIDORE_PHASE_OTA_WRITE, pipeline->flash_us);
+  ESP_LOGI(TAG, "Wrote %i bytes to flash at %i bytes/s", pipeline->written, ota_pipeline_throughput(pipeline));
+  return pipeline->error;
+}
+
+void ota_pipeline_destroy(ota_pipeline_t *pipeline)
+{
+  if (pipeline == NULL)
+  {
+    return;
+  }
+
+  ota_pipeline_fail(pipeline, ESP_ERR_INVALID_STATE);
+  ota_pipeline_stop(pipeline);
+
+  if (pipeline->filled != NULL)
+  {
+    vSemaphoreDelete(pipeline->filled);
+  }
+  if (pipeline->free != NULL)
+  {
+    vSemaphoreDelete(pipeline->free);
+  }
+  if (pipeline->done != NULL)
+  {
+    vSemaphoreDelete(pipeline->done);
+  }
+  free(pipeline);
+}
+
+size_t ota_pipeline_throughput(ota_pipeline_t *pipeline)
+{
+  int64_t until = pipeline->running ? esp_timer_get_time() : pipeline->finished_at;
+  int64_t elapsed = until - pipeline->started_at;
+  if (elapsed <= 0)
+  {
+    return 0;
+  }
+  return (size_t)((int64_t)__atomic_load_n(&pipeline->written, __ATOMIC_RELAXED) * 1000000 / elapsed);
+}
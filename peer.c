@@ -0,0 +1,440 @@
+#include "peer.h"
+#include <stdio.h>
+#include <string.h>
+#include "esp_http_client.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "mdns.h"
+#include "nvs_flash.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ota.h"
+#include "ota_checkpoint.h"
+#include "types.h"
+
+static const char *TAG = "PROVIDORE_PEER";
+
+#define PEER_CHUNK_LEN 1024
+#define PEER_MAX_RESULTS 8
+#define PEER_URL_LEN (48 + sizeof(PEER_FIRMWARE_PATH) + MANIFEST_SHA256_LEN)
+
+// What is being shared, saved to NVS so it can be shared again after a reboot
+typedef struct _peer_image
+{
+  uint32_t partition_address;
+  uint32_t image_len;
+  char sha256[MANIFEST_SHA256_LEN];
+  char created_at[ISO8601_DATE_LEN];
+  char expiry[ISO8601_DATE_LEN];
+  char signature[SIGNATURE_LEN];
+} peer_image_t;
+
+// A download from a peer, which the request it is for can cancel or time out
+typedef struct _peer_download
+{
+  ota_request_context_t *context;
+  bool aborted;
+} peer_download_t;
+
+static peer_image_t peer_image;
+static portMUX_TYPE peer_image_lock = portMUX_INITIALIZER_UNLOCKED;
+static httpd_handle_t peer_server;
+
+static const esp_partition_t *peer_partition(uint32_t address)
+{
+  const esp_partition_t *partition = NULL;
+  esp_partition_iterator_t iterator = esp_partition_find(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, NULL);
+  for (; iterator != NULL && partition == NULL; iterator = esp_partition_next(iterator))
+  {
+    if (esp_partition_get(iterator)->address == address)
+    {
+      partition = esp_partition_get(iterator);
+    }
+  }
+  esp_partition_iterator_release(iterator);
+  return partition;
+}
+
+static esp_err_t peer_image_load(peer_image_t *image)
+{
+  bzero(image, sizeof(peer_image_t));
+
+  nvs_handle_t handle;
+  esp_err_t result = nvs_open("providore", NVS_READONLY, &handle);
+  if (result != ESP_OK)
+  {
+    return result;
+  }
+
+  size_t length = sizeof(peer_image_t);
+  result = nvs_get_blob(handle, "peer_image", image, &length);
+  nvs_close(handle);
+
+  if (result != ESP_OK || length != sizeof(peer_image_t))
+  {
+    bzero(image, sizeof(peer_image_t));
+    return result == ESP_OK ? ESP_ERR_INVALID_SIZE : result;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t peer_image_save(const peer_image_t *image)
+{
+  nvs_handle_t handle;
+  esp_err_t result = nvs_open("providore", NVS_READWRITE, &handle);
+  if (result != ESP_OK)
+  {
+    return result;
+  }
+
+  if (image != NULL)
+  {
+    result = nvs_set_blob(handle, "peer_image", image, sizeof(peer_image_t));
+  }
+  else
+  {
+    result = nvs_erase_key(handle, "peer_image");
+    result = result == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : result;
+  }
+  if (result == ESP_OK)
+  {
+    result = nvs_commit(handle);
+  }
+  nvs_close(handle);
+
+  if (result != ESP_OK)
+  {
+    ESP_LOGW(TAG, "Unable to save the shared image: %s", esp_err_to_name(result));
+  }
+  return result;
+}
+
+static esp_err_t peer_firmware_get(httpd_req_t *req)
+{
+  peer_image_t image;
+  portENTER_CRITICAL(&peer_image_lock);
+  memcpy(&image, &peer_image, sizeof(peer_image_t));
+  portEXIT_CRITICAL(&peer_image_lock);
+
+  // Only serve the image that was asked for, so a peer never gets one it can't use
+  char query[16 + MANIFEST_SHA256_LEN];
+  char sha256[MANIFEST_SHA256_LEN];
+  if (httpd_req_get_url_query_str(req, (char *)&query, sizeof(query)) != ESP_OK || httpd_query_key_value((const char *)&query, "sha256", (char *)&sha256, sizeof(sha256)) != ESP_OK || image.image_len == 0 || strcasecmp(sha256, image.sha256) != 0)
+  {
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Firmware not available");
+  }
+
+  const esp_partition_t *partition = peer_partition(image.partition_address);
+  if (partition == NULL)
+  {
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Firmware not available");
+  }
+
+  ESP_LOGI(TAG, "Sharing %i byte firmware image", image.image_len);
+  httpd_resp_set_type(req, "application/octet-stream");
+  httpd_resp_set_hdr(req, "created-at", image.created_at);
+  httpd_resp_set_hdr(req, "expiry", image.expiry);
+  httpd_resp_set_hdr(req, "signature", image.signature);
+  httpd_resp_set_hdr(req, "X-Firmware-Sha256", image.sha256);
+
+  uint8_t chunk[PEER_CHUNK_LEN];
+  for (size_t offset = 0; offset < image.image_len; offset += PEER_CHUNK_LEN)
+  {
+    size_t len = image.image_len - offset < PEER_CHUNK_LEN ? image.image_len - offset : PEER_CHUNK_LEN;
+    esp_err_t result = esp_partition_read(partition, offset, (void *)&chunk, len);
+    if (result == ESP_OK)
+    {
+      result = httpd_resp_send_chunk(req, (const char *)&chunk, len);
+    }
+    if (result != ESP_OK)
+    {
+      ESP_LOGW(TAG, "Sharing firmware failed: %s", esp_err_to_name(result));
+      return result;
+    }
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static void peer_advertise(const char *sha256)
+{
+  if (peer_server == NULL)
+  {
+    return;
+  }
+
+  if (strlen(sha256) == 0)
+  {
+    mdns_service_remove(PEER_SERVICE_TYPE, PEER_SERVICE_PROTO);
+    return;
+  }
+
+  // Replaces the TXT record when the service is already advertised
+  mdns_txt_item_t txt[] = {{"sha256", sha256}};
+  if (mdns_service_add(NULL, PEER_SERVICE_TYPE, PEER_SERVICE_PROTO, CONFIG_PROVIDORE_PEER_PORT, txt, 1) != ESP_OK)
+  {
+    mdns_service_txt_item_set(PEER_SERVICE_TYPE, PEER_SERVICE_PROTO, "sha256", sha256);
+  }
+}
+
+esp_err_t providore_peer_start()
+{
+  if (peer_server != NULL)
+  {
+    return ESP_OK;
+  }
+
+  peer_image_t image;
+  if (peer_image_load(&image) == ESP_OK)
+  {
+    // The partition may have been written to since, ie. by an OTA that failed
+    char sha256[MANIFEST_SHA256_LEN];
+    if (!providore_ota_partition_sha256(peer_partition(image.partition_address), (char *)&sha256) || strcmp(sha256, image.sha256) != 0)
+    {
+      ESP_LOGW(TAG, "Shared firmware image has changed, no longer sharing it");
+      bzero(&image, sizeof(peer_image_t));
+      peer_image_save(NULL);
+    }
+  }
+  portENTER_CRITICAL(&peer_image_lock);
+  memcpy(&peer_image, &image, sizeof(peer_image_t));
+  portEXIT_CRITICAL(&peer_image_lock);
+
+  httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  config.server_port = CONFIG_PROVIDORE_PEER_PORT;
+  config.ctrl_port = CONFIG_PROVIDORE_PEER_PORT + 1;
+  config.stack_size = CONFIG_PROVIDORE_PEER_STACK_SIZE;
+  esp_err_t result = httpd_start(&peer_server, &config);
+  if (result != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Unable to start the firmware sharing server: %s", esp_err_to_name(result));
+    peer_server = NULL;
+    return result;
+  }
+
+  httpd_uri_t firmware = {
+      .uri = PEER_FIRMWARE_PATH,
+      .method = HTTP_GET,
+      .handler = peer_firmware_get,
+      .user_ctx = NULL};
+  httpd_register_uri_handler(peer_server, &firmware);
+
+  peer_advertise(image.sha256);
+  return ESP_OK;
+}
+
+void providore_peer_stop()
+{
+  if (peer_server == NULL)
+  {
+    return;
+  }
+  mdns_service_remove(PEER_SERVICE_TYPE, PEER_SERVICE_PROTO);
+  httpd_stop(peer_server);
+  peer_server = NULL;
+}
+
+void providore_peer_offer(const esp_partition_t *partition, size_t image_len, const char *created_at, const char *expiry, const char *signature)
+{
+  peer_image_t image;
+  bzero(&image, sizeof(peer_image_t));
+  image.partition_address = partition->address;
+  image.image_len = image_len;
+  if (!providore_ota_partition_sha256(partition, (char *)&image.sha256))
+  {
+    return;
+  }
+  strncpy(image.created_at, created_at, ISO8601_DATE_LEN - 1);
+  strncpy(image.expiry, expiry, ISO8601_DATE_LEN - 1);
+  strncpy(image.signature, signature, SIGNATURE_LEN - 1);
+
+  portENTER_CRITICAL(&peer_image_lock);
+  memcpy(&peer_image, &image, sizeof(peer_image_t));
+  portEXIT_CRITICAL(&peer_image_lock);
+  peer_image_save(&image);
+  peer_advertise(image.sha256);
+}
+
+void providore_peer_forget(const esp_partition_t *partition)
+{
+  portENTER_CRITICAL(&peer_image_lock);
+  bool shared = peer_image.image_len > 0 && peer_image.partition_address == partition->address;
+  if (shared)
+  {
+    bzero(&peer_image, sizeof(peer_image_t));
+  }
+  portEXIT_CRITICAL(&peer_image_lock);
+
+  if (shared)
+  {
+    peer_advertise("");
+    peer_image_save(NULL);
+  }
+}
+
+// Look for a peer advertising the image
+static bool peer_find(const char *sha256, char *url)
+{
+  mdns_result_t *results = NULL;
+  if (mdns_query_ptr(PEER_SERVICE_TYPE, PEER_SERVICE_PROTO, CONFIG_PROVIDORE_PEER_DISCOVERY_TIMEOUT, PEER_MAX_RESULTS, &results) != ESP_OK)
+  {
+    return false;
+  }
+
+  bool found = false;
+  for (mdns_result_t *result = results; result != NULL && !found; result = result->next)
+  {
+    bool matches = false;
+    for (size_t i = 0; i < result->txt_count; i++)
+    {
+      matches = matches || (strcmp(result->txt[i].key, "sha256") == 0 && result->txt[i].value != NULL && strcasecmp(result->txt[i].value, sha256) == 0);
+    }
+
+    for (mdns_ip_addr_t *addr = result->addr; matches && addr != NULL && !found; addr = addr->next)
+    {
+      if (addr->addr.type == ESP_IPADDR_TYPE_V4)
+      {
+        snprintf(url, PEER_URL_LEN, "http://" IPSTR ":%u" PEER_FIRMWARE_PATH "?sha256=%s", IP2STR(&addr->addr.u_addr.ip4), result->port, sha256);
+        found = true;
+      }
+    }
+  }
+  mdns_query_results_free(results);
+  return found;
+}
+
+// Put the context back how it was before the download started
+static void peer_reset(ota_request_context_t *context)
+{
+  providore_ota_abort(context);
+  bzero(context->created_at, ISO8601_DATE_LEN);
+  bzero(context->expiry, ISO8601_DATE_LEN);
+  bzero(context->signature, SIGNATURE_LEN);
+  bzero(&context->checkpoint, sizeof(ota_checkpoint_t));
+  context->delta_encoded = false;
+  context->content_encoding = INFLATE_NONE;
+  context->ota_state = OTA_READY;
+  context->downloaded = 0;
+  context->total = 0;
+  context->reported_at = 0;
+  context->expected_sha256 = NULL;
+}
+
+// Ticks left before the request times out, portMAX_DELAY when it can't
+static TickType_t peer_time_left(const ota_request_context_t *context)
+{
+  const providore_request_t *request = context->request;
+  if (request == NULL || request->timeout == 0)
+  {
+    return portMAX_DELAY;
+  }
+  TickType_t elapsed = xTaskGetTickCount() - request->started;
+  return elapsed < request->timeout ? request->timeout - elapsed : 0;
+}
+
+static bool peer_should_abort(const ota_request_context_t *context)
+{
+  return (context->request != NULL && __atomic_load_n(&context->request->cancelled, __ATOMIC_ACQUIRE)) || peer_time_left(context) == 0;
+}
+
+// Cancelling or timing out the request stops the download the same way it
+// does one from the server, by failing it and closing the connection
+static esp_err_t peer_event_handle(esp_http_client_event_t *evt)
+{
+  peer_download_t *download = (peer_download_t *)evt->user_data;
+  if (download->aborted)
+  {
+    return ESP_OK;
+  }
+
+  esp_http_client_event_t request_evt = *evt;
+  request_evt.user_data = (void *)download->context;
+  if ((evt->event_id == HTTP_EVENT_ON_HEADER || evt->event_id == HTTP_EVENT_ON_DATA) && peer_should_abort(download->context))
+  {
+    ESP_LOGW(TAG, "Request %s, closing the connection to the peer", __atomic_load_n(&download->context->request->cancelled, __ATOMIC_ACQUIRE) ? "cancelled" : "timed out");
+    download->aborted = true;
+    request_evt.event_id = HTTP_EVENT_ERROR;
+    request_evt.data = NULL;
+    request_evt.data_len = 0;
+    providore_ota_firmware_event_handle(&request_evt);
+    esp_http_client_close(evt->client);
+    return ESP_OK;
+  }
+  return providore_ota_firmware_event_handle(&request_evt);
+}
+
+esp_err_t providore_peer_fetch(ota_request_context_t *context, const char *sha256)
+{
+  char url[PEER_URL_LEN];
+
+  // Only devices taking part in sharing go looking for it
+  if (peer_server == NULL || strlen(sha256) == 0)
+  {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+
+  // Already downloaded and waiting for a reboot - don't fetch it from ourselves
+  portENTER_CRITICAL(&peer_image_lock);
+  bool shared = strcasecmp(peer_image.sha256, sha256) == 0;
+  portEXIT_CRITICAL(&peer_image_lock);
+  if (shared)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+#ifdef CONFIG_PROVIDORE_OTA_RESUME
+  // A partial download from the server is quicker to resume than to start again
+  ota_checkpoint_t checkpoint;
+  if (ota_checkpoint_load(&checkpoint) == ESP_OK && checkpoint.offset > 0)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+#endif
+
+  if (!peer_find(sha256, (char *)&url))
+  {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  // Looking for a peer can use up what was left of the request's time
+  TickType_t time_left = peer_time_left(context);
+  if (peer_should_abort(context))
+  {
+    return ESP_ERR_TIMEOUT;
+  }
+  int timeout_ms = CONFIG_PROVIDORE_PEER_TIMEOUT;
+  if (time_left != portMAX_DELAY && (uint64_t)time_left * portTICK_PERIOD_MS < timeout_ms)
+  {
+    timeout_ms = time_left * portTICK_PERIOD_MS;
+  }
+
+  ESP_LOGI(TAG, "Downloading firmware from %s", url);
+  context->expected_sha256 = sha256;
+  peer_download_t download = {.context = context, .aborted = false};
+  esp_http_client_config_t http_client_config = {
+      .url = (const char *)&url,
+      .event_handler = peer_event_handle,
+      .user_data = (void *)&download,
+      .timeout_ms = timeout_ms > 0 ? timeout_ms : 1};
+  esp_http_client_handle_t client = esp_http_client_init(&http_client_config);
+  if (client == NULL)
+  {
+    context->expected_sha256 = NULL;
+    return ESP_ERR_NO_MEM;
+  }
+
+  esp_err_t err = esp_http_client_perform(client);
+  esp_http_client_cleanup(client);
+  if (err == ESP_OK && context->ota_state == OTA_COMPLETED)
+  {
+    context->expected_sha256 = NULL;
+    return ESP_OK;
+  }
+
+  peer_reset(context);
+  if (download.aborted || peer_should_abort(context))
+  {
+    return ESP_ERR_TIMEOUT;
+  }
+  ESP_LOGW(TAG, "Downloading firmware from a peer failed, using the server");
+  return err == ESP_OK || err == ESP_ERR_TIMEOUT ? ESP_FAIL : err;
+}
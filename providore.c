@@ -1,28 +1,71 @@
 #include "providore.h"
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
-#include "mbedtls/base64.h"
-#include "mbedtls/md.h"
-#include "mbedtls/sha256.h"
-#include "esp_hmac.h"
+#include "freertos/task.h"
 #include "esp_log.h"
 #include "esp_http_client.h"
+#include "nvs.h"
+#include "config_cache.h"
+#include "esp_timer.h"
+#include "metrics.h"
+#include "once.h"
 #include "ota.h"
+#include "server_time.h"
+#include "session.h"
+#include "signature.h"
+#include "signer.h"
 #include "types.h"
 
 static const char *TAG = "PROVIDORE";
 
+#define PROVIDORE_TASK_STACK_SIZE CONFIG_PROVIDORE_TASK_STACK_SIZE
+
+// Shared by every request so config, manifest and sync fetches reuse one connection
+static providore_session_t default_session;
+// Long-polls for config changes on a connection of their own, so they never hold up other requests
+static providore_session_t push_session;
+// Firmware downloads can take minutes, so they get a connection of their own too,
+// torn down afterwards as downloads are rare
+static providore_session_t firmware_session;
+// Worked out once and reused for every request from the same device. Requests
+// only read it, the lock is for changing identity.
+static providore_signer_t default_signer;
+static bool default_signer_ready = false;
+static SemaphoreHandle_t signer_lock;
+static providore_once_t init_once = PROVIDORE_ONCE_INIT;
+
+// Only one firmware update can write to the OTA partition at a time, so there
+// is a single context, claimed with a compare-and-swap rather than a lock.
+static ota_request_context_t ota_context;
+static volatile uint32_t ota_context_claimed;
+
+// Where a response body goes when it isn't copied into a fixed output buffer
+typedef struct _response_sink
+{
+  config_parser_t *parser;
+  providore_buffer_t *buffer;
+  sync_decoder_t *sync;
+} response_sink_t;
+
 typedef struct _request_context
 {
-  char url[URL_BUFFER_LEN];
   char *response;
   size_t response_len;
   size_t response_max_len;
+  size_t content_len;
+  signature_verifier_t verifier;
+  config_parser_t *parser;
+  providore_buffer_t *buffer;
+  sync_decoder_t *sync;
+  esp_err_t sink_error;
   char created_at[ISO8601_DATE_LEN];
   char expiry[ISO8601_DATE_LEN];
   char signature[SIGNATURE_LEN];
+  char etag[ETAG_LEN];
+  char last_modified[HTTP_DATE_LEN];
 } request_context_t;
 
 esp_err_t http_event_handle(esp_http_client_event_t *evt)
@@ -42,22 +85,57 @@ esp_err_t http_event_handle(esp_http_client_event_t *evt)
     ESP_LOGI(TAG, "HTTP_EVENT_ON_HEADER: %s: %s", evt->header_key, evt->header_value);
     if (strncmp(evt->header_key, "created-at", 10) == 0)
     {
-      strncpy(context->created_at, evt->header_value, ISO8601_DATE_LEN);
+      strncpy(context->created_at, evt->header_value, ISO8601_DATE_LEN - 1);
+      context->created_at[ISO8601_DATE_LEN - 1] = '\0';
     }
     if (strncmp(evt->header_key, "expiry", 6) == 0)
     {
-      strncpy(context->expiry, evt->header_value, ISO8601_DATE_LEN);
+      strncpy(context->expiry, evt->header_value, ISO8601_DATE_LEN - 1);
+      context->expiry[ISO8601_DATE_LEN - 1] = '\0';
     }
     if (strncmp(evt->header_key, "signature", 9) == 0)
     {
-      strncpy(context->signature, evt->header_value, SIGNATURE_LEN);
+      strncpy(context->signature, evt->header_value, SIGNATURE_LEN - 1);
+    }
+    if (strncasecmp(evt->header_key, "etag", 4) == 0)
+    {
+      strncpy(context->etag, evt->header_value, ETAG_LEN - 1);
+    }
+    if (strncasecmp(evt->header_key, "last-modified", 13) == 0)
+    {
+      strncpy(context->last_modified, evt->header_value, HTTP_DATE_LEN - 1);
     }
   }
   break;
   case HTTP_EVENT_ON_DATA:
   {
     request_context_t *context = (request_context_t *)evt->user_data;
-    if (context->response_len < context->response_max_len)
+    // Sign as we go, so the body never has to be held in memory a second time
+    signature_verify_update(&context->verifier, evt->data, evt->data_len);
+    context->content_len += evt->data_len;
+
+    if (context->parser != NULL)
+    {
+      if (context->sink_error == ESP_OK)
+      {
+        context->sink_error = config_parser_write(context->parser, evt->data, evt->data_len);
+      }
+    }
+    else if (context->buffer != NULL)
+    {
+      if (context->sink_error == ESP_OK)
+      {
+        context->sink_error = providore_buffer_append(context->buffer, evt->data, evt->data_len);
+      }
+    }
+    else if (context->sync != NULL)
+    {
+      if (context->sink_error == ESP_OK)
+      {
+        context->sink_error = sync_decoder_write(context->sync, evt->data, evt->data_len);
+      }
+    }
+    else if (context->response_len < context->response_max_len)
     {
       size_t len = context->response_len + evt->data_len > context->response_max_len ? context->response_max_len - context->response_len : evt->data_len;
       memcpy(context->response + context->response_len, evt->data, len);
@@ -73,203 +151,749 @@ esp_err_t http_event_handle(esp_http_client_event_t *evt)
   return ESP_OK;
 }
 
-void generate_hmac_signature(char *buffer, size_t buffer_len, const char *method, const char *path, const char *version, const char *created_at, const char *expiry)
+void generate_iso8601_timestamp(time_t *time, char *output)
 {
-  char *buffer_ptr = buffer;
-  memset(buffer_ptr, 0, sizeof(char) * buffer_len);
+  // gmtime shares one result between every task that calls it
+  struct tm input;
+  gmtime_r(time, &input);
+  memset(output, 0, sizeof(char) * ISO8601_DATE_LEN);
+  strftime(output, ISO8601_DATE_LEN, "%FT%TZ", &input);
+}
 
-  strcpy(buffer + strlen(buffer), method);
-  strcpy(buffer + strlen(buffer), "\n");
-  strcpy(buffer + strlen(buffer), path);
-  strcpy(buffer + strlen(buffer), "\n");
-  strcpy(buffer + strlen(buffer), version);
-  strcpy(buffer + strlen(buffer), "\n");
-  strcpy(buffer + strlen(buffer), created_at);
-  strcpy(buffer + strlen(buffer), "\n");
-  strcpy(buffer + strlen(buffer), expiry);
+// Any task can make the first request, so the shared state is set up exactly once
+static void providore_init()
+{
+  if (providore_once_begin(&init_once))
+  {
+    providore_session_init(&default_session);
+    providore_session_init(&push_session);
+    providore_session_init(&firmware_session);
+    push_session.wait = CONFIG_PROVIDORE_PUSH_WAIT;
+    // Leave the server time to answer a request it has held for the whole wait
+    push_session.timeout_ms = (CONFIG_PROVIDORE_PUSH_WAIT + 10) * 1000;
+    signer_lock = xSemaphoreCreateMutex();
+    providore_once_end(&init_once);
+  }
 }
 
-esp_err_t hmac_calculate(const char *psk, const void *message, size_t message_len, uint8_t *sig)
+static providore_session_t *providore_session()
 {
-#ifdef SECURED_SHARED_KEY
-  return esp_hmac_calculate(ETS_EFUSE_BLOCK_KEY4, (const void *)&message, strlen(message), (uint8_t *)&sig);
-#else
-  mbedtls_md_context_t ctx;
-  mbedtls_md_type_t md_type = MBEDTLS_MD_SHA256;
-  mbedtls_md_init(&ctx);
-  mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(md_type), 1);
-  mbedtls_md_hmac_starts(&ctx, (unsigned char *)psk, strlen(psk));
-  mbedtls_md_hmac_update(&ctx, (const unsigned char *)message, strlen(message));
-  mbedtls_md_hmac_finish(&ctx, sig);
-  return ESP_OK;
-#endif
+  providore_init();
+  return &default_session;
 }
 
-void generate_hmac(char *buffer, size_t buffer_len, const char *device_id, const char *psk, const char *method, const char *path, const char *version, const char *created_at, const char *expiry)
+// Switching identity while another task has a request in flight is not supported
+static providore_signer_t *providore_signer(const char *device_id, const char *psk)
 {
-  char sig[32];
-  char signature[buffer_len - 21];
+  providore_init();
+  xSemaphoreTake(signer_lock, portMAX_DELAY);
 
-  memset(buffer, 0, sizeof(char) * buffer_len);
+  // Without a device_id, use the identity loaded by providore_load_identity()
+  if (device_id != NULL && (!default_signer_ready || !providore_signer_matches(&default_signer, device_id, psk)))
+  {
+    default_signer_ready = providore_signer_init(&default_signer, device_id, psk) == ESP_OK;
+  }
+  providore_signer_t *signer = default_signer_ready ? &default_signer : NULL;
 
-  generate_hmac_signature((char *)&signature, buffer_len - 21, method, path, version, created_at, expiry);
-  hmac_calculate(psk, (const void *)&signature, strlen(signature), (uint8_t *)&sig);
+  xSemaphoreGive(signer_lock);
+  return signer;
+}
 
-  char base64[48];
-  size_t olen;
-  mbedtls_base64_encode((unsigned char *)&base64, 48, &olen, (const unsigned char *)&sig, 32);
-  strcpy(buffer, "Hmac key-id=");
-  strcpy(buffer + strlen(buffer), device_id);
-  strcpy(buffer + strlen(buffer), ", signature=");
-  strcpy(buffer + strlen(buffer), base64);
+esp_err_t providore_load_identity()
+{
+  providore_init();
+  xSemaphoreTake(signer_lock, portMAX_DELAY);
+  esp_err_t result = providore_signer_load(&default_signer);
+  default_signer_ready = result == ESP_OK;
+  xSemaphoreGive(signer_lock);
+  return result;
 }
 
-bool verify_message(const char *psk, request_context_t *context)
+static ota_request_context_t *ota_context_claim()
 {
-  uint buffer_len = context->response_len + 1 + ISO8601_DATE_LEN + 1 + ISO8601_DATE_LEN + 1;
-  char buffer[buffer_len];
-  char sig[SIGNATURE_LEN];
-  char base64[48];
-  size_t olen;
+  uint32_t expected = 0;
+  if (!__atomic_compare_exchange_n(&ota_context_claimed, &expected, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+  {
+    ESP_LOGE(TAG, "A firmware upgrade is already running");
+    return NULL;
+  }
 
-  bzero(&buffer, buffer_len);
-  snprintf((char *)buffer, buffer_len, "%s\n%s\n%s", context->response, context->created_at, context->expiry);
-  hmac_calculate(psk, (char *)buffer, strlen(buffer), (uint8_t *)&sig);
-  mbedtls_base64_encode((unsigned char *)&base64, 48, &olen, (const unsigned char *)&sig, 32);
-  return strncmp((const char *)base64, context->signature, SIGNATURE_LEN) == 0;
+  bzero(&ota_context, sizeof(ota_context));
+  ota_context.ota_state = OTA_READY;
+  return &ota_context;
 }
 
-void generate_iso8601_timestamp(time_t *time, char *output)
+static void ota_context_release(ota_request_context_t *context)
 {
-  // https: // stackoverflow.com/questions/10530804/gmtime-change-two-pointers-at-the-same-time
-  struct tm input = *gmtime(time);
-  memset(output, 0, sizeof(char) * ISO8601_DATE_LEN);
-  strftime(output, ISO8601_DATE_LEN, "%FT%TZ", &input);
+  __atomic_store_n(&ota_context_claimed, 0, __ATOMIC_RELEASE);
 }
 
-providore_err_t providore_get(const char *method, const char *path, const char *device_id, const char *psk, size_t output_max_len, const char *output, size_t *output_len)
+void sign_request(esp_http_client_handle_t client, const providore_signer_t *signer, const char *method, const char *path)
 {
-  request_context_t context;
-
-  bzero(output, output_max_len);
-  bzero(&context, sizeof(context));
-
-  time_t now = time(&now);
+  int64_t started_at = esp_timer_get_time();
+  time_t now = providore_server_time_now();
   time_t until = now + (15 * 60);
 
   char hmac[HMAC_BUFFER_LEN];
   const char created_at[ISO8601_DATE_LEN];
   const char expiry[ISO8601_DATE_LEN];
 
-  char *url_ptr = (char *)&context.url;
-  memset(url_ptr, 0, sizeof(char) * URL_BUFFER_LEN);
-  strcpy(url_ptr, CONFIG_PROVIDORE_SERVER);
-  strcpy(url_ptr + strlen((char *)&context.url), path);
-
-  context.response = (char *)output;
-  context.response_max_len = output_max_len;
-
-  esp_http_client_config_t http_client_config = {
-      .url = url_ptr,
-      .event_handler = http_event_handle,
-      .user_data = (void *)&context};
-
   generate_iso8601_timestamp(&now, (char *)&created_at);
   generate_iso8601_timestamp(&until, (char *)&expiry);
-  generate_hmac((char *)&hmac, HMAC_BUFFER_LEN, device_id, psk, method, path, FIRMWARE_VERSION, (char *)&created_at, (char *)&expiry);
+  providore_signer_authorization(signer, (char *)&hmac, HMAC_BUFFER_LEN, method, path, FIRMWARE_VERSION, (char *)&created_at, (char *)&expiry);
 
-  esp_http_client_handle_t client = esp_http_client_init(&http_client_config);
   esp_http_client_set_header(client, "X-Firmware-Version", FIRMWARE_VERSION);
   esp_http_client_set_header(client, "Authorization", (const char *)&hmac);
   esp_http_client_set_header(client, "Created-At", (const char *)&created_at);
   esp_http_client_set_header(client, "Expiry", (const char *)&expiry);
+  providore_metrics_record(PROVIDORE_PHASE_SIGN, esp_timer_get_time() - started_at);
+}
+
+// Serve an unchanged config from NVS, checking it against the signature it was cached with
+providore_err_t providore_get_cached(const providore_signer_t *signer, const config_cache_t *cache, size_t output_max_len, const char *output, size_t *output_len)
+{
+  signature_verifier_t verifier;
+  size_t length = output_max_len;
+
+  esp_err_t result = config_cache_load_body((void *)output, &length);
+  if (result == ESP_ERR_NVS_INVALID_LENGTH)
+  {
+    return PROVIDORE_RESPONSE_TOO_LARGE;
+  }
+  if (result != ESP_OK)
+  {
+    return PROVIDORE_SIG_MISMATCH;
+  }
+
+  signature_verify_begin(&verifier, signer);
+  signature_verify_update(&verifier, output, length);
+  if (!signature_verify_finish(&verifier, cache->created_at, cache->expiry, cache->signature))
+  {
+    ESP_LOGE(TAG, "Cached config failed signature check");
+    return PROVIDORE_SIG_MISMATCH;
+  }
 
-  esp_err_t err = esp_http_client_perform(client);
+  if (output_len != NULL)
+  {
+    *output_len = length;
+  }
+  return PROVIDORE_OK;
+}
+
+// Watch the session on behalf of an asynchronous request, so it can be cancelled or time out
+// The client to make the request with, or NULL once the session has been ended
+static esp_http_client_handle_t providore_watch(providore_session_t *session, esp_http_client_handle_t client, const providore_request_t *request)
+{
+  if (request == NULL)
+  {
+    return client;
+  }
+  return providore_session_watch(session, &request->cancelled, request->started, request->timeout);
+}
+
+static providore_operation_t providore_operation(const char *path)
+{
+  if (strncmp(path, "/sync", 5) == 0)
+  {
+    return PROVIDORE_OPERATION_SYNC;
+  }
+  if (strcmp(path, "/firmware/manifest") == 0)
+  {
+    return PROVIDORE_OPERATION_MANIFEST;
+  }
+  return PROVIDORE_OPERATION_CONFIG;
+}
+
+// With a sink, the body is handed to a parser or buffer chain as it arrives instead of being copied to output
+static providore_err_t providore_get_on(providore_session_t *session, const char *method, const char *path, const providore_signer_t *signer, size_t output_max_len, const char *output, size_t *output_len, const response_sink_t *sink, bool cached, const providore_request_t *request)
+{
+  request_context_t context;
+  config_cache_t cache;
+
+  if (output != NULL)
+  {
+    bzero((char *)output, output_max_len);
+  }
+  bzero(&context, sizeof(context));
+
+  context.response = (char *)output;
+  context.response_max_len = output_max_len;
+  if (sink != NULL)
+  {
+    context.parser = sink->parser;
+    context.buffer = sink->buffer;
+    context.sync = sink->sync;
+  }
+
+  esp_http_client_handle_t client = providore_session_begin(session, path, http_event_handle, (void *)&context);
+  if (client != NULL)
+  {
+    client = providore_watch(session, client, request);
+  }
+  if (client == NULL)
+  {
+    return PROVIDORE_CONNECTION_FAIL;
+  }
+  signature_verify_begin(&context.verifier, signer);
+
+  sign_request(client, signer, method, path);
+
+  // Only ask the server to skip the body when there is a copy to fall back on
+  bool use_cache = cached;
+  cached = use_cache && config_cache_load(&cache) == ESP_OK;
+  if (cached)
+  {
+    if (strlen(cache.etag) > 0)
+    {
+      esp_http_client_set_header(client, "If-None-Match", cache.etag);
+    }
+    if (strlen(cache.last_modified) > 0)
+    {
+      esp_http_client_set_header(client, "If-Modified-Since", cache.last_modified);
+    }
+  }
+
+  esp_err_t err = providore_session_perform(session);
   if (err != ESP_OK)
   {
     ESP_LOGE(TAG, "Fetch error");
   }
+  int status_code = esp_http_client_get_status_code(client);
+  providore_metrics_heap(providore_operation(path), providore_session_heap_used(session));
+
+  esp_http_client_delete_header(client, "If-None-Match");
+  esp_http_client_delete_header(client, "If-Modified-Since");
+  providore_session_end(session);
+
+  if (err == ESP_ERR_TIMEOUT)
+  {
+    signature_verify_free(&context.verifier);
+    return request != NULL && __atomic_load_n(&request->cancelled, __ATOMIC_ACQUIRE) ? PROVIDORE_CANCELLED : PROVIDORE_TIMEOUT;
+  }
+
+  // Nothing came back to verify, so don't report it as a bad signature
+  if (err != ESP_OK)
+  {
+    signature_verify_free(&context.verifier);
+    return PROVIDORE_CONNECTION_FAIL;
+  }
+
+  if (cached && status_code == 304)
+  {
+    signature_verify_free(&context.verifier);
+    ESP_LOGI(TAG, "%s not modified, using cached copy", path);
+    providore_err_t result = providore_get_cached(signer, &cache, output_max_len, output, output_len);
+    if (result == PROVIDORE_SIG_MISMATCH)
+    {
+      // The cache can't be trusted, so fetch the whole thing again
+      config_cache_clear();
+      return providore_get_on(session, method, path, signer, output_max_len, output, output_len, sink, true, request);
+    }
+    return result;
+  }
+
+  if (output_len != NULL)
+  {
+    *output_len = context.response_len;
+  }
+
+  if (!signature_verify_finish(&context.verifier, context.created_at, context.expiry, context.signature))
+  {
+    return PROVIDORE_SIG_MISMATCH;
+  }
+  providore_server_time_learn(context.created_at, context.expiry);
+
+  if (context.parser != NULL)
+  {
+    if (context.sink_error != ESP_OK || config_parser_finish(context.parser) != ESP_OK)
+    {
+      return PROVIDORE_INVALID_CONFIG;
+    }
+    return PROVIDORE_OK;
+  }
 
-  esp_http_client_cleanup(client);
-  if (verify_message(psk, &context))
+  if (context.buffer != NULL)
   {
+    if (context.sink_error != ESP_OK)
+    {
+      ESP_LOGE(TAG, "Out of buffer memory for a %i byte response", context.content_len);
+      return PROVIDORE_NO_MEM;
+    }
     return PROVIDORE_OK;
   }
-  else
+
+  if (context.sync != NULL)
+  {
+    if (context.sink_error != ESP_OK || sync_decoder_finish(context.sync) != ESP_OK)
+    {
+      return PROVIDORE_INVALID_RESPONSE;
+    }
+    return PROVIDORE_OK;
+  }
+
+  if (context.content_len > context.response_len)
+  {
+    ESP_LOGE(TAG, "Response of %i bytes does not fit in the %i byte output buffer", context.content_len, output_max_len);
+    return PROVIDORE_RESPONSE_TOO_LARGE;
+  }
+
+#ifdef CONFIG_PROVIDORE_CONFIG_CACHE
+  if (use_cache && status_code == 200 && (strlen(context.etag) > 0 || strlen(context.last_modified) > 0))
   {
+    bzero(&cache, sizeof(cache));
+    strcpy(cache.created_at, context.created_at);
+    strcpy(cache.expiry, context.expiry);
+    strcpy(cache.signature, context.signature);
+    strcpy(cache.etag, context.etag);
+    strcpy(cache.last_modified, context.last_modified);
+    config_cache_save(&cache, output, context.response_len);
+  }
+#endif
+  return PROVIDORE_OK;
+}
+
+providore_err_t providore_get(const char *method, const char *path, const providore_signer_t *signer, size_t output_max_len, const char *output, size_t *output_len, const response_sink_t *sink, bool cached, const providore_request_t *request)
+{
+  return providore_get_on(providore_session(), method, path, signer, output_max_len, output, output_len, sink, cached, request);
+}
+
+providore_err_t providore_wait_config(const char *device_id, const char *psk, size_t output_max_len, const char *output, size_t *output_len)
+{
+  config_cache_t before;
+  config_cache_t after;
+
+  providore_signer_t *signer = providore_signer(device_id, psk);
+  if (signer == NULL)
+  {
+    ESP_LOGE(TAG, "No device identity to sign the request with");
     return PROVIDORE_SIG_MISMATCH;
   }
+
+#ifndef CONFIG_PROVIDORE_CONFIG_CACHE
+  // Without the cached ETag / Last-Modified there is nothing to wait for a change from
+  ESP_LOGE(TAG, "Config push needs CONFIG_PROVIDORE_CONFIG_CACHE");
+  return PROVIDORE_INVALID_CONFIG;
+#endif
+  // The cached copy's ETag / Last-Modified is what the server waits for a change from
+  bool had_cache = config_cache_load(&before) == ESP_OK;
+  providore_err_t result = providore_get_on(&push_session, "GET", "/config", signer, output_max_len, output, output_len, NULL, true, NULL);
+  if (result != PROVIDORE_OK)
+  {
+    return result;
+  }
+
+  // A server that doesn't long-poll answers straight away with the same config,
+  // signed afresh, so only the ETag / Last-Modified say whether it changed
+  if (had_cache && config_cache_load(&after) == ESP_OK && (strlen(after.etag) > 0 || strlen(after.last_modified) > 0) && strcmp(before.etag, after.etag) == 0 && strcmp(before.last_modified, after.last_modified) == 0)
+  {
+    return PROVIDORE_NO_UPDATE;
+  }
+  return PROVIDORE_OK;
+}
+
+static providore_err_t providore_fetch_config(const providore_signer_t *signer, size_t output_max_len, const char *output, size_t *output_len, const providore_request_t *request)
+{
+#ifdef CONFIG_PROVIDORE_CONFIG_CACHE
+  return providore_get("GET", "/config", signer, output_max_len, output, output_len, NULL, true, request);
+#else
+  return providore_get("GET", "/config", signer, output_max_len, output, output_len, NULL, false, request);
+#endif
 }
 
 providore_err_t providore_get_config(const char *device_id, const char *psk, size_t output_max_len, const char *output, size_t *output_len)
 {
-  return providore_get("GET", "/config", device_id, psk, output_max_len, output, output_len);
+  providore_signer_t *signer = providore_signer(device_id, psk);
+  if (signer == NULL)
+  {
+    ESP_LOGE(TAG, "No device identity to sign the request with");
+    return PROVIDORE_SIG_MISMATCH;
+  }
+
+  return providore_fetch_config(signer, output_max_len, output, output_len, NULL);
+}
+
+providore_err_t providore_get_config_parsed(const char *device_id, const char *psk, config_parser_cb callback, void *user_data)
+{
+  config_parser_t parser;
+  response_sink_t sink = {.parser = &parser};
+  providore_signer_t *signer = providore_signer(device_id, psk);
+  if (signer == NULL)
+  {
+    ESP_LOGE(TAG, "No device identity to sign the request with");
+    return PROVIDORE_SIG_MISMATCH;
+  }
+
+  // The cache needs the whole body, so a streamed config is always fetched in full
+  config_parser_begin(&parser, callback, user_data);
+  return providore_get("GET", "/config", signer, 0, NULL, NULL, &sink, false, NULL);
+}
+
+providore_err_t providore_get_config_buffer(const char *device_id, const char *psk, providore_buffer_t *output)
+{
+  response_sink_t sink = {.buffer = output};
+  providore_buffer_init(output);
+  providore_signer_t *signer = providore_signer(device_id, psk);
+  if (signer == NULL)
+  {
+    ESP_LOGE(TAG, "No device identity to sign the request with");
+    return PROVIDORE_SIG_MISMATCH;
+  }
+
+  return providore_get("GET", "/config", signer, 0, NULL, NULL, &sink, false, NULL);
+}
+
+providore_err_t providore_sync(const char *device_id, const char *psk, const sync_handler_t *handlers, size_t handler_count)
+{
+  char path[URL_BUFFER_LEN];
+  sync_decoder_t decoder;
+  response_sink_t sink = {.sync = &decoder};
+
+  providore_signer_t *signer = providore_signer(device_id, psk);
+  if (signer == NULL)
+  {
+    ESP_LOGE(TAG, "No device identity to sign the request with");
+    return PROVIDORE_SIG_MISMATCH;
+  }
+
+  if (handler_count > SYNC_HANDLER_MAX)
+  {
+    ESP_LOGE(TAG, "Too many resources to sync in one request");
+    return PROVIDORE_INVALID_RESPONSE;
+  }
+
+  // The resources are part of the signed path
+  size_t path_len = snprintf(path, sizeof(path), "/sync?resources=");
+  for (size_t i = 0; i < handler_count && path_len < sizeof(path); i++)
+  {
+    path_len += snprintf(path + path_len, sizeof(path) - path_len, "%s%s", i > 0 ? "," : "", handlers[i].name);
+  }
+  if (path_len >= sizeof(path))
+  {
+    ESP_LOGE(TAG, "Too many resources to sync in one request");
+    return PROVIDORE_INVALID_RESPONSE;
+  }
+
+  sync_decoder_begin(&decoder, handlers, handler_count);
+  return providore_get("GET", path, signer, 0, NULL, NULL, &sink, false, NULL);
+}
+
+static providore_err_t providore_get_manifest(const providore_signer_t *signer, firmware_manifest_t *manifest, const providore_request_t *request)
+{
+  config_parser_t parser;
+  response_sink_t sink = {.parser = &parser};
+
+  bzero(manifest, sizeof(firmware_manifest_t));
+  config_parser_begin(&parser, providore_ota_manifest_field, manifest);
+  providore_err_t result = providore_get("GET", "/firmware/manifest", signer, 0, NULL, NULL, &sink, false, request);
+  if (result == PROVIDORE_OK && strlen(manifest->version) == 0 && strlen(manifest->sha256) == 0)
+  {
+    ESP_LOGE(TAG, "Firmware manifest has no version or sha256");
+    return PROVIDORE_INVALID_RESPONSE;
+  }
+  return result;
 }
 
+providore_err_t providore_firmware_manifest(const char *device_id, const char *psk, firmware_manifest_t *manifest)
+{
+  providore_signer_t *signer = providore_signer(device_id, psk);
+  if (signer == NULL)
+  {
+    ESP_LOGE(TAG, "No device identity to sign the request with");
+    return PROVIDORE_SIG_MISMATCH;
+  }
+  return providore_get_manifest(signer, manifest, NULL);
+}
+
+static esp_err_t providore_fetch_firmware(ota_request_context_t *context)
+{
+  esp_err_t err = ESP_FAIL;
+
+#ifdef CONFIG_PROVIDORE_OTA_MANIFEST
+  // Only download, and erase the partition, when there is something different to install
+  firmware_manifest_t manifest;
+  providore_err_t manifest_result = providore_get_manifest(context->signer, &manifest, context->request);
+  if (manifest_result == PROVIDORE_CANCELLED || manifest_result == PROVIDORE_TIMEOUT)
+  {
+    context->ota_state = OTA_FAILED;
+    return ESP_ERR_TIMEOUT;
+  }
+  if (manifest_result == PROVIDORE_OK)
+  {
+    if (!providore_ota_manifest_differs(&manifest))
+    {
+      ESP_LOGI(TAG, "Firmware %s is up to date", manifest.version);
+      context->ota_state = OTA_UP_TO_DATE;
+      return ESP_OK;
+    }
+    ESP_LOGI(TAG, "Firmware %s (%i bytes) is available", manifest.version, manifest.size);
+    context->image_size = manifest.size;
+#ifdef CONFIG_PROVIDORE_PEER
+    // A neighbour may already have it, which saves downloading it from the server again
+    esp_err_t peer_result = providore_peer_fetch(context, manifest.sha256);
+    if (peer_result == ESP_OK)
+    {
+      return ESP_OK;
+    }
+    if (peer_result == ESP_ERR_TIMEOUT)
+    {
+      context->ota_state = OTA_FAILED;
+      return ESP_ERR_TIMEOUT;
+    }
+#endif
+  }
+  else
+  {
+    ESP_LOGW(TAG, "No usable firmware manifest, checking for firmware anyway");
+  }
+#endif
+
+  providore_session_t *session = &firmware_session;
+  esp_http_client_handle_t client = providore_session_begin(session, "/firmware", providore_ota_firmware_event_handle, (void *)context);
+  if (client != NULL)
+  {
+    client = providore_watch(session, client, context->request);
+  }
+  if (client != NULL)
+  {
+    sign_request(client, context->signer, "GET", "/firmware");
+
+#ifdef CONFIG_PROVIDORE_OTA_RESUME
+    // Pick up where an interrupted download left off
+    if (ota_checkpoint_load(&context->checkpoint) == ESP_OK && context->checkpoint.offset > 0)
+    {
+      char range[32];
+      snprintf((char *)&range, sizeof(range), "bytes=%u-", context->checkpoint.offset);
+      esp_http_client_set_header(client, "Range", (const char *)&range);
+      if (strlen(context->checkpoint.etag) > 0)
+      {
+        esp_http_client_set_header(client, "If-Range", context->checkpoint.etag);
+      }
+    }
+#endif
+
+#ifdef CONFIG_PROVIDORE_OTA_DELTA
+    // Let the server send a patch against the running firmware. A resumed
+    // download always carries on with the full image.
+    const char *running_sha256 = providore_ota_running_sha256();
+    if (context->checkpoint.offset == 0 && running_sha256 != NULL)
+    {
+      esp_http_client_set_header(client, "X-Firmware-Sha256", running_sha256);
+    }
+#endif
+
+#ifdef CONFIG_PROVIDORE_OTA_COMPRESSION
+    // Range offsets are into the uncompressed image, so a resumed download is never compressed
+    if (context->checkpoint.offset == 0)
+    {
+      esp_http_client_set_header(client, "Accept-Encoding", "gzip, deflate");
+    }
+#endif
+
+    err = providore_session_perform(session);
+    if (err != ESP_OK)
+    {
+      ESP_LOGE(TAG, "Fetch error %i", err);
+    }
+    providore_metrics_heap(PROVIDORE_OPERATION_FIRMWARE, providore_session_heap_used(session));
+
+    esp_http_client_delete_header(client, "Range");
+    esp_http_client_delete_header(client, "If-Range");
+    esp_http_client_delete_header(client, "X-Firmware-Sha256");
+    esp_http_client_delete_header(client, "Accept-Encoding");
+    providore_session_end(session);
+    providore_session_cleanup(session);
+  }
+
+  // A kept-alive connection doesn't always report a disconnect, so make sure
+  // an OTA that will not finish is cleaned up.
+  if (context->ota_state != OTA_COMPLETED && context->ota_state != OTA_FAILED && context->ota_state != OTA_UP_TO_DATE)
+  {
+    providore_ota_abort(context);
+    context->ota_state = OTA_FAILED;
+  }
+  return err;
+}
+
+static providore_err_t providore_firmware_result(const ota_request_context_t *context, esp_err_t err)
+{
+  switch (context->ota_state)
+  {
+  case OTA_COMPLETED:
+    return PROVIDORE_OK;
+  case OTA_UP_TO_DATE:
+    return PROVIDORE_NO_UPDATE;
+  default:
+    if (context->request != NULL && __atomic_load_n(&context->request->cancelled, __ATOMIC_ACQUIRE))
+    {
+      return PROVIDORE_CANCELLED;
+    }
+    return err == ESP_ERR_TIMEOUT ? PROVIDORE_TIMEOUT : PROVIDORE_FIRMWARE_FAIL;
+  }
+}
+
+// The download runs on a task with a stack big enough for TLS and the OTA
+// handler, and only signals the caller once it is completely finished with
+// the context.
 void providore_firmware_upgrade_task(void *arguments)
 {
   ota_request_context_t *context = (ota_request_context_t *)arguments;
-  time_t now = time(&now);
-  time_t until = now + (15 * 60);
+  context->result = providore_firmware_result(context, providore_fetch_firmware(context));
+  providore_metrics_stack(PROVIDORE_TASK_FIRMWARE, PROVIDORE_TASK_STACK_SIZE);
+  xSemaphoreGive(context->done);
+  vTaskDelete(NULL);
+}
 
-  char hmac[HMAC_BUFFER_LEN];
-  const char created_at[ISO8601_DATE_LEN];
-  const char expiry[ISO8601_DATE_LEN];
+providore_err_t providore_firmware_upgrade(const char *device_id, const char *psk)
+{
+  providore_signer_t *signer = providore_signer(device_id, psk);
+  if (signer == NULL)
+  {
+    ESP_LOGE(TAG, "No device identity to sign the request with");
+    return PROVIDORE_FIRMWARE_FAIL;
+  }
 
-  char *url_ptr = (char *)&(context->url);
-  memset(url_ptr, 0, sizeof(char) * URL_BUFFER_LEN);
-  strcpy(url_ptr, CONFIG_PROVIDORE_SERVER);
-  strcpy(url_ptr + strlen((char *)&(context->url)), "/firmware");
+  ota_request_context_t *context = ota_context_claim();
+  if (context == NULL)
+  {
+    return PROVIDORE_BUSY;
+  }
+  context->signer = signer;
+  context->done = xSemaphoreCreateBinaryStatic(&context->done_buffer);
 
-  esp_http_client_config_t http_client_config = {
-      .url = url_ptr,
-      .event_handler = providore_ota_firmware_event_handle,
-      .user_data = context};
+  if (xTaskCreate(providore_firmware_upgrade_task, "firmware_upgrade", PROVIDORE_TASK_STACK_SIZE, (void *)context, 1, NULL) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Unable to start the firmware upgrade task");
+    ota_context_release(context);
+    return PROVIDORE_NO_MEM;
+  }
 
-  generate_iso8601_timestamp(&now, (char *)&created_at);
-  generate_iso8601_timestamp(&until, (char *)&expiry);
-  generate_hmac((char *)&hmac, HMAC_BUFFER_LEN, context->device_id, context->psk, "GET", "/firmware", FIRMWARE_VERSION, (char *)&created_at, (char *)&expiry);
+  xSemaphoreTake(context->done, portMAX_DELAY);
+  providore_err_t result = context->result;
+  ota_context_release(context);
+  return result;
+}
 
-  esp_http_client_handle_t client = esp_http_client_init(&http_client_config);
-  esp_http_client_set_header(client, "X-Firmware-Version", FIRMWARE_VERSION);
-  esp_http_client_set_header(client, "Authorization", (const char *)&hmac);
-  esp_http_client_set_header(client, "Created-At", (const char *)&created_at);
-  esp_http_client_set_header(client, "Expiry", (const char *)&expiry);
+static providore_err_t providore_firmware_upgrade_request(providore_request_t *request)
+{
+  ota_request_context_t *context = ota_context_claim();
+  if (context == NULL)
+  {
+    return PROVIDORE_BUSY;
+  }
+  context->signer = request->signer;
+  context->request = request;
 
-  esp_err_t err = esp_http_client_perform(client);
-  if (err != ESP_OK)
+  providore_err_t result = providore_firmware_result(context, providore_fetch_firmware(context));
+  ota_context_release(context);
+  return result;
+}
+
+static void providore_request_task(void *arguments)
+{
+  providore_request_t *request = (providore_request_t *)arguments;
+  providore_err_t result;
+
+  switch (request->type)
+  {
+  case PROVIDORE_REQUEST_FIRMWARE:
+    result = providore_firmware_upgrade_request(request);
+    break;
+  default:
+    result = providore_fetch_config(request->signer, request->output_max_len, request->output, request->output_len, request);
+    break;
+  }
+
+  providore_complete_cb on_complete = request->on_complete;
+  void *user_data = request->user_data;
+  if (on_complete != NULL)
   {
-    ESP_LOGE(TAG, "Fetch error %i", err);
+    on_complete(result, user_data);
   }
+  providore_metrics_stack(PROVIDORE_TASK_REQUEST, PROVIDORE_TASK_STACK_SIZE);
 
-  esp_http_client_cleanup(client);
+  // The caller may free the request as soon as it sees it has stopped, so this is the last use of it
+  __atomic_store_n(&request->running, false, __ATOMIC_RELEASE);
   vTaskDelete(NULL);
 }
 
-ota_request_context_t context;
-providore_err_t providore_firmware_upgrade(const char *device_id, const char *psk)
+static providore_err_t providore_request_start(providore_request_t *request, const char *name, uint32_t timeout_ms)
 {
-  TaskHandle_t handle;
-  bzero(&context, sizeof(context));
-  context.ota_state = OTA_READY;
-  context.device_id = device_id;
-  context.psk = psk;
-  context.event_group = xEventGroupCreate();
+  request->started = xTaskGetTickCount();
+  request->timeout = pdMS_TO_TICKS(timeout_ms);
+  request->cancelled = false;
+  request->running = true;
 
-  xTaskCreate(providore_firmware_upgrade_task, "firmware_upgrade", 8096, (void *)&context, 1, &handle);
-  EventBits_t result = xEventGroupWaitBits(context.event_group, OTA_COMPLETED | OTA_FAILED, pdFALSE, pdFALSE, portMAX_DELAY);
-  if (result == OTA_COMPLETED)
+  if (xTaskCreate(providore_request_task, name, PROVIDORE_TASK_STACK_SIZE, (void *)request, 1, NULL) != pdPASS)
   {
-    return PROVIDORE_OK;
+    ESP_LOGE(TAG, "Unable to start the %s task", name);
+    request->running = false;
+    return PROVIDORE_NO_MEM;
   }
+  return PROVIDORE_OK;
+}
 
-  return PROVIDORE_FIRMWARE_FAIL;
+providore_err_t providore_get_config_async(providore_request_t *request, const char *device_id, const char *psk, size_t output_max_len, const char *output, size_t *output_len, uint32_t timeout_ms, providore_complete_cb on_complete, void *user_data)
+{
+  bzero(request, sizeof(providore_request_t));
+  request->type = PROVIDORE_REQUEST_CONFIG;
+  request->signer = providore_signer(device_id, psk);
+  if (request->signer == NULL)
+  {
+    ESP_LOGE(TAG, "No device identity to sign the request with");
+    return PROVIDORE_SIG_MISMATCH;
+  }
+  request->output_max_len = output_max_len;
+  request->output = output;
+  request->output_len = output_len;
+  request->on_complete = on_complete;
+  request->user_data = user_data;
+
+  return providore_request_start(request, "providore_config", timeout_ms);
+}
+
+providore_err_t providore_firmware_upgrade_async(providore_request_t *request, const char *device_id, const char *psk, uint32_t timeout_ms, providore_progress_cb on_progress, providore_complete_cb on_complete, void *user_data)
+{
+  bzero(request, sizeof(providore_request_t));
+  request->type = PROVIDORE_REQUEST_FIRMWARE;
+  request->signer = providore_signer(device_id, psk);
+  if (request->signer == NULL)
+  {
+    ESP_LOGE(TAG, "No device identity to sign the request with");
+    return PROVIDORE_FIRMWARE_FAIL;
+  }
+  request->on_progress = on_progress;
+  request->on_complete = on_complete;
+  request->user_data = user_data;
+
+  return providore_request_start(request, "providore_firmware", timeout_ms);
+}
+
+void providore_cancel(providore_request_t *request)
+{
+  __atomic_store_n(&request->cancelled, true, __ATOMIC_RELEASE);
+}
+
+bool providore_request_running(const providore_request_t *request)
+{
+  return __atomic_load_n(&request->running, __ATOMIC_ACQUIRE);
+}
+
+void providore_server_hints(uint32_t *poll_interval, uint32_t *retry_after)
+{
+  providore_session_hints(providore_session(), poll_interval, retry_after);
+}
+
+void providore_close_session()
+{
+  providore_session_close(providore_session());
+  providore_session_close(&push_session);
+  providore_session_close(&firmware_session);
 }
 
 bool providore_self_test_required()
 {
   esp_ota_img_states_t state;
-  esp_partition_t *partition = esp_ota_get_running_partition();
+  const esp_partition_t *partition = esp_ota_get_running_partition();
   esp_err_t result = esp_ota_get_state_partition(partition, &state);
   if (result != ESP_OK)
   {
@@ -0,0 +1,118 @@
+#include "push.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "providore.h"
+#include "scheduler.h"
+
+static const char *TAG = "PROVIDORE_PUSH";
+
+// Backoff and polling are spread out so devices that lost the server together don't all come back together
+#define PUSH_JITTER_PERCENT 20
+// A request answered in less than half the wait wasn't held by the server
+#define PUSH_HELD_MIN_US ((int64_t)CONFIG_PROVIDORE_PUSH_WAIT * 500000)
+
+static providore_push_config_t push_config;
+// Cleared by the task as it finishes, so it is only ever notified while it is still there
+static TaskHandle_t push_task;
+static portMUX_TYPE push_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool push_stopping;
+
+static void push_task_run(void *arguments)
+{
+  providore_scheduler_state_t state;
+  bzero(&state, sizeof(state));
+
+  // The backoff follows the same policy as the poll scheduler. A held
+  // long-poll is followed by the next straight away, bar the scheduler's
+  // minimum of a second.
+  providore_scheduler_config_t policy;
+  bzero(&policy, sizeof(policy));
+  policy.backoff_min = push_config.backoff_min;
+  policy.backoff_max = push_config.backoff_max;
+
+  // The config already cached by another request is unchanged to the server,
+  // but is still the first this task has to report
+  bool reported = false;
+  while (!__atomic_load_n(&push_stopping, __ATOMIC_ACQUIRE))
+  {
+    size_t config_len = 0;
+    int64_t started = esp_timer_get_time();
+    providore_err_t result = providore_wait_config(NULL, NULL, push_config.config_max_len, push_config.config, &config_len);
+    int64_t took = esp_timer_get_time() - started;
+    if ((result == PROVIDORE_OK || (result == PROVIDORE_NO_UPDATE && !reported)) && push_config.on_config != NULL && !__atomic_load_n(&push_stopping, __ATOMIC_ACQUIRE))
+    {
+      push_config.on_config(push_config.config, config_len, push_config.user_data);
+      reported = true;
+    }
+
+    // A server that doesn't hold requests answers an unchanged config straight
+    // away, so it is polled every interval instead
+    bool held = result == PROVIDORE_OK || took >= PUSH_HELD_MIN_US;
+    policy.interval = held ? 1 : push_config.interval;
+    bool waited = result == PROVIDORE_OK || result == PROVIDORE_NO_UPDATE;
+    policy.jitter_percent = waited && held ? 0 : PUSH_JITTER_PERCENT;
+    uint32_t delay = providore_scheduler_next_delay(&policy, &state, waited ? PROVIDORE_OK : result, 0, 0, esp_random());
+    if (!waited)
+    {
+      ESP_LOGW(TAG, "Config long-poll failed (%i), %i in a row, reconnecting in %is", result, state.failures, delay);
+    }
+    else if (!held)
+    {
+      ESP_LOGD(TAG, "Config request wasn't held, next in %is", delay);
+    }
+    providore_metrics_stack(PROVIDORE_TASK_PUSH, PUSH_STACK_SIZE);
+
+    // providore_push_stop cuts the wait short
+    ulTaskNotifyTake(pdTRUE, (TickType_t)((uint64_t)delay * configTICK_RATE_HZ));
+  }
+
+  portENTER_CRITICAL(&push_lock);
+  push_task = NULL;
+  portEXIT_CRITICAL(&push_lock);
+  vTaskDelete(NULL);
+}
+
+esp_err_t providore_push_start(const providore_push_config_t *config)
+{
+  portENTER_CRITICAL(&push_lock);
+  bool running = push_task != NULL;
+  portEXIT_CRITICAL(&push_lock);
+  if (running)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+#ifndef CONFIG_PROVIDORE_CONFIG_CACHE
+  ESP_LOGE(TAG, "Config push needs CONFIG_PROVIDORE_CONFIG_CACHE");
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+  if (config->config == NULL || config->interval == 0 || config->backoff_min == 0 || config->backoff_max < config->backoff_min)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  memcpy(&push_config, config, sizeof(providore_push_config_t));
+  __atomic_store_n(&push_stopping, false, __ATOMIC_RELEASE);
+  // The handle is set before the task first runs
+  if (xTaskCreate(push_task_run, "providore_push", PUSH_STACK_SIZE, NULL, 1, &push_task) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Unable to start the config push task");
+    push_task = NULL;
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+void providore_push_stop()
+{
+  __atomic_store_n(&push_stopping, true, __ATOMIC_RELEASE);
+  portENTER_CRITICAL(&push_lock);
+  if (push_task != NULL)
+  {
+    xTaskNotifyGive(push_task);
+  }
+  portEXIT_CRITICAL(&push_lock);
+}
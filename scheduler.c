@@ -0,0 +1,165 @@
+#include "scheduler.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "providore.h"
+
+static const char *TAG = "PROVIDORE_SCHEDULER";
+
+#define SCHEDULER_STACK_SIZE CONFIG_PROVIDORE_SCHEDULER_STACK_SIZE
+
+static providore_scheduler_config_t scheduler_config;
+// Cleared by the task as it finishes, so it is only ever notified while it is still there
+static TaskHandle_t scheduler_task;
+static portMUX_TYPE scheduler_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool scheduler_stopping;
+
+static uint32_t scheduler_jitter(uint32_t delay, uint32_t jitter_percent, uint32_t random)
+{
+  uint32_t spread = (uint32_t)((uint64_t)delay * jitter_percent / 100);
+  if (spread == 0)
+  {
+    return delay;
+  }
+  return delay - spread + random % (2 * spread + 1);
+}
+
+uint32_t providore_scheduler_next_delay(const providore_scheduler_config_t *config, providore_scheduler_state_t *state, providore_err_t result, uint32_t poll_interval, uint32_t retry_after, uint32_t random)
+{
+  uint32_t delay;
+
+  if (result == PROVIDORE_OK)
+  {
+    state->failures = 0;
+    delay = poll_interval > 0 ? poll_interval : config->interval;
+  }
+  else
+  {
+    state->failures++;
+    delay = config->backoff_min;
+    for (uint32_t i = 1; i < state->failures && delay < config->backoff_max; i++)
+    {
+      delay *= 2;
+    }
+    delay = delay > config->backoff_max ? config->backoff_max : delay;
+  }
+
+  delay = scheduler_jitter(delay, config->jitter_percent, random);
+
+  // The server knows how busy it is, so never come back sooner than it asked,
+  // jitter included
+  if (retry_after > delay)
+  {
+    delay = retry_after;
+  }
+  return delay > 0 ? delay : 1;
+}
+
+static void scheduler_poll(providore_scheduler_state_t *state, uint32_t *delay)
+{
+  size_t config_len = 0;
+  uint32_t poll_interval = 0;
+  uint32_t retry_after = 0;
+
+  providore_err_t result = providore_get_config(NULL, NULL, scheduler_config.config_max_len, scheduler_config.config, &config_len);
+  providore_server_hints(&poll_interval, &retry_after);
+  if (scheduler_config.on_config != NULL)
+  {
+    scheduler_config.on_config(result, scheduler_config.config, config_len, scheduler_config.user_data);
+  }
+
+  // Without a manifest, a firmware check that finds nothing new fails, so it doesn't affect the backoff
+  if (result == PROVIDORE_OK && scheduler_config.firmware && !__atomic_load_n(&scheduler_stopping, __ATOMIC_ACQUIRE))
+  {
+    providore_err_t firmware_result = providore_firmware_upgrade(NULL, NULL);
+    if (scheduler_config.on_firmware != NULL)
+    {
+      scheduler_config.on_firmware(firmware_result, scheduler_config.user_data);
+    }
+  }
+
+  *delay = providore_scheduler_next_delay(&scheduler_config, state, result, poll_interval, retry_after, esp_random());
+  if (result != PROVIDORE_OK)
+  {
+    ESP_LOGW(TAG, "Poll failed (%i), %i in a row, next poll in %is", result, state->failures, *delay);
+  }
+  else
+  {
+    ESP_LOGI(TAG, "Next poll in %is", *delay);
+  }
+}
+
+static void scheduler_task_run(void *arguments)
+{
+  providore_scheduler_state_t state;
+  bzero(&state, sizeof(state));
+
+  uint32_t delay = scheduler_config.startup_delay_max > 0 ? esp_random() % (scheduler_config.startup_delay_max + 1) : 0;
+  while (!__atomic_load_n(&scheduler_stopping, __ATOMIC_ACQUIRE))
+  {
+    // providore_scheduler_poll_now and providore_scheduler_stop cut the wait short
+    ulTaskNotifyTake(pdTRUE, (TickType_t)((uint64_t)delay * configTICK_RATE_HZ));
+    if (__atomic_load_n(&scheduler_stopping, __ATOMIC_ACQUIRE))
+    {
+      break;
+    }
+    scheduler_poll(&state, &delay);
+    // The scheduler never finishes, so take its stack use after every poll
+    providore_metrics_stack(PROVIDORE_TASK_SCHEDULER, SCHEDULER_STACK_SIZE);
+  }
+
+  portENTER_CRITICAL(&scheduler_lock);
+  scheduler_task = NULL;
+  portEXIT_CRITICAL(&scheduler_lock);
+  vTaskDelete(NULL);
+}
+
+esp_err_t providore_scheduler_start(const providore_scheduler_config_t *config)
+{
+  portENTER_CRITICAL(&scheduler_lock);
+  bool running = scheduler_task != NULL;
+  portEXIT_CRITICAL(&scheduler_lock);
+  if (running)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (config->config == NULL || config->interval == 0 || config->backoff_min == 0 || config->backoff_max < config->backoff_min)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  memcpy(&scheduler_config, config, sizeof(providore_scheduler_config_t));
+  __atomic_store_n(&scheduler_stopping, false, __ATOMIC_RELEASE);
+  // The handle is set before the task first runs
+  if (xTaskCreate(scheduler_task_run, "providore_poll", SCHEDULER_STACK_SIZE, NULL, 1, &scheduler_task) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Unable to start the scheduler task");
+    scheduler_task = NULL;
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+static void scheduler_notify()
+{
+  portENTER_CRITICAL(&scheduler_lock);
+  if (scheduler_task != NULL)
+  {
+    xTaskNotifyGive(scheduler_task);
+  }
+  portEXIT_CRITICAL(&scheduler_lock);
+}
+
+void providore_scheduler_poll_now()
+{
+  scheduler_notify();
+}
+
+// A poll that is already under way finishes first
+void providore_scheduler_stop()
+{
+  __atomic_store_n(&scheduler_stopping, true, __ATOMIC_RELEASE);
+  scheduler_notify();
+}
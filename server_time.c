@@ -0,0 +1,115 @@
+#include "server_time.h"
+#include <stdio.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "PROVIDORE_SERVER_TIME";
+
+// Set on first boot, and left alone by deep sleep
+#define SERVER_TIME_VALID 0x50544f46
+
+RTC_DATA_ATTR static uint32_t server_time_valid;
+RTC_DATA_ATTR static int64_t server_time_offset;
+static portMUX_TYPE server_time_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// newlib has no timegm, so count the days since 1970-01-01 for a UTC date
+// https://howardhinnant.github.io/date_algorithms.html#days_from_civil
+static int64_t server_time_days(int year, int month, int day)
+{
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  int64_t year_of_era = year - era * 400;
+  int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+// Parses the "%FT%TZ" timestamps the server signs with. Fractional seconds are ignored.
+static bool server_time_parse(const char *timestamp, int64_t *output)
+{
+  int year, month, day, hour, minute, second;
+  if (timestamp == NULL || sscanf(timestamp, "%4d-%2d-%2dT%2d:%2d:%2d", &year, &month, &day, &hour, &minute, &second) != 6)
+  {
+    return false;
+  }
+  if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+  {
+    return false;
+  }
+
+  *output = server_time_days(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+  return true;
+}
+
+void providore_server_time_learn(const char *created_at, const char *expiry)
+{
+  int64_t server_time;
+  int64_t expires;
+  if (!server_time_parse(created_at, &server_time) || !server_time_parse(expiry, &expires))
+  {
+    ESP_LOGW(TAG, "Unable to read server time from %s", created_at == NULL ? "" : created_at);
+    return;
+  }
+
+  // The response was signed before it was sent, so this is behind by up to a
+  // one way trip - well inside the second the timestamps are rounded to.
+  int64_t now = (int64_t)time(NULL);
+  int64_t offset = server_time - now;
+
+  // Once the offset is known a replayed response shows up as expired, and
+  // would otherwise wind the clock back to when it was signed. Before then
+  // the local clock can't tell, so the first verified response is trusted.
+  portENTER_CRITICAL(&server_time_lock);
+  bool valid = server_time_valid == SERVER_TIME_VALID;
+  bool expired = valid && expires < now + server_time_offset;
+  bool changed = !expired && (!valid || offset > server_time_offset);
+  if (changed)
+  {
+    server_time_offset = offset;
+    server_time_valid = SERVER_TIME_VALID;
+  }
+  portEXIT_CRITICAL(&server_time_lock);
+
+  if (expired)
+  {
+    ESP_LOGW(TAG, "Response expired at %s, not learning server time from it", expiry);
+  }
+  else if (changed)
+  {
+    ESP_LOGI(TAG, "Server clock is %lld seconds from ours", offset);
+  }
+}
+
+bool providore_server_time_offset(int64_t *offset)
+{
+  portENTER_CRITICAL(&server_time_lock);
+  bool valid = server_time_valid == SERVER_TIME_VALID;
+  if (valid && offset != NULL)
+  {
+    *offset = server_time_offset;
+  }
+  portEXIT_CRITICAL(&server_time_lock);
+  return valid;
+}
+
+void providore_server_time_reset()
+{
+  portENTER_CRITICAL(&server_time_lock);
+  server_time_valid = 0;
+  server_time_offset = 0;
+  portEXIT_CRITICAL(&server_time_lock);
+}
+
+time_t providore_server_time_now()
+{
+  time_t now = time(NULL);
+#ifdef CONFIG_PROVIDORE_SERVER_TIME
+  int64_t offset;
+  if (providore_server_time_offset(&offset))
+  {
+    return now + (time_t)offset;
+  }
+#endif
+  return now;
+}
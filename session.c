@@ -0,0 +1,366 @@
+#include "session.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "metrics.h"
+#include "freertos/task.h"
+
+static const char *TAG = "PROVIDORE_SESSION";
+
+// What esp_http_client uses when timeout_ms isn't set
+#define SESSION_DEFAULT_TIMEOUT_MS 5000
+
+// providore_cancel sets the flag from another task
+static bool session_cancelled(const providore_session_t *session)
+{
+  return session->cancelled != NULL && __atomic_load_n(session->cancelled, __ATOMIC_ACQUIRE);
+}
+
+static bool session_should_abort(providore_session_t *session)
+{
+  if (session_cancelled(session))
+  {
+    return true;
+  }
+  return session->timeout > 0 && xTaskGetTickCount() - session->started >= session->timeout;
+}
+
+static void session_sample_heap(providore_session_t *session)
+{
+  size_t free = esp_get_free_heap_size();
+  if (free < session->heap_free_min)
+  {
+    session->heap_free_min = free;
+  }
+}
+
+// Every request on the session goes through this handler, so the connection
+// state can be tracked before the event is handed to the request's own handler.
+static esp_err_t session_event_handle(esp_http_client_event_t *evt)
+{
+  providore_session_t *session = (providore_session_t *)evt->user_data;
+  // Sampled on every event, this also catches what the previous one allocated
+  session_sample_heap(session);
+
+  // Nothing more reaches the request handler once it has been told the request failed
+  if (session->aborted && evt->event_id != HTTP_EVENT_DISCONNECTED)
+  {
+    return ESP_OK;
+  }
+
+  if ((evt->event_id == HTTP_EVENT_ON_HEADER || evt->event_id == HTTP_EVENT_ON_DATA) && session_should_abort(session))
+  {
+    ESP_LOGW(TAG, "Request %s, closing the connection", session_cancelled(session) ? "cancelled" : "timed out");
+    session->aborted = true;
+    session->received = true;
+    if (session->event_handler != NULL)
+    {
+      esp_http_client_event_t request_evt = *evt;
+      request_evt.event_id = HTTP_EVENT_ERROR;
+      request_evt.data = NULL;
+      request_evt.data_len = 0;
+      request_evt.user_data = session->user_data;
+      session->event_handler(&request_evt);
+    }
+    // The read that follows fails, so esp_http_client_perform returns early
+    esp_http_client_close(evt->client);
+    session->connected = false;
+    return ESP_OK;
+  }
+
+  switch (evt->event_id)
+  {
+  case HTTP_EVENT_ON_CONNECTED:
+    session->connected = true;
+    providore_metrics_record(PROVIDORE_PHASE_CONNECT, esp_timer_get_time() - session->requested_at);
+    break;
+  case HTTP_EVENT_HEADER_SENT:
+    session->sent_at = esp_timer_get_time();
+    break;
+  case HTTP_EVENT_ON_HEADER:
+    if (!session->received)
+    {
+      session->first_byte_at = esp_timer_get_time();
+      providore_metrics_record(PROVIDORE_PHASE_FIRST_BYTE, session->first_byte_at - session->sent_at);
+    }
+    session->received = true;
+    // Only the delay-seconds form of Retry-After is understood
+    if (strncasecmp(evt->header_key, "retry-after", 11) == 0)
+    {
+      session->retry_after = strtoul(evt->header_value, NULL, 10);
+    }
+    if (strncasecmp(evt->header_key, "x-poll-interval", 15) == 0)
+    {
+      session->poll_interval = strtoul(evt->header_value, NULL, 10);
+    }
+    break;
+  case HTTP_EVENT_ON_DATA:
+    providore_metrics_received(evt->data_len);
+    break;
+  case HTTP_EVENT_ON_FINISH:
+    providore_metrics_record(PROVIDORE_PHASE_BODY, esp_timer_get_time() - session->first_byte_at);
+    break;
+  case HTTP_EVENT_ERROR:
+  case HTTP_EVENT_DISCONNECTED:
+    session->connected = false;
+    // The server may have dropped a kept-alive connection while we were idle.
+    // Keep that from the request handler - the request will be retried.
+    if (session->reused && !session->received)
+    {
+      return ESP_OK;
+    }
+    break;
+  default:
+    break;
+  }
+
+  if (session->event_handler == NULL)
+  {
+    return ESP_OK;
+  }
+
+  esp_http_client_event_t request_evt = *evt;
+  request_evt.user_data = session->user_data;
+  return session->event_handler(&request_evt);
+}
+
+static void session_disconnect(providore_session_t *session)
+{
+  if (session->client != NULL)
+  {
+    esp_http_client_close(session->client);
+  }
+  session->connected = false;
+}
+
+static int session_timeout_ms(const providore_session_t *session)
+{
+  return session->timeout_ms > 0 ? session->timeout_ms : SESSION_DEFAULT_TIMEOUT_MS;
+}
+
+// The client on IDF 4.3 can't change its timeout once created, so a different
+// timeout means a new client, and a new connection
+static esp_err_t session_client_create(providore_session_t *session, int timeout_ms)
+{
+  if (session->client != NULL)
+  {
+    // The request hasn't started, so its handler doesn't hear about the old connection closing
+    http_event_handle_cb event_handler = session->event_handler;
+    session->event_handler = NULL;
+    session_disconnect(session);
+    esp_http_client_cleanup(session->client);
+    session->event_handler = event_handler;
+  }
+
+  esp_http_client_config_t http_client_config = {
+      .url = session->url,
+      .event_handler = session_event_handle,
+      .user_data = (void *)session,
+      .timeout_ms = timeout_ms,
+  };
+  session->client = esp_http_client_init(&http_client_config);
+  session->client_timeout_ms = timeout_ms;
+  if (session->client == NULL)
+  {
+    ESP_LOGE(TAG, "Unable to create HTTP client");
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+static void session_prepare_request(providore_session_t *session)
+{
+  esp_http_client_set_method(session->client, HTTP_METHOD_GET);
+  if (session->wait > 0)
+  {
+    char prefer[24];
+    snprintf((char *)&prefer, sizeof(prefer), "wait=%u", session->wait);
+    esp_http_client_set_header(session->client, "Prefer", (const char *)&prefer);
+  }
+}
+
+esp_err_t providore_session_init(providore_session_t *session)
+{
+  bzero(session, sizeof(providore_session_t));
+  session->lock = xSemaphoreCreateMutex();
+  if (session->lock == NULL)
+  {
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+esp_http_client_handle_t providore_session_begin(providore_session_t *session, const char *path, http_event_handle_cb event_handler, void *user_data)
+{
+  xSemaphoreTake(session->lock, portMAX_DELAY);
+
+  if (strlen(CONFIG_PROVIDORE_SERVER) + strlen(path) >= URL_BUFFER_LEN)
+  {
+    ESP_LOGE(TAG, "URL for %s is too long", path);
+    xSemaphoreGive(session->lock);
+    return NULL;
+  }
+
+  session->heap_free_at_begin = esp_get_free_heap_size();
+  session->heap_free_min = session->heap_free_at_begin;
+
+  char *url_ptr = (char *)&session->url;
+  memset(url_ptr, 0, sizeof(char) * URL_BUFFER_LEN);
+  strcpy(url_ptr, CONFIG_PROVIDORE_SERVER);
+  strcpy(url_ptr + strlen(url_ptr), path);
+
+  session->event_handler = event_handler;
+  session->user_data = user_data;
+
+  // A client left with a shorter timeout by a request with little time left is replaced
+  if (session->client == NULL || session->client_timeout_ms != session_timeout_ms(session))
+  {
+    if (session_client_create(session, session_timeout_ms(session)) != ESP_OK)
+    {
+      xSemaphoreGive(session->lock);
+      return NULL;
+    }
+  }
+  else
+  {
+    if (session->connected && xTaskGetTickCount() - session->last_used > pdMS_TO_TICKS(CONFIG_PROVIDORE_SESSION_IDLE_TIMEOUT * 1000))
+    {
+      ESP_LOGI(TAG, "Session idle for too long, reconnecting");
+      session_disconnect(session);
+    }
+    esp_http_client_set_url(session->client, url_ptr);
+  }
+  session_prepare_request(session);
+
+  return session->client;
+}
+
+esp_http_client_handle_t providore_session_watch(providore_session_t *session, const volatile bool *cancelled, TickType_t started, TickType_t timeout)
+{
+  session->cancelled = cancelled;
+  session->started = started;
+  session->timeout = timeout;
+  if (timeout == 0)
+  {
+    return session->client;
+  }
+
+  // The time left is only checked as headers and data arrive, so a connect or
+  // read that waits on the server must give up by then as well
+  TickType_t elapsed = xTaskGetTickCount() - started;
+  uint64_t left_ms = elapsed < timeout ? (uint64_t)(timeout - elapsed) * portTICK_PERIOD_MS : 0;
+  if (left_ms < (uint64_t)session->client_timeout_ms)
+  {
+    if (session_client_create(session, left_ms > 0 ? (int)left_ms : 1) != ESP_OK)
+    {
+      providore_session_end(session);
+      return NULL;
+    }
+    session_prepare_request(session);
+  }
+  return session->client;
+}
+
+esp_err_t providore_session_perform(providore_session_t *session)
+{
+  session->reused = session->connected;
+  session->received = false;
+  session->aborted = false;
+  session->poll_interval = 0;
+  session->retry_after = 0;
+
+  // Waiting on another request for the session may have used up the time already
+  if (session_should_abort(session))
+  {
+    session->aborted = true;
+    return ESP_ERR_TIMEOUT;
+  }
+
+  session->requested_at = esp_timer_get_time();
+  esp_err_t err = esp_http_client_perform(session->client);
+  if (err != ESP_OK && session->reused && !session->received)
+  {
+    ESP_LOGW(TAG, "Kept-alive connection was closed by the server, reconnecting");
+    providore_metrics_retry();
+    session_disconnect(session);
+    session->reused = false;
+    session->requested_at = esp_timer_get_time();
+    err = esp_http_client_perform(session->client);
+  }
+
+  // A client whose timeout was capped at the time left gives up reading without
+  // an error, so a request still running when the time ran out is treated as cut off
+  if (!session->aborted && session_should_abort(session))
+  {
+    session->aborted = true;
+  }
+
+  // Cancelled requests are reported the same way - the caller knows it asked
+  if (session->aborted)
+  {
+    err = ESP_ERR_TIMEOUT;
+  }
+
+  if (err != ESP_OK)
+  {
+    session_disconnect(session);
+  }
+  providore_metrics_request(err != ESP_OK);
+  session_sample_heap(session);
+  session->last_used = xTaskGetTickCount();
+  return err;
+}
+
+size_t providore_session_heap_used(const providore_session_t *session)
+{
+  return session->heap_free_at_begin > session->heap_free_min ? session->heap_free_at_begin - session->heap_free_min : 0;
+}
+
+void providore_session_end(providore_session_t *session)
+{
+  __atomic_store_n(&session->hints, (uint64_t)session->poll_interval << 32 | session->retry_after, __ATOMIC_RELEASE);
+  session->event_handler = NULL;
+  session->user_data = NULL;
+  session->cancelled = NULL;
+  session->timeout = 0;
+  xSemaphoreGive(session->lock);
+}
+
+void providore_session_hints(const providore_session_t *session, uint32_t *poll_interval, uint32_t *retry_after)
+{
+  uint64_t hints = __atomic_load_n(&session->hints, __ATOMIC_ACQUIRE);
+  *poll_interval = (uint32_t)(hints >> 32);
+  *retry_after = (uint32_t)hints;
+}
+
+void providore_session_close(providore_session_t *session)
+{
+  if (session->lock == NULL)
+  {
+    return;
+  }
+
+  xSemaphoreTake(session->lock, portMAX_DELAY);
+  session_disconnect(session);
+  xSemaphoreGive(session->lock);
+}
+
+void providore_session_cleanup(providore_session_t *session)
+{
+  if (session->lock == NULL)
+  {
+    return;
+  }
+
+  xSemaphoreTake(session->lock, portMAX_DELAY);
+  if (session->client != NULL)
+  {
+    esp_http_client_cleanup(session->client);
+    session->client = NULL;
+  }
+  session->connected = false;
+  xSemaphoreGive(session->lock);
+}
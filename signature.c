@@ -0,0 +1,75 @@
+#include "signature.h"
+#include <stdint.h>
+#include <string.h>
+#include "mbedtls/base64.h"
+#include "esp_timer.h"
+#include "metrics.h"
+#include "types.h"
+
+void signature_verify_begin(signature_verifier_t *verifier, const providore_signer_t *signer)
+{
+  verifier->signer = signer;
+  verifier->elapsed_us = 0;
+#ifdef CONFIG_SECURED_SHARED_KEY
+  mbedtls_sha256_init(&verifier->inner);
+  mbedtls_sha256_starts_ret(&verifier->inner, 0);
+#else
+  providore_signer_hmac_begin(signer, &verifier->inner);
+#endif
+}
+
+bool signature_verify_resume(signature_verifier_t *verifier, const providore_signer_t *signer, const mbedtls_sha256_context *state)
+{
+  verifier->signer = signer;
+  verifier->elapsed_us = 0;
+  mbedtls_sha256_init(&verifier->inner);
+  mbedtls_sha256_clone(&verifier->inner, state);
+  return true;
+}
+
+void signature_verify_update(signature_verifier_t *verifier, const void *data, size_t data_len)
+{
+  int64_t started_at = esp_timer_get_time();
+  mbedtls_sha256_update_ret(&verifier->inner, (const unsigned char *)data, data_len);
+  verifier->elapsed_us += esp_timer_get_time() - started_at;
+}
+
+bool signature_verify_checkpoint(signature_verifier_t *verifier, mbedtls_sha256_context *state)
+{
+  // Cloning moves any state held by the SHA peripheral into memory
+  mbedtls_sha256_init(state);
+  mbedtls_sha256_clone(state, &verifier->inner);
+  return true;
+}
+
+bool signature_verify_finish(signature_verifier_t *verifier, const char *created_at, const char *expiry, const char *signature)
+{
+  uint8_t digest[HMAC_DIGEST_LEN];
+  char base64[48];
+  size_t olen;
+
+  signature_verify_update(verifier, "\n", 1);
+  signature_verify_update(verifier, created_at, strlen(created_at));
+  signature_verify_update(verifier, "\n", 1);
+  signature_verify_update(verifier, expiry, strlen(expiry));
+
+#ifdef CONFIG_SECURED_SHARED_KEY
+  // The HMAC peripheral takes the message in one go, so it signs the message's SHA-256
+  int64_t started_at = esp_timer_get_time();
+  mbedtls_sha256_finish_ret(&verifier->inner, (unsigned char *)&digest);
+  mbedtls_sha256_free(&verifier->inner);
+  providore_signer_hmac(verifier->signer, (const uint8_t *)&digest, HMAC_DIGEST_LEN, (uint8_t *)&digest);
+#else
+  int64_t started_at = esp_timer_get_time();
+  providore_signer_hmac_finish(verifier->signer, &verifier->inner, (uint8_t *)&digest);
+#endif
+  providore_metrics_record(PROVIDORE_PHASE_VERIFY, verifier->elapsed_us + esp_timer_get_time() - started_at);
+
+  mbedtls_base64_encode((unsigned char *)&base64, 48, &olen, (const unsigned char *)&digest, HMAC_DIGEST_LEN);
+  return strncmp((const char *)base64, signature, SIGNATURE_LEN) == 0;
+}
+
+void signature_verify_free(signature_verifier_t *verifier)
+{
+  mbedtls_sha256_free(&verifier->inner);
+}
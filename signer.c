@@ -0,0 +1,177 @@
+#include "signer.h"
+#include <stdio.h>
+#include <string.h>
+#include "mbedtls/base64.h"
+#include "configuration.h"
+#include "types.h"
+#include "esp_log.h"
+#ifdef CONFIG_SECURED_SHARED_KEY
+#include "esp_hmac.h"
+#endif
+
+static const char *TAG = "PROVIDORE_SIGNER";
+
+#ifndef CONFIG_SECURED_SHARED_KEY
+static void hmac_pad(const char *psk, uint8_t pad_byte, unsigned char *pad)
+{
+  unsigned char key[HMAC_DIGEST_LEN];
+  const unsigned char *key_ptr = (const unsigned char *)psk;
+  size_t key_len = strlen(psk);
+
+  // Keys longer than a block are hashed first, as per RFC 2104
+  if (key_len > HMAC_BLOCK_LEN)
+  {
+    mbedtls_sha256_ret(key_ptr, key_len, key, 0);
+    key_ptr = key;
+    key_len = HMAC_DIGEST_LEN;
+  }
+
+  memset(pad, pad_byte, HMAC_BLOCK_LEN);
+  for (size_t i = 0; i < key_len; i++)
+  {
+    pad[i] ^= key_ptr[i];
+  }
+}
+
+static void hmac_pad_state(const char *psk, uint8_t pad_byte, mbedtls_sha256_context *state)
+{
+  unsigned char pad[HMAC_BLOCK_LEN];
+  mbedtls_sha256_context ctx;
+
+  hmac_pad(psk, pad_byte, (unsigned char *)&pad);
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts_ret(&ctx, 0);
+  mbedtls_sha256_update_ret(&ctx, (const unsigned char *)&pad, HMAC_BLOCK_LEN);
+  memset(&pad, 0, HMAC_BLOCK_LEN);
+
+  // Keep a copy rather than the context itself, so the SHA peripheral isn't held onto
+  mbedtls_sha256_init(state);
+  mbedtls_sha256_clone(state, &ctx);
+  mbedtls_sha256_free(&ctx);
+}
+
+void providore_signer_hmac_begin(const providore_signer_t *signer, mbedtls_sha256_context *inner)
+{
+  mbedtls_sha256_init(inner);
+  mbedtls_sha256_clone(inner, &signer->inner);
+}
+
+void providore_signer_hmac_finish(const providore_signer_t *signer, mbedtls_sha256_context *inner, uint8_t *digest)
+{
+  mbedtls_sha256_context outer;
+
+  mbedtls_sha256_finish_ret(inner, digest);
+  mbedtls_sha256_free(inner);
+
+  mbedtls_sha256_init(&outer);
+  mbedtls_sha256_clone(&outer, &signer->outer);
+  mbedtls_sha256_update_ret(&outer, digest, HMAC_DIGEST_LEN);
+  mbedtls_sha256_finish_ret(&outer, digest);
+  mbedtls_sha256_free(&outer);
+}
+#endif
+
+esp_err_t providore_signer_init(providore_signer_t *signer, const char *device_id, const char *psk)
+{
+  if (strlen(device_id) >= DEVICE_ID_LEN)
+  {
+    ESP_LOGE(TAG, "device_id is longer than %i characters", DEVICE_ID_LEN - 1);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  strcpy(signer->device_id, device_id);
+
+#ifndef CONFIG_SECURED_SHARED_KEY
+  if (strlen(psk) >= PSK_LEN)
+  {
+    ESP_LOGE(TAG, "psk is longer than %i characters", PSK_LEN - 1);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  strcpy(signer->psk, psk);
+  hmac_pad_state(psk, 0x36, &signer->inner);
+  hmac_pad_state(psk, 0x5c, &signer->outer);
+#endif
+  return ESP_OK;
+}
+
+esp_err_t providore_signer_load(providore_signer_t *signer)
+{
+  char device_id[DEVICE_ID_LEN];
+  char psk[PSK_LEN];
+  size_t length = DEVICE_ID_LEN;
+
+  esp_err_t result = get_device_id((char *)&device_id, &length);
+  if (result != ESP_OK)
+  {
+    return result;
+  }
+
+  length = PSK_LEN;
+  psk[0] = '\0';
+  result = get_psk((char *)&psk, &length);
+  if (result != ESP_OK)
+  {
+    return result;
+  }
+
+  result = providore_signer_init(signer, (const char *)&device_id, (const char *)&psk);
+  memset(&psk, 0, PSK_LEN);
+  return result;
+}
+
+bool providore_signer_matches(const providore_signer_t *signer, const char *device_id, const char *psk)
+{
+#ifdef CONFIG_SECURED_SHARED_KEY
+  return strcmp(signer->device_id, device_id) == 0;
+#else
+  return strcmp(signer->device_id, device_id) == 0 && strcmp(signer->psk, psk) == 0;
+#endif
+}
+
+esp_err_t providore_signer_hmac(const providore_signer_t *signer, const void *message, size_t message_len, uint8_t *digest)
+{
+#ifdef CONFIG_SECURED_SHARED_KEY
+  return esp_hmac_calculate(HMAC_KEY4, message, message_len, digest);
+#else
+  mbedtls_sha256_context inner;
+  providore_signer_hmac_begin(signer, &inner);
+  mbedtls_sha256_update_ret(&inner, (const unsigned char *)message, message_len);
+  providore_signer_hmac_finish(signer, &inner, digest);
+  return ESP_OK;
+#endif
+}
+
+void providore_signer_authorization(const providore_signer_t *signer, char *output, size_t output_len, const char *method, const char *path, const char *version, const char *created_at, const char *expiry)
+{
+  uint8_t digest[HMAC_DIGEST_LEN];
+  char base64[48];
+  size_t olen;
+
+#ifdef CONFIG_SECURED_SHARED_KEY
+  // The HMAC peripheral needs the whole message up front
+  char message[HMAC_BUFFER_LEN];
+  int message_len = snprintf((char *)&message, HMAC_BUFFER_LEN, "%s\n%s\n%s\n%s\n%s", method, path, version, created_at, expiry);
+  if (message_len >= HMAC_BUFFER_LEN)
+  {
+    ESP_LOGE(TAG, "Request for %s is too long to sign, raise CONFIG_PROVIDORE_AUTHORIZATION_LEN", path);
+    message_len = HMAC_BUFFER_LEN - 1;
+  }
+  providore_signer_hmac(signer, &message, message_len, (uint8_t *)&digest);
+#else
+  // Hash the canonical request fields straight into the HMAC
+  mbedtls_sha256_context inner;
+  providore_signer_hmac_begin(signer, &inner);
+  const char *fields[] = {method, path, version, created_at, expiry};
+  for (int i = 0; i < 5; i++)
+  {
+    if (i > 0)
+    {
+      mbedtls_sha256_update_ret(&inner, (const unsigned char *)"\n", 1);
+    }
+    mbedtls_sha256_update_ret(&inner, (const unsigned char *)fields[i], strlen(fields[i]));
+  }
+  providore_signer_hmac_finish(signer, &inner, (uint8_t *)&digest);
+#endif
+
+  mbedtls_base64_encode((unsigned char *)&base64, 48, &olen, (const unsigned char *)&digest, HMAC_DIGEST_LEN);
+  snprintf(output, output_len, "Hmac key-id=%s, signature=%s", signer->device_id, base64);
+}
@@ -0,0 +1,174 @@
+#include "sync.h"
+#include <string.h>
+#include "esp_log.h"
+#include "buffer_pool.h"
+#include "config_parser.h"
+
+static const char *TAG = "PROVIDORE_SYNC";
+
+static const sync_handler_t *sync_find_handler(sync_decoder_t *decoder)
+{
+  for (size_t i = 0; i < decoder->handler_count; i++)
+  {
+    if (strcmp(decoder->handlers[i].name, decoder->name) == 0)
+    {
+      decoder->handled |= 1u << i;
+      return &decoder->handlers[i];
+    }
+  }
+  ESP_LOGW(TAG, "No handler for %s, skipping it", decoder->name);
+  return NULL;
+}
+
+static esp_err_t sync_part_output(sync_decoder_t *decoder, const void *data, size_t data_len)
+{
+  esp_err_t result = ESP_OK;
+  if (decoder->current != NULL)
+  {
+    result = decoder->current->on_part(decoder->name, decoder->part_offset, data, data_len, decoder->part_len, decoder->current->user_data);
+  }
+  decoder->part_offset += data_len;
+  if (decoder->part_offset == decoder->part_len)
+  {
+    decoder->parts++;
+    decoder->state = SYNC_READING_NAME_LEN;
+  }
+  return result;
+}
+
+void sync_decoder_begin(sync_decoder_t *decoder, const sync_handler_t *handlers, size_t handler_count)
+{
+  bzero(decoder, sizeof(sync_decoder_t));
+  decoder->handlers = handlers;
+  decoder->handler_count = handler_count < SYNC_HANDLER_MAX ? handler_count : SYNC_HANDLER_MAX;
+  decoder->state = SYNC_READING_MAGIC;
+}
+
+esp_err_t sync_decoder_write(sync_decoder_t *decoder, const void *data, size_t data_len)
+{
+  const uint8_t *data_ptr = (const uint8_t *)data;
+  esp_err_t result = ESP_OK;
+
+  while (data_len > 0 && result == ESP_OK)
+  {
+    size_t len = 0;
+    switch (decoder->state)
+    {
+    case SYNC_READING_MAGIC:
+    case SYNC_READING_LENGTH:
+    {
+      // Fields can be split across chunks, so gather them first
+      size_t needed = 4 - decoder->fields_len;
+      len = data_len < needed ? data_len : needed;
+      memcpy(decoder->fields + decoder->fields_len, data_ptr, len);
+      decoder->fields_len += len;
+      if (len < needed)
+      {
+        break;
+      }
+      decoder->fields_len = 0;
+
+      if (decoder->state == SYNC_READING_MAGIC)
+      {
+        if (memcmp(decoder->fields, SYNC_MAGIC, 4) != 0)
+        {
+          ESP_LOGE(TAG, "Not a sync response");
+          result = ESP_ERR_INVALID_RESPONSE;
+          break;
+        }
+        decoder->state = SYNC_READING_NAME_LEN;
+        break;
+      }
+
+      decoder->part_len = (size_t)decoder->fields[0] | (size_t)decoder->fields[1] << 8 | (size_t)decoder->fields[2] << 16 | (size_t)decoder->fields[3] << 24;
+      decoder->part_offset = 0;
+      decoder->current = sync_find_handler(decoder);
+      decoder->state = SYNC_READING_BODY;
+      if (decoder->part_len == 0)
+      {
+        result = sync_part_output(decoder, NULL, 0);
+      }
+    }
+    break;
+    case SYNC_READING_NAME_LEN:
+      len = 1;
+      decoder->name_len = data_ptr[0];
+      decoder->fields_len = 0;
+      bzero(decoder->name, SYNC_NAME_LEN);
+      if (decoder->name_len == 0 || decoder->name_len >= SYNC_NAME_LEN)
+      {
+        ESP_LOGE(TAG, "Part name of %i bytes is not valid", decoder->name_len);
+        result = ESP_ERR_INVALID_RESPONSE;
+        break;
+      }
+      decoder->state = SYNC_READING_NAME;
+      break;
+    case SYNC_READING_NAME:
+    {
+      size_t needed = decoder->name_len - decoder->fields_len;
+      len = data_len < needed ? data_len : needed;
+      memcpy(decoder->name + decoder->fields_len, data_ptr, len);
+      decoder->fields_len += len;
+      if (len == needed)
+      {
+        decoder->fields_len = 0;
+        decoder->state = SYNC_READING_LENGTH;
+      }
+    }
+    break;
+    case SYNC_READING_BODY:
+      len = decoder->part_len - decoder->part_offset < data_len ? decoder->part_len - decoder->part_offset : data_len;
+      result = sync_part_output(decoder, data_ptr, len);
+      break;
+    }
+
+    data_ptr += len;
+    data_len -= len;
+  }
+
+  return result;
+}
+
+esp_err_t sync_decoder_finish(sync_decoder_t *decoder)
+{
+  if (decoder->state != SYNC_READING_NAME_LEN)
+  {
+    ESP_LOGE(TAG, "Sync response ended part way through a part");
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  ESP_LOGI(TAG, "Received %i parts", decoder->parts);
+  for (size_t i = 0; i < decoder->handler_count; i++)
+  {
+    bool handled = decoder->handled & 1u << i;
+    if (!handled)
+    {
+      ESP_LOGW(TAG, "No %s in the sync response", decoder->handlers[i].name);
+    }
+    if (decoder->handlers[i].received != NULL)
+    {
+      *decoder->handlers[i].received = handled;
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t sync_buffer_part(const char *name, size_t offset, const void *data, size_t data_len, size_t part_len, void *user_data)
+{
+  return providore_buffer_append((providore_buffer_t *)user_data, data, data_len);
+}
+
+esp_err_t sync_parser_part(const char *name, size_t offset, const void *data, size_t data_len, size_t part_len, void *user_data)
+{
+  config_parser_t *parser = (config_parser_t *)user_data;
+  if (part_len == 0)
+  {
+    return ESP_OK;
+  }
+  esp_err_t result = config_parser_write(parser, data, data_len);
+  if (result == ESP_OK && offset + data_len == part_len)
+  {
+    result = config_parser_finish(parser);
+  }
+  return result;
+}
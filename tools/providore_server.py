@@ -0,0 +1,294 @@
+#!/usr/bin/env python3
+"""A minimal stand-in Providore server for local testing.
+
+Serves one device a config file and a firmware image, speaking the protocol
+described in the README: signed requests and responses, conditional and
+long-polled config requests, the firmware manifest, resumable firmware
+downloads and /sync. Delta patches and compressed firmware are not served,
+so leave PROVIDORE_OTA_DELTA and PROVIDORE_OTA_COMPRESSION off, or expect
+full, uncompressed images.
+
+  python3 tools/providore_server.py --device-id my-device --psk secret \\
+      --config config.json --firmware build/app.bin --firmware-version 1.0.1
+
+With CONFIG_SECURED_SHARED_KEY, pass the key burnt to the eFuse with
+--key-hex instead of --psk. Responses are then signed over the SHA-256 of
+the message rather than the message itself.
+
+To see how devices cope with a poor network, --slow-link limits how fast
+each response is sent, and --reset-rate and --truncate-rate reset the
+connection instead of answering, or cut bodies off halfway, for that
+fraction of requests. --port 0 picks a free port, printed on startup.
+"""
+
+import argparse
+import base64
+import hashlib
+import hmac
+import json
+import os
+import random
+import re
+import socket
+import ssl
+import struct
+import time
+from datetime import datetime, timedelta, timezone
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlsplit
+
+ISO8601 = "%Y-%m-%dT%H:%M:%SZ"
+SIGNATURE_LIFETIME = timedelta(minutes=15)
+AUTHORIZATION = re.compile(r"Hmac key-id=([^,]+), signature=(\S+)")
+
+
+def sign(key, message):
+    return base64.b64encode(hmac.new(key, message, hashlib.sha256).digest()).decode()
+
+
+def image_sha256(image):
+    """The digest ESP-IDF reports for an app image: the SHA-256 appended to
+    it when byte 23 of the header says there is one, else of the whole image."""
+    if len(image) > 24 + 32 and image[0] == 0xE9 and image[23] == 1:
+        return image[-32:].hex()
+    return hashlib.sha256(image).hexdigest()
+
+
+class Resources:
+    """The config and firmware, re-read whenever the files change."""
+
+    def __init__(self, args):
+        self.args = args
+
+    def config(self):
+        with open(self.args.config, "rb") as f:
+            return f.read()
+
+    def config_etag(self, body):
+        return '"%s"' % hashlib.sha256(body).hexdigest()[:32]
+
+    def firmware(self):
+        with open(self.args.firmware, "rb") as f:
+            return f.read()
+
+    def manifest(self):
+        image = self.firmware()
+        return json.dumps({
+            "version": self.args.firmware_version,
+            "size": len(image),
+            "sha256": image_sha256(image),
+        }).encode()
+
+
+class Server(ThreadingHTTPServer):
+    # Room for a fleet of devices connecting at once
+    request_queue_size = 256
+    daemon_threads = True
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, format, *args):
+        if not self.server.args.quiet:
+            super().log_message(format, *args)
+
+    def do_GET(self):
+        if not self.verify_request():
+            self.respond(401, b"")
+            return
+
+        url = urlsplit(self.path)
+        routes = {
+            "/config": self.get_config,
+            "/firmware": self.get_firmware,
+            "/firmware/manifest": self.get_manifest,
+            "/sync": self.get_sync,
+        }
+        route = routes.get(url.path)
+        if route is None:
+            self.respond(404, b"")
+            return
+        try:
+            route(parse_qs(url.query))
+        except FileNotFoundError:
+            self.respond(404, b"")
+
+    # Requests are signed over method, path (with the query), firmware
+    # version, created-at and expiry, each separated by a newline
+    def verify_request(self):
+        match = AUTHORIZATION.fullmatch(self.headers.get("Authorization", ""))
+        created_at = self.headers.get("Created-At", "")
+        expiry = self.headers.get("Expiry", "")
+        version = self.headers.get("X-Firmware-Version", "")
+        if match is None or match.group(1) != self.server.args.device_id:
+            self.log_message("Unknown device or missing Authorization")
+            return False
+
+        message = "\n".join([self.command, self.path, version, created_at, expiry]).encode()
+        if not hmac.compare_digest(sign(self.server.key, message), match.group(2)):
+            self.log_message("Request signature mismatch")
+            return False
+
+        try:
+            expires = datetime.strptime(expiry, ISO8601).replace(tzinfo=timezone.utc)
+        except ValueError:
+            self.log_message("Expiry %r is not an ISO8601 timestamp", expiry)
+            return False
+        if expires < datetime.now(timezone.utc):
+            self.log_message("Request expired at %s, check the device clock", expiry)
+            return False
+        return True
+
+    # Responses are signed over body, created-at and expiry. For firmware the
+    # signed body is always the whole image, whatever part of it is sent. The
+    # eFuse key signs the SHA-256 of that message, as the HMAC peripheral
+    # can't take a message in parts.
+    def signature_headers(self, signed_body):
+        now = datetime.now(timezone.utc)
+        created_at = now.strftime(ISO8601)
+        expiry = (now + SIGNATURE_LIFETIME).strftime(ISO8601)
+        message = signed_body + b"\n" + created_at.encode() + b"\n" + expiry.encode()
+        if self.server.args.key_hex:
+            message = hashlib.sha256(message).digest()
+        return {
+            "created-at": created_at,
+            "expiry": expiry,
+            "signature": sign(self.server.key, message),
+        }
+
+    def respond(self, status, body, headers=None):
+        faults = self.server.faults
+        if faults.random() < self.server.args.reset_rate:
+            # Closing with a zero linger time sends a reset rather than a FIN
+            self.connection.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+            self.connection.close()
+            self.close_connection = True
+            return
+        truncated = body and faults.random() < self.server.args.truncate_rate
+
+        self.send_response(status)
+        for key, value in (headers or {}).items():
+            self.send_header(key, value)
+        if self.server.args.poll_interval > 0:
+            self.send_header("X-Poll-Interval", str(self.server.args.poll_interval))
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        if truncated:
+            body = body[: len(body) // 2]
+            self.close_connection = True
+        self.send_body(body)
+
+    def send_body(self, body):
+        rate = self.server.args.slow_link
+        if rate <= 0:
+            self.wfile.write(body)
+            return
+        # A segment at a time, as fast as the link allows
+        for offset in range(0, len(body), 1460):
+            self.wfile.write(body[offset : offset + 1460])
+            self.wfile.flush()
+            time.sleep(1460 / rate)
+
+    def get_config(self, query):
+        resources = self.server.resources
+        body = resources.config()
+        etag = resources.config_etag(body)
+
+        # Prefer: wait=<seconds> holds an unchanged config request open until
+        # the config changes or the wait is up
+        if self.headers.get("If-None-Match") == etag:
+            wait = re.search(r"wait=(\d+)", self.headers.get("Prefer", ""))
+            deadline = time.monotonic() + (int(wait.group(1)) if wait else 0)
+            while time.monotonic() < deadline:
+                time.sleep(0.5)
+                body = resources.config()
+                if resources.config_etag(body) != etag:
+                    break
+            etag_now = resources.config_etag(body)
+            if etag_now == etag:
+                self.respond(304, b"", {"ETag": etag})
+                return
+            etag = etag_now
+
+        headers = self.signature_headers(body)
+        headers["ETag"] = etag
+        headers["Content-Type"] = "application/json"
+        self.respond(200, body, headers)
+
+    def get_manifest(self, query):
+        body = self.server.resources.manifest()
+        headers = self.signature_headers(body)
+        headers["Content-Type"] = "application/json"
+        self.respond(200, body, headers)
+
+    def get_firmware(self, query):
+        image = self.server.resources.firmware()
+        etag = '"%s"' % hashlib.sha256(image).hexdigest()[:32]
+        headers = self.signature_headers(image)
+        headers["ETag"] = etag
+        headers["Content-Type"] = "application/octet-stream"
+
+        # A resumed download gets the rest of the image, as long as the image
+        # is still the one it started with
+        ranged = re.fullmatch(r"bytes=(\d+)-", self.headers.get("Range", ""))
+        if_range = self.headers.get("If-Range")
+        if ranged and (if_range is None or if_range == etag):
+            start = int(ranged.group(1))
+            if start < len(image):
+                headers["Content-Range"] = "bytes %i-%i/%i" % (start, len(image) - 1, len(image))
+                self.respond(206, image[start:], headers)
+                return
+        self.respond(200, image, headers)
+
+    # "PSYN" followed by <name length: u8> <name> <body length: u32 LE> <body>
+    # for each resource asked for, signed as a whole
+    def get_sync(self, query):
+        resources = self.server.resources
+        parts = {"config": resources.config, "manifest": resources.manifest}
+        body = b"PSYN"
+        for name in ",".join(query.get("resources", [])).split(","):
+            if name in parts:
+                part = parts[name]()
+                body += struct.pack("<B", len(name)) + name.encode() + struct.pack("<I", len(part)) + part
+        headers = self.signature_headers(body)
+        headers["Content-Type"] = "application/vnd.providore.sync"
+        self.respond(200, body, headers)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Minimal stand-in Providore server for local testing")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--device-id", required=True)
+    key = parser.add_mutually_exclusive_group(required=True)
+    key.add_argument("--psk", help="The device's pre-shared key")
+    key.add_argument("--key-hex", help="The HMAC key in the eFuse, for CONFIG_SECURED_SHARED_KEY")
+    parser.add_argument("--config", required=True, help="Config file served at /config")
+    parser.add_argument("--firmware", required=True, help="Firmware image served at /firmware")
+    parser.add_argument("--firmware-version", required=True, help="Version named in the manifest")
+    parser.add_argument("--poll-interval", type=int, default=0, help="X-Poll-Interval to send, 0 for none")
+    parser.add_argument("--cert", help="Certificate to serve HTTPS with")
+    parser.add_argument("--cert-key", help="Private key for --cert")
+    parser.add_argument("--slow-link", type=int, default=0, help="Bytes a second to send responses at, 0 for no limit")
+    parser.add_argument("--reset-rate", type=float, default=0, help="Fraction of requests to reset the connection on")
+    parser.add_argument("--truncate-rate", type=float, default=0, help="Fraction of responses to cut off halfway")
+    parser.add_argument("--seed", type=int, help="Seed for choosing which requests fail")
+    parser.add_argument("--quiet", action="store_true", help="Don't log each request")
+    args = parser.parse_args()
+
+    server = Server(("", args.port), Handler)
+    server.args = args
+    server.faults = random.Random(args.seed)
+    server.key = bytes.fromhex(args.key_hex) if args.key_hex else args.psk.encode()
+    server.resources = Resources(args)
+    if args.cert:
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        context.load_cert_chain(args.cert, args.cert_key)
+        server.socket = context.wrap_socket(server.socket, server_side=True)
+
+    print("Serving %s on port %i" % (os.path.basename(args.firmware), server.server_address[1]), flush=True)
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()